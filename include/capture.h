@@ -0,0 +1,83 @@
+/* Copyright 2020, JP Norair
+  *
+  * Licensed under the OpenTag License, Version 1.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  * http://www.indigresso.com/wiki/doku.php?id=opentag:license_1_0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  *
+  */
+
+#ifndef capture_h
+#define capture_h
+
+// Application Headers
+#include "sockpush.h"
+
+// Standard C & POSIX Libraries
+#include <stddef.h>
+#include <stdint.h>
+
+
+/// Capture log: a binary, append-only record of every line that crosses the
+/// daemon socket(s), with the time it crossed.
+///
+/// The file starts with the 8 byte CAPTURE_MAGIC.  After that it is a series
+/// of records, each a capture_rec_t header followed by size bytes of payload.
+/// Fields are in host byte order.  Each ottercat run appends:
+/// - a SESSION record, whose payload is the CLOCK_REALTIME of time 0, in ns
+/// - a CHANNEL record for each socket, whose payload is the socket path
+/// - RX and TX records for each line, whose payload is the line without its
+///   terminator
+///
+/// time_ns is CLOCK_MONOTONIC time since the session record.  Records are
+/// buffered in memory and written in blocks, so a crash can lose the last
+/// few lines.
+
+#define CAPTURE_MAGIC           "OTRCAP01"
+
+#define CAPTURE_REC_SESSION     'S'
+#define CAPTURE_REC_CHANNEL     'C'
+#define CAPTURE_REC_RX          '<'     ///< daemon to ottercat
+#define CAPTURE_REC_TX          '>'     ///< ottercat to daemon
+
+typedef struct {
+    uint64_t    time_ns;
+    uint32_t    size;
+    uint16_t    chan;
+    uint8_t     type;
+    uint8_t     rsvd;
+} capture_rec_t;
+
+typedef void* capture_t;
+
+
+/// Open (or create) a capture file for appending, and start a session.
+/// Returns NULL if the file can't be used.
+capture_t capture_open(const char* path);
+
+/// Flush and close.  Call only after all attached sockets are closed.
+void capture_close(capture_t handle);
+
+/// Record all traffic on a sockpush connection, as a new channel.  label is
+/// written into the CHANNEL record, usually the socket path.  A NULL handle
+/// is a no-op.  Returns the channel number, or a negative value on error.
+int capture_attach(capture_t handle, sp_handle_t sp, const char* label);
+
+
+/// Replay the RX records of a capture file as a stand-in daemon.  A socket is
+/// created at socket_path and the first client to connect is sent the lines
+/// at their original pacing, divided by speed (speed <= 0: as fast as
+/// possible).  If chan >= 0, only that channel is replayed.  Whatever the
+/// client sends is read and discarded.  Returns 0 when the capture has been
+/// played, or a negative value on error.
+int capture_replay(const char* path, const char* socket_path, double speed, int chan);
+
+
+#endif
@@ -48,6 +48,12 @@ typedef struct {
     size_t      mempool_size;
     int         timeout_ms;
     int         tries;
+    int         idle_ms;
+    int         rate;
+    bool        framed;
+    bool        shmring;
+    bool        resend;
+    bool        ackonly;
 } cliopt_t;
 
 
@@ -71,4 +77,22 @@ void cliopt_settimeout(int timeout_ms);
 int cliopt_gettries(void);
 void cliopt_settries(int timeout_ms);
 
+int cliopt_getidle(void);
+void cliopt_setidle(int idle_ms);
+
+int cliopt_getrate(void);
+void cliopt_setrate(int rate);
+
+bool cliopt_isframed(void);
+void cliopt_setframed(bool val);
+
+bool cliopt_isshmring(void);
+void cliopt_setshmring(bool val);
+
+bool cliopt_isresend(void);
+void cliopt_setresend(bool val);
+
+bool cliopt_isackonly(void);
+void cliopt_setackonly(bool val);
+
 #endif /* cliopt_h */
@@ -0,0 +1,73 @@
+/* Copyright 2020, JP Norair
+  *
+  * Licensed under the OpenTag License, Version 1.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  * http://www.indigresso.com/wiki/doku.php?id=opentag:license_1_0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  *
+  */
+
+#ifndef cmdcheck_h
+#define cmdcheck_h
+
+// Standard C & POSIX Libraries
+#include <stddef.h>
+
+
+/// Local command table, so that malformed command lines are caught before
+/// anything is sent to the daemon.  The table is a text file that describes
+/// the daemon's command set, one form of a command per line:
+///
+///     # comment
+///     r       -i uint:0..255 [uint]
+///     file    r uint uint uint
+///     file    w uint uint uint bintex
+///     led     hex (on|off)
+///
+/// The first word is the command name.  A command can have several lines,
+/// and a command line is accepted if it matches any of them.  The rest are
+/// argument specs:
+///
+///     -x, --name      flag, anywhere in the line
+///     -x=TYPE         option that takes a value ("-x 5", "-x5", "--name=5")
+///     TYPE            required argument
+///     [TYPE]          optional argument: only others like it may follow
+///     TYPE...         any number of arguments: must be last
+///     word            the literal word
+///     (a|b|c)         one of these literal words
+///
+/// TYPE is any, int, uint, hex or bintex.  int and uint may have a range, as
+/// in uint:0..255.  bintex is a [...] group, a quoted string, or a number.
+/// Template variables like ${devid} match any type.
+///
+/// Names are looked up in an open addressed hash table, so the check takes a
+/// few microseconds per line, whatever the size of the table.
+
+typedef void* cmdcheck_t;
+
+
+/// Load a command table.  Errors are printed to stderr with their line
+/// number, and NULL is returned.
+cmdcheck_t cmdcheck_load(const char* path);
+void cmdcheck_free(cmdcheck_t handle);
+
+/// Check one command line.  Returns 0 if it is valid, or -1 with a message
+/// in err.  A NULL handle accepts everything.
+int cmdcheck_line(cmdcheck_t handle, const char* line, size_t size, char* err, size_t errmax);
+
+/// Check every command in a script, as it would be run: blank lines, #
+/// comments and command graph directives are skipped, and JSON lines are
+/// checked by their "data" string.  Each error is printed
+/// to stderr as "line N: ...".  Returns the number of bad lines, and the
+/// number of commands checked in *checked if it isn't NULL.
+int cmdcheck_script(cmdcheck_t handle, const char* script, int* checked);
+
+
+#endif
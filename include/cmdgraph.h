@@ -0,0 +1,77 @@
+/* Copyright 2020, JP Norair
+  *
+  * Licensed under the OpenTag License, Version 1.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  * http://www.indigresso.com/wiki/doku.php?id=opentag:license_1_0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  *
+  */
+
+#ifndef cmdgraph_h
+#define cmdgraph_h
+
+// Standard C & POSIX Libraries
+#include <stdbool.h>
+#include <stddef.h>
+
+
+/// Command graphs: a command script whose ordering constraints are stated in
+/// it, so that the commands that don't depend on each other run at the same
+/// time.  A script without any of these directives is a plain script, which
+/// runs one line at a time and stops at its first error.
+///
+///     @group NAME [after A,B...]
+///             The following commands are in group NAME, and run in order.
+///             With "after", the group's next command waits until groups A
+///             and B have finished everything they have so far.  A group can
+///             be opened again later, to add to its chain.
+///     @end    The following commands are in no group.
+///     @barrier
+///             Everything above finishes before anything below starts.  It
+///             also ends the current group.
+///     # ...   Comment.
+///
+/// Commands in no group are independent of each other, and are limited only
+/// by the barriers.  A group can only name groups opened above it, so the
+/// graph has no cycles.
+///
+/// A command that fails fails the commands that depend on it, which are
+/// skipped.  A barrier after a failure skips the rest of the script.  Other
+/// commands carry on.  Each response line is written to fd_out as
+/// "[N] line", where N is the line number of its command in the script, and
+/// a summary goes to stderr at the end.
+
+#define CMDGRAPH_ERR_SKIPPED    (-9)
+
+typedef struct {
+    int         fd_out;
+    int         concurrency;    ///< commands in flight at once
+    void*       filter;         ///< output filter (filter_t), or NULL
+    void*       capture;        ///< traffic capture (capture_t), or NULL
+    void*       journal;        ///< with --ack-only: session journal (collect_t), or NULL
+} cmdgraph_cfg_t;
+
+
+/// True if the script has any graph directives
+bool cmdgraph_detect(const char* script);
+
+/// True if the line (without leading whitespace) is a graph directive.
+/// Fan-out runs each device's lines in order, which meets every constraint,
+/// so it just skips them.
+bool cmdgraph_isdirective(const char* line);
+
+/// Run the script, modified in place, against the daemon at socket.
+/// Returns 0 if every command succeeded, -4 if any failed or were skipped,
+/// or a lesser negative value if the script is malformed (with a message on
+/// stderr) or the socket can't be opened.
+int cmdgraph_run(const char* socket, char* script, const cmdgraph_cfg_t* cfg);
+
+
+#endif
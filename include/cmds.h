@@ -26,7 +26,10 @@
 #include <stdarg.h>
 
 
-int cmd_devmgr(dterm_handle_t* dth, uint8_t* dst, int* inbytes, uint8_t* src, size_t dstmax);
+/// Sends the command in src to the daemon, and returns the length of the
+/// response frame, or a negative error.  *dst is (re)allocated in dth->tctx
+/// to fit the frame, and *dstmax is updated with its size.
+int cmd_devmgr(dterm_handle_t* dth, uint8_t** dst, size_t* dstmax, int* inbytes, uint8_t* src);
 
 
 #endif
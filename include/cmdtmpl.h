@@ -0,0 +1,58 @@
+/* Copyright 2020, JP Norair
+  *
+  * Licensed under the OpenTag License, Version 1.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  * http://www.indigresso.com/wiki/doku.php?id=opentag:license_1_0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  *
+  */
+
+#ifndef cmdtmpl_h
+#define cmdtmpl_h
+
+// Standard C & POSIX Libraries
+#include <stddef.h>
+
+
+/// Bulk templates: one command template, with ${field} placeholders, run once
+/// for every row of a data file.
+///
+/// The data is CSV with a header row that names the fields, or NDJSON (one
+/// JSON object per line, which is detected by a '{' at the start).  CSV
+/// fields may be quoted, with "" for a quote, and quoted fields may span
+/// lines.  In NDJSON, string values are unescaped, and other values are
+/// used as they are written.
+///
+/// The template is compiled once into literal and field segments.  Rows are
+/// streamed from the file: each one is split in place in a reused line
+/// buffer, and expanded into a reused command buffer, so there is no
+/// allocation per row.  Up to cfg->concurrency commands are in flight at
+/// once.  Response lines are written to fd_out as "[N] line", where N is the
+/// data row number (from 1, not counting the CSV header).  A row that lacks
+/// a field of the template is reported and not sent.  A summary goes to
+/// stderr at the end.
+
+typedef struct {
+    int         fd_out;
+    int         concurrency;    ///< commands in flight at once
+    void*       filter;         ///< output filter (filter_t), or NULL
+    void*       capture;        ///< traffic capture (capture_t), or NULL
+    void*       journal;        ///< with --ack-only: session journal (collect_t), or NULL
+} cmdtmpl_cfg_t;
+
+
+/// Run template for each row of the file at data_path ("-" for stdin)
+/// against the daemon at socket.  Returns 0 if every row succeeded, -4 if
+/// any failed, or a lesser negative value if the template or data can't be
+/// used (with a message on stderr) or the socket can't be opened.
+int cmdtmpl_run(const char* socket, const char* tmpl, const char* data_path, const cmdtmpl_cfg_t* cfg);
+
+
+#endif
@@ -0,0 +1,74 @@
+/* Copyright 2020, JP Norair
+  *
+  * Licensed under the OpenTag License, Version 1.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  * http://www.indigresso.com/wiki/doku.php?id=opentag:license_1_0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  *
+  */
+
+#ifndef collect_h
+#define collect_h
+
+// Standard C & POSIX Libraries
+#include <stddef.h>
+#include <stdint.h>
+
+
+/// Fire-and-forget support.  With --ack-only, a command is done when its ack
+/// arrives, and the rxstat of its session is left for a collector.  The
+/// session ids go into a journal, which the collector follows.
+///
+/// The journal is a text file with one JSON object per line:
+///
+///     {"sid":12,"target":"/tmp/otter.sock","cmd":"r -i 1234 3"}
+///
+/// Each line is written with a single append, so several writers (threads or
+/// processes) can share a journal.
+///
+/// The daemon sends an rxstat only to the clients connected when it arrives,
+/// so the collector has to be running by then, usually in the background.
+
+typedef void* collect_t;
+
+typedef struct {
+    int         fd_out;
+    int         timeout_ms;     ///< wait for each session, once it is in the journal
+    int         idle_ms;        ///< keep following the journal this long when nothing is pending (<= 0: until a signal)
+    void*       filter;         ///< output filter (filter_t), or NULL
+    void*       capture;        ///< traffic capture (capture_t), or NULL
+} collect_cfg_t;
+
+
+/// Open (or create) a journal for appending.  Returns NULL if the file can't
+/// be used.  A NULL handle is accepted by the other calls as a no-op.
+collect_t collect_open(const char* path);
+void collect_close(collect_t handle);
+
+/// Append a session to the journal.  Whitespace at the end of cmd is left
+/// out.  Returns 0, or a negative value if it couldn't be written.
+int collect_note(collect_t handle, const char* target, uint32_t sid, const char* cmd, size_t cmdsize);
+
+
+/// Collector: connect to socket, and write out the rxstats of the sessions
+/// in the journal at journal_path that were started on that socket.  The
+/// journal is followed as it grows.  An rxstat that arrives just before its
+/// journal line is kept for a moment, so the order of the two doesn't
+/// matter.  A session that isn't seen within cfg->timeout_ms is reported as
+/// missing.
+///
+/// Runs until nothing is pending and the journal hasn't grown for
+/// cfg->idle_ms, or until SIGINT/SIGTERM.  With cfg->idle_ms <= 0, it runs
+/// until the signal, as a watch does.  Returns 0 if every session was
+/// collected, -4 if any are missing, or a lesser negative value on error.
+int collect_run(const char* socket, const char* journal_path, const collect_cfg_t* cfg);
+
+
+#endif
@@ -0,0 +1,50 @@
+/* Copyright 2020, JP Norair
+  *
+  * Licensed under the OpenTag License, Version 1.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  * http://www.indigresso.com/wiki/doku.php?id=opentag:license_1_0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  *
+  */
+
+#ifndef devmgr_json_h
+#define devmgr_json_h
+
+// HB Libraries
+#include <cJSON.h>
+
+// Standard C & POSIX Libraries
+#include <stdint.h>
+
+
+/// Accessors for the otter daemon response objects (DTerm2 JSON).
+/// Shared between cmd_devmgr (synchronous CLI path) and libottercat.
+///
+/// ack:    {"type":"ack", "data":{"cmd":"(STRING)", "err":(INT), "sid":(INT)}}
+/// rxstat: {"type":"rxstat", "data":{"sid":(INT), "qual":(INT), "frame":"(STRING)" ...}}
+///
+/// A session with several rxstats marks them with "end":false, and marks the
+/// last one (which may not have a frame) with "end":true.  An rxstat without
+/// "end" is a single-frame session.
+
+cJSON* devmgr_json_gettype(cJSON* top, const char* typename);
+
+int devmgr_json_getack(cJSON* top, uint32_t* sid);
+
+const char* devmgr_json_getcmd(cJSON* top);
+
+int devmgr_json_getframe(cJSON* top, cJSON** frame, int* qualtest);
+
+/// Returns 1 if the rxstat ends its session, 0 if more rxstats follow, or -1
+/// if it has no session marker.
+int devmgr_json_getend(cJSON* top);
+
+
+#endif
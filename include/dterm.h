@@ -31,9 +31,6 @@
 //#include <stdlib.h>
 
 
-#define LINESIZE            1024
-#define CMDSIZE             LINESIZE        //CMDSIZE is deprecated
-
 typedef enum {
     DFMT_Binary,
     DFMT_Text,
@@ -64,6 +61,17 @@ typedef struct {
 
     bool    use_socket;
     void*   devmgr;
+    
+    // Response cache (rcache_t) and the target name used in its keys.
+    // Attached after initialization: NULL if not used.
+    void*       cache;
+    const char* target;
+    
+    // Output filter (filter_t) applied to response lines, or NULL
+    void*       filter;
+    
+    // With --ack-only: journal (collect_t) for the sessions left open, or NULL
+    void*       journal;
 
 } dterm_handle_t;
 
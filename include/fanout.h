@@ -0,0 +1,78 @@
+/* Copyright 2020, JP Norair
+  *
+  * Licensed under the OpenTag License, Version 1.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  * http://www.indigresso.com/wiki/doku.php?id=opentag:license_1_0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  *
+  */
+
+#ifndef fanout_h
+#define fanout_h
+
+// Standard C & POSIX Libraries
+#include <stddef.h>
+
+
+/// Fan-out: run one command stream against many otter daemons at once.
+///
+/// Every target gets its own libottercat connection, and runs the command
+/// lines in order, stopping at its first error (the same as dterm does for a
+/// single socket).  Targets are independent of each other, so the total run
+/// time is about that of the slowest target.  Each response line is written
+/// to fd_out as "[target] line".  A summary is written to stderr at the end.
+///
+/// With a device ID list, the command stream is a template: it is run once
+/// per device on every target, with FANOUT_DEVID_VAR replaced by the device
+/// ID, and with up to cfg->concurrency devices in flight per target.  Output
+/// lines are tagged with the device ID.  Devices that fail are retried, by
+/// themselves, for up to cfg->rounds extra rounds.  The devices that still
+/// failed are written to cfg->failed_path, which can be fed back in as a
+/// device ID list.
+///
+/// Returns 0 if every target (and device) completed successfully, -4 if any
+/// failed or timed out, or a lesser negative value on setup errors.
+
+#define FANOUT_DEVID_VAR    "${devid}"
+
+typedef struct {
+    int         fd_out;
+    int         target_timeout_ms;  ///< time for each target's whole job (<= 0: no limit)
+    char**      devid;              ///< device ID list, or NULL
+    size_t      num_devids;
+    int         concurrency;        ///< devices in flight per target
+    int         rounds;             ///< retry rounds for failed devices
+    const char* failed_path;        ///< file for failed device IDs, or NULL
+    void*       filter;             ///< output filter (filter_t), or NULL
+    void*       capture;            ///< traffic capture (capture_t), or NULL
+    void*       journal;            ///< with --ack-only: session journal (collect_t), or NULL
+} fanout_cfg_t;
+
+void fanout_cfg_init(fanout_cfg_t* cfg);
+
+int fanout_run(const char** targets, size_t num_targets, char* cmdstream, const fanout_cfg_t* cfg);
+
+
+/// Load target socket paths from a file, one per line.  Blank lines and lines
+/// starting with '#' are ignored.  The paths are appended to *targets, which
+/// is realloc'ed, and *num_targets is updated.  Strings are malloc'ed.
+/// Returns the number of paths loaded, or a negative value on error.
+int fanout_loadtargets(const char* path, char*** targets, size_t* num_targets);
+
+
+/// Split a device ID list, in place, and append the IDs to *devids (which is
+/// realloc'ed).  IDs are separated by commas or whitespace, and '#' starts a
+/// comment that runs to the end of the line.  The IDs point into list, which
+/// must outlive *devids.  Returns the number of IDs found, or a negative
+/// value on error.
+int fanout_splitdevids(char* list, char*** devids, size_t* num_devids);
+
+
+#endif
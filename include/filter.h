@@ -0,0 +1,71 @@
+/* Copyright 2020, JP Norair
+  *
+  * Licensed under the OpenTag License, Version 1.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  * http://www.indigresso.com/wiki/doku.php?id=opentag:license_1_0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  *
+  */
+
+#ifndef filter_h
+#define filter_h
+
+// Standard C & POSIX Libraries
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+/// Output filters: a match expression and/or a projection, compiled once
+/// and then applied to the raw bytes of each response line.
+///
+/// Expression syntax:
+///
+///     expr    := term ( "||" term )*
+///     term    := factor ( "&&" factor )*
+///     factor  := "!" factor | "(" expr ")" | path [ op literal ]
+///     op      := "==" | "!=" | "<" | "<=" | ">" | ">="
+///     literal := "string" | number | true | false | null
+///     path    := name ( "." name )*      (a numeric name indexes an array)
+///
+/// For example: type=="rxstat" && data.qual==0 && data.sid>=10
+///
+/// A bare path is true if it exists and is not false or null.  Comparisons
+/// with a path that doesn't exist are false.  A value of another JSON type
+/// than the literal is only != to it.  Strings are compared as they are
+/// written in the JSON, without decoding escapes.
+///
+/// A projection is a comma separated list of paths, such as
+/// "data.sid,data.frame".  The output line is the values, tab separated.
+/// Strings are written without quotes, objects and arrays as JSON text, and
+/// paths that don't exist as null.
+///
+/// Evaluation never parses the whole line.  Each comparison first checks
+/// that its last key appears in the line at all, which rejects most lines
+/// with a single memmem().  Otherwise it walks only the objects on its path,
+/// skipping over the values of other keys.
+
+typedef void* filter_t;
+
+
+/// Compile a filter.  Either expr or project may be NULL.  On a syntax error
+/// NULL is returned, and a message is written to errbuf.
+filter_t filter_compile(const char* expr, const char* project, char* errbuf, size_t errmax);
+
+void filter_free(filter_t handle);
+
+/// Apply the filter to a line.  Returns -1 if the line doesn't match.
+/// Otherwise *out is set to the text to print and its length is returned:
+/// this is the line itself, or the projection, which is written to *buf
+/// (grown with realloc as needed).  A NULL filter passes every line as-is.
+int filter_line(filter_t handle, const uint8_t* line, size_t len, uint8_t** buf, size_t* alloc, const uint8_t** out);
+
+
+#endif
@@ -0,0 +1,35 @@
+/* Copyright 2020, JP Norair
+  *
+  * Licensed under the OpenTag License, Version 1.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  * http://www.indigresso.com/wiki/doku.php?id=opentag:license_1_0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  *
+  */
+
+#ifndef framebridge_h
+#define framebridge_h
+
+
+/// Frame bridge: a local adapter between framed clients (SP_FLAG_FRAMED, see
+/// sockpush.h) and a daemon that only speaks newline-delimited text.
+///
+/// A socket is created at listen_path.  For each client that connects, the
+/// bridge opens a connection to daemon_path.  Frames from the client are
+/// written to the daemon as lines.  Lines from the daemon are sent to the
+/// client as frames, with the type and sid taken from the line's "type" and
+/// "sid" values.  Clients are served one at a time, until SIGINT/SIGTERM.
+///
+/// Returns 0 on a normal exit, or a negative value if the listening socket
+/// can't be created.
+int framebridge_run(const char* listen_path, const char* daemon_path);
+
+
+#endif
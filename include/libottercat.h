@@ -0,0 +1,174 @@
+/* Copyright 2020, JP Norair
+  *
+  * Licensed under the OpenTag License, Version 1.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  * http://www.indigresso.com/wiki/doku.php?id=opentag:license_1_0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  *
+  */
+
+#ifndef libottercat_h
+#define libottercat_h
+
+// Standard C & POSIX Libraries
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+
+/// libottercat: embeddable, asynchronous interface to an otter daemon.
+///
+/// Commands are submitted with otc_submit() and complete asynchronously,
+/// either through a completion callback or into the handle's completion
+/// queue (when callback is NULL), which is drained via otc_poll() and
+/// otc_wait().  Each handle owns one sockpush connection and one engine
+/// thread that sends commands, matches acks & rxstats, and enforces the
+/// timeout and retry settings.
+///
+/// Sessions with several rxstats (marked with "end":false until the last one)
+/// are streamed: the callback gets each frame as it arrives, with
+/// otc_result_t::more set, then a final result.  The session ends at the
+/// "end":true rxstat, or after timeout_ms without one.  Requests without a
+/// callback get the final result only.
+///
+/// Read-type commands listed in otc_cfg_t::coalesce are coalesced: when one
+/// is submitted while an identical command string is still awaiting its
+/// ack or rxstat, it isn't sent again.  It gets a copy of that command's
+/// results (with otc_result_t::shared set).  The list must outlive the handle.
+///
+/// Callbacks run on the engine thread.  They may call otc_submit(), but they
+/// must not block and must not call otc_close() on their own handle.
+
+
+// Error codes, returned by functions and in otc_result_t::rc
+#define OTC_ERR_PARAM           -1
+#define OTC_ERR_NOMEM           -2
+#define OTC_ERR_SOCKET          -3
+#define OTC_ERR_TIMEOUT         -4
+#define OTC_ERR_SEND            -6
+#define OTC_ERR_QUAL            -7
+#define OTC_ERR_CLOSED          -8
+#define OTC_ERR_ACK(ERR)        (-256 - abs(ERR))
+
+// otc_cfg_t::flags
+// OTC_FLAG_EVLOOP: run the handle's socket on the shared sockpush event loop
+// (see sp_evloop_start()) instead of a dedicated I/O thread.
+#define OTC_FLAG_EVLOOP         1
+
+// OTC_FLAG_AIMD: adapt the number of commands in flight to the link.  The
+// congestion window grows on clean rxstats, up to cfg.window, and is halved
+// on timeouts and qual failures.  Without it, cfg.window is a fixed limit.
+#define OTC_FLAG_AIMD           2
+
+// OTC_FLAG_FRAMED: use the sockpush framed transport (SP_FLAG_FRAMED)
+// instead of newline-delimited text.  The daemon must support it.
+#define OTC_FLAG_FRAMED         4
+
+// OTC_FLAG_SHMRING: offer the daemon shared memory rings (SP_FLAG_SHMRING).
+// The connection stays on the socket if the offer isn't taken.
+#define OTC_FLAG_SHMRING        8
+
+// OTC_FLAG_REPLAY: after a reconnect, sockpush resends the commands that had
+// no ack yet (SP_FLAG_REPLAY), so they complete instead of timing out.
+#define OTC_FLAG_REPLAY         16
+
+// OTC_FLAG_ACKONLY: complete each command on its ack.  The rxstat is not
+// waited for, and res.sid is left for a collector (see collect.h).
+#define OTC_FLAG_ACKONLY        32
+
+// Priority classes for otc_submit_class().  OTC_CLASS_URGENT is always sent
+// first.  The other classes share the link in proportion to
+// otc_cfg_t::weight, so no class is starved.  otc_submit() uses NORMAL.
+#define OTC_CLASS_URGENT        0
+#define OTC_CLASS_HIGH          1
+#define OTC_CLASS_NORMAL        2
+#define OTC_CLASS_BULK          3
+#define OTC_CLASSES             4
+
+
+typedef void* otc_handle_t;
+
+
+typedef struct {
+    int         timeout_ms;     ///< per-try response timeout
+    int         tries;          ///< total tries (1 = no retries)
+    int         window;         ///< max commands in flight on the socket
+    int         rate;           ///< max commands sent per second (0 = no limit)
+    unsigned int flags;         ///< OTC_FLAG_... or 0
+    int         weight[OTC_CLASSES]; ///< share of each non-urgent class
+    const char** coalesce;      ///< NULL-terminated names of commands to coalesce, or NULL
+    void*       capture;        ///< capture_t to record the socket's traffic in, or NULL
+} otc_cfg_t;
+
+
+typedef struct {
+    int         depth;          ///< commands waiting to be sent
+    int         depth_max;      ///< highest depth so far
+    uint64_t    sent;           ///< commands sent, including retries
+    uint64_t    wait_ms_total;  ///< total time commands waited to be sent
+    int         wait_ms_max;    ///< longest time a command waited to be sent
+} otc_classstats_t;
+
+
+typedef struct {
+    uint64_t    id;             ///< value returned via otc_submit()
+    void*       user;           ///< user pointer passed to otc_submit()
+    int         rc;             ///< >= 0: frame length.  < 0: OTC_ERR_...
+    int         ack_err;        ///< "err" value from the ack
+    uint32_t    sid;            ///< session id from the ack (0 = no rxstat)
+    int         qual;           ///< "qual" value from the rxstat
+    int         tries;          ///< number of times the command was sent
+    const char* cmd;            ///< command string as submitted
+    const char* ack;            ///< raw ack line, or NULL
+    const char* rxstat;         ///< raw rxstat line, or NULL
+    const char* frame;          ///< rxstat frame string, or NULL
+    size_t      frame_size;
+    int         more;           ///< 1: one frame of a session, more follow
+    int         shared;         ///< 1: coalesced, copied from an identical command
+} otc_result_t;
+
+
+typedef void (*otc_callback_t)(otc_handle_t, const otc_result_t*, void*);
+
+
+
+void otc_cfg_init(otc_cfg_t* cfg);
+
+int otc_open(otc_handle_t* handle, const char* socket_path, const otc_cfg_t* cfg);
+int otc_close(otc_handle_t handle);
+
+/// Queue a command.  If callback is NULL, the result goes into the handle's
+/// completion queue.  Returns 0 and writes the request id to *id (if not
+/// NULL), or a negative OTC_ERR_ value.
+int otc_submit(otc_handle_t handle, const char* cmd, size_t cmdsize,
+               otc_callback_t callback, void* user, uint64_t* id);
+
+/// Queue a command in a priority class (OTC_CLASS_...).  Retries of a
+/// command stay in its class.
+int otc_submit_class(otc_handle_t handle, int cls, const char* cmd, size_t cmdsize,
+                     otc_callback_t callback, void* user, uint64_t* id);
+
+/// Drain up to max results from the completion queue.  otc_poll() never
+/// blocks; otc_wait() blocks up to timeout_ms (< 0 waits indefinitely) for at
+/// least one result.  Returns the number of results written to out.  Each
+/// result must be handed back via otc_release().
+int otc_poll(otc_handle_t handle, otc_result_t** out, int max);
+int otc_wait(otc_handle_t handle, otc_result_t** out, int max, int timeout_ms);
+void otc_release(otc_handle_t handle, otc_result_t* result);
+
+/// Number of submitted commands that have not yet completed
+int otc_pending(otc_handle_t handle);
+
+/// Send queue metrics of one priority class
+int otc_classstats(otc_handle_t handle, int cls, otc_classstats_t* stats);
+
+
+#endif
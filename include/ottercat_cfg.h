@@ -69,6 +69,15 @@
 
 
 
+/// Feature configuration defaults.
+/// Features that need extra libraries are set by the Makefile, e.g. IOURING=1
+#define OTTERCAT_FEATURE(VAL)           OTTERCAT_FEATURE_##VAL
+#ifndef OTTERCAT_FEATURE_IOURING
+#   define OTTERCAT_FEATURE_IOURING     DISABLED
+#endif
+
+
+
 /// Parameter configuration defaults
 ///@todo some of these should be otter environment variables, namely timeouts and addresses
 #define OTTERCAT_PARAM(VAL)             OTTERCAT_PARAM_##VAL
@@ -87,9 +96,45 @@
 #ifndef OTTERCAT_PARAM_BYLINE
 #   define OTTERCAT_PARAM_BYLINE        "Haystack Technologies, Inc."
 #endif
+#ifndef OTTERCAT_PARAM_MAXLINE
+#   define OTTERCAT_PARAM_MAXLINE       (16*1024*1024)
+#endif
+#ifndef OTTERCAT_PARAM_MAXTARGETS
+#   define OTTERCAT_PARAM_MAXTARGETS    1024
+#endif
+#ifndef OTTERCAT_PARAM_CACHESIZE
+#   define OTTERCAT_PARAM_CACHESIZE     (4*1024*1024)
+#endif
+#ifndef OTTERCAT_PARAM_CACHETTL
+#   define OTTERCAT_PARAM_CACHETTL      10000
+#endif
+#ifndef OTTERCAT_PARAM_CACHECMDS
+#   define OTTERCAT_PARAM_CACHECMDS     "r,read"
+#endif
+#ifndef OTTERCAT_PARAM_CACHEMAXREC
+#   define OTTERCAT_PARAM_CACHEMAXREC   (64*1024)
+#endif
+#ifndef OTTERCAT_PARAM_WATCHBUF
+#   define OTTERCAT_PARAM_WATCHBUF      (1024*1024)
+#endif
 #ifndef OTTERCAT_PARAM_MMAP_PAGESIZE
 #   define OTTERCAT_PARAM_MMAP_PAGESIZE (128*1024)
 #endif
+#ifndef OTTERCAT_PARAM_SHMRING
+#   define OTTERCAT_PARAM_SHMRING       (1024*1024)
+#endif
+#ifndef OTTERCAT_PARAM_XFER_CHUNK
+#   define OTTERCAT_PARAM_XFER_CHUNK    128
+#endif
+#ifndef OTTERCAT_PARAM_XFER_ROUNDS
+#   define OTTERCAT_PARAM_XFER_ROUNDS   2
+#endif
+#ifndef OTTERCAT_PARAM_XFER_PUTCMD
+#   define OTTERCAT_PARAM_XFER_PUTCMD   "w -i ${devid} -r ${offset}:${end} ${fileid} ${data}"
+#endif
+#ifndef OTTERCAT_PARAM_XFER_GETCMD
+#   define OTTERCAT_PARAM_XFER_GETCMD   "r -i ${devid} -r ${offset}:${end} ${fileid}"
+#endif
 
 
 
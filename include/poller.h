@@ -0,0 +1,66 @@
+/* Copyright 2020, JP Norair
+  *
+  * Licensed under the OpenTag License, Version 1.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  * http://www.indigresso.com/wiki/doku.php?id=opentag:license_1_0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  *
+  */
+
+#ifndef poller_h
+#define poller_h
+
+// Standard C & POSIX Libraries
+#include <stdbool.h>
+
+
+/// Periodic polling: stay connected to the daemon and run a set of commands
+/// (the lines of a script) once per period, until SIGINT/SIGTERM or until
+/// cfg->polls polls have been run.
+///
+/// The schedule is a timerfd on CLOCK_MONOTONIC with an absolute start, so
+/// polls stay on the grid start + k*period however long each one takes.  If
+/// a poll is still running when the next one is due, that one is skipped
+/// rather than queued, and so are any periods the process missed entirely.
+///
+/// The response lines of each command are written to fd_out as "[C.K] line",
+/// where C is the poll number and K the command's place in the script (both
+/// from 1), once the command is complete.  With cfg->changes, a command's
+/// lines are only written when its result differs from the last poll: the
+/// rxstat frames and quals are hashed, and the hash is compared.  Commands
+/// that fail are always written.
+///
+/// Stats go to stderr at the end: polls run and skipped, results, and the
+/// scheduling jitter (how late each poll started after its due time).
+
+typedef struct {
+    int         fd_out;
+    long        period_ms;
+    unsigned long polls;        ///< polls to run (0: until a signal)
+    bool        changes;        ///< write only the results that changed
+    int         concurrency;    ///< commands in flight at once
+    void*       filter;         ///< output filter (filter_t), or NULL
+    void*       capture;        ///< traffic capture (capture_t), or NULL
+} poller_cfg_t;
+
+void poller_cfg_init(poller_cfg_t* cfg);
+
+/// Parse a period such as "500", "500ms", "2s" or "1m" (no suffix is ms).
+/// Returns the period in ms, or a negative value if arg is malformed.
+long poller_parseperiod(const char* arg);
+
+/// Poll the commands in cmdstream (one per line; blank lines and # comments
+/// are skipped) against the daemon at socket.  Returns 0 if every command
+/// succeeded in every poll, -4 if any failed, or a lesser negative value if
+/// there are no commands or the socket can't be opened.
+int poller_run(const char* socket, const char* cmdstream, const poller_cfg_t* cfg);
+
+
+#endif
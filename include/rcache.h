@@ -0,0 +1,64 @@
+/* Copyright 2020, JP Norair
+  *
+  * Licensed under the OpenTag License, Version 1.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  * http://www.indigresso.com/wiki/doku.php?id=opentag:license_1_0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  *
+  */
+
+#ifndef rcache_h
+#define rcache_h
+
+// Standard C & POSIX Libraries
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+/// Response cache: results of read-type commands, kept in a memory-mapped
+/// file so that they persist across ottercat invocations.
+///
+/// Entries are keyed by a byte string (ottercat uses the daemon socket and
+/// the command line, which names the device).  An entry is served only if it
+/// is younger than the TTL.  Values are appended to a ring in the file, so
+/// when the file is full the oldest entries are evicted first.  The file is
+/// locked with flock() around each access, so any number of ottercat
+/// processes can share it.
+
+typedef void* rcache_t;
+
+
+/// Open (or create) the cache file.  size is used only when the file is
+/// created.  cmds is a NULL-terminated list of command names that may be
+/// cached, which must outlive the handle.  Returns NULL on error.
+rcache_t rcache_open(const char* path, size_t size, int ttl_ms, const char** cmds);
+
+void rcache_close(rcache_t handle);
+
+/// Largest record the cache takes (key and value), a fraction of its ring.
+/// Returns 0 for a NULL handle.
+size_t rcache_maxval(rcache_t handle);
+
+/// True if the command line names one of the cacheable commands
+bool rcache_iscacheable(rcache_t handle, const char* cmd);
+
+/// Look up key.  On a hit, the value is copied into *buf, which is grown
+/// (realloc'ed) as needed, and its length is returned.  Returns -1 on a miss,
+/// or if the entry has expired.
+int rcache_get(rcache_t handle, const void* key, size_t keylen, uint8_t** buf, size_t* alloc);
+
+/// Store a value under key, replacing any older value.  Returns 0, or -1 if
+/// the value is larger than rcache_maxval() allows (it is not stored, and no
+/// other entry is evicted) or the file can't be locked.
+int rcache_put(rcache_t handle, const void* key, size_t keylen, const void* val, size_t vallen);
+
+
+#endif
@@ -0,0 +1,80 @@
+/* Copyright 2020, JP Norair
+  *
+  * Licensed under the OpenTag License, Version 1.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  * http://www.indigresso.com/wiki/doku.php?id=opentag:license_1_0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  *
+  */
+
+#ifndef runner_h
+#define runner_h
+
+// Application Headers
+#include "libottercat.h"
+
+// Standard C & POSIX Libraries
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+
+/// Pieces shared by the runners that drive a libottercat handle (fan-out,
+/// command graphs, templates, transfers and polling).
+///
+/// Runners keep their state under a mutex that the completion callbacks
+/// take, so otc_close() is always called outside of it: closing aborts the
+/// outstanding requests, and their callbacks run before it returns.
+
+/// Set up a handle's config from the command line options.  window is the
+/// number of commands in flight.  noflags are OTC_FLAG_ values the runner
+/// can't use, which are left out even if an option asks for them.
+void runner_otccfg(otc_cfg_t* otccfg, int window, unsigned int noflags, void* capture);
+
+/// Reduce a command line in the JSON form {"type":"...", "data":"..."} to
+/// its data string, in place.  Other lines are left as they are.
+char* runner_cmdline(char* line);
+
+/// ms from start to end, or to now if end is NULL (CLOCK_MONOTONIC)
+long runner_elapsed_ms(const struct timespec* start, const struct timespec* end);
+
+
+/// Response output: each line goes through the output filter and is
+/// written as "[tag] line".  Not thread safe: runners call these with their
+/// mutex held, which also keeps lines from interleaving.
+typedef struct {
+    int         fd_out;
+    void*       filter;         ///< output filter (filter_t), or NULL
+    uint8_t*    projbuf;
+    size_t      projalloc;
+} runout_t;
+
+void runner_outinit(runout_t* out, int fd_out, void* filter);
+void runner_outfree(runout_t* out);
+
+/// Run a response line through the filter, less its terminator.  Returns
+/// the size of *text, or -1 if the filter drops the line.
+int runner_filter(runout_t* out, const char* line, const uint8_t** text);
+
+/// The error line that stands in for a response, with name appended to
+/// desc if it isn't NULL.  Returns its length, as snprintf() does.
+int runner_errline(char* line, size_t max, int rc, const char* desc, const char* name);
+
+void runner_emit(runout_t* out, const char* tag, const char* line);
+void runner_emiterr(runout_t* out, const char* tag, int rc, const char* desc);
+
+/// Write a completion's ack and rxstat.  When the command is complete, also
+/// write an error line if the response doesn't speak for itself, and note an
+/// ack-only session in journal (see collect.h).  Returns true when complete.
+bool runner_result(runout_t* out, const char* tag, const otc_result_t* res, void* journal, const char* socket);
+
+
+#endif
@@ -0,0 +1,102 @@
+/* Copyright 2020, JP Norair
+  *
+  * Licensed under the OpenTag License, Version 1.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  * http://www.indigresso.com/wiki/doku.php?id=opentag:license_1_0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  *
+  */
+
+#ifndef shmring_h
+#define shmring_h
+
+// Standard C & POSIX Libraries
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+/// Shared memory ring transport, for a client and daemon on the same host.
+///
+/// One shared mapping holds two single-producer, single-consumer byte rings:
+/// ring 0 carries client to daemon, ring 1 daemon to client.  The bytes are
+/// the same stream that would otherwise go over the socket (text lines or
+/// frames), so the rings replace only the socket reads and writes.  Each
+/// ring has an eventfd doorbell, which the producer rings only when the
+/// consumer has said it is going to sleep.  The consumer spins briefly
+/// before that, so a busy link runs without any system calls.
+///
+/// Handshake: the client connects to the Unix socket as usual, and sends
+/// the line "shmring" with the mapping's memfd and the two eventfds
+/// attached (SCM_RIGHTS).  A daemon that takes the offer replies with the
+/// line {"type":"shmring","err":0}, and from then on all traffic uses the
+/// rings.  The socket stays open so that each side can see the other hang
+/// up.  Any other reply leaves the connection on the socket.  The offer is
+/// only made when asked for (SP_FLAG_SHMRING), and a daemon that doesn't
+/// know it may ignore it, or answer it with a line about "shmring" (such as
+/// an error ack), which the client drops.
+///
+/// Linux only (memfd, eventfd).  Elsewhere shmring_connect() fails and the
+/// socket is used.
+
+#define SHMRING_OFFER       "shmring"
+#define SHMRING_ACCEPT      "{\"type\":\"shmring\",\"err\":0}"
+
+typedef struct shmring_map shmring_map_t;
+
+typedef struct {
+    shmring_map_t*  map;
+    size_t          mapsize;
+    int             fd_mem;
+    int             fd_bell[2];     ///< doorbell eventfd of each ring
+    int             tx;             ///< ring this side writes: 0 client, 1 daemon
+} shmring_t;
+
+
+/// Client side: create the mapping (ringsize bytes per ring, rounded up to a
+/// power of 2) and offer it to the daemon on fd_sock.  Returns 0 if the
+/// daemon accepted it within timeout_ms.  Otherwise the rings are released
+/// and the connection stays on the socket, and the return is -1 if the
+/// daemon's reply was read (the whole line is consumed), or -2 if there was
+/// none in time.  After -2, a reply may still come: the caller drops the
+/// first line that shmring_isreply() matches.  Nothing else may be sent on
+/// the socket before this.
+int shmring_connect(shmring_t* shm, int fd_sock, size_t ringsize, int timeout_ms);
+
+/// True if a line received from the daemon is about the offer
+bool shmring_isreply(const uint8_t* line, size_t size);
+
+void shmring_close(shmring_t* shm);
+
+/// Write all of data to the outbound ring, waiting for space if needed.
+/// Returns 0, or -1 if the peer hasn't made space within timeout_ms.
+int shmring_write(shmring_t* shm, const uint8_t* data, size_t size, int timeout_ms);
+
+/// Contiguous span of bytes ready in the inbound ring.  Returns its size,
+/// which is 0 if the ring is empty.  Release it with shmring_consume().
+size_t shmring_peek(shmring_t* shm, const uint8_t** span);
+void shmring_consume(shmring_t* shm, size_t size);
+
+/// Wait for the inbound ring to have data.  fd_sock is watched meanwhile.
+/// Returns 1 when the ring has data, 2 when the socket is readable (which
+/// is how a hang-up shows), 0 on timeout (timeout_ms < 0: no timeout), or
+/// -1 on error.
+int shmring_wait(shmring_t* shm, int fd_sock, int timeout_ms);
+
+
+/// Loopback stand-in daemon for testing and benchmarks.  Listens on
+/// socket_path and serves one client at a time, accepting ring offers.
+/// Every command line gets an ack and an rxstat, as otter would send, over
+/// the ring or the socket, whichever the command came on.  Runs until
+/// SIGINT/SIGTERM.
+int shmring_loopback_run(const char* socket_path);
+
+
+#endif
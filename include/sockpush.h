@@ -17,6 +17,7 @@
 #ifndef sockpush_h
 #define sockpush_h
 
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdint.h>
 
@@ -24,14 +25,62 @@
 #define SP_SUB_OUTBOUND     2
 #define SP_SUB_INBOUND      1
 
+// sp_open() flags
+// SP_FLAG_EVLOOP: drive the connection from the shared event loop threads
+// instead of a dedicated I/O thread.  Use for large numbers of connections.
+#define SP_FLAG_EVLOOP      1
+
+// SP_FLAG_FRAMED: use the length-prefixed framed transport instead of
+// newline-delimited text.  Each sp_write()/sp_sendcmd() is sent as a frame.
+#define SP_FLAG_FRAMED      2
+
+// SP_FLAG_SHMRING: offer the daemon shared memory rings after connecting
+// (see shmring.h), and use the socket if it declines.  A daemon that
+// declines, or doesn't answer, isn't asked again on reconnects.  Implies a
+// dedicated I/O thread: SP_FLAG_EVLOOP is ignored.
+#define SP_FLAG_SHMRING     4
+
+// SP_FLAG_REPLAY: keep each command sent with sp_sendcmd() until an ack
+// comes back for it.  Acks come back in command order, so an ack goes to
+// the oldest kept command with the name in its "cmd".  When the daemon
+// goes away, the commands without an ack are sent again after the
+// reconnect, ahead of anything new.  Commands sent while disconnected are
+// held and sent on reconnect, instead of failing.
+#define SP_FLAG_REPLAY      8
+
+
+// Framed transport.  Each message is a 12 byte header and a payload, which
+// is one line of the text protocol without its terminator:
+//
+// Byte 0:1  -> Sync (FF55)
+// Byte 2    -> Type (SP_FRAME_...)
+// Byte 3    -> Control Field (0, reserved)
+// Byte 4:7  -> Payload Length
+// Byte 8:11 -> Session ID (sid), or 0
+// Byte 12:- -> Payload
+//
+// As in MPipe, all values are big-endian.  There is no CRC, because the
+// socket is already a reliable stream.  The payload can contain any bytes.
+#define SP_FRAME_HDRSIZE    12
+#define SP_FRAME_SYNC0      0xFF
+#define SP_FRAME_SYNC1      0x55
+#define SP_FRAME_MSG        0       ///< any other message
+#define SP_FRAME_CMD        1       ///< command, to the daemon
+#define SP_FRAME_ACK        2
+#define SP_FRAME_RXSTAT     3
+
 
 
 // External data types.  Use these in APIs and clients.
 // ---------------------------------------------------------------------------
 typedef void* sp_handle_t;
 typedef void* sp_reader_t;
+typedef void* sp_subscr_t;
 
-typedef int (*sp_action_t)(sp_handle_t, const uint8_t*, size_t);
+///@note sp_action_t gets called from the sockpush I/O thread.  The first
+///      argument is the "parent" pointer given to sp_subscribe().  Actions
+///      must not call back into sp_write() or sp_sendcmd() on the same handle.
+typedef int (*sp_action_t)(void*, const uint8_t*, size_t);
 
 
 
@@ -43,24 +92,97 @@ typedef int (*sp_action_t)(sp_handle_t, const uint8_t*, size_t);
 
 
 
+/// The address given to sp_open() is one of:
+/// - "loop:" or "loop:FILE", the in-process loopback daemon (see sploop.h)
+/// - "host:port" or "[v6addr]:port", a TCP connection
+/// - otherwise, the path of a Unix socket
+///
+/// A host name is resolved once, by sp_open().  SP_FLAG_SHMRING only works
+/// on a Unix socket, and is ignored on the others.
 int sp_open(sp_handle_t* handle, const char* socket_path, unsigned int flags);
 int sp_close(sp_handle_t handle);
 
+/// TCP socket options, applied to each connection as it is made.  Zero
+/// leaves a setting at the system default.  Keepalive probes start after
+/// keepidle_s seconds of silence, and the connection is dropped (and then
+/// reconnected) after keepcnt unanswered probes, keepintvl_s apart.  The
+/// same limit applies to sent data that isn't acknowledged, where the
+/// system supports it.  A connect that isn't made within connect_ms fails,
+/// and is retried like any other failed connect.
+typedef struct {
+    bool    nodelay;
+    int     keepidle_s;
+    int     keepintvl_s;
+    int     keepcnt;
+    int     sndbuf;
+    int     rcvbuf;
+    int     connect_ms;
+} sp_tcpopt_t;
+
+/// Defaults: nodelay, keepalive 5 s idle, 2 s interval, 3 probes, system
+/// buffer sizes and connect timeout.  Set before the connections are opened.
+void sp_tcp_setopt(const sp_tcpopt_t* opt);
+void sp_tcp_getopt(sp_tcpopt_t* opt);
+
+/// Start nthreads event loop threads for SP_FLAG_EVLOOP connections.  If cpus
+/// is not NULL, loop i is pinned to cpus[i].  If no loop has been started when
+/// the first SP_FLAG_EVLOOP connection is opened, a single unpinned loop is
+/// started for it.  Stop the loops only after all their connections are closed.
+int sp_evloop_start(unsigned int nthreads, const int* cpus);
+void sp_evloop_stop(void);
+
 sp_reader_t sp_reader_create(void* ctx, sp_handle_t handle);
 void sp_reader_purge(sp_reader_t reader);
 void sp_reader_destroy(sp_reader_t reader);
 
+///@note sp_read() truncates lines longer than readmax.  sp_readline() grows
+///      *readbuf (with realloc) to fit the whole line.  Either way, the size
+///      includes the line's null terminator.
+///@note Both return 0 on timeout, and SP_DROPPED once, right away, if the
+///      connection drops while the reader exists.  Lines received before
+///      the drop are returned first.
+#define SP_DROPPED          (-2)
 int sp_read(sp_reader_t reader, uint8_t* readbuf, size_t readmax, size_t timeout_ms);
+int sp_readline(sp_reader_t reader, uint8_t** readbuf, size_t* readalloc, size_t timeout_ms);
+
+/// Number of inbound lines dropped because they exceeded the maximum line
+/// size (OTTERCAT_PARAM_MAXLINE).
+unsigned long sp_oversize(sp_handle_t handle);
+
+/// Type and sid of the frame being published, for use in a subscriber
+/// action on a SP_FLAG_FRAMED connection, so that lines can be routed
+/// without parsing them.  Returns -1 on a text connection.
+int sp_frameinfo(sp_handle_t handle, uint8_t* type, uint32_t* sid);
+
+/// Write a frame header to hdr (SP_FRAME_HDRSIZE bytes)
+void sp_frame_pack(uint8_t* hdr, uint8_t type, uint32_t sid, size_t size);
+
+/// Read a frame header.  Returns -1 if hdr doesn't start with the sync bytes.
+int sp_frame_unpack(const uint8_t* hdr, uint8_t* type, uint32_t* sid, size_t* size);
 
 //int sp_comm(sp_handle_t handle, uint8_t* readbuf, size_t readmax, uint8_t* writebuf, size_t writesize);
 
 
 
 int sp_sendcmd(sp_handle_t handle, uint8_t* writebuf, size_t writesize);
+
+/// sp_sendcmd(), for a sender that tracks its commands.  With SP_FLAG_REPLAY,
+/// a command sent again with the same id (a retry) replaces the one that is
+/// kept for replay, so it is not replayed twice.  sp_forget() drops a kept
+/// command, for one that has timed out or been given up on.  id 0 is not
+/// tracked.
+int sp_sendcmd_id(sp_handle_t handle, uint8_t* writebuf, size_t writesize, uint64_t id);
+void sp_forget(sp_handle_t handle, uint64_t id);
 int sp_write(sp_handle_t handle, uint8_t* writebuf, size_t writesize);
 
+/// Wait until the connection is up, for a client that has to send right
+/// after sp_open().  Returns 0 once connected, or -2 if it isn't connected
+/// within timeout_ms.
+int sp_waitonline(sp_handle_t handle, size_t timeout_ms);
+
 
-int sp_subscribe(sp_handle_t handle, sp_action_t action, int flags, uint8_t* readbuf, size_t readmax);
+sp_subscr_t sp_subscribe(sp_handle_t handle, void* parent, sp_action_t action, int flags, uint8_t* buf, size_t max);
+void sp_unsubscribe(sp_subscr_t subscr);
 
 
 //int sp_dispatch(sp_handle_t handle, sp_status_t action, uint8_t* writebuf, size_t writesize);
@@ -0,0 +1,66 @@
+/* Copyright 2020, JP Norair
+  *
+  * Licensed under the OpenTag License, Version 1.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  * http://www.indigresso.com/wiki/doku.php?id=opentag:license_1_0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  *
+  */
+
+#ifndef sploop_h
+#define sploop_h
+
+// Standard C & POSIX Libraries
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+
+/// In-process loopback daemon, used by sockpush as the transport for
+/// "loop:" addresses.  Nothing leaves the process: what is sent is answered
+/// by a scripted responder, and the answers are queued for receive.  It is
+/// for measuring and testing the layers above sockpush without a daemon or
+/// the kernel in the way.
+///
+/// The script is a text file of response templates.  Every command line gets
+/// all the templates, in order, as response lines.  In a template:
+/// - ${sid} is a session number, counting commands from 1
+/// - ${cmd} is the first word of the command
+/// - ${line} is the whole command, less quotes, backslashes and controls
+///
+/// Blank lines and lines starting with '#' are skipped.  Without a script,
+/// each command gets an ack and an rxstat in the form otter sends them.
+///
+/// In framed mode, commands are read as frames and the responses are sent
+/// as frames, typed ack or rxstat by the template's "type" value.
+
+typedef struct sploop sploop_t;
+
+/// Returns NULL if the script can't be read, or has no templates
+sploop_t* sploop_open(const char* script_path, bool framed);
+void sploop_close(sploop_t* lb);
+
+/// Discard queued input and responses, for a reconnect
+void sploop_reset(sploop_t* lb);
+
+/// Send data to the responder.  Responses are queued for sploop_recv().
+/// Returns 0, or -1 if the response queue is full.
+int sploop_send(sploop_t* lb, const uint8_t* data, size_t size);
+
+/// Receive queued responses, waiting for some if there are none.  This is a
+/// cancellation point.  Returns the number of bytes, or -1 on error.
+ssize_t sploop_recv(sploop_t* lb, uint8_t* buf, size_t max);
+
+/// Descriptor that polls readable when responses may be queued
+int sploop_fd(sploop_t* lb);
+
+
+#endif
@@ -0,0 +1,52 @@
+/* Copyright 2020, JP Norair
+  *
+  * Licensed under the OpenTag License, Version 1.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  * http://www.indigresso.com/wiki/doku.php?id=opentag:license_1_0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  *
+  */
+
+#ifndef unixsrv_h
+#define unixsrv_h
+
+// Standard C & POSIX Libraries
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+/// Helpers for the local stand-in servers (capture replay, frame bridge,
+/// shmring loopback) and the other modes that run until a signal.
+
+/// Create a listening Unix socket at path.  A stale socket at path is
+/// removed first, but any other kind of file is left alone, and then the
+/// bind fails.  Returns the socket, or -1.
+int unixsrv_listen(const char* path, int backlog);
+
+/// Accept a client on fd_srv.  An interrupted accept() is retried unless a
+/// stop signal has been taken (see unixsrv_onstop()).  Returns the client's
+/// socket, or -1.
+int unixsrv_accept(int fd_srv);
+
+/// Blocking send of the whole buffer.  Returns 0, or -1 if the peer has gone.
+int unixsrv_sendall(int fd, const void* data, size_t size);
+
+/// Grow a buffer so it holds at least need bytes.  The allocation starts at
+/// chunk and doubles.  Returns -1 if need is over limit, or on no memory.
+int unixsrv_grow(uint8_t** buf, size_t* alloc, size_t need, size_t chunk, size_t limit);
+
+/// Catch SIGINT and SIGTERM, and ignore SIGPIPE.  The handler only sets the
+/// flag that unixsrv_stopped() returns, which this clears.
+void unixsrv_onstop(void);
+bool unixsrv_stopped(void);
+
+
+#endif
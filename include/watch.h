@@ -0,0 +1,88 @@
+/* Copyright 2020, JP Norair
+  *
+  * Licensed under the OpenTag License, Version 1.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  * http://www.indigresso.com/wiki/doku.php?id=opentag:license_1_0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  *
+  */
+
+#ifndef watch_h
+#define watch_h
+
+// Standard C & POSIX Libraries
+#include <stddef.h>
+#include <stdint.h>
+
+
+/// Watch mode: stay connected to the daemon and stream every inbound line
+/// (acks and unsolicited rxstats alike) to fd_out, until SIGINT/SIGTERM or
+/// until no line arrives for idle_ms.
+///
+/// Lines are filtered on their raw bytes, without parsing the JSON.  A line
+/// is printed if it passes every filter that is given:
+/// - types: the "type" value is one of the names in the list
+/// - sids: a "sid" value is in one of the ranges
+/// - fields: for every key=value pair, the key's value equals value
+///
+/// Keys are matched at their first appearance anywhere in the line, so a key
+/// nested in "data" is found the same way as a top-level key.  String values
+/// are compared literally (JSON escapes are not decoded).  Lines that pass
+/// then go through filter, if it is set (see filter.h).
+///
+/// Output is gathered into a buffer of bufsize bytes, which is written out
+/// in large blocks.  If the output can't keep up with the daemon, lines that
+/// don't fit in the buffer are dropped and counted, rather than holding up
+/// the socket.  The counters are written to stderr at exit, and every
+/// stats_ms if that is > 0.
+
+typedef struct {
+    uint32_t    lo;
+    uint32_t    hi;
+} watch_range_t;
+
+typedef struct {
+    const char* key;
+    const char* value;
+} watch_field_t;
+
+typedef struct {
+    int             fd_out;
+    size_t          bufsize;
+    int             idle_ms;        ///< end after this long without a line (<= 0: never)
+    int             stats_ms;       ///< period of the stats line (<= 0: only at exit)
+    const char**    types;          ///< NULL-terminated, or NULL for any type
+    watch_range_t*  sids;
+    size_t          num_sids;
+    watch_field_t*  fields;
+    size_t          num_fields;
+    void*           filter;         ///< filter_t, or NULL
+    void*           capture;        ///< capture_t, or NULL
+} watch_cfg_t;
+
+void watch_cfg_init(watch_cfg_t* cfg);
+
+/// Parse a list of sid ranges, such as "1-10,20,30-40", and append them to
+/// cfg->sids (which is realloc'ed).  Returns the number of ranges, or a
+/// negative value if the list is malformed.
+int watch_addsids(watch_cfg_t* cfg, const char* list);
+
+/// Parse a "key=value" filter, in place, and append it to cfg->fields (which
+/// is realloc'ed).  The strings point into arg, which must outlive cfg.
+/// Returns 0, or a negative value if arg has no '='.
+int watch_addfield(watch_cfg_t* cfg, char* arg);
+
+/// Connect to socket and watch it.  If cmdstr is not NULL, it is sent once
+/// the connection is up.  Returns 0 on a normal exit (signal or idle), or a
+/// negative value if the socket can't be opened.
+int watch_run(const char* socket, const char* cmdstr, const watch_cfg_t* cfg);
+
+
+#endif
@@ -0,0 +1,76 @@
+/* Copyright 2020, JP Norair
+  *
+  * Licensed under the OpenTag License, Version 1.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  * http://www.indigresso.com/wiki/doku.php?id=opentag:license_1_0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  *
+  */
+
+#ifndef xfer_h
+#define xfer_h
+
+// Standard C & POSIX Libraries
+#include <stdbool.h>
+#include <stddef.h>
+
+
+/// Chunked file transfer between a local file and a file on a device.
+///
+/// The file is cut into chunks, and each chunk is one command, made from a
+/// template with these placeholders:
+///
+///     ${devid}    device ID
+///     ${fileid}   device file ID
+///     ${offset}   byte offset of the chunk
+///     ${length}   bytes in the chunk
+///     ${end}      offset + length
+///     ${data}     put only: the chunk, as a bintex hex block "[0a1b...]"
+///
+/// Up to cfg->concurrency chunks are in flight at once.  A put chunk is done
+/// when its rxstat comes back with qual 0.  A get chunk is done when its
+/// rxstat frames, as hex, add up to the chunk's length; they are written at
+/// the chunk's offset.  Chunks that fail are sent again, by themselves, for
+/// up to cfg->rounds extra rounds.
+///
+/// With a resume journal, each chunk is recorded when it is done.  A run
+/// that finds a journal for the same transfer skips those chunks.  The
+/// journal is removed when the transfer completes.
+///
+///     {"xfer":"put","path":"cfg.bin","size":102400,"mtime":1600000000,"chunk":128,"fileid":"5","devid":"1234"}
+///     0
+///     2
+///     1
+///     ...
+
+typedef struct {
+    bool        is_get;
+    const char* path;           ///< local file
+    const char* devid;          ///< for ${devid}, or NULL
+    const char* fileid;
+    const char* cmd;            ///< chunk command template, or NULL for the default
+    size_t      size;           ///< get: bytes to read from the device file
+    int         chunk;          ///< bytes per chunk
+    int         concurrency;    ///< chunks in flight at once
+    int         rounds;         ///< retry rounds for failed chunks
+    const char* resume;         ///< resume journal, or NULL
+    void*       capture;        ///< traffic capture (capture_t), or NULL
+} xfer_cfg_t;
+
+void xfer_cfg_init(xfer_cfg_t* cfg);
+
+/// Run the transfer against the daemon at socket.  A summary goes to stderr,
+/// with a line for each chunk that failed.  Returns 0 when the whole file
+/// was transferred, -4 if any chunks failed, or a lesser negative value on
+/// setup errors (with a message on stderr).
+int xfer_run(const char* socket, const xfer_cfg_t* cfg);
+
+
+#endif
@@ -0,0 +1,455 @@
+/* Copyright 2020, JP Norair
+  *
+  * Licensed under the OpenTag License, Version 1.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  * http://www.indigresso.com/wiki/doku.php?id=opentag:license_1_0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  *
+  */
+
+// Application Headers
+#include "capture.h"
+#include "debug.h"
+#include "unixsrv.h"
+
+// Standard C & POSIX Libraries
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+
+#define CAPTURE_BUFSIZE     (64*1024)
+
+
+/// Each attached socket gets a channel, which is the subscriber's parent
+typedef struct capchan {
+    struct capchan*         next;
+    struct capture_handle*  cap;
+    uint16_t                chan;
+} capchan_t;
+
+typedef struct capture_handle {
+    int                 fd;
+    pthread_mutex_t     mutex;
+    struct timespec     t0;
+    uint8_t*            buf;
+    size_t              fill;
+    capchan_t*          chans;
+    uint16_t            num_chans;
+    bool                failed;
+} capture_handle_t;
+
+
+
+
+/** Capture Writer <BR>
+  * ========================================================================<BR>
+  */
+
+static uint64_t sub_ns(const struct timespec* ts) {
+    return ((uint64_t)ts->tv_sec * 1000000000ULL) + (uint64_t)ts->tv_nsec;
+}
+
+
+static int sub_writeall(int fd, const uint8_t* data, size_t size) {
+    ssize_t rc;
+
+    while (size != 0) {
+        rc = write(fd, data, size);
+        if (rc < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        data += rc;
+        size -= (size_t)rc;
+    }
+    return 0;
+}
+
+
+/// Write out the buffer.  Call with mutex held.  After a write error the
+/// capture stops, rather than failing again on every line.
+static void sub_flush(capture_handle_t* cap) {
+    if ((cap->fill != 0) && (cap->failed == false)) {
+        if (sub_writeall(cap->fd, cap->buf, cap->fill) != 0) {
+            ERR_PRINTF("capture: write failed (%s), capture stopped\n", strerror(errno));
+            cap->failed = true;
+        }
+    }
+    cap->fill = 0;
+}
+
+
+/// Append a record.  Call with mutex held.  The timestamp is taken here, so
+/// records are in time order in the file.
+static void sub_append(capture_handle_t* cap, uint8_t type, uint16_t chan, const void* data, size_t size) {
+    capture_rec_t rec;
+    struct timespec now;
+
+    if (cap->failed) {
+        return;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    rec.time_ns = sub_ns(&now) - sub_ns(&cap->t0);
+    rec.size    = (uint32_t)size;
+    rec.chan    = chan;
+    rec.type    = type;
+    rec.rsvd    = 0;
+
+    if ((cap->fill + sizeof(rec) + size) > CAPTURE_BUFSIZE) {
+        sub_flush(cap);
+    }
+    if ((sizeof(rec) + size) > CAPTURE_BUFSIZE) {
+        // Too big to buffer: write it straight through
+        struct iovec iov[2] = { { &rec, sizeof(rec) }, { (void*)data, size } };
+        if (writev(cap->fd, iov, 2) != (ssize_t)(sizeof(rec) + size)) {
+            ERR_PRINTF("capture: write failed, capture stopped\n");
+            cap->failed = true;
+        }
+        return;
+    }
+    memcpy(&cap->buf[cap->fill], &rec, sizeof(rec));
+    memcpy(&cap->buf[cap->fill + sizeof(rec)], data, size);
+    cap->fill += sizeof(rec) + size;
+}
+
+
+static void sub_record(capchan_t* ch, uint8_t type, const uint8_t* data, size_t size) {
+    // Lines from sockpush carry their terminator, which isn't recorded
+    while ((size != 0) && ((data[size-1] == 0) || (data[size-1] == '\n') || (data[size-1] == '\r'))) {
+        size--;
+    }
+    pthread_mutex_lock(&ch->cap->mutex);
+    sub_append(ch->cap, type, ch->chan, data, size);
+    pthread_mutex_unlock(&ch->cap->mutex);
+}
+
+static int sub_rx(void* parent, const uint8_t* data, size_t size) {
+    sub_record(parent, CAPTURE_REC_RX, data, size);
+    return 0;
+}
+
+static int sub_tx(void* parent, const uint8_t* data, size_t size) {
+    sub_record(parent, CAPTURE_REC_TX, data, size);
+    return 0;
+}
+
+
+
+
+/** Capture Public Functions <BR>
+  * ========================================================================<BR>
+  */
+
+capture_t capture_open(const char* path) {
+    capture_handle_t* cap;
+    struct stat st;
+    struct timespec wall;
+    uint64_t wall_ns;
+    char magic[8];
+
+    if (path == NULL) {
+        return NULL;
+    }
+    cap = calloc(1, sizeof(capture_handle_t));
+    if (cap == NULL) {
+        return NULL;
+    }
+    cap->buf = malloc(CAPTURE_BUFSIZE);
+    if (cap->buf == NULL) {
+        goto capture_open_FREE;
+    }
+
+    cap->fd = open(path, O_RDWR | O_APPEND | O_CREAT, 0644);
+    if (cap->fd < 0) {
+        ERR_PRINTF("cannot open capture file %s\n", path);
+        goto capture_open_FREE;
+    }
+    if (fstat(cap->fd, &st) != 0) {
+        goto capture_open_CLOSE;
+    }
+
+    // A new file gets the magic.  An existing one must already have it, so
+    // that a mistyped path doesn't get records appended to it.
+    if (st.st_size == 0) {
+        if (sub_writeall(cap->fd, (const uint8_t*)CAPTURE_MAGIC, 8) != 0) {
+            goto capture_open_CLOSE;
+        }
+    }
+    else if ((pread(cap->fd, magic, 8, 0) != 8) || (memcmp(magic, CAPTURE_MAGIC, 8) != 0)) {
+        ERR_PRINTF("%s is not a capture file\n", path);
+        goto capture_open_CLOSE;
+    }
+    if (pthread_mutex_init(&cap->mutex, NULL) != 0) {
+        goto capture_open_CLOSE;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &cap->t0);
+    clock_gettime(CLOCK_REALTIME, &wall);
+    wall_ns = sub_ns(&wall);
+    sub_append(cap, CAPTURE_REC_SESSION, 0, &wall_ns, sizeof(wall_ns));
+    return cap;
+
+    capture_open_CLOSE: close(cap->fd);
+    capture_open_FREE:  free(cap->buf);
+                        free(cap);
+    return NULL;
+}
+
+
+void capture_close(capture_t handle) {
+    capture_handle_t* cap = handle;
+    capchan_t* ch;
+
+    if (cap != NULL) {
+        pthread_mutex_lock(&cap->mutex);
+        sub_flush(cap);
+        pthread_mutex_unlock(&cap->mutex);
+
+        while (cap->chans != NULL) {
+            ch          = cap->chans;
+            cap->chans  = ch->next;
+            free(ch);
+        }
+        pthread_mutex_destroy(&cap->mutex);
+        close(cap->fd);
+        free(cap->buf);
+        free(cap);
+    }
+}
+
+
+int capture_attach(capture_t handle, sp_handle_t sp, const char* label) {
+    capture_handle_t* cap = handle;
+    capchan_t* ch;
+
+    if (cap == NULL) {
+        return 0;
+    }
+    ch = calloc(1, sizeof(capchan_t));
+    if (ch == NULL) {
+        return -1;
+    }
+    ch->cap = cap;
+
+    pthread_mutex_lock(&cap->mutex);
+    ch->chan    = cap->num_chans++;
+    ch->next    = cap->chans;
+    cap->chans  = ch;
+    sub_append(cap, CAPTURE_REC_CHANNEL, ch->chan, label, (label == NULL) ? 0 : strlen(label));
+    pthread_mutex_unlock(&cap->mutex);
+
+    // The subscriptions are freed by sp_close(), and ch by capture_close()
+    if ((sp_subscribe(sp, ch, &sub_rx, SP_SUB_INBOUND, NULL, 0) == NULL)
+    ||  (sp_subscribe(sp, ch, &sub_tx, SP_SUB_OUTBOUND, NULL, 0) == NULL)) {
+        return -2;
+    }
+    return (int)ch->chan;
+}
+
+
+
+
+/** Capture Replay <BR>
+  * ========================================================================<BR>
+  */
+
+/// Read and discard whatever the client has sent.  Returns -1 when the
+/// client has gone.
+static int sub_drain(int fd) {
+    uint8_t scratch[4096];
+    ssize_t rc;
+
+    for (;;) {
+        rc = recv(fd, scratch, sizeof(scratch), MSG_DONTWAIT);
+        if (rc > 0) {
+            continue;
+        }
+        if (rc == 0) {
+            return -1;
+        }
+        return ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) ? 0 : -1;
+    }
+}
+
+
+/// Send the output buffer, then wait until due (a CLOCK_MONOTONIC time in
+/// ns), draining the client meanwhile.  The last millisecond is spun, so
+/// that sub-millisecond gaps are kept.
+static int sub_waituntil(int fd, uint8_t* out, size_t* fill, uint64_t due) {
+    struct pollfd pfd;
+    struct timespec now;
+    uint64_t now_ns, wait_ms;
+
+    if (unixsrv_sendall(fd, out, *fill) != 0) {
+        return -1;
+    }
+    *fill = 0;
+
+    for (;;) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        now_ns = sub_ns(&now);
+        if (now_ns >= due) {
+            return 0;
+        }
+        wait_ms     = (due - now_ns) / 1000000ULL;
+        pfd.fd      = fd;
+        pfd.events  = POLLIN;
+        if ((poll(&pfd, 1, (wait_ms > 1000) ? 1000 : (int)wait_ms) > 0) && (sub_drain(fd) != 0)) {
+            return -1;
+        }
+    }
+}
+
+
+/// Create the stand-in socket and wait for a client
+static int sub_accept(const char* socket_path) {
+    int fd_srv, fd_cli;
+
+    fd_srv = unixsrv_listen(socket_path, 1);
+    if (fd_srv < 0) {
+        return -1;
+    }
+    fd_cli = unixsrv_accept(fd_srv);
+    close(fd_srv);
+    return fd_cli;
+}
+
+
+int capture_replay(const char* path, const char* socket_path, double speed, int chan) {
+    FILE* fp;
+    capture_rec_t rec;
+    char magic[8];
+    uint8_t* payload    = NULL;
+    size_t payalloc     = 0;
+    uint8_t* out        = NULL;
+    size_t fill         = 0;
+    int fd_cli          = -1;
+    int rc              = 0;
+    uint64_t base_ns    = 0;
+    uint64_t due_ns     = 0;
+    unsigned long lines = 0;
+    uint64_t bytes      = 0;
+    struct timespec start, end;
+
+    fp = fopen(path, "r");
+    if (fp == NULL) {
+        ERR_PRINTF("cannot open capture file %s\n", path);
+        return -1;
+    }
+    if ((fread(magic, 1, 8, fp) != 8) || (memcmp(magic, CAPTURE_MAGIC, 8) != 0)) {
+        ERR_PRINTF("%s is not a capture file\n", path);
+        rc = -2;
+        goto capture_replay_CLOSE;
+    }
+    out = malloc(CAPTURE_BUFSIZE);
+    if (out == NULL) {
+        rc = -3;
+        goto capture_replay_CLOSE;
+    }
+
+    fd_cli = sub_accept(socket_path);
+    if (fd_cli < 0) {
+        ERR_PRINTF("cannot listen on %s\n", socket_path);
+        rc = -4;
+        goto capture_replay_CLOSE;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    base_ns = sub_ns(&start);
+    due_ns  = base_ns;
+
+    // A record cut short at the end of the file (from a crash) ends the
+    // replay like a clean end of file does.
+    while (fread(&rec, sizeof(rec), 1, fp) == 1) {
+        if (rec.size > payalloc) {
+            uint8_t* newbuf = realloc(payload, (size_t)rec.size + 1);
+            if (newbuf == NULL) {
+                rc = -3;
+                break;
+            }
+            payload     = newbuf;
+            payalloc    = (size_t)rec.size;
+        }
+        if ((rec.size != 0) && (fread(payload, rec.size, 1, fp) != 1)) {
+            break;
+        }
+
+        // Each session is timed from the client's connection, or from the
+        // last line of the session before: the gap between runs is skipped.
+        if (rec.type == CAPTURE_REC_SESSION) {
+            base_ns = due_ns;
+            continue;
+        }
+        if ((rec.type != CAPTURE_REC_RX) || ((chan >= 0) && (rec.chan != chan))) {
+            continue;
+        }
+
+        if (speed > 0) {
+            due_ns = base_ns + (uint64_t)((double)rec.time_ns / speed);
+            if (sub_waituntil(fd_cli, out, &fill, due_ns) != 0) {
+                break;
+            }
+        }
+
+        // Lines go out through the buffer, which is sent when it is full or
+        // when the replay has to wait.
+        if ((fill + rec.size + 1) > CAPTURE_BUFSIZE) {
+            if ((unixsrv_sendall(fd_cli, out, fill) != 0) || (sub_drain(fd_cli) != 0)) {
+                fill = 0;
+                break;
+            }
+            fill = 0;
+        }
+        if ((rec.size + 1) > CAPTURE_BUFSIZE) {
+            payload[rec.size] = '\n';
+            if (unixsrv_sendall(fd_cli, payload, (size_t)rec.size + 1) != 0) {
+                break;
+            }
+        }
+        else {
+            memcpy(&out[fill], payload, rec.size);
+            fill += rec.size;
+            out[fill++] = '\n';
+        }
+        lines++;
+        bytes += rec.size + 1;
+    }
+    if (fill != 0) {
+        unixsrv_sendall(fd_cli, out, fill);
+        fill = 0;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    fprintf(stderr, "replay: %lu lines, %llu bytes in %llu ms\n", lines, (unsigned long long)bytes,
+            (unsigned long long)((sub_ns(&end) - sub_ns(&start)) / 1000000ULL));
+
+    // Like a daemon, the stand-in doesn't hang up: it waits for the client
+    while (sub_waituntil(fd_cli, out, &fill, UINT64_MAX) == 0);
+
+    close(fd_cli);
+    unlink(socket_path);
+
+    capture_replay_CLOSE:
+    fclose(fp);
+    free(payload);
+    free(out);
+    return rc;
+}
@@ -18,7 +18,24 @@
 #include "cliopt.h"
 #include "ottercat_cfg.h"
 
-static cliopt_t* master;
+// Defaults are in place before cliopt_init() so that modules linked into
+// libottercat can use the printer macros without a CLI front-end.
+static cliopt_t defaults = {
+    .verbose_on     = false,
+    .debug_on       = false,
+    .format         = FORMAT_JsonHex,
+    .mempool_size   = OTTERCAT_PARAM_MMAP_PAGESIZE,
+    .timeout_ms     = 500,
+    .tries          = 1,
+    .idle_ms        = 0,
+    .rate           = 0,
+    .framed         = false,
+    .shmring        = false,
+    .resend         = true,
+    .ackonly        = false,
+};
+
+static cliopt_t* master = &defaults;
 
 cliopt_t* cliopt_init(cliopt_t* new_master) {
     master = new_master;
@@ -28,6 +45,12 @@ cliopt_t* cliopt_init(cliopt_t* new_master) {
     master->mempool_size    = OTTERCAT_PARAM_MMAP_PAGESIZE;
     master->timeout_ms      = 500;
     master->tries           = 1;
+    master->idle_ms         = 0;
+    master->rate            = 0;
+    master->framed          = false;
+    master->shmring         = false;
+    master->resend          = true;
+    master->ackonly         = false;
     return master;
 }
 
@@ -73,3 +96,45 @@ int cliopt_gettries(void) {
 void cliopt_settries(int retries) {
     master->tries = retries;
 }
+
+int cliopt_getidle(void) {
+    return master->idle_ms;
+}
+void cliopt_setidle(int idle_ms) {
+    master->idle_ms = idle_ms;
+}
+
+int cliopt_getrate(void) {
+    return master->rate;
+}
+void cliopt_setrate(int rate) {
+    master->rate = rate;
+}
+
+bool cliopt_isframed(void) {
+    return master->framed;
+}
+void cliopt_setframed(bool val) {
+    master->framed = val;
+}
+
+bool cliopt_isshmring(void) {
+    return master->shmring;
+}
+void cliopt_setshmring(bool val) {
+    master->shmring = val;
+}
+
+bool cliopt_isresend(void) {
+    return master->resend;
+}
+void cliopt_setresend(bool val) {
+    master->resend = val;
+}
+
+bool cliopt_isackonly(void) {
+    return master->ackonly;
+}
+void cliopt_setackonly(bool val) {
+    master->ackonly = val;
+}
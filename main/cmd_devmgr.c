@@ -36,10 +36,14 @@
 // Local Headers
 #include "cliopt.h"
 #include "cmds.h"
+#include "collect.h"
 #include "debug.h"
+#include "devmgr_json.h"
 #include "dterm.h"
+#include "filter.h"
 #include "ottercat_cfg.h"
 //#include "popen2.h"
+#include "rcache.h"
 #include "sockpush.h"
 
 // HB Headers/Libraries
@@ -58,6 +62,7 @@
 #include <ctype.h>
 #include <dirent.h>
 #include <poll.h>
+#include <unistd.h>
 
 #ifdef __linux__
 #   include <stdio_ext.h>
@@ -124,80 +129,148 @@ static struct timespec diff_timespec(struct timespec start, struct timespec end)
 }
 
 
-static cJSON* sub_json_gettype(cJSON* top, const char* typename) {
-    top = cJSON_GetObjectItemCaseSensitive(top, "type");
-    if (cJSON_IsString(top)) {
-        if (strcmp(top->valuestring, typename) == 0) {
-            return top;
-        }
+/// Rate ceiling (--rate): wait until the next send slot, so that commands
+/// go out no faster than the configured number per second.
+static void sub_pace(void) {
+    static struct timespec next = {0, 0};
+    struct timespec now;
+    long interval;
+    
+    if (cliopt_getrate() <= 0) {
+        return;
     }
+    interval = 1000000000L / cliopt_getrate();
     
-    return NULL;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if ((now.tv_sec < next.tv_sec) || ((now.tv_sec == next.tv_sec) && (now.tv_nsec < next.tv_nsec))) {
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    }
+    else {
+        next = now;
+    }
+    next.tv_sec  += interval / 1000000000L;
+    next.tv_nsec += interval % 1000000000L;
+    if (next.tv_nsec >= 1000000000L) {
+        next.tv_nsec -= 1000000000L;
+        next.tv_sec  += 1;
+    }
 }
 
 
-static int sub_json_getack(cJSON* top, uint32_t* sid) {
-    uint32_t sidval = 0;
-    int errval = -1;
-
-    cJSON* obj;
-
-    top = cJSON_GetObjectItemCaseSensitive(top, "data");
-    if (cJSON_IsObject(top)) {
-        obj = cJSON_GetObjectItemCaseSensitive(top, "err");
-        if (cJSON_IsNumber(obj)) {
-            errval = obj->valueint;
-            
-            if (sid != NULL) {
-                obj = cJSON_GetObjectItemCaseSensitive(top, "sid");
-                if (cJSON_IsNumber(obj)) {
-                    sidval = obj->valueint;
-                }
-                *sid = sidval;
-            }
+/// Copy the frame into *dst, which is grown (in the dterm thread context) to
+/// fit it.  Returns the frame length, or -2 if the buffer can't be grown.
+static int sub_putframe(dterm_handle_t* dth, uint8_t** dst, size_t* dstmax, const char* frame) {
+    size_t size = strlen(frame);
+    
+    if ((size + 1) > *dstmax) {
+        uint8_t* newdst = talloc_realloc_size(dth->tctx, *dst, size + 1);
+        if (newdst == NULL) {
+            return -2;
         }
+        *dst    = newdst;
+        *dstmax = size + 1;
     }
+    memcpy(*dst, frame, size + 1);
     
-    return errval;
+    return (int)size;
 }
 
 
+/// Write a response line to the output, if it passes the output filter.  The
+/// line may be null-terminated.
+static void sub_output(dterm_handle_t* dth, const uint8_t* line, int linelen, uint8_t** buf, size_t* alloc) {
+    const uint8_t* text;
+    int textlen;
+    
+    while ((linelen > 0) && ((line[linelen-1] == 0) || (line[linelen-1] == '\r') || (line[linelen-1] == '\n'))) {
+        linelen--;
+    }
+    textlen = filter_line(dth->filter, line, (size_t)linelen, buf, alloc, &text);
+    if (textlen >= 0) {
+        if (cliopt_isverbose()) {
+            dprintf(dth->fd.out, _E_GRN"[%u]>> "_E_NRM, linelen);
+        }
+        dprintf(dth->fd.out, "%.*s\n", textlen, text);
+    }
+}
 
-static int sub_json_getframe(cJSON* top, cJSON** frame, int* qualtest) {
-    int sid = -1;
 
-    cJSON* obj;
+/// Append a line of output to the record of a cacheable command.  Returns
+/// -1 if the record can't be kept, or if it would grow past max, which is
+/// the case for long streamed sessions: those are not cached.
+static int sub_record(void* ctx, char** record, size_t* size, size_t max, const uint8_t* line, int linelen) {
+    char* newrec;
+    
+    while ((linelen > 0) && ((line[linelen-1] == 0) || (line[linelen-1] == '\r') || (line[linelen-1] == '\n'))) {
+        linelen--;
+    }
+    if ((*size + linelen + 1) > max) {
+        return -1;
+    }
+    newrec = talloc_realloc_size(ctx, *record, *size + linelen + 2);
+    if (newrec == NULL) {
+        return -1;
+    }
+    memcpy(&newrec[*size], line, linelen);
+    *size          += linelen;
+    newrec[(*size)++] = '\n';
+    newrec[*size]   = 0;
+    *record         = newrec;
+    return 0;
+}
 
-    top = cJSON_GetObjectItemCaseSensitive(top, "data");
-    if (cJSON_IsObject(top)) {
-        obj = cJSON_GetObjectItemCaseSensitive(top, "sid");
-        if (cJSON_IsNumber(obj)) {
-            sid = obj->valueint;
-            
-            if (qualtest != NULL) {
-                obj = cJSON_GetObjectItemCaseSensitive(top, "qual");
-                if (cJSON_IsNumber(obj)) {
-                    *qualtest = obj->valueint;
+
+/// Cached values are the frame, a NUL, and then the response lines as they
+/// were received.  A hit prints the lines and returns the frame the same way
+/// as a response from the daemon.
+static int sub_cache_serve(dterm_handle_t* dth, uint8_t** dst, size_t* dstmax, const char* key, size_t keylen) {
+    uint8_t* val    = NULL;
+    size_t valmax   = 0;
+    uint8_t* proj   = NULL;
+    size_t projmax  = 0;
+    uint8_t* line;
+    uint8_t* lineend;
+    size_t framelen;
+    int rc;
+    
+    rc = rcache_get(dth->cache, key, keylen, &val, &valmax);
+    if (rc >= 0) {
+        framelen = strnlen((char*)val, (size_t)rc);
+        if (framelen < (size_t)rc) {
+            VERBOSE_PRINTF("Serving from cache\n");
+            for (line=&val[framelen+1]; line<&val[rc]; line=lineend+1) {
+                lineend = memchr(line, '\n', (size_t)(&val[rc] - line));
+                if (lineend == NULL) {
+                    lineend = &val[rc];
                 }
+                sub_output(dth, line, (int)(lineend - line), &proj, &projmax);
             }
-            if (frame != NULL) {
-                *frame = cJSON_GetObjectItemCaseSensitive(top, "frame");
-            }
+            rc = sub_putframe(dth, dst, dstmax, (char*)val);
+        }
+        else {
+            rc = -1;
         }
     }
-    
-    return sid;
+    free(proj);
+    free(val);
+    return rc;
 }
 
 
-static int sub_devmgr_socket(dterm_handle_t* dth, uint8_t* dst, int* inbytes, uint8_t* src, size_t dstmax) {
-    uint8_t dout[1024];
+static int sub_devmgr_socket(dterm_handle_t* dth, uint8_t** dst, size_t* dstmax, int* inbytes, uint8_t* src) {
+    static uint64_t cmd_count = 0;
+    uint8_t* dout           = NULL;
+    size_t doutmax          = 0;
+    uint8_t* proj           = NULL;
+    size_t projmax          = 0;
     
     int rc;
     int state;
     int qualtest;
     int cmd_err;
-    uint32_t cmd_sid;
+    int session_end;
+    int session_rc          = 0;
+    uint32_t cmd_sid        = 0;
     struct timespec ref;
     struct timespec test;
     sp_reader_t reader;
@@ -208,7 +281,32 @@ static int sub_devmgr_socket(dterm_handle_t* dth, uint8_t* dst, int* inbytes, ui
     void* ctx               = talloc_new(dth->tctx);
     int read_timeout        = cliopt_gettimeout();
     int global_timeout      = read_timeout * cliopt_gettries() + (read_timeout/2);
+    int idle_timeout        = (cliopt_getidle() > 0) ? cliopt_getidle() : read_timeout;
+    char* cache_key         = NULL;
+    char* record            = NULL;
+    size_t record_size      = 0;
+    size_t record_max       = OTTERCAT_PARAM_CACHEMAXREC;
+    uint64_t cmd_id         = ++cmd_count;
     
+    ///0. Read-type commands may be served from the response cache, which is
+    ///   keyed by daemon and command line (the command names the device).
+    ///   Fire-and-forget commands don't get a response to cache.
+    if ((dth->cache != NULL) && (dth->target != NULL) && (cliopt_isackonly() == false)) {
+        char* cmd = talloc_strndup(ctx, (const char*)src, (size_t)*inbytes);
+        if ((cmd != NULL) && rcache_iscacheable(dth->cache, cmd)) {
+            cmd[strcspn(cmd, "\r\n")] = 0;
+            cache_key = talloc_asprintf(ctx, "%s\n%s", dth->target, cmd);
+            if (record_max > rcache_maxval(dth->cache)) {
+                record_max = rcache_maxval(dth->cache);
+            }
+        }
+        if (cache_key != NULL) {
+            rc = sub_cache_serve(dth, dst, dstmax, cache_key, strlen(cache_key));
+            if (rc >= 0) {
+                goto sub_devmgr_socket_END;
+            }
+        }
+    }
     
     ///1. Create the synchronous reader instance for sockpush module
     reader = sp_reader_create(ctx, sp_handle);
@@ -227,8 +325,10 @@ static int sub_devmgr_socket(dterm_handle_t* dth, uint8_t* dst, int* inbytes, ui
     
     ///3. Write the output command to the socket.  This is the easy part
     sub_devmgr_socket_SENDCMD:
+    record_size = 0;
+    sub_pace();
     DEBUG_PRINTF("Sending %i bytes to sp_sendcmd():\n%.*s\n", *inbytes, *inbytes, src);
-    rc = sp_sendcmd(sp_handle, src, (size_t)*inbytes);
+    rc = sp_sendcmd_id(sp_handle, src, (size_t)*inbytes, cmd_id);
     if (rc < 0) {
 fprintf(stderr, "sp_sendcmd() returned %i\n", rc);
         rc = -6;
@@ -240,16 +340,43 @@ fprintf(stderr, "sp_sendcmd() returned %i\n", rc);
     state = 0;
     cmd_sid = -1;
     while (1) {
-        rc = sp_read(reader, dout, sizeof(dout), read_timeout);
-        if (rc <= 0) {
+        rc = sp_readline(reader, &dout, &doutmax, (state == 2) ? idle_timeout : read_timeout);
+
+        // The connection dropped.  A command still waiting for its ack is
+        // resent by sockpush after the reconnect (--resend unacked), so keep
+        // waiting.  An acked one is retried now, and sockpush holds the retry
+        // until the reconnect.  Without replay, a retry sent now would fail
+        // on the dead link, so wait out the read timeout as before, and retry
+        // then.  A streamed session can't be picked up again: it ends here.
+        if ((rc == SP_DROPPED) && (state == 2)) {
+            VERBOSE_PRINTF("Session %u dropped: ending\n", cmd_sid);
+            rc = session_rc;
+            break;
+        }
+        if (rc == SP_DROPPED) {
+            VERBOSE_PRINTF("Connection dropped in cmd_devmgr()\n");
+            rc = ((state != 0) && cliopt_isresend()) ? -4 : -1;
+        }
+        else if ((rc <= 0) && (state == 2)) {
+            // Idle timeout ends a session that is being streamed
+            VERBOSE_PRINTF("Session %u idle for %i ms: ending\n", cmd_sid, idle_timeout);
+            rc = session_rc;
+            break;
+        }
+        else if (rc <= 0) {
             ERR_PRINTF("sp_read() timeout in cmd_devmgr(): %i ms\n", read_timeout);
             rc = -4; //-4 == retry
         }
         else {
-            if (cliopt_isverbose()) {
-                dprintf(dth->fd.out, _E_GRN"[%u]>> "_E_NRM, rc);
+            sub_output(dth, dout, rc, &proj, &projmax);
+            if ((cache_key != NULL)
+             && (sub_record(ctx, &record, &record_size, record_max, dout, rc) != 0)) {
+                VERBOSE_PRINTF("Response too large to cache\n");
+                talloc_free(record);
+                record      = NULL;
+                record_size = 0;
+                cache_key   = NULL;
             }
-            dprintf(dth->fd.out, "%.*s\n", rc, dout);
             
             rc = -1;
             qualtest = 0;
@@ -262,8 +389,8 @@ fprintf(stderr, "sp_sendcmd() returned %i\n", rc);
                 // - If sid is zero, this command doesn't have a packet, and
                 //   thus the operation is complete.
                 case 0:
-                    if (sub_json_gettype(resp, "ack") != NULL) {
-                        cmd_err = sub_json_getack(resp, &cmd_sid);
+                    if (devmgr_json_gettype(resp, "ack") != NULL) {
+                        cmd_err = devmgr_json_getack(resp, &cmd_sid);
                         if (cmd_err != 0) {
                             ///@todo better error reporting
                             rc = -256 - abs(cmd_err);
@@ -274,6 +401,13 @@ fprintf(stderr, "sp_sendcmd() returned %i\n", rc);
                             goto sub_devmgr_socket_TERM;
                         }
                         
+                        // Fire-and-forget: the rxstat is left to a collector
+                        if (cliopt_isackonly()) {
+                            collect_note(dth->journal, dth->target, cmd_sid, (const char*)src, (size_t)*inbytes);
+                            rc = 0;
+                            goto sub_devmgr_socket_TERM;
+                        }
+                        
                         // Success + wait for rxstat packet
                         state = 1;
                     }
@@ -285,23 +419,49 @@ fprintf(stderr, "sp_sendcmd() returned %i\n", rc);
                 // - If qualtest!=0, then data is corrupted: retry.
                 // - If the frame is somehow invalid: retry
                 // - If the frame is valid, rc set accordingly, and exit.
+                // - A session marker ("end" with no frame) is valid too.
+                // - If the session has more frames ("end":false), or there is
+                //   an idle timeout set, stream the session in state 2.
                 case 1:
-                    if (sub_json_gettype(resp, "rxstat") != NULL) {
+                    if (devmgr_json_gettype(resp, "rxstat") != NULL) {
                         cJSON* frame = NULL;
                     
-                        if (cmd_sid == sub_json_getframe(resp, &frame, &qualtest)) {
-                            state   = 2;
-                            rc      = -4;   //-4 == retry
+                        if (cmd_sid == devmgr_json_getframe(resp, &frame, &qualtest)) {
+                            session_end = devmgr_json_getend(resp);
+                            rc          = -4;   //-4 == retry
                             
-                            if ((qualtest == 0) && (frame != NULL)) {
+                            if (qualtest == 0) {
                                 if ((cJSON_IsString(frame)) && (frame->valuestring != NULL)) {
-                                    rc = (int)strlen(frame->valuestring);
-                                    if (rc > (int)dstmax - 1) {
-                                        ///@todo dstmax too small, flag error
-                                        rc = (int)dstmax - 1;
+                                    rc = sub_putframe(dth, dst, dstmax, frame->valuestring);
+                                    if (rc < 0) {
+                                        ERR_PRINTF("no memory for %zu byte frame\n", strlen(frame->valuestring));
+                                        goto sub_devmgr_socket_TERM;
                                     }
-                                    memcpy(dst, frame->valuestring, rc+1);
                                 }
+                                else if (session_end >= 0) {
+                                    rc = 0;     // session marker without a frame
+                                }
+                            }
+                            
+                            if ((rc >= 0) && ((session_end == 0) || ((session_end < 0) && (cliopt_getidle() > 0)))) {
+                                session_rc  = rc;
+                                rc          = -1;
+                                state       = 2;
+                            }
+                        }
+                    }
+                    break;
+                
+                // State 2: streaming a multi-frame session.  Each rxstat has
+                // already been written out as it arrived, so nothing is kept.
+                // - The session ends on "end":true, or on the idle timeout.
+                // - A corrupted frame can't be retried without repeating the
+                //   whole session, so it is passed through as-is.
+                case 2:
+                    if (devmgr_json_gettype(resp, "rxstat") != NULL) {
+                        if (cmd_sid == devmgr_json_getframe(resp, NULL, NULL)) {
+                            if (devmgr_json_getend(resp) == 1) {
+                                rc = session_rc;
                             }
                         }
                     }
@@ -330,6 +490,11 @@ fprintf(stderr, "sp_sendcmd() returned %i\n", rc);
             break;
         }
         
+        // A session being streamed is bounded by its idle timeout only
+        if (state == 2) {
+            continue;
+        }
+        
         // Retract the timeout
         if (clock_gettime(CLOCK_MONOTONIC, &test) != 0) {
             rc = -5;
@@ -351,8 +516,23 @@ fprintf(stderr, "sp_sendcmd() returned %i\n", rc);
     }
     
     sub_devmgr_socket_TERM:
+    sp_forget(sp_handle, cmd_id);
     cJSON_Delete(resp);
     sp_reader_destroy(reader);
+    free(dout);
+    free(proj);
+    
+    // Only complete responses to read commands (with an rxstat) are cached
+    if ((cache_key != NULL) && (record != NULL) && (rc >= 0) && (cmd_sid > 0)) {
+        const char* frame   = ((rc > 0) && (*dst != NULL)) ? (const char*)*dst : "";
+        size_t framelen     = strlen(frame);
+        char* val           = talloc_size(ctx, framelen + 1 + record_size);
+        if (val != NULL) {
+            memcpy(val, frame, framelen + 1);
+            memcpy(&val[framelen + 1], record, record_size);
+            rcache_put(dth->cache, cache_key, strlen(cache_key), val, framelen + 1 + record_size);
+        }
+    }
     
     sub_devmgr_socket_END:
     talloc_free(ctx);
@@ -364,7 +544,7 @@ fprintf(stderr, "sp_sendcmd() returned %i\n", rc);
 
 
 
-int cmd_devmgr(dterm_handle_t* dth, uint8_t* dst, int* inbytes, uint8_t* src, size_t dstmax) {
+int cmd_devmgr(dterm_handle_t* dth, uint8_t** dst, size_t* dstmax, int* inbytes, uint8_t* src) {
     int rc;
     
     if (dth == NULL) {
@@ -375,7 +555,7 @@ int cmd_devmgr(dterm_handle_t* dth, uint8_t* dst, int* inbytes, uint8_t* src, si
     }
     
     if (dth->use_socket) {
-        rc = sub_devmgr_socket(dth, dst, inbytes, src, dstmax);
+        rc = sub_devmgr_socket(dth, dst, dstmax, inbytes, src);
     }
     else {
         rc = -3;
@@ -0,0 +1,660 @@
+/* Copyright 2020, JP Norair
+  *
+  * Licensed under the OpenTag License, Version 1.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  * http://www.indigresso.com/wiki/doku.php?id=opentag:license_1_0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  *
+  */
+
+// Application Headers
+#include "cmdcheck.h"
+#include "cmdgraph.h"
+#include "ottercat_cfg.h"
+
+// HB Headers/Libraries
+#include <cJSON.h>
+
+// Standard C & POSIX Libraries
+#include <ctype.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+#define CMDCHECK_MAXWORDS   256
+
+typedef enum {
+    CCARG_any       = 0,
+    CCARG_int       = 1,
+    CCARG_uint      = 2,
+    CCARG_hex       = 3,
+    CCARG_bintex    = 4,
+    CCARG_literal   = 5
+} CCARG_Type;
+
+static const char* ccarg_name[] = { "any", "int", "uint", "hex", "bintex" };
+
+typedef struct {
+    CCARG_Type  type;
+    bool        ranged;
+    long long   min;
+    long long   max;
+    const char* words;          ///< literal: "a|b|c"
+} ccarg_t;
+
+typedef struct {
+    const char* name;
+    size_t      len;
+    bool        hasval;
+    ccarg_t     val;
+} ccopt_t;
+
+typedef struct {
+    const char* name;
+    ccopt_t*    opt;
+    int         opts;
+    ccarg_t*    arg;
+    int         args;
+    int         required;
+    bool        variadic;
+    int         next;           ///< next form of the same command, or -1
+} ccform_t;
+
+typedef struct {
+    char*       text;           ///< the table file, cut up in place
+    ccform_t*   form;
+    int         forms;
+    int*        slot;           ///< hash table of first forms, -1 if empty
+    size_t      mask;
+} cmdcheck_tab_t;
+
+typedef struct {
+    const char* s;
+    size_t      len;
+} ccword_t;
+
+
+
+
+/** Words and Values <BR>
+  * ========================================================================<BR>
+  */
+
+static uint32_t sub_hash(const char* s, size_t len) {
+    uint32_t hash = 2166136261u;
+    while (len-- != 0) {
+        hash = (hash ^ (uint8_t)*s++) * 16777619u;
+    }
+    return hash;
+}
+
+
+/// Split a command line into words.  [...], {...} and "..." groups are one
+/// word each, whatever they have in them.
+static int sub_split(const char* line, size_t size, ccword_t* word, int max) {
+    const char* end = line + size;
+    int n = 0;
+
+    while (line < end) {
+        const char* start;
+        int depth = 0;
+
+        while ((line < end) && isspace((unsigned char)*line)) line++;
+        if (line >= end) {
+            break;
+        }
+        if (n >= max) {
+            return -1;
+        }
+
+        start = line;
+        if (*line == '"') {
+            for (line++; (line < end) && (*line != '"'); line++) {
+                line += ((*line == '\\') && ((line+1) < end));
+            }
+            line += (line < end);
+        }
+        else {
+            for (; (line < end) && ((depth > 0) || !isspace((unsigned char)*line)); line++) {
+                depth += ((*line == '[') || (*line == '{'));
+                depth -= ((depth > 0) && ((*line == ']') || (*line == '}')));
+            }
+        }
+        word[n].s   = start;
+        word[n].len = (size_t)(line - start);
+        n++;
+    }
+    return n;
+}
+
+
+static bool sub_istemplate(const char* s, size_t len) {
+    for (; len > 1; s++, len--) {
+        if ((s[0] == '$') && (s[1] == '{')) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/// Decimal, or hex with 0x
+static bool sub_getnum(const char* s, size_t len, bool is_signed, long long* value) {
+    char buf[32];
+    char* end;
+    int base = 10;
+
+    if ((len == 0) || (len >= sizeof(buf))) {
+        return false;
+    }
+    memcpy(buf, s, len);
+    buf[len] = 0;
+    if ((is_signed == false) && (buf[0] == '-')) {
+        return false;
+    }
+    if ((buf[buf[0] == '-'] == '0') && ((buf[(buf[0] == '-') + 1] | 0x20) == 'x')) {
+        base = 16;
+    }
+    errno   = 0;
+    *value  = strtoll(buf, &end, base);
+    return (errno == 0) && (*end == 0) && (end != buf);
+}
+
+
+static bool sub_isword(const char* words, const char* s, size_t len) {
+    const char* bar;
+
+    for (; words != NULL; words = (bar == NULL) ? NULL : bar+1) {
+        bar = strchr(words, '|');
+        size_t wlen = (bar == NULL) ? strlen(words) : (size_t)(bar - words);
+        if ((wlen == len) && (memcmp(words, s, len) == 0)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+static bool sub_checkarg(const ccarg_t* arg, const char* s, size_t len) {
+    long long value;
+    size_t i;
+
+    if (sub_istemplate(s, len)) {
+        return true;
+    }
+    switch (arg->type) {
+        case CCARG_int:
+        case CCARG_uint:
+            if (sub_getnum(s, len, (arg->type == CCARG_int), &value) == false) {
+                return false;
+            }
+            return (arg->ranged == false) || ((value >= arg->min) && (value <= arg->max));
+
+        case CCARG_hex:
+            i = ((len > 2) && (s[0] == '0') && ((s[1] | 0x20) == 'x')) ? 2 : 0;
+            if (i == len) {
+                return false;
+            }
+            for (; i<len; i++) {
+                if (isxdigit((unsigned char)s[i]) == 0) {
+                    return false;
+                }
+            }
+            return true;
+
+        case CCARG_bintex:
+            return (s[0] == '[') || (s[0] == '"') || sub_getnum(s, len, true, &value);
+
+        case CCARG_literal:
+            return sub_isword(arg->words, s, len);
+
+        default:
+            return true;
+    }
+}
+
+
+static void sub_describe(const ccarg_t* arg, char* buf, size_t max) {
+    if (arg->type == CCARG_literal) {
+        snprintf(buf, max, "%s", arg->words);
+    }
+    else if (arg->ranged) {
+        snprintf(buf, max, "%s:%lld..%lld", ccarg_name[arg->type], arg->min, arg->max);
+    }
+    else {
+        snprintf(buf, max, "%s", ccarg_name[arg->type]);
+    }
+}
+
+
+
+
+/** Table Loader <BR>
+  * ========================================================================<BR>
+  */
+
+/// TYPE, TYPE:MIN..MAX, word, or (a|b|c).  word is cut in place.
+static int sub_parsetype(char* word, ccarg_t* arg) {
+    char* colon;
+    char* dots;
+    char* end;
+    size_t baselen;
+
+    memset(arg, 0, sizeof(ccarg_t));
+    if (word[0] == '(') {
+        size_t len = strlen(word);
+        if ((len < 3) || (word[len-1] != ')')) {
+            return -1;
+        }
+        word[len-1] = 0;
+        arg->type   = CCARG_literal;
+        arg->words  = &word[1];
+        return 0;
+    }
+
+    colon   = strchr(word, ':');
+    baselen = (colon == NULL) ? strlen(word) : (size_t)(colon - word);
+    arg->type = CCARG_literal;
+    for (int i=0; i<(int)(sizeof(ccarg_name)/sizeof(ccarg_name[0])); i++) {
+        if ((strlen(ccarg_name[i]) == baselen) && (memcmp(ccarg_name[i], word, baselen) == 0)) {
+            arg->type = (CCARG_Type)i;
+            break;
+        }
+    }
+    if (arg->type == CCARG_literal) {
+        arg->words = word;
+        return 0;
+    }
+    if (colon == NULL) {
+        return 0;
+    }
+
+    // Range: int and uint only
+    dots = strstr(colon, "..");
+    if (((arg->type != CCARG_int) && (arg->type != CCARG_uint)) || (dots == NULL)) {
+        return -1;
+    }
+    *dots       = 0;
+    arg->ranged = true;
+    arg->min    = strtoll(colon+1, &end, 0);
+    if ((*end != 0) || (end == colon+1)) {
+        return -1;
+    }
+    arg->max    = strtoll(dots+2, &end, 0);
+    if ((*end != 0) || (end == dots+2) || (arg->max < arg->min)) {
+        return -1;
+    }
+    return 0;
+}
+
+
+static int sub_parseform(cmdcheck_tab_t* tab, ccform_t* form, char* line, const char* path, int lineno) {
+    char* cursor;
+    char* word;
+    bool optional = false;
+    size_t len;
+
+    form->name  = strtok_r(line, " \t\r", &cursor);
+    form->next  = -1;
+
+    for (word=strtok_r(NULL, " \t\r", &cursor); word!=NULL; word=strtok_r(NULL, " \t\r", &cursor)) {
+        len = strlen(word);
+        if (form->variadic) {
+            fprintf(stderr, OTTERCAT_PARAM_NAME ": %s:%d: nothing may follow \"...\"\n", path, lineno);
+            return -2;
+        }
+
+        // Flags and options
+        if ((word[0] == '-') && (len > 1)) {
+            ccopt_t* newopt = realloc(form->opt, (form->opts + 1) * sizeof(ccopt_t));
+            char* eq        = strchr(word, '=');
+            if (newopt == NULL) {
+                return -1;
+            }
+            form->opt           = newopt;
+            newopt              = &form->opt[form->opts++];
+            memset(newopt, 0, sizeof(ccopt_t));
+            newopt->name        = word;
+            if (eq != NULL) {
+                *eq             = 0;
+                newopt->hasval  = true;
+                if (sub_parsetype(eq+1, &newopt->val) != 0) {
+                    fprintf(stderr, OTTERCAT_PARAM_NAME ": %s:%d: bad type \"%s\"\n", path, lineno, eq+1);
+                    return -2;
+                }
+            }
+            newopt->len         = strlen(word);
+            continue;
+        }
+
+        // Positional arguments
+        ccarg_t* newarg = realloc(form->arg, (form->args + 1) * sizeof(ccarg_t));
+        bool is_optional = false;
+        if (newarg == NULL) {
+            return -1;
+        }
+        form->arg = newarg;
+        if ((len > 3) && (strcmp(&word[len-3], "...") == 0)) {
+            word[len-3]     = 0;
+            form->variadic  = true;
+        }
+        else if ((len > 2) && (word[0] == '[') && (word[len-1] == ']')) {
+            word[len-1]     = 0;
+            word++;
+            is_optional     = true;
+        }
+        if (sub_parsetype(word, &form->arg[form->args]) != 0) {
+            fprintf(stderr, OTTERCAT_PARAM_NAME ": %s:%d: bad type \"%s\"\n", path, lineno, word);
+            return -2;
+        }
+        if (optional && !is_optional && !form->variadic) {
+            fprintf(stderr, OTTERCAT_PARAM_NAME ": %s:%d: required argument after an optional one\n", path, lineno);
+            return -2;
+        }
+        optional = optional || is_optional;
+        form->args++;
+        form->required += !(optional || form->variadic);
+    }
+
+    // Add to the hash table, or to the end of the command's chain
+    size_t i = sub_hash(form->name, strlen(form->name)) & tab->mask;
+    int self = (int)(form - tab->form);
+    for (; tab->slot[i] >= 0; i = (i + 1) & tab->mask) {
+        int f = tab->slot[i];
+        if (strcmp(tab->form[f].name, form->name) == 0) {
+            while (tab->form[f].next >= 0) {
+                f = tab->form[f].next;
+            }
+            tab->form[f].next = self;
+            return 0;
+        }
+    }
+    tab->slot[i] = self;
+    return 0;
+}
+
+
+cmdcheck_t cmdcheck_load(const char* path) {
+    cmdcheck_tab_t* tab;
+    FILE* fp;
+    long size;
+    char* line;
+    char* next;
+    int lines;
+    int lineno;
+
+    tab = calloc(1, sizeof(cmdcheck_tab_t));
+    if (tab == NULL) {
+        return NULL;
+    }
+
+    fp = fopen(path, "r");
+    if (fp == NULL) {
+        fprintf(stderr, OTTERCAT_PARAM_NAME ": command table %s could not be opened\n", path);
+        goto cmdcheck_load_ERR;
+    }
+    if ((fseek(fp, 0, SEEK_END) != 0) || ((size = ftell(fp)) < 0)) {
+        fprintf(stderr, OTTERCAT_PARAM_NAME ": command table %s could not be read\n", path);
+        fclose(fp);
+        goto cmdcheck_load_ERR;
+    }
+    rewind(fp);
+    tab->text = malloc((size_t)size + 1);
+    if ((tab->text == NULL) || (fread(tab->text, 1, (size_t)size, fp) != (size_t)size)) {
+        fclose(fp);
+        goto cmdcheck_load_ERR;
+    }
+    fclose(fp);
+    tab->text[size] = 0;
+
+    // Size the hash table to twice the number of lines, at least
+    lines = 1;
+    for (long i=0; i<size; i++) {
+        lines += (tab->text[i] == '\n');
+    }
+    for (tab->mask=15; tab->mask < (size_t)(2*lines); tab->mask = (tab->mask << 1) | 1);
+    tab->form = calloc((size_t)lines, sizeof(ccform_t));
+    tab->slot = malloc((tab->mask + 1) * sizeof(int));
+    if ((tab->form == NULL) || (tab->slot == NULL)) {
+        goto cmdcheck_load_ERR;
+    }
+    memset(tab->slot, 0xFF, (tab->mask + 1) * sizeof(int));
+
+    lineno = 0;
+    for (line=tab->text; line!=NULL; line=next) {
+        next = strchr(line, '\n');
+        if (next != NULL) {
+            *next++ = 0;
+        }
+        lineno++;
+        while (isspace((unsigned char)*line)) line++;
+        if ((*line == 0) || (*line == '#')) {
+            continue;
+        }
+        if (sub_parseform(tab, &tab->form[tab->forms], line, path, lineno) != 0) {
+            tab->forms++;
+            goto cmdcheck_load_ERR;
+        }
+        tab->forms++;
+    }
+    return tab;
+
+    cmdcheck_load_ERR:
+    cmdcheck_free(tab);
+    return NULL;
+}
+
+
+void cmdcheck_free(cmdcheck_t handle) {
+    cmdcheck_tab_t* tab = handle;
+
+    if (tab != NULL) {
+        for (int i=0; (tab->form != NULL) && (i<tab->forms); i++) {
+            free(tab->form[i].opt);
+            free(tab->form[i].arg);
+        }
+        free(tab->form);
+        free(tab->slot);
+        free(tab->text);
+        free(tab);
+    }
+}
+
+
+
+
+/** Line Checker <BR>
+  * ========================================================================<BR>
+  */
+
+/// Returns 0 on a match.  Otherwise, err has the reason and *progress is the
+/// number of words that matched, which picks the message to show when no
+/// form of a command matches.
+static int sub_match(const ccform_t* form, const ccword_t* word, int words, char* err, size_t errmax, int* progress) {
+    const ccarg_t* arg;
+    char desc[64];
+    int pos = 0;
+
+    for (int i=1; i<words; i++) {
+        const char* s   = word[i].s;
+        size_t len      = word[i].len;
+        *progress       = i;
+
+        if ((len > 1) && (s[0] == '-') && !isdigit((unsigned char)s[1]) && !sub_istemplate(s, len)) {
+            const ccopt_t* opt  = NULL;
+            const char* val     = NULL;
+            size_t vlen         = 0;
+
+            for (int j=0; j<form->opts; j++) {
+                const ccopt_t* test = &form->opt[j];
+                if ((len == test->len) && (memcmp(s, test->name, len) == 0)) {
+                    opt = test;
+                    break;
+                }
+                // "-i5" and "--name=5"
+                if (test->hasval && (len > test->len) && (memcmp(s, test->name, test->len) == 0)) {
+                    bool is_long = (test->name[1] == '-');
+                    if (!is_long || (s[test->len] == '=')) {
+                        opt     = test;
+                        val     = &s[test->len + is_long];
+                        vlen    = len - test->len - is_long;
+                        break;
+                    }
+                }
+            }
+            if (opt == NULL) {
+                snprintf(err, errmax, "%s: unknown option %.*s", form->name, (int)len, s);
+                return -1;
+            }
+            if (opt->hasval && (val == NULL)) {
+                if (++i >= words) {
+                    snprintf(err, errmax, "%s: option %s needs a value", form->name, opt->name);
+                    return -1;
+                }
+                val     = word[i].s;
+                vlen    = word[i].len;
+            }
+            if (opt->hasval && !sub_checkarg(&opt->val, val, vlen)) {
+                sub_describe(&opt->val, desc, sizeof(desc));
+                snprintf(err, errmax, "%s: option %s: \"%.*s\" is not %s", form->name, opt->name, (int)vlen, val, desc);
+                return -1;
+            }
+            continue;
+        }
+
+        if (pos < form->args) {
+            arg = &form->arg[pos++];
+        }
+        else if (form->variadic) {
+            arg = &form->arg[form->args - 1];
+            pos++;
+        }
+        else {
+            snprintf(err, errmax, "%s: too many arguments, at \"%.*s\"", form->name, (int)len, s);
+            return -1;
+        }
+        if (sub_checkarg(arg, s, len) == false) {
+            sub_describe(arg, desc, sizeof(desc));
+            snprintf(err, errmax, "%s: argument %d: \"%.*s\" is not %s", form->name, pos, (int)len, s, desc);
+            return -1;
+        }
+    }
+
+    *progress = words;
+    if (pos < form->required) {
+        sub_describe(&form->arg[pos], desc, sizeof(desc));
+        snprintf(err, errmax, "%s: missing argument %d (%s)", form->name, pos+1, desc);
+        return -1;
+    }
+    return 0;
+}
+
+
+int cmdcheck_line(cmdcheck_t handle, const char* line, size_t size, char* err, size_t errmax) {
+    cmdcheck_tab_t* tab = handle;
+    ccword_t word[CMDCHECK_MAXWORDS];
+    char msg[256];
+    int words;
+    int best = -1;
+    int progress;
+    size_t i;
+
+    if (tab == NULL) {
+        return 0;
+    }
+    words = sub_split(line, size, word, CMDCHECK_MAXWORDS);
+    if (words < 0) {
+        snprintf(err, errmax, "more than %d words", CMDCHECK_MAXWORDS);
+        return -1;
+    }
+    if (words == 0) {
+        return 0;
+    }
+
+    for (i = sub_hash(word[0].s, word[0].len) & tab->mask; tab->slot[i] >= 0; i = (i + 1) & tab->mask) {
+        const char* name = tab->form[tab->slot[i]].name;
+        if ((strlen(name) == word[0].len) && (memcmp(name, word[0].s, word[0].len) == 0)) {
+            break;
+        }
+    }
+    if (tab->slot[i] < 0) {
+        snprintf(err, errmax, "unknown command \"%.*s\"", (int)word[0].len, word[0].s);
+        return -1;
+    }
+
+    for (int f=tab->slot[i]; f>=0; f=tab->form[f].next) {
+        progress = 0;
+        if (sub_match(&tab->form[f], word, words, msg, sizeof(msg), &progress) == 0) {
+            return 0;
+        }
+        if (progress > best) {
+            best = progress;
+            snprintf(err, errmax, "%s", msg);
+        }
+    }
+    return -1;
+}
+
+
+int cmdcheck_script(cmdcheck_t handle, const char* script, int* checked) {
+    const char* line;
+    const char* next;
+    char err[256];
+    int lineno  = 0;
+    int bad     = 0;
+    int count   = 0;
+
+    for (line=script; (line!=NULL) && (*line!=0); line=next) {
+        size_t size;
+        char* data = NULL;
+        int rc;
+
+        next = strchr(line, '\n');
+        size = (next == NULL) ? strlen(line) : (size_t)(next - line);
+        next = (next == NULL) ? NULL : next+1;
+        lineno++;
+
+        while ((size > 0) && isspace((unsigned char)*line)) { line++; size--; }
+        while ((size > 0) && isspace((unsigned char)line[size-1])) size--;
+        if ((size == 0) || (*line == '#') || cmdgraph_isdirective(line)) {
+            continue;
+        }
+
+        // {"type":"...", "data":"..."} carries the command in data
+        if (*line == '{') {
+            char* copy  = strndup(line, size);
+            cJSON* obj  = cJSON_Parse(copy);
+            cJSON* item = cJSON_GetObjectItemCaseSensitive(obj, "data");
+            if (cJSON_IsString(item)) {
+                data = strdup(item->valuestring);
+            }
+            cJSON_Delete(obj);
+            free(copy);
+        }
+
+        count++;
+        rc = (data != NULL) ? cmdcheck_line(handle, data, strlen(data), err, sizeof(err))
+                            : cmdcheck_line(handle, line, size, err, sizeof(err));
+        free(data);
+        if (rc < 0) {
+            fprintf(stderr, OTTERCAT_PARAM_NAME ": line %d: %s\n", lineno, err);
+            bad++;
+        }
+    }
+
+    if (checked != NULL) {
+        *checked = count;
+    }
+    return bad;
+}
@@ -0,0 +1,469 @@
+/* Copyright 2020, JP Norair
+  *
+  * Licensed under the OpenTag License, Version 1.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  * http://www.indigresso.com/wiki/doku.php?id=opentag:license_1_0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  *
+  */
+
+/// Command graphs run on a libottercat handle, the same as fan-out, so that
+/// any number of commands can be in flight and each ack and rxstat still
+/// finds its command.  The graph is built once from the script.  Then, every
+/// time a command completes, the commands of the current barrier section
+/// are checked for ones that have become ready.  Dependencies always point
+/// back up the script, so one pass in script order settles them.
+
+// Application Headers
+#include "cmdgraph.h"
+#include "debug.h"
+#include "libottercat.h"
+#include "ottercat_cfg.h"
+#include "runner.h"
+
+// Standard C & POSIX Libraries
+#include <ctype.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+typedef enum {
+    CGNODE_wait     = 0,
+    CGNODE_run      = 1,
+    CGNODE_ok       = 2,
+    CGNODE_failed   = 3,
+    CGNODE_skipped  = 4
+} CGNODE_Type;
+
+struct cmdgraph;
+
+typedef struct {
+    struct cmdgraph* cg;
+    char*           cmd;
+    int             line;
+    int             section;
+    int             prev;           ///< previous command of the group, or -1
+    int*            after;          ///< group tails to wait for
+    int             num_after;
+    CGNODE_Type     state;
+} cgnode_t;
+
+typedef struct {
+    char*           name;
+    int             tail;           ///< last command of the group, or -1
+    int*            after;          ///< waits for the group's next command
+    int             num_after;
+} cggroup_t;
+
+typedef struct cmdgraph {
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+    const cmdgraph_cfg_t* cfg;
+    const char*     socket;
+    otc_handle_t    otc;
+
+    cgnode_t*       node;
+    int             nodes;
+    cggroup_t*      group;
+    int             groups;
+    int             sections;
+    int             section;        ///< barrier section being run
+    int             first;          ///< its first command
+
+    int             done;
+    int             ok;
+    int             failed;
+    int             skipped;
+
+    // Response output, guarded by mutex
+    runout_t        out;
+} cmdgraph_t;
+
+
+
+
+/** Script Parser <BR>
+  * ========================================================================<BR>
+  */
+
+static const char* sub_directive(const char* line, const char* name) {
+    size_t len = strlen(name);
+
+    if ((line[0] == '@') && (strncmp(&line[1], name, len) == 0)
+    && ((line[len+1] == 0) || isspace((unsigned char)line[len+1]))) {
+        return &line[len+1];
+    }
+    return NULL;
+}
+
+
+bool cmdgraph_isdirective(const char* line) {
+    return (sub_directive(line, "group") != NULL)
+        || (sub_directive(line, "end") != NULL)
+        || (sub_directive(line, "barrier") != NULL);
+}
+
+
+bool cmdgraph_detect(const char* script) {
+    const char* line;
+
+    for (line=script; (line!=NULL) && (*line!=0); line=strchr(line, '\n')) {
+        while (isspace((unsigned char)*line)) line++;
+        if (cmdgraph_isdirective(line)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+static int sub_findgroup(cmdgraph_t* cg, const char* name) {
+    for (int i=0; i<cg->groups; i++) {
+        if (strcmp(cg->group[i].name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+
+/// "@group NAME [after A,B...]".  Returns the group, or a negative value.
+static int sub_opengroup(cmdgraph_t* cg, char* args, int lineno) {
+    cggroup_t* grp;
+    char* cursor;
+    char* name;
+    char* word;
+    int g;
+
+    name = strtok_r(args, " \t", &cursor);
+    if (name == NULL) {
+        fprintf(stderr, OTTERCAT_PARAM_NAME ": line %d: @group needs a name\n", lineno);
+        return -2;
+    }
+    g = sub_findgroup(cg, name);
+    if (g < 0) {
+        g = cg->groups++;
+        cg->group[g].name   = name;
+        cg->group[g].tail   = -1;
+    }
+    grp = &cg->group[g];
+
+    word = strtok_r(NULL, " \t", &cursor);
+    if (word == NULL) {
+        return g;
+    }
+    if (strcmp(word, "after") != 0) {
+        fprintf(stderr, OTTERCAT_PARAM_NAME ": line %d: expected \"after\", not \"%s\"\n", lineno, word);
+        return -2;
+    }
+    for (word=strtok_r(NULL, " \t,", &cursor); word!=NULL; word=strtok_r(NULL, " \t,", &cursor)) {
+        int dep = sub_findgroup(cg, word);
+        int* newlist;
+        if ((dep < 0) || (dep == g)) {
+            fprintf(stderr, OTTERCAT_PARAM_NAME ": line %d: \"%s\" is not a group above\n", lineno, word);
+            return -2;
+        }
+        if (cg->group[dep].tail < 0) {
+            continue;
+        }
+        newlist = realloc(grp->after, (grp->num_after + 1) * sizeof(int));
+        if (newlist == NULL) {
+            return -1;
+        }
+        grp->after = newlist;
+        grp->after[grp->num_after++] = cg->group[dep].tail;
+    }
+    return g;
+}
+
+
+/// Build the graph.  Command lines in the JSON form {"type":"...",
+/// "data":"..."} are reduced to their data string (runner_cmdline()).
+static int sub_parse(cmdgraph_t* cg, char* script) {
+    char* line;
+    char* next;
+    char* args;
+    int lineno  = 0;
+    int cur     = -1;
+    int lines   = 1;
+
+    for (line=script; *line!=0; line++) {
+        lines += (*line == '\n');
+    }
+    cg->node    = calloc((size_t)lines, sizeof(cgnode_t));
+    cg->group   = calloc((size_t)lines, sizeof(cggroup_t));
+    if ((cg->node == NULL) || (cg->group == NULL)) {
+        return -1;
+    }
+    cg->sections = 1;
+
+    for (line=script; line!=NULL; line=next) {
+        next = strchr(line, '\n');
+        if (next != NULL) {
+            *next++ = 0;
+        }
+        lineno++;
+
+        while (isspace((unsigned char)*line)) line++;
+        for (size_t len=strlen(line); (len > 0) && isspace((unsigned char)line[len-1]); len--) {
+            line[len-1] = 0;
+        }
+        if ((*line == 0) || (*line == '#')) {
+            continue;
+        }
+
+        if ((args = (char*)sub_directive(line, "group")) != NULL) {
+            cur = sub_opengroup(cg, args, lineno);
+            if (cur < 0) {
+                return cur;
+            }
+            continue;
+        }
+        if (sub_directive(line, "end") != NULL) {
+            cur = -1;
+            continue;
+        }
+        if (sub_directive(line, "barrier") != NULL) {
+            cur = -1;
+            cg->sections++;
+            continue;
+        }
+        if (*line == '@') {
+            fprintf(stderr, OTTERCAT_PARAM_NAME ": line %d: unknown directive %s\n", lineno, line);
+            return -2;
+        }
+
+        cgnode_t* node  = &cg->node[cg->nodes];
+        node->cg        = cg;
+        node->cmd       = runner_cmdline(line);
+        node->line      = lineno;
+        node->section   = cg->sections - 1;
+        node->prev      = -1;
+        if (cur >= 0) {
+            cggroup_t* grp  = &cg->group[cur];
+            node->prev      = grp->tail;
+            node->after     = grp->after;
+            node->num_after = grp->num_after;
+            grp->tail       = cg->nodes;
+            grp->after      = NULL;
+            grp->num_after  = 0;
+        }
+        cg->nodes++;
+    }
+
+    return cg->nodes;
+}
+
+
+
+
+/** Scheduler <BR>
+  * ========================================================================<BR>
+  * Everything here is called with cg->mutex held.
+  */
+
+static void sub_emiterr(cmdgraph_t* cg, cgnode_t* node, int rc, const char* desc) {
+    char tag[16];
+    snprintf(tag, sizeof(tag), "%d", node->line);
+    runner_emiterr(&cg->out, tag, rc, desc);
+}
+
+
+static void sub_finish(cmdgraph_t* cg, cgnode_t* node, CGNODE_Type state) {
+    node->state = state;
+    cg->done++;
+    switch (state) {
+        case CGNODE_ok:         cg->ok++;       break;
+        case CGNODE_failed:     cg->failed++;   break;
+        default:                cg->skipped++;
+                                sub_emiterr(cg, node, CMDGRAPH_ERR_SKIPPED, "skipped");
+                                break;
+    }
+    if (cg->done == cg->nodes) {
+        pthread_cond_broadcast(&cg->cond);
+    }
+}
+
+
+/// CGNODE_ok if every dependency succeeded, CGNODE_wait if some are still
+/// running, or CGNODE_failed if any failed or were skipped
+static CGNODE_Type sub_depstate(cmdgraph_t* cg, cgnode_t* node) {
+    CGNODE_Type state = CGNODE_ok;
+    CGNODE_Type test;
+
+    for (int i=-1; i<node->num_after; i++) {
+        int dep = (i < 0) ? node->prev : node->after[i];
+        if (dep < 0) {
+            continue;
+        }
+        test = cg->node[dep].state;
+        if ((test == CGNODE_failed) || (test == CGNODE_skipped)) {
+            return CGNODE_failed;
+        }
+        if (test != CGNODE_ok) {
+            state = CGNODE_wait;
+        }
+    }
+    return state;
+}
+
+
+static void sub_oncomplete(otc_handle_t otc, const otc_result_t* res, void* user);
+
+
+/// Start every command that is ready.  When a section is finished, go on to
+/// the next one, unless something in it failed.
+static void sub_schedule(cmdgraph_t* cg) {
+    cgnode_t* node;
+    bool busy;
+    bool clean;
+    int i;
+    int rc;
+
+    while (cg->section < cg->sections) {
+        busy = false;
+        for (i=cg->first; (i<cg->nodes) && (cg->node[i].section == cg->section); i++) {
+            node = &cg->node[i];
+            if (node->state == CGNODE_wait) {
+                switch (sub_depstate(cg, node)) {
+                case CGNODE_ok:
+                    node->state = CGNODE_run;
+                    rc = otc_submit(cg->otc, node->cmd, strlen(node->cmd), &sub_oncomplete, node, NULL);
+                    if (rc < 0) {
+                        sub_emiterr(cg, node, rc, "submit error");
+                        sub_finish(cg, node, CGNODE_failed);
+                    }
+                    break;
+                case CGNODE_failed:
+                    sub_finish(cg, node, CGNODE_skipped);
+                    break;
+                default:
+                    break;
+                }
+            }
+            busy = busy || (node->state == CGNODE_wait) || (node->state == CGNODE_run);
+        }
+        if (busy) {
+            return;
+        }
+
+        // Section finished: a failure in it stops the script at the barrier
+        clean = true;
+        for (int j=cg->first; j<i; j++) {
+            clean = clean && (cg->node[j].state == CGNODE_ok);
+        }
+        cg->first = i;
+        cg->section++;
+        if (clean == false) {
+            for (; i<cg->nodes; i++) {
+                sub_finish(cg, &cg->node[i], CGNODE_skipped);
+            }
+            cg->first   = cg->nodes;
+            cg->section = cg->sections;
+        }
+    }
+}
+
+
+static void sub_oncomplete(otc_handle_t otc, const otc_result_t* res, void* user) {
+    cgnode_t* node  = user;
+    cmdgraph_t* cg  = node->cg;
+    int rc          = res->rc;
+    char tag[16];
+
+    pthread_mutex_lock(&cg->mutex);
+
+    // Aborted when the handle is closed
+    if (node->state != CGNODE_run) {
+        goto sub_oncomplete_END;
+    }
+
+    snprintf(tag, sizeof(tag), "%d", node->line);
+    if (runner_result(&cg->out, tag, res, cg->cfg->journal, cg->socket) == false) {
+        goto sub_oncomplete_END;
+    }
+
+    sub_finish(cg, node, (rc < 0) ? CGNODE_failed : CGNODE_ok);
+    sub_schedule(cg);
+
+    sub_oncomplete_END:
+    pthread_mutex_unlock(&cg->mutex);
+}
+
+
+
+
+/** Public API <BR>
+  * ========================================================================<BR>
+  */
+
+int cmdgraph_run(const char* socket, char* script, const cmdgraph_cfg_t* cfg) {
+    cmdgraph_t cg;
+    otc_cfg_t otccfg;
+    struct timespec start;
+    int rc;
+
+    if ((socket == NULL) || (script == NULL) || (cfg == NULL)) {
+        return -1;
+    }
+
+    memset(&cg, 0, sizeof(cg));
+    cg.cfg      = cfg;
+    cg.socket   = socket;
+    rc = sub_parse(&cg, script);
+    if (rc < 0) {
+        goto cmdgraph_run_FREE;
+    }
+    pthread_mutex_init(&cg.mutex, NULL);
+    pthread_cond_init(&cg.cond, NULL);
+    runner_outinit(&cg.out, cfg->fd_out, cfg->filter);
+
+    runner_otccfg(&otccfg, cfg->concurrency, 0, cfg->capture);
+
+    rc = otc_open(&cg.otc, socket, &otccfg);
+    if (rc < 0) {
+        fprintf(stderr, "Err: socket could not be opened.\n");
+        goto cmdgraph_run_DESTROY;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pthread_mutex_lock(&cg.mutex);
+    sub_schedule(&cg);
+    while (cg.done < cg.nodes) {
+        pthread_cond_wait(&cg.cond, &cg.mutex);
+    }
+    pthread_mutex_unlock(&cg.mutex);
+
+    otc_close(cg.otc);
+
+    fprintf(stderr, OTTERCAT_PARAM_NAME ": %d commands in %d sections: %d ok, %d failed, %d skipped.  %li ms\n",
+            cg.nodes, cg.sections, cg.ok, cg.failed, cg.skipped, runner_elapsed_ms(&start, NULL));
+    rc = (cg.ok == cg.nodes) ? 0 : -4;
+
+    cmdgraph_run_DESTROY:
+    pthread_cond_destroy(&cg.cond);
+    pthread_mutex_destroy(&cg.mutex);
+
+    cmdgraph_run_FREE:
+    for (int i=0; i<cg.nodes; i++) {
+        free(cg.node[i].after);
+    }
+    for (int i=0; i<cg.groups; i++) {
+        free(cg.group[i].after);
+    }
+    free(cg.node);
+    free(cg.group);
+    runner_outfree(&cg.out);
+    return rc;
+}
@@ -0,0 +1,715 @@
+/* Copyright 2020, JP Norair
+  *
+  * Licensed under the OpenTag License, Version 1.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  * http://www.indigresso.com/wiki/doku.php?id=opentag:license_1_0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  *
+  */
+
+/// The main thread reads, splits and expands the rows, and submits them to
+/// a libottercat handle.  There is a fixed set of slots, twice the window,
+/// so that a command is always queued behind the ones in flight.  When all
+/// slots are busy, the main thread waits for a completion.  libottercat
+/// reuses its request buffers, so with the line and command buffers here,
+/// the steady state doesn't allocate at all.
+
+// Application Headers
+#include "cmdtmpl.h"
+#include "debug.h"
+#include "libottercat.h"
+#include "ottercat_cfg.h"
+#include "runner.h"
+
+// Standard C & POSIX Libraries
+#include <ctype.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+#define CMDTMPL_VAR_OPEN    "${"
+
+typedef struct {
+    size_t          lit;            ///< literal text ahead of the field, in the template
+    size_t          litlen;
+    int             field;          ///< field index, or -1 for the end
+} tseg_t;
+
+typedef struct {
+    const char*     s;              ///< NULL: not in the row
+    size_t          len;
+} tspan_t;
+
+struct cmdtmpl;
+
+typedef struct {
+    struct cmdtmpl* ct;
+    unsigned long   row;
+} tslot_t;
+
+typedef struct cmdtmpl {
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+    const cmdtmpl_cfg_t* cfg;
+    const char*     socket;
+    otc_handle_t    otc;
+
+    // Compiled template
+    const char*     text;
+    tseg_t*         seg;
+    char*           names;          ///< copy of the template, cut into field names
+    const char**    field;
+    int             fields;
+
+    // Data
+    FILE*           fp;
+    bool            ndjson;
+    int*            column;         ///< CSV column of each field
+    int             columns;
+    char*           line;
+    size_t          linealloc;
+    char*           more;
+    size_t          morealloc;
+    tspan_t*        col;            ///< CSV columns of the row
+    tspan_t*        val;            ///< field values of the row
+    char*           exp;
+    size_t          expalloc;
+
+    // Slots and progress, guarded by mutex
+    tslot_t*        slot;
+    int*            freeslot;
+    int             frees;
+    int             slots;
+    unsigned long   rows;
+    unsigned long   ok;
+    unsigned long   failed;
+
+    // Response output, guarded by mutex
+    runout_t        out;
+} cmdtmpl_t;
+
+
+
+
+/** Template <BR>
+  * ========================================================================<BR>
+  */
+
+static int sub_compile(cmdtmpl_t* ct, const char* tmpl) {
+    const char* mark;
+    const char* close;
+    size_t cursor = 0;
+    int vars = 0;
+    int segs = 0;
+
+    for (mark=strstr(tmpl, CMDTMPL_VAR_OPEN); mark!=NULL; mark=strstr(mark+2, CMDTMPL_VAR_OPEN)) {
+        vars++;
+    }
+    ct->text    = tmpl;
+    ct->seg     = calloc((size_t)vars + 1, sizeof(tseg_t));
+    ct->field   = calloc((size_t)vars + 1, sizeof(char*));
+    ct->names   = strdup(tmpl);
+    if ((ct->seg == NULL) || (ct->field == NULL) || (ct->names == NULL)) {
+        return -1;
+    }
+
+    while ((mark = strstr(&tmpl[cursor], CMDTMPL_VAR_OPEN)) != NULL) {
+        int f;
+        close = strchr(mark+2, '}');
+        if ((close == NULL) || (close == mark+2)) {
+            fprintf(stderr, OTTERCAT_PARAM_NAME ": template: bad placeholder at \"%.16s\"\n", mark);
+            return -2;
+        }
+        ct->names[close - tmpl] = 0;
+        for (f=0; (f<ct->fields) && (strcmp(ct->field[f], &ct->names[mark+2 - tmpl]) != 0); f++);
+        if (f == ct->fields) {
+            ct->field[ct->fields++] = &ct->names[mark+2 - tmpl];
+        }
+        ct->seg[segs].lit       = cursor;
+        ct->seg[segs].litlen    = (size_t)(mark - &tmpl[cursor]);
+        ct->seg[segs].field     = f;
+        segs++;
+        cursor = (size_t)(close+1 - tmpl);
+    }
+    ct->seg[segs].lit       = cursor;
+    ct->seg[segs].litlen    = strlen(&tmpl[cursor]);
+    ct->seg[segs].field     = -1;
+    return 0;
+}
+
+
+/// Expand the template with ct->val into ct->exp.  Returns the size, or -1
+/// with the reason in *why, and the field in *field.  A value can't have a
+/// line break, which would end the command early.
+static long sub_expand(cmdtmpl_t* ct, const char** why, int* field) {
+    const tseg_t* seg;
+    size_t need = 0;
+    size_t fill = 0;
+
+    for (seg=ct->seg; ; seg++) {
+        need += seg->litlen;
+        if (seg->field < 0) {
+            break;
+        }
+        *field = seg->field;
+        if (ct->val[seg->field].s == NULL) {
+            *why = "missing field ";
+            return -1;
+        }
+        if ((memchr(ct->val[seg->field].s, '\n', ct->val[seg->field].len) != NULL)
+         || (memchr(ct->val[seg->field].s, '\r', ct->val[seg->field].len) != NULL)) {
+            *why = "line break in field ";
+            return -1;
+        }
+        need += ct->val[seg->field].len;
+    }
+    if ((need + 1) > ct->expalloc) {
+        char* newbuf = realloc(ct->exp, need + 1);
+        if (newbuf == NULL) {
+            *why = "out of memory";
+            *field = -1;
+            return -1;
+        }
+        ct->exp         = newbuf;
+        ct->expalloc    = need + 1;
+    }
+
+    for (seg=ct->seg; ; seg++) {
+        memcpy(&ct->exp[fill], &ct->text[seg->lit], seg->litlen);
+        fill += seg->litlen;
+        if (seg->field < 0) {
+            break;
+        }
+        memcpy(&ct->exp[fill], ct->val[seg->field].s, ct->val[seg->field].len);
+        fill += ct->val[seg->field].len;
+    }
+    ct->exp[fill] = 0;
+    return (long)fill;
+}
+
+
+
+
+/** Data Rows <BR>
+  * ========================================================================<BR>
+  */
+
+static bool sub_quoteopen(const char* s, size_t len) {
+    bool open = false;
+    while (len-- != 0) {
+        open ^= (*s++ == '"');
+    }
+    return open;
+}
+
+
+/// Read the next record into ct->line, without its line terminator.  A CSV
+/// record goes on to the next line while a quote is open.
+static long sub_readrecord(cmdtmpl_t* ct) {
+    ssize_t len;
+    ssize_t more;
+
+    len = getline(&ct->line, &ct->linealloc, ct->fp);
+    if (len < 0) {
+        return -1;
+    }
+    while (!ct->ndjson && sub_quoteopen(ct->line, (size_t)len)) {
+        more = getline(&ct->more, &ct->morealloc, ct->fp);
+        if (more < 0) {
+            break;
+        }
+        if ((size_t)(len + more + 1) > ct->linealloc) {
+            char* newbuf = realloc(ct->line, (size_t)(len + more + 1));
+            if (newbuf == NULL) {
+                return -1;
+            }
+            ct->line        = newbuf;
+            ct->linealloc   = (size_t)(len + more + 1);
+        }
+        memcpy(&ct->line[len], ct->more, (size_t)more + 1);
+        len += more;
+    }
+    while ((len > 0) && ((ct->line[len-1] == '\n') || (ct->line[len-1] == '\r'))) {
+        len--;
+    }
+    ct->line[len] = 0;
+    return (long)len;
+}
+
+
+/// Split a CSV record in place.  Up to max columns go into col.  Returns the
+/// number of columns in the record.
+static int sub_splitcsv(char* line, tspan_t* col, int max) {
+    char* r = line;
+    char* w = line;
+    int n = 0;
+
+    while (1) {
+        char* start = w;
+        if (*r == '"') {
+            for (r++; *r != 0; ) {
+                if (*r == '"') {
+                    if (r[1] != '"') {
+                        r++;
+                        break;
+                    }
+                    r++;
+                }
+                *w++ = *r++;
+            }
+            while ((*r != 0) && (*r != ',')) {
+                *w++ = *r++;
+            }
+        }
+        else {
+            while ((*r != 0) && (*r != ',')) {
+                *w++ = *r++;
+            }
+        }
+        if (n < max) {
+            col[n].s    = start;
+            col[n].len  = (size_t)(w - start);
+        }
+        n++;
+        if (*r++ != ',') {
+            break;
+        }
+    }
+    return n;
+}
+
+
+static int sub_hexval(const char* s) {
+    int value = 0;
+    for (int i=0; i<4; i++) {
+        int c = s[i];
+        value <<= 4;
+        if ((c >= '0') && (c <= '9'))       value |= c - '0';
+        else if ((c >= 'a') && (c <= 'f'))  value |= c - 'a' + 10;
+        else if ((c >= 'A') && (c <= 'F'))  value |= c - 'A' + 10;
+        else return -1;
+    }
+    return value;
+}
+
+
+/// Unescape the JSON string that starts at *r (after its quote), writing at
+/// w.  Returns the end of the output, and leaves *r after the closing quote.
+static char* sub_unescape(char** r, char* w) {
+    char* p = *r;
+
+    while ((*p != 0) && (*p != '"')) {
+        if (*p != '\\') {
+            *w++ = *p++;
+            continue;
+        }
+        p++;
+        switch (*p) {
+            case 'b': *w++ = '\b'; p++; break;
+            case 'f': *w++ = '\f'; p++; break;
+            case 'n': *w++ = '\n'; p++; break;
+            case 'r': *w++ = '\r'; p++; break;
+            case 't': *w++ = '\t'; p++; break;
+            case 'u': {
+                long cp = sub_hexval(p+1);
+                if (cp < 0) {
+                    *w++ = *p++;
+                    break;
+                }
+                p += 5;
+                if ((cp >= 0xD800) && (cp < 0xDC00) && (p[0] == '\\') && (p[1] == 'u')) {
+                    long lo = sub_hexval(p+2);
+                    if ((lo >= 0xDC00) && (lo < 0xE000)) {
+                        cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                        p += 6;
+                    }
+                }
+                if (cp < 0x80) {
+                    *w++ = (char)cp;
+                }
+                else if (cp < 0x800) {
+                    *w++ = (char)(0xC0 | (cp >> 6));
+                    *w++ = (char)(0x80 | (cp & 0x3F));
+                }
+                else if (cp < 0x10000) {
+                    *w++ = (char)(0xE0 | (cp >> 12));
+                    *w++ = (char)(0x80 | ((cp >> 6) & 0x3F));
+                    *w++ = (char)(0x80 | (cp & 0x3F));
+                }
+                else {
+                    *w++ = (char)(0xF0 | (cp >> 18));
+                    *w++ = (char)(0x80 | ((cp >> 12) & 0x3F));
+                    *w++ = (char)(0x80 | ((cp >> 6) & 0x3F));
+                    *w++ = (char)(0x80 | (cp & 0x3F));
+                }
+            } break;
+            case 0:   break;
+            default:  *w++ = *p++; break;
+        }
+    }
+    *r = (*p == '"') ? p+1 : p;
+    return w;
+}
+
+
+/// Pick the template fields out of a flat JSON object, in place.  Nested
+/// values are used as their raw JSON text.  Returns 0, or -1 if the line is
+/// not an object.
+static int sub_splitjson(cmdtmpl_t* ct, char* p) {
+    for (int f=0; f<ct->fields; f++) {
+        ct->val[f].s = NULL;
+    }
+
+    while (isspace((unsigned char)*p)) p++;
+    if (*p++ != '{') {
+        return -1;
+    }
+    while (1) {
+        char* key;
+        size_t keylen;
+        char* value;
+        size_t vlen;
+
+        while (isspace((unsigned char)*p)) p++;
+        if (*p == '}') {
+            return 0;
+        }
+        if (*p++ != '"') {
+            return -1;
+        }
+        key = p;
+        while ((*p != 0) && (*p != '"')) {
+            p += ((*p == '\\') && (p[1] != 0)) + 1;
+        }
+        if (*p == 0) {
+            return -1;
+        }
+        keylen = (size_t)(p - key);
+        p++;
+        while (isspace((unsigned char)*p)) p++;
+        if (*p++ != ':') {
+            return -1;
+        }
+        while (isspace((unsigned char)*p)) p++;
+
+        value = p;
+        if (*p == '"') {
+            p++;
+            value   = p;
+            vlen    = (size_t)(sub_unescape(&p, value) - value);
+        }
+        else if ((*p == '{') || (*p == '[')) {
+            int depth = 0;
+            do {
+                if (*p == '"') {
+                    for (p++; (*p != 0) && (*p != '"'); p += ((*p == '\\') && (p[1] != 0)) + 1);
+                }
+                depth += ((*p == '{') || (*p == '['));
+                depth -= ((*p == '}') || (*p == ']'));
+                p += (*p != 0);
+            } while ((depth > 0) && (*p != 0));
+            vlen = (size_t)(p - value);
+        }
+        else {
+            while ((*p != 0) && (*p != ',') && (*p != '}') && !isspace((unsigned char)*p)) p++;
+            vlen = (size_t)(p - value);
+        }
+
+        for (int f=0; f<ct->fields; f++) {
+            if ((strlen(ct->field[f]) == keylen) && (memcmp(ct->field[f], key, keylen) == 0)) {
+                ct->val[f].s    = value;
+                ct->val[f].len  = vlen;
+            }
+        }
+
+        while (isspace((unsigned char)*p)) p++;
+        if (*p == ',') {
+            p++;
+        }
+        else if (*p == '}') {
+            return 0;
+        }
+        else {
+            return -1;
+        }
+    }
+}
+
+
+/// Look at the first character of the data: '{' means NDJSON.  Otherwise,
+/// read the CSV header, and look up each field of the template in it.
+static int sub_openrows(cmdtmpl_t* ct) {
+    long len;
+    char* p;
+    int c;
+
+    while (((c = fgetc(ct->fp)) != EOF) && isspace(c));
+    if (c == EOF) {
+        fprintf(stderr, OTTERCAT_PARAM_NAME ": data file is empty\n");
+        return -2;
+    }
+    ungetc(c, ct->fp);
+
+    ct->val = calloc((size_t)ct->fields + 1, sizeof(tspan_t));
+    if (ct->val == NULL) {
+        return -1;
+    }
+    ct->ndjson = (c == '{');
+    if (ct->ndjson) {
+        return 0;
+    }
+
+    len = sub_readrecord(ct);
+    if (len < 0) {
+        return -2;
+    }
+    ct->columns = 1;
+    for (p=ct->line; *p!=0; p++) {
+        ct->columns += (*p == ',');
+    }
+    ct->col     = calloc((size_t)ct->columns, sizeof(tspan_t));
+    ct->column  = calloc((size_t)ct->fields + 1, sizeof(int));
+    if ((ct->col == NULL) || (ct->column == NULL)) {
+        return -1;
+    }
+    ct->columns = sub_splitcsv(ct->line, ct->col, ct->columns);
+
+    for (int f=0; f<ct->fields; f++) {
+        int c;
+        for (c=0; c<ct->columns; c++) {
+            const char* name = ct->col[c].s;
+            size_t len       = ct->col[c].len;
+            while ((len > 0) && isspace((unsigned char)*name)) { name++; len--; }
+            while ((len > 0) && isspace((unsigned char)name[len-1])) len--;
+            if ((strlen(ct->field[f]) == len) && (memcmp(ct->field[f], name, len) == 0)) {
+                break;
+            }
+        }
+        if (c == ct->columns) {
+            fprintf(stderr, OTTERCAT_PARAM_NAME ": template field \"%s\" is not in the CSV header\n", ct->field[f]);
+            return -2;
+        }
+        ct->column[f] = c;
+    }
+    return 0;
+}
+
+
+/// Split the row in ct->line into ct->val.  Returns 0, or -1 if it is
+/// malformed.
+static int sub_splitrow(cmdtmpl_t* ct) {
+    int n;
+
+    if (ct->ndjson) {
+        return sub_splitjson(ct, ct->line);
+    }
+    n = sub_splitcsv(ct->line, ct->col, ct->columns);
+    for (int f=0; f<ct->fields; f++) {
+        ct->val[f] = (ct->column[f] < n) ? ct->col[ct->column[f]] : (tspan_t){ NULL, 0 };
+    }
+    return 0;
+}
+
+
+
+
+/** Runner <BR>
+  * ========================================================================<BR>
+  */
+
+/// Write an error line for a row.  Call with ct->mutex held.
+static void sub_emiterr(cmdtmpl_t* ct, unsigned long row, int rc, const char* desc, const char* name) {
+    char tag[24];
+    char line[256];
+    snprintf(tag, sizeof(tag), "%lu", row);
+    runner_errline(line, sizeof(line), rc, desc, name);
+    runner_emit(&ct->out, tag, line);
+}
+
+
+static void sub_oncomplete(otc_handle_t otc, const otc_result_t* res, void* user) {
+    tslot_t* slot   = user;
+    cmdtmpl_t* ct   = slot->ct;
+    char tag[24];
+
+    pthread_mutex_lock(&ct->mutex);
+
+    snprintf(tag, sizeof(tag), "%lu", slot->row);
+    if (runner_result(&ct->out, tag, res, ct->cfg->journal, ct->socket) == false) {
+        goto sub_oncomplete_END;
+    }
+    if (res->rc < 0) {
+        ct->failed++;
+    }
+    else {
+        ct->ok++;
+    }
+    ct->freeslot[ct->frees++] = (int)(slot - ct->slot);
+    pthread_cond_signal(&ct->cond);
+
+    sub_oncomplete_END:
+    pthread_mutex_unlock(&ct->mutex);
+}
+
+
+/// Split, expand and submit the row in ct->line
+static void sub_submitrow(cmdtmpl_t* ct) {
+    tslot_t* slot;
+    const char* why = NULL;
+    long size;
+    int field = -1;
+    int rc;
+
+    ct->rows++;
+    if (sub_splitrow(ct) != 0) {
+        pthread_mutex_lock(&ct->mutex);
+        sub_emiterr(ct, ct->rows, -2, "malformed row", NULL);
+        ct->failed++;
+        pthread_mutex_unlock(&ct->mutex);
+        return;
+    }
+    size = sub_expand(ct, &why, &field);
+    if (size < 0) {
+        pthread_mutex_lock(&ct->mutex);
+        sub_emiterr(ct, ct->rows, -2, why, (field < 0) ? NULL : ct->field[field]);
+        ct->failed++;
+        pthread_mutex_unlock(&ct->mutex);
+        return;
+    }
+
+    pthread_mutex_lock(&ct->mutex);
+    while (ct->frees == 0) {
+        pthread_cond_wait(&ct->cond, &ct->mutex);
+    }
+    slot        = &ct->slot[ct->freeslot[--ct->frees]];
+    slot->row   = ct->rows;
+    pthread_mutex_unlock(&ct->mutex);
+
+    rc = otc_submit(ct->otc, ct->exp, (size_t)size, &sub_oncomplete, slot, NULL);
+    if (rc < 0) {
+        pthread_mutex_lock(&ct->mutex);
+        sub_emiterr(ct, slot->row, rc, "submit error", NULL);
+        ct->failed++;
+        ct->freeslot[ct->frees++] = (int)(slot - ct->slot);
+        pthread_mutex_unlock(&ct->mutex);
+    }
+}
+
+
+
+
+/** Public API <BR>
+  * ========================================================================<BR>
+  */
+
+int cmdtmpl_run(const char* socket, const char* tmpl, const char* data_path, const cmdtmpl_cfg_t* cfg) {
+    cmdtmpl_t ct;
+    otc_cfg_t otccfg;
+    struct timespec start;
+    long elapsed;
+    long len;
+    int rc;
+
+    if ((socket == NULL) || (tmpl == NULL) || (data_path == NULL) || (cfg == NULL)) {
+        return -1;
+    }
+
+    memset(&ct, 0, sizeof(ct));
+    ct.cfg      = cfg;
+    ct.socket   = socket;
+    rc = sub_compile(&ct, tmpl);
+    if (rc < 0) {
+        goto cmdtmpl_run_FREE;
+    }
+
+    ct.fp = (strcmp(data_path, "-") == 0) ? stdin : fopen(data_path, "r");
+    if (ct.fp == NULL) {
+        fprintf(stderr, OTTERCAT_PARAM_NAME ": data file %s could not be opened\n", data_path);
+        rc = -2;
+        goto cmdtmpl_run_FREE;
+    }
+    rc = sub_openrows(&ct);
+    if (rc < 0) {
+        goto cmdtmpl_run_CLOSE;
+    }
+
+    ct.slots    = 2 * ((cfg->concurrency < 1) ? 1 : cfg->concurrency);
+    ct.slot     = calloc((size_t)ct.slots, sizeof(tslot_t));
+    ct.freeslot = calloc((size_t)ct.slots, sizeof(int));
+    if ((ct.slot == NULL) || (ct.freeslot == NULL)) {
+        rc = -1;
+        goto cmdtmpl_run_CLOSE;
+    }
+    for (int i=0; i<ct.slots; i++) {
+        ct.slot[i].ct       = &ct;
+        ct.freeslot[i]      = ct.slots - 1 - i;
+    }
+    ct.frees = ct.slots;
+    pthread_mutex_init(&ct.mutex, NULL);
+    pthread_cond_init(&ct.cond, NULL);
+    runner_outinit(&ct.out, cfg->fd_out, cfg->filter);
+
+    runner_otccfg(&otccfg, ct.slots / 2, 0, cfg->capture);
+
+    rc = otc_open(&ct.otc, socket, &otccfg);
+    if (rc < 0) {
+        fprintf(stderr, "Err: socket could not be opened.\n");
+        goto cmdtmpl_run_DESTROY;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while ((len = sub_readrecord(&ct)) >= 0) {
+        if (strspn(ct.line, " \t") != (size_t)len) {
+            sub_submitrow(&ct);
+        }
+    }
+
+    pthread_mutex_lock(&ct.mutex);
+    while (ct.frees < ct.slots) {
+        pthread_cond_wait(&ct.cond, &ct.mutex);
+    }
+    pthread_mutex_unlock(&ct.mutex);
+
+    otc_close(ct.otc);
+
+    elapsed = runner_elapsed_ms(&start, NULL);
+    fprintf(stderr, OTTERCAT_PARAM_NAME ": %lu rows: %lu ok, %lu failed.  %li ms, %.0f rows/s\n",
+            ct.rows, ct.ok, ct.failed, elapsed, (elapsed > 0) ? (1000.0 * (double)ct.rows / (double)elapsed) : 0.0);
+    rc = (ct.failed == 0) ? 0 : -4;
+
+    cmdtmpl_run_DESTROY:
+    pthread_cond_destroy(&ct.cond);
+    pthread_mutex_destroy(&ct.mutex);
+
+    cmdtmpl_run_CLOSE:
+    if (ct.fp != stdin) {
+        fclose(ct.fp);
+    }
+
+    cmdtmpl_run_FREE:
+    free(ct.seg);
+    free(ct.field);
+    free(ct.names);
+    free(ct.column);
+    free(ct.col);
+    free(ct.val);
+    free(ct.line);
+    free(ct.more);
+    free(ct.exp);
+    free(ct.slot);
+    free(ct.freeslot);
+    runner_outfree(&ct.out);
+    return rc;
+}
@@ -0,0 +1,504 @@
+/* Copyright 2020, JP Norair
+  *
+  * Licensed under the OpenTag License, Version 1.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  * http://www.indigresso.com/wiki/doku.php?id=opentag:license_1_0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  *
+  */
+
+// Application Headers
+#include "collect.h"
+#include "capture.h"
+#include "cliopt.h"
+#include "debug.h"
+#include "devmgr_json.h"
+#include "filter.h"
+#include "ottercat_cfg.h"
+#include "sockpush.h"
+
+// HB Headers/Libraries
+#include <cJSON.h>
+
+// Standard C & POSIX Libraries
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+
+// Sessions waiting for their rxstat are hashed by sid
+#define COLLECT_BUCKETS     1024
+
+// rxstats that came in ahead of their journal line are kept this long, up
+// to this many
+#define COLLECT_EARLY_MS    2000
+#define COLLECT_EARLY_MAX   256
+
+// How often the journal is checked for new lines
+#define COLLECT_POLL_MS     100
+
+
+typedef struct {
+    int             fd;
+    pthread_mutex_t mutex;
+} collect_handle_t;
+
+
+
+
+/** Journal Writer <BR>
+  * ========================================================================<BR>
+  */
+
+collect_t collect_open(const char* path) {
+    collect_handle_t* journal;
+
+    journal = calloc(1, sizeof(collect_handle_t));
+    if (journal == NULL) {
+        return NULL;
+    }
+    journal->fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (journal->fd < 0) {
+        free(journal);
+        return NULL;
+    }
+    pthread_mutex_init(&journal->mutex, NULL);
+    return journal;
+}
+
+
+void collect_close(collect_t handle) {
+    collect_handle_t* journal = handle;
+
+    if (journal != NULL) {
+        close(journal->fd);
+        pthread_mutex_destroy(&journal->mutex);
+        free(journal);
+    }
+}
+
+
+/// Append src as the inside of a JSON string.  Control characters, which
+/// can't be in a command line anyway, are left out.
+static size_t sub_putstring(char* dst, const char* src, size_t size) {
+    size_t len = 0;
+
+    for (size_t i=0; i<size; i++) {
+        if ((src[i] == '"') || (src[i] == '\\')) {
+            dst[len++] = '\\';
+            dst[len++] = src[i];
+        }
+        else if ((unsigned char)src[i] >= ' ') {
+            dst[len++] = src[i];
+        }
+    }
+    return len;
+}
+
+
+int collect_note(collect_t handle, const char* target, uint32_t sid, const char* cmd, size_t cmdsize) {
+    collect_handle_t* journal = handle;
+    size_t tgtsize;
+    size_t len;
+    char* line;
+    int rc = 0;
+
+    if (journal == NULL) {
+        return 0;
+    }
+    while ((cmdsize > 0) && ((cmd[cmdsize-1] == 0) || isspace((unsigned char)cmd[cmdsize-1]))) {
+        cmdsize--;
+    }
+    target  = (target != NULL) ? target : "";
+    tgtsize = strlen(target);
+    line    = malloc(64 + 2*tgtsize + 2*cmdsize);
+    if (line == NULL) {
+        return -1;
+    }
+
+    len     = (size_t)sprintf(line, "{\"sid\":%u,\"target\":\"", sid);
+    len    += sub_putstring(&line[len], target, tgtsize);
+    len    += (size_t)sprintf(&line[len], "\",\"cmd\":\"");
+    len    += sub_putstring(&line[len], cmd, cmdsize);
+    len    += (size_t)sprintf(&line[len], "\"}\n");
+
+    // One write per line, so that lines from other writers don't interleave
+    pthread_mutex_lock(&journal->mutex);
+    if (write(journal->fd, line, len) != (ssize_t)len) {
+        rc = -2;
+    }
+    pthread_mutex_unlock(&journal->mutex);
+
+    free(line);
+    return rc;
+}
+
+
+
+
+/** Collector <BR>
+  * ========================================================================<BR>
+  * The collector reads every inbound line with a synchronous reader, and
+  * checks the journal for new lines between reads.  Pending sessions are in
+  * a hash table by sid.  An rxstat for a sid that isn't pending yet goes on
+  * the early list, in case its journal line is about to be written.
+  */
+
+typedef struct csess {
+    struct csess*   next;
+    uint32_t        sid;
+    struct timespec deadline;
+} csess_t;
+
+typedef struct {
+    uint32_t        sid;
+    int             end;
+    struct timespec at;
+    char*           line;
+    size_t          size;
+} cearly_t;
+
+typedef struct {
+    const collect_cfg_t* cfg;
+    const char*     target;
+    csess_t*        bucket[COLLECT_BUCKETS];
+    size_t          pending;
+    cearly_t        early[COLLECT_EARLY_MAX];
+    size_t          num_early;
+    uint8_t*        proj;
+    size_t          proj_alloc;
+
+    unsigned long   journaled;
+    unsigned long   collected;
+    unsigned long   missing;
+} collector_t;
+
+
+static volatile sig_atomic_t collect_stop = 0;
+
+static void sub_sigstop(int sigcode) {
+    collect_stop = 1;
+}
+
+
+static long sub_until_ms(const struct timespec* now, const struct timespec* then) {
+    return ((long)(then->tv_sec - now->tv_sec) * 1000)
+         + ((then->tv_nsec - now->tv_nsec) / 1000000);
+}
+
+
+static void sub_addms(struct timespec* ts, int ms) {
+    ts->tv_sec     += ms / 1000;
+    ts->tv_nsec    += (long)(ms % 1000) * 1000000;
+    if (ts->tv_nsec >= 1000000000) {
+        ts->tv_nsec    -= 1000000000;
+        ts->tv_sec     += 1;
+    }
+}
+
+
+static void sub_output(collector_t* col, const char* line, size_t size) {
+    const uint8_t* text;
+    int textlen;
+
+    while ((size > 0) && ((line[size-1] == 0) || (line[size-1] == '\r') || (line[size-1] == '\n'))) {
+        size--;
+    }
+    textlen = filter_line(col->cfg->filter, (const uint8_t*)line, size, &col->proj, &col->proj_alloc, &text);
+    if (textlen >= 0) {
+        dprintf(col->cfg->fd_out, "%.*s\n", textlen, text);
+    }
+}
+
+
+static csess_t** sub_find(collector_t* col, uint32_t sid) {
+    csess_t** slot = &col->bucket[sid % COLLECT_BUCKETS];
+
+    while ((*slot != NULL) && ((*slot)->sid != sid)) {
+        slot = &(*slot)->next;
+    }
+    return slot;
+}
+
+
+static void sub_remove(collector_t* col, csess_t** slot) {
+    csess_t* sess = *slot;
+
+    *slot = sess->next;
+    free(sess);
+    col->pending--;
+}
+
+
+/// The early list is kept in order of arrival
+static void sub_early_drop(collector_t* col, size_t i) {
+    free(col->early[i].line);
+    col->num_early--;
+    memmove(&col->early[i], &col->early[i+1], (col->num_early - i) * sizeof(cearly_t));
+}
+
+
+/// A session has been journaled.  Its rxstats may already be on the early
+/// list.  Returns 0, or -1 if it can't be tracked.
+static int sub_journaled(collector_t* col, uint32_t sid, const struct timespec* now) {
+    csess_t** slot;
+    csess_t* sess;
+    bool ended = false;
+
+    col->journaled++;
+    for (size_t i=0; i<col->num_early; ) {
+        if (col->early[i].sid == sid) {
+            sub_output(col, col->early[i].line, col->early[i].size);
+            ended = ended || (col->early[i].end != 0);
+            sub_early_drop(col, i);
+            continue;
+        }
+        i++;
+    }
+    if (ended) {
+        col->collected++;
+        return 0;
+    }
+
+    slot = sub_find(col, sid);
+    if (*slot == NULL) {
+        sess = calloc(1, sizeof(csess_t));
+        if (sess == NULL) {
+            return -1;
+        }
+        sess->sid   = sid;
+        *slot       = sess;
+        col->pending++;
+    }
+    (*slot)->deadline = *now;
+    sub_addms(&(*slot)->deadline, col->cfg->timeout_ms);
+    return 0;
+}
+
+
+/// Read the journal lines that have been added since the last call.  Lines
+/// for other targets are skipped.  Returns the number of lines read.
+static int sub_readjournal(collector_t* col, FILE* fp, char** line, size_t* alloc, const struct timespec* now) {
+    cJSON* entry;
+    cJSON* obj;
+    ssize_t size;
+    int lines = 0;
+
+    while ((size = getline(line, alloc, fp)) > 0) {
+        // A line still being written is read again once it is complete
+        if ((*line)[size-1] != '\n') {
+            fseek(fp, -(long)size, SEEK_CUR);
+            break;
+        }
+        lines++;
+        entry = cJSON_Parse(*line);
+        if (entry == NULL) {
+            continue;
+        }
+        obj = cJSON_GetObjectItemCaseSensitive(entry, "target");
+        if ((cJSON_IsString(obj) == false) || (obj->valuestring[0] == 0) || (strcmp(obj->valuestring, col->target) == 0)) {
+            obj = cJSON_GetObjectItemCaseSensitive(entry, "sid");
+            if (cJSON_IsNumber(obj) && (obj->valuedouble > 0)) {
+                sub_journaled(col, (uint32_t)obj->valuedouble, now);
+            }
+        }
+        cJSON_Delete(entry);
+    }
+    clearerr(fp);
+    return lines;
+}
+
+
+/// Handle an inbound line.  Only rxstats are of interest.
+static void sub_inbound(collector_t* col, const char* line, size_t size, const struct timespec* now) {
+    csess_t** slot;
+    cJSON* resp;
+    int sid;
+    int end;
+
+    resp = cJSON_Parse(line);
+    if (resp == NULL) {
+        return;
+    }
+    if (devmgr_json_gettype(resp, "rxstat") == NULL) {
+        goto sub_inbound_END;
+    }
+    sid = devmgr_json_getframe(resp, NULL, NULL);
+    if (sid <= 0) {
+        goto sub_inbound_END;
+    }
+    end = devmgr_json_getend(resp);
+
+    slot = sub_find(col, (uint32_t)sid);
+    if (*slot != NULL) {
+        sub_output(col, line, size);
+        if (end != 0) {
+            sub_remove(col, slot);
+            col->collected++;
+        }
+        else {
+            // Each frame of a session renews its deadline
+            (*slot)->deadline = *now;
+            sub_addms(&(*slot)->deadline, col->cfg->timeout_ms);
+        }
+        goto sub_inbound_END;
+    }
+
+    // Not journaled (yet).  The oldest early rxstat makes room if needed.
+    if (col->num_early == COLLECT_EARLY_MAX) {
+        sub_early_drop(col, 0);
+    }
+    col->early[col->num_early].line = malloc(size);
+    if (col->early[col->num_early].line != NULL) {
+        memcpy(col->early[col->num_early].line, line, size);
+        col->early[col->num_early].size = size;
+        col->early[col->num_early].sid  = (uint32_t)sid;
+        col->early[col->num_early].end  = end;
+        col->early[col->num_early].at   = *now;
+        col->num_early++;
+    }
+
+    sub_inbound_END:
+    cJSON_Delete(resp);
+}
+
+
+/// Report sessions past their deadline, and forget stale early rxstats
+static void sub_expire(collector_t* col, const struct timespec* now) {
+    csess_t** slot;
+
+    for (int i=0; (i<COLLECT_BUCKETS) && (col->pending != 0); i++) {
+        slot = &col->bucket[i];
+        while (*slot != NULL) {
+            if (sub_until_ms(now, &(*slot)->deadline) > 0) {
+                slot = &(*slot)->next;
+                continue;
+            }
+            dprintf(col->cfg->fd_out, "{\"cmd\":\"" OTTERCAT_PARAM_NAME "\", \"sid\":%u, \"err\":-4, \"desc\":\"rxstat not collected\"}\n",
+                    (*slot)->sid);
+            col->missing++;
+            sub_remove(col, slot);
+        }
+    }
+    while ((col->num_early != 0) && (sub_until_ms(&col->early[0].at, now) >= COLLECT_EARLY_MS)) {
+        sub_early_drop(col, 0);
+    }
+}
+
+
+int collect_run(const char* socket, const char* journal_path, const collect_cfg_t* cfg) {
+    collector_t col;
+    struct sigaction sa;
+    struct timespec now;
+    struct timespec start;
+    struct timespec last_new;
+    sp_handle_t handle;
+    sp_reader_t reader;
+    FILE* fp;
+    int fd;
+    char* jline         = NULL;
+    size_t jalloc       = 0;
+    uint8_t* rline      = NULL;
+    size_t ralloc       = 0;
+    int rc;
+
+    memset(&col, 0, sizeof(col));
+    col.cfg     = cfg;
+    col.target  = socket;
+
+    // The journal may not exist yet, when the collector is started first
+    fd = open(journal_path, O_RDONLY | O_CREAT, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Err: journal %s could not be opened.\n", journal_path);
+        return -1;
+    }
+    fp = fdopen(fd, "r");
+    if (fp == NULL) {
+        close(fd);
+        return -1;
+    }
+
+    if (sp_open(&handle, socket, (cliopt_isframed() ? SP_FLAG_FRAMED : 0) | (cliopt_isshmring() ? SP_FLAG_SHMRING : 0)) != 0) {
+        fprintf(stderr, "Err: socket could not be opened.\n");
+        rc = -2;
+        goto collect_run_FCLOSE;
+    }
+    if (capture_attach(cfg->capture, handle, socket) < 0) {
+        rc = -1;
+        goto collect_run_CLOSE;
+    }
+    reader = sp_reader_create(NULL, handle);
+    if (reader == NULL) {
+        rc = -1;
+        goto collect_run_CLOSE;
+    }
+
+    collect_stop = 0;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = &sub_sigstop;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    last_new = start;
+    while (collect_stop == 0) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (sub_readjournal(&col, fp, &jline, &jalloc, &now) > 0) {
+            last_new = now;
+        }
+
+        // Everything the socket has now, then back to the journal
+        rc = sp_readline(reader, &rline, &ralloc, COLLECT_POLL_MS);
+        while (rc > 0) {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            sub_inbound(&col, (const char*)rline, (size_t)rc, &now);
+            rc = sp_readline(reader, &rline, &ralloc, 0);
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        sub_expire(&col, &now);
+        if ((cfg->idle_ms > 0) && (col.pending == 0) && (sub_until_ms(&last_new, &now) >= cfg->idle_ms)) {
+            break;
+        }
+    }
+
+    fprintf(stderr, OTTERCAT_PARAM_NAME ": %lu sessions: %lu collected, %lu missing, %zu pending.  %li ms\n",
+            col.journaled, col.collected, col.missing, col.pending, sub_until_ms(&start, &now));
+    rc = ((col.missing != 0) || (col.pending != 0)) ? -4 : 0;
+
+    sp_reader_destroy(reader);
+
+    collect_run_CLOSE:
+    sp_close(handle);
+
+    collect_run_FCLOSE:
+    fclose(fp);
+    for (int i=0; i<COLLECT_BUCKETS; i++) {
+        while (col.bucket[i] != NULL) {
+            sub_remove(&col, &col.bucket[i]);
+        }
+    }
+    while (col.num_early != 0) {
+        sub_early_drop(&col, 0);
+    }
+    free(col.proj);
+    free(jline);
+    free(rline);
+    return rc;
+}
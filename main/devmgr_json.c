@@ -0,0 +1,117 @@
+/* Copyright 2020, JP Norair
+  *
+  * Licensed under the OpenTag License, Version 1.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  * http://www.indigresso.com/wiki/doku.php?id=opentag:license_1_0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  *
+  */
+
+#include "devmgr_json.h"
+
+#include <cJSON.h>
+
+#include <stdint.h>
+#include <string.h>
+
+
+
+cJSON* devmgr_json_gettype(cJSON* top, const char* typename) {
+    top = cJSON_GetObjectItemCaseSensitive(top, "type");
+    if (cJSON_IsString(top)) {
+        if (strcmp(top->valuestring, typename) == 0) {
+            return top;
+        }
+    }
+    
+    return NULL;
+}
+
+
+int devmgr_json_getack(cJSON* top, uint32_t* sid) {
+    uint32_t sidval = 0;
+    int errval = -1;
+
+    cJSON* obj;
+
+    top = cJSON_GetObjectItemCaseSensitive(top, "data");
+    if (cJSON_IsObject(top)) {
+        obj = cJSON_GetObjectItemCaseSensitive(top, "err");
+        if (cJSON_IsNumber(obj)) {
+            errval = obj->valueint;
+            
+            if (sid != NULL) {
+                obj = cJSON_GetObjectItemCaseSensitive(top, "sid");
+                if (cJSON_IsNumber(obj)) {
+                    sidval = obj->valueint;
+                }
+                *sid = sidval;
+            }
+        }
+    }
+    
+    return errval;
+}
+
+
+
+const char* devmgr_json_getcmd(cJSON* top) {
+    top = cJSON_GetObjectItemCaseSensitive(top, "data");
+    if (cJSON_IsObject(top)) {
+        top = cJSON_GetObjectItemCaseSensitive(top, "cmd");
+        if (cJSON_IsString(top)) {
+            return top->valuestring;
+        }
+    }
+    
+    return NULL;
+}
+
+
+
+int devmgr_json_getframe(cJSON* top, cJSON** frame, int* qualtest) {
+    int sid = -1;
+
+    cJSON* obj;
+
+    top = cJSON_GetObjectItemCaseSensitive(top, "data");
+    if (cJSON_IsObject(top)) {
+        obj = cJSON_GetObjectItemCaseSensitive(top, "sid");
+        if (cJSON_IsNumber(obj)) {
+            sid = obj->valueint;
+            
+            if (qualtest != NULL) {
+                obj = cJSON_GetObjectItemCaseSensitive(top, "qual");
+                if (cJSON_IsNumber(obj)) {
+                    *qualtest = obj->valueint;
+                }
+            }
+            if (frame != NULL) {
+                *frame = cJSON_GetObjectItemCaseSensitive(top, "frame");
+            }
+        }
+    }
+    
+    return sid;
+}
+
+
+
+int devmgr_json_getend(cJSON* top) {
+    top = cJSON_GetObjectItemCaseSensitive(top, "data");
+    if (cJSON_IsObject(top)) {
+        top = cJSON_GetObjectItemCaseSensitive(top, "end");
+        if (cJSON_IsBool(top)) {
+            return cJSON_IsTrue(top) ? 1 : 0;
+        }
+    }
+    
+    return -1;
+}
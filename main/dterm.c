@@ -153,6 +153,10 @@ int dterm_init(dterm_handle_t* dth, int fd_in, int fd_out, bool use_socket, void
     
     dth->use_socket = use_socket;
     dth->devmgr     = devmgr_handle;
+    dth->cache      = NULL;
+    dth->target     = NULL;
+    dth->filter     = NULL;
+    dth->journal    = NULL;
     dth->fd.in      = fd_in;
     dth->fd.out     = fd_out;
     return 0;
@@ -184,16 +188,22 @@ void dterm_deinit(dterm_handle_t* dth) {
   */
 
 static int sub_proc_lineinput(dterm_handle_t* dth, int* cmdrc, char* loadbuf, int linelen) {
-    uint8_t     protocol_buf[1024];
+    char        errbuf[128];
     cJSON*      cmdobj;
-    uint8_t*    cursor  = protocol_buf;
-    int         bufmax  = sizeof(protocol_buf);
+    char*       header  = NULL;
+    uint8_t*    frame   = NULL;
+    size_t      framemax = 0;
     int         bytesout = 0;
     
     int bytesin;
     
     DEBUG_PRINTF("raw input (%i bytes) %.*s\n", linelen, linelen, loadbuf);
 
+    // A line that is skipped, and not run, is not an error
+    if (cmdrc != NULL) {
+        *cmdrc = 0;
+    }
+
     // Isolation memory context
     iso_ctx = dth->tctx;
 
@@ -214,22 +224,19 @@ static int sub_proc_lineinput(dterm_handle_t* dth, int* cmdrc, char* loadbuf, in
         dataobj = cJSON_GetObjectItemCaseSensitive(cmdobj, "data");
 
         if (cJSON_IsString(typeobj) && cJSON_IsString(dataobj)) {
-            int hdr_sz;
             VCLIENT_PRINTF("JSON Request (%i bytes): %.*s\n", linelen, linelen, loadbuf);
             loadbuf = dataobj->valuestring;
-            hdr_sz  = snprintf((char*)cursor, bufmax-1, "{\"type\":\"%s\", \"data\":", typeobj->valuestring);
-            cursor += hdr_sz;
-            bufmax -= hdr_sz;
+            header  = talloc_asprintf(dth->tctx, "{\"type\":\"%s\", \"data\":", typeobj->valuestring);
         }
         else {
             goto sub_proc_lineinput_FREE;
         }
     }
     
-    // Null terminate the cursor: errors may report a string.
-    *cursor     = 0;
+    // The frame buffer is grown by cmd_devmgr() to fit the response frame,
+    // and it is released along with the rest of the thread context.
     bytesin     = linelen;
-    bytesout    = cmd_devmgr(dth, cursor, &bytesin, (uint8_t*)loadbuf, bufmax);
+    bytesout    = cmd_devmgr(dth, &frame, &framemax, &bytesin, (uint8_t*)loadbuf);
     if (cmdrc != NULL) {
         *cmdrc = bytesout;
     }
@@ -237,25 +244,28 @@ static int sub_proc_lineinput(dterm_handle_t* dth, int* cmdrc, char* loadbuf, in
     ///@todo spruce-up the command error reporting, maybe even with
     ///      a cursor showing where the first error was found.
     if (bytesout < 0) {
-        bytesout = snprintf((char*)protocol_buf, sizeof(protocol_buf)-1,
+        bytesout = snprintf(errbuf, sizeof(errbuf),
                     "{\"cmd\":\"" OTTERCAT_PARAM_NAME "\", \"err\":%d, \"desc\":\"execution error\"}\n", bytesout);
-        write(dth->fd.out, (char*)protocol_buf, bytesout);
+        write(dth->fd.out, errbuf, bytesout);
     }
     
     // If there are bytes to send to MPipe, do that.
     // If bytesout == 0, there is no error, but also nothing
     // to send to MPipe.
-    else if (bytesout > 0) {
-        if (cJSON_IsObject(cmdobj)) {
-            VCLIENT_PRINTF("JSON Response (%i bytes): %.*s\n", bytesout, bytesout, (char*)cursor);
-            cursor += bytesout;
-            bufmax -= bytesout;
-            cursor  = (uint8_t*)stpncpy((char*)cursor, "}\n", bufmax);
-            bytesout= (int)(cursor - protocol_buf);
+    else if ((bytesout > 0) && (frame != NULL)) {
+        char* output = (char*)frame;
+        
+        if (header != NULL) {
+            VCLIENT_PRINTF("JSON Response (%i bytes): %.*s\n", bytesout, bytesout, (char*)frame);
+            output = talloc_asprintf(dth->tctx, "%s%.*s}\n", header, bytesout, (char*)frame);
+            if (output == NULL) {
+                goto sub_proc_lineinput_FREE;
+            }
+            bytesout = (int)strlen(output);
         }
         
-        DEBUG_PRINTF("raw output (%i bytes) %.*s\n", bytesout, bytesout, protocol_buf);
-        //write(dth->fd.out, (char*)protocol_buf, bytesout);
+        DEBUG_PRINTF("raw output (%i bytes) %.*s\n", bytesout, bytesout, output);
+        //write(dth->fd.out, output, bytesout);
     }
     
     sub_proc_lineinput_FREE:
@@ -287,7 +297,7 @@ int dterm_cmdstream(dterm_handle_t* dth, char* stream) {
     streamcursor = stream;
     while (stream_sz > 0) {
         int linelen;
-        int cmdrc;
+        int cmdrc = 0;
         size_t poolsize;
         size_t est_poolobj;
         
@@ -0,0 +1,638 @@
+/* Copyright 2020, JP Norair
+  *
+  * Licensed under the OpenTag License, Version 1.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  * http://www.indigresso.com/wiki/doku.php?id=opentag:license_1_0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  *
+  */
+
+/// Fan-out runner.  All the concurrency comes from libottercat: each target
+/// is one handle on the sockpush event loop, and each target has a number of
+/// slots that run devices through the command lines.  A slot advances to its
+/// next command from the completion callback of the previous one.  The main
+/// thread only waits for the targets to finish, or for the deadline.
+///
+/// Without a device list, each target has one slot and one (anonymous)
+/// device, which is a plain run of the command stream.
+
+// Application Headers
+#include "fanout.h"
+#include "cliopt.h"
+#include "cmdgraph.h"
+#include "debug.h"
+#include "libottercat.h"
+#include "ottercat_cfg.h"
+#include "runner.h"
+
+// Standard C & POSIX Libraries
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+typedef enum {
+    FOSTAT_running  = 0,
+    FOSTAT_ok       = 1,
+    FOSTAT_failed   = 2,
+    FOSTAT_timeout  = 3,
+    FOSTAT_noconn   = 4
+} FOSTAT_Type;
+
+static const char* fostat_name[] = { "running", "ok", "failed", "timeout", "noconn" };
+
+
+typedef struct fanout fanout_t;
+typedef struct fotarget fotarget_t;
+
+typedef struct {
+    fotarget_t*     tgt;
+    size_t          dev;
+    size_t          line;
+    bool            busy;
+} foslot_t;
+
+
+struct fotarget {
+    fanout_t*       fo;
+    const char*     path;
+    otc_handle_t    otc;
+    FOSTAT_Type     status;
+    int             rc;
+    struct timespec end;
+
+    // Device results for this target: FOSTAT_running until tried
+    uint8_t*        devstat;
+    int*            devrc;
+    size_t          devs_ok;
+    size_t          devs_failed;
+
+    // Work list for the current round, and the slots running it
+    size_t*         work;
+    size_t          works;
+    size_t          work_next;
+    int             round;
+    int             busy;
+    foslot_t*       slot;
+};
+
+
+struct fanout {
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+    const fanout_cfg_t* cfg;
+    size_t          running;
+    struct timespec start;
+
+    char**          cmd;
+    size_t          cmds;
+    size_t          devs;
+    int             slots;
+    fotarget_t*     target;
+    size_t          targets;
+
+    // Scratch buffer for expanding command templates, guarded by mutex
+    char*           expbuf;
+    size_t          expalloc;
+
+    // Response output, guarded by mutex
+    runout_t        out;
+};
+
+
+
+
+/// Split the command stream into lines, in place.  Lines in the JSON form
+/// {"type":"...", "data":"..."} are reduced to their data string, which is
+/// what gets sent to the daemon.
+static int sub_splitcmds(fanout_t* fo, char* stream) {
+    char* cursor;
+    char* line;
+    size_t max = 0;
+
+    for (cursor=stream; *cursor!=0; cursor++) {
+        max += (*cursor == '\n');
+    }
+    fo->cmd = calloc(max+1, sizeof(char*));
+    if (fo->cmd == NULL) {
+        return -1;
+    }
+
+    for (line=strtok_r(stream, "\n", &cursor); line!=NULL; line=strtok_r(NULL, "\n", &cursor)) {
+        while (isspace(*line)) line++;
+        if ((*line == 0) || cmdgraph_isdirective(line)) {
+            continue;
+        }
+        fo->cmd[fo->cmds++] = runner_cmdline(line);
+    }
+
+    return (int)fo->cmds;
+}
+
+
+/// Expand every FANOUT_DEVID_VAR in the command line with the device ID.
+/// Call with fo->mutex held: the result is in fo->expbuf.
+static const char* sub_expand(fanout_t* fo, const char* line, const char* devid, size_t* size) {
+    const size_t varlen = sizeof(FANOUT_DEVID_VAR) - 1;
+    const char* mark;
+    size_t need;
+    size_t fill = 0;
+
+    if (devid == NULL) {
+        *size = strlen(line);
+        return line;
+    }
+
+    need = strlen(line) + 1;
+    for (mark=strstr(line, FANOUT_DEVID_VAR); mark!=NULL; mark=strstr(mark+varlen, FANOUT_DEVID_VAR)) {
+        need += strlen(devid);
+    }
+    if (need > fo->expalloc) {
+        char* newbuf = realloc(fo->expbuf, need);
+        if (newbuf == NULL) {
+            return NULL;
+        }
+        fo->expbuf  = newbuf;
+        fo->expalloc= need;
+    }
+
+    while ((mark = strstr(line, FANOUT_DEVID_VAR)) != NULL) {
+        memcpy(&fo->expbuf[fill], line, (size_t)(mark - line));
+        fill   += (size_t)(mark - line);
+        fill   += (size_t)(stpcpy(&fo->expbuf[fill], devid) - &fo->expbuf[fill]);
+        line    = mark + varlen;
+    }
+    fill += (size_t)(stpcpy(&fo->expbuf[fill], line) - &fo->expbuf[fill]);
+
+    *size = fill;
+    return fo->expbuf;
+}
+
+
+/// The output tag of a target and device
+static const char* sub_tag(fanout_t* fo, fotarget_t* tgt, size_t dev, char* tag, size_t max) {
+    const char* devid = (fo->cfg->devid != NULL) ? fo->cfg->devid[dev] : NULL;
+
+    if (devid == NULL) {
+        return tgt->path;
+    }
+    if (fo->targets == 1) {
+        return devid;
+    }
+    snprintf(tag, max, "%s %s", tgt->path, devid);
+    return tag;
+}
+
+
+static void sub_emiterr(fanout_t* fo, fotarget_t* tgt, size_t dev, int rc, const char* desc) {
+    char tag[256];
+    runner_emiterr(&fo->out, sub_tag(fo, tgt, dev, tag, sizeof(tag)), rc, desc);
+}
+
+
+/// Call with fo->mutex held
+static void sub_finish(fanout_t* fo, fotarget_t* tgt, FOSTAT_Type status, int rc) {
+    if (tgt->status == FOSTAT_running) {
+        tgt->status = status;
+        tgt->rc     = rc;
+        clock_gettime(CLOCK_MONOTONIC, &tgt->end);
+        fo->running--;
+        pthread_cond_broadcast(&fo->cond);
+    }
+}
+
+
+static void sub_oncomplete(otc_handle_t otc, const otc_result_t* res, void* user);
+
+
+/// Submit the slot's current line.  Call with fo->mutex held.
+static int sub_submit(fanout_t* fo, foslot_t* slot) {
+    const char* devid = (fo->cfg->devid != NULL) ? fo->cfg->devid[slot->dev] : NULL;
+    const char* cmd;
+    size_t size;
+
+    cmd = sub_expand(fo, fo->cmd[slot->line], devid, &size);
+    if (cmd == NULL) {
+        return OTC_ERR_NOMEM;
+    }
+    return otc_submit(slot->tgt->otc, cmd, size, &sub_oncomplete, slot, NULL);
+}
+
+
+/// Record the result of one device.  Call with fo->mutex held.
+static void sub_devdone(fotarget_t* tgt, size_t dev, int rc) {
+    if (tgt->devstat[dev] == FOSTAT_failed) {
+        tgt->devs_failed--;
+    }
+    tgt->devrc[dev]     = rc;
+    tgt->devstat[dev]   = (rc < 0) ? FOSTAT_failed : FOSTAT_ok;
+    if (rc < 0) tgt->devs_failed++;
+    else        tgt->devs_ok++;
+}
+
+
+/// Start the next device from the work list on an idle slot.  When the work
+/// list is done, either start another round with the failed devices, or
+/// finish the target.  Call with fo->mutex held.
+static void sub_schedule(fanout_t* fo, fotarget_t* tgt) {
+    foslot_t* slot;
+    int rc;
+
+    while (tgt->status == FOSTAT_running) {
+        if (tgt->work_next >= tgt->works) {
+            if (tgt->busy != 0) {
+                return;
+            }
+            if ((tgt->devs_failed == 0) || (tgt->round >= fo->cfg->rounds)) {
+                sub_finish(fo, tgt, (tgt->devs_failed == 0) ? FOSTAT_ok : FOSTAT_failed, 0);
+                return;
+            }
+
+            // Selective retry: run only the devices that failed
+            tgt->round++;
+            tgt->works      = 0;
+            tgt->work_next  = 0;
+            for (size_t i=0; i<fo->devs; i++) {
+                if (tgt->devstat[i] == FOSTAT_failed) {
+                    tgt->work[tgt->works++] = i;
+                }
+            }
+            VERBOSE_PRINTF("%s: retrying %zu devices (round %i)\n", tgt->path, tgt->works, tgt->round+1);
+            continue;
+        }
+
+        // Find an idle slot
+        slot = NULL;
+        for (int i=0; i<fo->slots; i++) {
+            if (tgt->slot[i].busy == false) {
+                slot = &tgt->slot[i];
+                break;
+            }
+        }
+        if (slot == NULL) {
+            return;
+        }
+
+        slot->dev   = tgt->work[tgt->work_next++];
+        slot->line  = 0;
+        rc          = sub_submit(fo, slot);
+        if (rc < 0) {
+            sub_emiterr(fo, tgt, slot->dev, rc, "submit error");
+            sub_devdone(tgt, slot->dev, rc);
+            continue;
+        }
+        slot->busy  = true;
+        tgt->busy++;
+    }
+}
+
+
+static void sub_oncomplete(otc_handle_t otc, const otc_result_t* res, void* user) {
+    foslot_t* slot  = user;
+    fotarget_t* tgt = slot->tgt;
+    fanout_t* fo    = tgt->fo;
+    int rc          = res->rc;
+    char tag[256];
+
+    pthread_mutex_lock(&fo->mutex);
+
+    // Late completions, e.g. aborts after a deadline, are dropped
+    if (tgt->status != FOSTAT_running) {
+        goto sub_oncomplete_END;
+    }
+
+    if (runner_result(&fo->out, sub_tag(fo, tgt, slot->dev, tag, sizeof(tag)), res, fo->cfg->journal, tgt->path) == false) {
+        goto sub_oncomplete_END;
+    }
+
+    // A device stops at its first error, like dterm does
+    if ((rc >= 0) && (++slot->line < fo->cmds)) {
+        rc = sub_submit(fo, slot);
+        if (rc >= 0) {
+            goto sub_oncomplete_END;
+        }
+    }
+
+    sub_devdone(tgt, slot->dev, rc);
+    slot->busy = false;
+    tgt->busy--;
+    sub_schedule(fo, tgt);
+
+    sub_oncomplete_END:
+    pthread_mutex_unlock(&fo->mutex);
+}
+
+
+static void sub_summary(fanout_t* fo) {
+    const fanout_cfg_t* cfg = fo->cfg;
+    struct timespec now;
+    size_t count[5] = { 0, 0, 0, 0, 0 };
+    size_t devs_failed = 0;
+    fotarget_t* tgt;
+    FILE* failed_fp = NULL;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    if ((cfg->devid != NULL) && (cfg->failed_path != NULL)) {
+        failed_fp = fopen(cfg->failed_path, "w");
+        if (failed_fp == NULL) {
+            fprintf(stderr, ERRMARK"could not write %s\n", cfg->failed_path);
+        }
+    }
+
+    for (size_t i=0; i<fo->targets; i++) {
+        tgt = &fo->target[i];
+        count[tgt->status]++;
+        if ((tgt->status != FOSTAT_ok) || cliopt_isverbose()) {
+            if (cfg->devid == NULL) {
+                fprintf(stderr, "  %-32s %-8s rc=%d  %ld ms\n",
+                        tgt->path, fostat_name[tgt->status], tgt->rc, runner_elapsed_ms(&fo->start, &tgt->end));
+            }
+            else {
+                fprintf(stderr, "  %-32s %-8s %zu/%zu devices ok  %ld ms\n",
+                        tgt->path, fostat_name[tgt->status], tgt->devs_ok, fo->devs, runner_elapsed_ms(&fo->start, &tgt->end));
+            }
+        }
+
+        // Failed and untried devices
+        if ((cfg->devid != NULL) && (tgt->devstat != NULL)) {
+            for (size_t d=0; d<fo->devs; d++) {
+                if (tgt->devstat[d] == FOSTAT_ok) {
+                    continue;
+                }
+                devs_failed++;
+                if (failed_fp != NULL) {
+                    fprintf(failed_fp, "%s\n", cfg->devid[d]);
+                }
+                if (cliopt_isverbose()) {
+                    fprintf(stderr, "    %-16s %s rc=%d\n", cfg->devid[d],
+                            (tgt->devstat[d] == FOSTAT_failed) ? "failed" : "not run", tgt->devrc[d]);
+                }
+            }
+        }
+    }
+
+    if (failed_fp != NULL) {
+        fclose(failed_fp);
+    }
+
+    if (cfg->devid != NULL) {
+        fprintf(stderr, "%s: %zu devices x %zu targets: %zu failed.\n",
+                OTTERCAT_PARAM_NAME, fo->devs, fo->targets, devs_failed);
+    }
+    fprintf(stderr, "%s: %zu targets: %zu ok, %zu failed, %zu timeout, %zu noconn.  %ld ms\n",
+            OTTERCAT_PARAM_NAME, fo->targets, count[FOSTAT_ok], count[FOSTAT_failed],
+            count[FOSTAT_timeout], count[FOSTAT_noconn], runner_elapsed_ms(&fo->start, &now));
+}
+
+
+static int sub_target_init(fanout_t* fo, fotarget_t* tgt, const char* path) {
+    tgt->fo     = fo;
+    tgt->path   = path;
+    tgt->status = FOSTAT_running;
+    tgt->end    = fo->start;
+    tgt->devstat= calloc(fo->devs, sizeof(uint8_t));
+    tgt->devrc  = calloc(fo->devs, sizeof(int));
+    tgt->work   = malloc(fo->devs * sizeof(size_t));
+    tgt->slot   = calloc(fo->slots, sizeof(foslot_t));
+    if ((tgt->devstat == NULL) || (tgt->devrc == NULL) || (tgt->work == NULL) || (tgt->slot == NULL)) {
+        return -1;
+    }
+    for (size_t i=0; i<fo->devs; i++) {
+        tgt->work[i] = i;
+    }
+    tgt->works = fo->devs;
+    for (int i=0; i<fo->slots; i++) {
+        tgt->slot[i].tgt = tgt;
+    }
+    return 0;
+}
+
+
+static void sub_target_free(fotarget_t* tgt) {
+    free(tgt->devstat);
+    free(tgt->devrc);
+    free(tgt->work);
+    free(tgt->slot);
+}
+
+
+
+
+void fanout_cfg_init(fanout_cfg_t* cfg) {
+    if (cfg != NULL) {
+        memset(cfg, 0, sizeof(fanout_cfg_t));
+        cfg->fd_out         = 1;
+        cfg->concurrency    = 1;
+    }
+}
+
+
+int fanout_run(const char** targets, size_t num_targets, char* cmdstream, const fanout_cfg_t* cfg) {
+    fanout_t fo;
+    otc_cfg_t otccfg;
+    struct timespec deadline;
+    int rc = 0;
+
+    if ((targets == NULL) || (num_targets == 0) || (cmdstream == NULL) || (cfg == NULL)) {
+        return -1;
+    }
+    if ((cfg->devid != NULL) && (cfg->num_devids == 0)) {
+        return -1;
+    }
+
+    memset(&fo, 0, sizeof(fanout_t));
+    fo.cfg  = cfg;
+    fo.devs = (cfg->devid != NULL) ? cfg->num_devids : 1;
+    fo.slots= (cfg->devid != NULL) ? cfg->concurrency : 1;
+    fo.slots= (fo.slots < 1) ? 1 : fo.slots;
+    if (sub_splitcmds(&fo, cmdstream) <= 0) {
+        free(fo.cmd);
+        return -2;
+    }
+    fo.target = calloc(num_targets, sizeof(fotarget_t));
+    if (fo.target == NULL) {
+        free(fo.cmd);
+        return -1;
+    }
+    pthread_mutex_init(&fo.mutex, NULL);
+    pthread_cond_init(&fo.cond, NULL);
+    runner_outinit(&fo.out, cfg->fd_out, cfg->filter);
+
+    // Commands within a device are sequential, so the window only needs to
+    // cover one command per slot.  The congestion window keeps the slots
+    // from flooding a daemon whose link can't keep up.
+    runner_otccfg(&otccfg, fo.slots, 0, cfg->capture);
+
+    // pthread_cond_timedwait() runs on CLOCK_REALTIME
+    clock_gettime(CLOCK_MONOTONIC, &fo.start);
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec    += cfg->target_timeout_ms / 1000;
+    deadline.tv_nsec   += (long)(cfg->target_timeout_ms % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    // Open every target, then start them all.  fo.mutex is held while
+    // submitting, so no completion is handled before the loop is done.
+    pthread_mutex_lock(&fo.mutex);
+    for (fo.targets=0; fo.targets<num_targets; fo.targets++) {
+        fotarget_t* tgt = &fo.target[fo.targets];
+        fo.running++;
+
+        if (sub_target_init(&fo, tgt, targets[fo.targets]) != 0) {
+            sub_finish(&fo, tgt, FOSTAT_failed, OTC_ERR_NOMEM);
+            continue;
+        }
+
+        rc = otc_open(&tgt->otc, tgt->path, &otccfg);
+        if (rc < 0) {
+            tgt->otc = NULL;
+            runner_emiterr(&fo.out, tgt->path, rc, "socket could not be opened");
+            sub_finish(&fo, tgt, FOSTAT_noconn, rc);
+            continue;
+        }
+
+        sub_schedule(&fo, tgt);
+    }
+
+    // Wait for all targets.  Per-command timeouts and retries are handled by
+    // libottercat, target_timeout_ms bounds the whole job of each target.
+    while (fo.running != 0) {
+        if (cfg->target_timeout_ms <= 0) {
+            pthread_cond_wait(&fo.cond, &fo.mutex);
+        }
+        else if (pthread_cond_timedwait(&fo.cond, &fo.mutex, &deadline) == ETIMEDOUT) {
+            for (size_t i=0; i<fo.targets; i++) {
+                sub_finish(&fo, &fo.target[i], FOSTAT_timeout, OTC_ERR_TIMEOUT);
+            }
+        }
+    }
+    pthread_mutex_unlock(&fo.mutex);
+
+    // Close outside of fo.mutex (see runner.h)
+    rc = 0;
+    for (size_t i=0; i<fo.targets; i++) {
+        if (fo.target[i].otc != NULL) {
+            otc_close(fo.target[i].otc);
+        }
+        if (fo.target[i].status != FOSTAT_ok) {
+            rc = -4;
+        }
+    }
+
+    sub_summary(&fo);
+
+    for (size_t i=0; i<fo.targets; i++) {
+        sub_target_free(&fo.target[i]);
+    }
+    pthread_cond_destroy(&fo.cond);
+    pthread_mutex_destroy(&fo.mutex);
+    free(fo.expbuf);
+    runner_outfree(&fo.out);
+    free(fo.target);
+    free(fo.cmd);
+
+    return rc;
+}
+
+
+
+int fanout_loadtargets(const char* path, char*** targets, size_t* num_targets) {
+    FILE* fp;
+    char* line  = NULL;
+    size_t alloc= 0;
+    ssize_t len;
+    int count   = 0;
+
+    if ((path == NULL) || (targets == NULL) || (num_targets == NULL)) {
+        return -1;
+    }
+
+    fp = fopen(path, "r");
+    if (fp == NULL) {
+        return -2;
+    }
+
+    while ((len = getline(&line, &alloc, fp)) >= 0) {
+        char* start = line;
+        char** newlist;
+
+        while (isspace(*start)) start++;
+        while ((len > 0) && isspace(line[len-1])) line[--len] = 0;
+        if ((*start == 0) || (*start == '#')) {
+            continue;
+        }
+
+        newlist = realloc(*targets, (*num_targets + 1) * sizeof(char*));
+        if (newlist == NULL) {
+            count = -3;
+            break;
+        }
+        *targets = newlist;
+        (*targets)[*num_targets] = strdup(start);
+        if ((*targets)[*num_targets] == NULL) {
+            count = -3;
+            break;
+        }
+        (*num_targets)++;
+        count++;
+    }
+
+    free(line);
+    fclose(fp);
+    return count;
+}
+
+
+
+int fanout_splitdevids(char* list, char*** devids, size_t* num_devids) {
+    const char* delims = ", \t\r\n";
+    char* cursor;
+    char* id;
+    size_t max = 1;
+    size_t alloc;
+    char** newlist;
+    int count = 0;
+
+    if ((list == NULL) || (devids == NULL) || (num_devids == NULL)) {
+        return -1;
+    }
+
+    // Upper bound on the number of IDs, so the list grows only once
+    for (cursor=list; *cursor!=0; cursor++) {
+        max += (strchr(delims, *cursor) != NULL);
+    }
+    alloc   = *num_devids + max;
+    newlist = realloc(*devids, alloc * sizeof(char*));
+    if (newlist == NULL) {
+        return -3;
+    }
+    *devids = newlist;
+
+    for (id=strtok_r(list, delims, &cursor); id!=NULL; id=strtok_r(NULL, delims, &cursor)) {
+        if (*id == '#') {
+            // Comment runs to the end of the line
+            cursor += strcspn(cursor, "\n");
+            continue;
+        }
+        (*devids)[(*num_devids)++] = id;
+        count++;
+    }
+
+    return count;
+}
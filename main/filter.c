@@ -0,0 +1,729 @@
+/* Copyright 2020, JP Norair
+  *
+  * Licensed under the OpenTag License, Version 1.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  * http://www.indigresso.com/wiki/doku.php?id=opentag:license_1_0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  *
+  */
+
+/// The compiled expression is a tree of nodes, stored in one array and
+/// linked by index.  Paths are split into their names at compile time, and
+/// the last name of each path is kept in its quoted form ("name") as the
+/// needle for the presence check.
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#   define _GNU_SOURCE
+#endif
+
+// Application Headers
+#include "filter.h"
+
+// Standard C & POSIX Libraries
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+typedef enum {
+    FN_or       = 0,
+    FN_and      = 1,
+    FN_not      = 2,
+    FN_test     = 3,
+    FN_cmp      = 4
+} FN_Type;
+
+typedef enum {
+    FOP_eq      = 0,
+    FOP_ne      = 1,
+    FOP_lt      = 2,
+    FOP_le      = 3,
+    FOP_gt      = 4,
+    FOP_ge      = 5
+} FOP_Type;
+
+typedef enum {
+    FLIT_string = 0,
+    FLIT_number = 1,
+    FLIT_word   = 2         ///< true, false, null
+} FLIT_Type;
+
+
+typedef struct {
+    char**      name;
+    size_t*     namelen;
+    size_t      depth;
+    char*       needle;     ///< "name" of the last object key, or NULL
+    size_t      needlelen;
+} fpath_t;
+
+
+typedef struct {
+    FN_Type     type;
+    int         left;
+    int         right;
+    fpath_t     path;
+    FOP_Type    op;
+    FLIT_Type   littype;
+    char*       lit;
+    size_t      litlen;
+    double      num;
+} fnode_t;
+
+
+typedef struct {
+    fnode_t*    node;
+    size_t      num_nodes;
+    int         root;       ///< -1: no expression
+    fpath_t*    proj;
+    size_t      num_proj;
+} filter_handle_t;
+
+
+typedef struct {
+    filter_handle_t* flt;
+    const char* expr;
+    const char* cursor;
+    char*       errbuf;
+    size_t      errmax;
+} fparse_t;
+
+
+
+
+/** Raw JSON Scanning <BR>
+  * ========================================================================<BR>
+  * These work on a span of bytes [p, end).  They only find the ends of
+  * values: nothing is decoded or allocated.
+  */
+
+static bool sub_isdelim(uint8_t c) {
+    return (c == ',') || (c == '}') || (c == ']') || (c == ':') || isspace(c);
+}
+
+
+static const uint8_t* sub_skipws(const uint8_t* p, const uint8_t* end) {
+    while ((p < end) && isspace(*p)) {
+        p++;
+    }
+    return p;
+}
+
+
+/// p is just past the opening quote.  Returns the closing quote, or end.
+static const uint8_t* sub_endstring(const uint8_t* p, const uint8_t* end) {
+    const uint8_t* start = p;
+    const uint8_t* quote;
+    const uint8_t* esc;
+
+    while ((quote = memchr(p, '"', (size_t)(end - p))) != NULL) {
+        for (esc=quote; (esc > start) && (esc[-1] == '\\'); esc--);
+        if (((quote - esc) & 1) == 0) {
+            return quote;
+        }
+        p = quote + 1;
+    }
+    return end;
+}
+
+
+/// Returns the byte after the value at p, or NULL if it is truncated
+static const uint8_t* sub_endvalue(const uint8_t* p, const uint8_t* end) {
+    int depth = 0;
+
+    if (p >= end) {
+        return NULL;
+    }
+    if (*p == '"') {
+        p = sub_endstring(p+1, end);
+        return (p < end) ? p+1 : NULL;
+    }
+    if ((*p == '{') || (*p == '[')) {
+        for (; p<end; p++) {
+            if (*p == '"') {
+                p = sub_endstring(p+1, end);
+                if (p >= end) {
+                    return NULL;
+                }
+            }
+            else if ((*p == '{') || (*p == '[')) {
+                depth++;
+            }
+            else if (((*p == '}') || (*p == ']')) && (--depth == 0)) {
+                return p+1;
+            }
+        }
+        return NULL;
+    }
+    while ((p < end) && !sub_isdelim(*p)) {
+        p++;
+    }
+    return p;
+}
+
+
+/// p is at '{'.  Returns the value of the member with this name, or NULL.
+static const uint8_t* sub_member(const uint8_t* p, const uint8_t* end, const char* name, size_t namelen) {
+    const uint8_t* key;
+    const uint8_t* keyend;
+
+    for (p++; ; p++) {
+        p = sub_skipws(p, end);
+        if ((p >= end) || (*p != '"')) {
+            return NULL;
+        }
+        key     = p+1;
+        keyend  = sub_endstring(key, end);
+        if (keyend >= end) {
+            return NULL;
+        }
+        p = sub_skipws(keyend+1, end);
+        if ((p >= end) || (*p != ':')) {
+            return NULL;
+        }
+        p = sub_skipws(p+1, end);
+        if (((size_t)(keyend - key) == namelen) && (memcmp(key, name, namelen) == 0)) {
+            return p;
+        }
+        p = sub_endvalue(p, end);
+        if (p == NULL) {
+            return NULL;
+        }
+        p = sub_skipws(p, end);
+        if ((p >= end) || (*p != ',')) {
+            return NULL;
+        }
+    }
+}
+
+
+/// p is at '['.  Returns the element at index, or NULL.
+static const uint8_t* sub_element(const uint8_t* p, const uint8_t* end, unsigned long index) {
+    p = sub_skipws(p+1, end);
+    if ((p >= end) || (*p == ']')) {
+        return NULL;
+    }
+    while (index-- != 0) {
+        p = sub_endvalue(p, end);
+        if (p == NULL) {
+            return NULL;
+        }
+        p = sub_skipws(p, end);
+        if ((p >= end) || (*p != ',')) {
+            return NULL;
+        }
+        p = sub_skipws(p+1, end);
+    }
+    return p;
+}
+
+
+static const uint8_t* sub_resolve(const fpath_t* path, const uint8_t* line, const uint8_t* end) {
+    const uint8_t* p = sub_skipws(line, end);
+
+    for (size_t i=0; (p != NULL) && (i<path->depth); i++) {
+        if ((p < end) && (*p == '{')) {
+            p = sub_member(p, end, path->name[i], path->namelen[i]);
+        }
+        else if ((p < end) && (*p == '[') && isdigit((uint8_t)path->name[i][0])) {
+            p = sub_element(p, end, strtoul(path->name[i], NULL, 10));
+        }
+        else {
+            p = NULL;
+        }
+    }
+    return ((p != NULL) && (p < end)) ? p : NULL;
+}
+
+
+static bool sub_isword(const uint8_t* v, const uint8_t* end, const char* word, size_t wordlen) {
+    if (((size_t)(end - v) < wordlen) || (memcmp(v, word, wordlen) != 0)) {
+        return false;
+    }
+    return (&v[wordlen] == end) || sub_isdelim(v[wordlen]);
+}
+
+
+
+
+/** Evaluation <BR>
+  * ========================================================================<BR>
+  */
+
+static bool sub_opresult(FOP_Type op, int cmp) {
+    switch (op) {
+        case FOP_eq: return (cmp == 0);
+        case FOP_ne: return (cmp != 0);
+        case FOP_lt: return (cmp < 0);
+        case FOP_le: return (cmp <= 0);
+        case FOP_gt: return (cmp > 0);
+        case FOP_ge: return (cmp >= 0);
+        default:     return false;
+    }
+}
+
+
+static bool sub_compare(const fnode_t* node, const uint8_t* v, const uint8_t* end) {
+    const uint8_t* vend;
+    char numbuf[64];
+    size_t len;
+    double num;
+    int cmp;
+
+    switch (node->littype) {
+    case FLIT_string:
+        if (*v != '"') {
+            break;
+        }
+        vend = sub_endstring(v+1, end);
+        if (vend >= end) {
+            return false;
+        }
+        len = (size_t)(vend - (v+1));
+        cmp = memcmp(v+1, node->lit, (len < node->litlen) ? len : node->litlen);
+        if (cmp == 0) {
+            cmp = (len > node->litlen) - (len < node->litlen);
+        }
+        return sub_opresult(node->op, cmp);
+
+    case FLIT_number:
+        if ((*v != '-') && !isdigit(*v)) {
+            break;
+        }
+        for (len=0; (&v[len] < end) && (len < sizeof(numbuf)-1) && !sub_isdelim(v[len]); len++) {
+            numbuf[len] = (char)v[len];
+        }
+        numbuf[len] = 0;
+        num = strtod(numbuf, NULL);
+        return sub_opresult(node->op, (num > node->num) - (num < node->num));
+
+    case FLIT_word:
+        cmp = sub_isword(v, end, node->lit, node->litlen) ? 0 : 1;
+        return sub_opresult(node->op, cmp);
+    }
+
+    // The value is another JSON type: only != is true
+    return (node->op == FOP_ne);
+}
+
+
+static bool sub_eval(const filter_handle_t* flt, int index, const uint8_t* line, const uint8_t* end) {
+    const fnode_t* node = &flt->node[index];
+    const uint8_t* v;
+
+    switch (node->type) {
+    case FN_or:     return sub_eval(flt, node->left, line, end) || sub_eval(flt, node->right, line, end);
+    case FN_and:    return sub_eval(flt, node->left, line, end) && sub_eval(flt, node->right, line, end);
+    case FN_not:    return !sub_eval(flt, node->left, line, end);
+    default:        break;
+    }
+
+    // A key that isn't anywhere in the line can't be on the path
+    if ((node->path.needle != NULL)
+    && (memmem(line, (size_t)(end - line), node->path.needle, node->path.needlelen) == NULL)) {
+        return false;
+    }
+    v = sub_resolve(&node->path, line, end);
+    if (v == NULL) {
+        return false;
+    }
+    if (node->type == FN_test) {
+        return !sub_isword(v, end, "false", 5) && !sub_isword(v, end, "null", 4);
+    }
+    return sub_compare(node, v, end);
+}
+
+
+static int sub_append(uint8_t** buf, size_t* alloc, size_t* fill, const void* data, size_t size) {
+    if ((*fill + size + 1) > *alloc) {
+        size_t newalloc = (*alloc == 0) ? 256 : *alloc;
+        uint8_t* newbuf;
+        while (newalloc < (*fill + size + 1)) {
+            newalloc *= 2;
+        }
+        newbuf = realloc(*buf, newalloc);
+        if (newbuf == NULL) {
+            return -1;
+        }
+        *buf    = newbuf;
+        *alloc  = newalloc;
+    }
+    memcpy(&(*buf)[*fill], data, size);
+    *fill += size;
+    (*buf)[*fill] = 0;
+    return 0;
+}
+
+
+static int sub_project(const filter_handle_t* flt, const uint8_t* line, const uint8_t* end, uint8_t** buf, size_t* alloc) {
+    const uint8_t* v;
+    const uint8_t* vend;
+    size_t fill = 0;
+    int rc = 0;
+
+    for (size_t i=0; (rc == 0) && (i<flt->num_proj); i++) {
+        if (i != 0) {
+            rc = sub_append(buf, alloc, &fill, "\t", 1);
+        }
+        v = sub_resolve(&flt->proj[i], line, end);
+        if ((v != NULL) && (*v == '"')) {
+            vend = sub_endstring(v+1, end);
+            rc  |= sub_append(buf, alloc, &fill, v+1, (size_t)(vend - (v+1)));
+        }
+        else if ((v != NULL) && ((vend = sub_endvalue(v, end)) != NULL)) {
+            rc  |= sub_append(buf, alloc, &fill, v, (size_t)(vend - v));
+        }
+        else {
+            rc  |= sub_append(buf, alloc, &fill, "null", 4);
+        }
+    }
+    return (rc == 0) ? (int)fill : -1;
+}
+
+
+
+
+/** Compiler <BR>
+  * ========================================================================<BR>
+  */
+
+static int sub_error(fparse_t* ps, const char* msg) {
+    if ((ps->errbuf != NULL) && (ps->errmax != 0)) {
+        snprintf(ps->errbuf, ps->errmax, "%s at column %d of \"%s\"", msg, (int)(ps->cursor - ps->expr) + 1, ps->expr);
+    }
+    return -1;
+}
+
+
+static void sub_skipspace(fparse_t* ps) {
+    while (isspace((uint8_t)*ps->cursor)) {
+        ps->cursor++;
+    }
+}
+
+
+static bool sub_isnamechar(char c) {
+    return isalnum((uint8_t)c) || (c == '_') || (c == '-');
+}
+
+
+static void sub_freepath(fpath_t* path) {
+    for (size_t i=0; i<path->depth; i++) {
+        free(path->name[i]);
+    }
+    free(path->name);
+    free(path->namelen);
+    free(path->needle);
+}
+
+
+static int sub_parsepath(fparse_t* ps, fpath_t* path) {
+    const char* start;
+    char** newname;
+    size_t* newlen;
+    size_t len;
+
+    memset(path, 0, sizeof(fpath_t));
+    sub_skipspace(ps);
+    do {
+        if (path->depth != 0) {
+            ps->cursor++;
+        }
+        for (start=ps->cursor; sub_isnamechar(*ps->cursor); ps->cursor++);
+        len = (size_t)(ps->cursor - start);
+        if (len == 0) {
+            return sub_error(ps, "expected a path");
+        }
+        newname = realloc(path->name, (path->depth+1) * sizeof(char*));
+        if (newname == NULL) {
+            return sub_error(ps, "out of memory");
+        }
+        path->name  = newname;
+        newlen      = realloc(path->namelen, (path->depth+1) * sizeof(size_t));
+        if (newlen == NULL) {
+            return sub_error(ps, "out of memory");
+        }
+        path->namelen = newlen;
+        path->name[path->depth] = strndup(start, len);
+        if (path->name[path->depth] == NULL) {
+            return sub_error(ps, "out of memory");
+        }
+        path->namelen[path->depth++] = len;
+    } while (*ps->cursor == '.');
+
+    // An array index can't be searched for, but an object key can
+    if (!isdigit((uint8_t)*start)) {
+        path->needlelen = len + 2;
+        path->needle    = malloc(len + 3);
+        if (path->needle == NULL) {
+            return sub_error(ps, "out of memory");
+        }
+        sprintf(path->needle, "\"%.*s\"", (int)len, start);
+    }
+    return 0;
+}
+
+
+static int sub_newnode(fparse_t* ps, FN_Type type, int left, int right) {
+    fnode_t* newnode = realloc(ps->flt->node, (ps->flt->num_nodes+1) * sizeof(fnode_t));
+
+    if (newnode == NULL) {
+        return sub_error(ps, "out of memory");
+    }
+    ps->flt->node = newnode;
+    newnode = &ps->flt->node[ps->flt->num_nodes];
+    memset(newnode, 0, sizeof(fnode_t));
+    newnode->type   = type;
+    newnode->left   = left;
+    newnode->right  = right;
+    return (int)ps->flt->num_nodes++;
+}
+
+
+static int sub_parseliteral(fparse_t* ps, fnode_t* node) {
+    const char* start;
+    char* endp;
+
+    sub_skipspace(ps);
+    start = ps->cursor;
+
+    if (*start == '"') {
+        for (ps->cursor++; (*ps->cursor != '"') && (*ps->cursor != 0); ps->cursor++) {
+            if ((ps->cursor[0] == '\\') && (ps->cursor[1] != 0)) {
+                ps->cursor++;
+            }
+        }
+        if (*ps->cursor != '"') {
+            return sub_error(ps, "unterminated string");
+        }
+        node->littype   = FLIT_string;
+        node->litlen    = (size_t)(ps->cursor - (start+1));
+        node->lit       = strndup(start+1, node->litlen);
+        ps->cursor++;
+    }
+    else if ((*start == '-') || isdigit((uint8_t)*start)) {
+        node->littype   = FLIT_number;
+        node->num       = strtod(start, &endp);
+        if (endp == start) {
+            return sub_error(ps, "invalid number");
+        }
+        ps->cursor      = endp;
+        node->lit       = strndup(start, (size_t)(endp - start));
+    }
+    else {
+        for (; isalpha((uint8_t)*ps->cursor); ps->cursor++);
+        node->littype   = FLIT_word;
+        node->litlen    = (size_t)(ps->cursor - start);
+        if (!(((node->litlen == 4) && (strncmp(start, "true", 4) == 0))
+           || ((node->litlen == 5) && (strncmp(start, "false", 5) == 0))
+           || ((node->litlen == 4) && (strncmp(start, "null", 4) == 0)))) {
+            ps->cursor = start;
+            return sub_error(ps, "expected a string, number, true, false or null");
+        }
+        if (node->op > FOP_ne) {
+            ps->cursor = start;
+            return sub_error(ps, "true, false and null can only be compared with == or !=");
+        }
+        node->lit       = strndup(start, node->litlen);
+    }
+    return (node->lit != NULL) ? 0 : sub_error(ps, "out of memory");
+}
+
+
+static int sub_parseexpr(fparse_t* ps);
+
+static int sub_parsefactor(fparse_t* ps) {
+    static const struct { const char* str; FOP_Type op; } ops[] = {
+        { "==", FOP_eq }, { "!=", FOP_ne }, { "<=", FOP_le }, { ">=", FOP_ge }, { "<", FOP_lt }, { ">", FOP_gt }
+    };
+    fpath_t path;
+    int index;
+
+    sub_skipspace(ps);
+    if (*ps->cursor == '!') {
+        ps->cursor++;
+        index = sub_parsefactor(ps);
+        return (index < 0) ? index : sub_newnode(ps, FN_not, index, -1);
+    }
+    if (*ps->cursor == '(') {
+        ps->cursor++;
+        index = sub_parseexpr(ps);
+        if (index < 0) {
+            return index;
+        }
+        sub_skipspace(ps);
+        if (*ps->cursor != ')') {
+            return sub_error(ps, "expected ')'");
+        }
+        ps->cursor++;
+        return index;
+    }
+
+    if (sub_parsepath(ps, &path) != 0) {
+        sub_freepath(&path);
+        return -1;
+    }
+    index = sub_newnode(ps, FN_test, -1, -1);
+    if (index < 0) {
+        sub_freepath(&path);
+        return -1;
+    }
+    ps->flt->node[index].path = path;
+
+    sub_skipspace(ps);
+    for (size_t i=0; i<(sizeof(ops)/sizeof(ops[0])); i++) {
+        size_t oplen = strlen(ops[i].str);
+        if (strncmp(ps->cursor, ops[i].str, oplen) == 0) {
+            ps->cursor += oplen;
+            ps->flt->node[index].type   = FN_cmp;
+            ps->flt->node[index].op     = ops[i].op;
+            return (sub_parseliteral(ps, &ps->flt->node[index]) == 0) ? index : -1;
+        }
+    }
+    if (*ps->cursor == '=') {
+        return sub_error(ps, "use == to compare");
+    }
+    return index;
+}
+
+
+static int sub_parseterm(fparse_t* ps) {
+    int left, right;
+
+    left = sub_parsefactor(ps);
+    while (left >= 0) {
+        sub_skipspace(ps);
+        if (strncmp(ps->cursor, "&&", 2) != 0) {
+            break;
+        }
+        ps->cursor += 2;
+        right = sub_parsefactor(ps);
+        left  = (right < 0) ? right : sub_newnode(ps, FN_and, left, right);
+    }
+    return left;
+}
+
+
+static int sub_parseexpr(fparse_t* ps) {
+    int left, right;
+
+    left = sub_parseterm(ps);
+    while (left >= 0) {
+        sub_skipspace(ps);
+        if (strncmp(ps->cursor, "||", 2) != 0) {
+            break;
+        }
+        ps->cursor += 2;
+        right = sub_parseterm(ps);
+        left  = (right < 0) ? right : sub_newnode(ps, FN_or, left, right);
+    }
+    return left;
+}
+
+
+
+
+/** Public Functions <BR>
+  * ========================================================================<BR>
+  */
+
+filter_t filter_compile(const char* expr, const char* project, char* errbuf, size_t errmax) {
+    filter_handle_t* flt;
+    fparse_t ps;
+
+    flt = calloc(1, sizeof(filter_handle_t));
+    if (flt == NULL) {
+        return NULL;
+    }
+    flt->root   = -1;
+    ps.flt      = flt;
+    ps.errbuf   = errbuf;
+    ps.errmax   = errmax;
+
+    if (expr != NULL) {
+        ps.expr     = expr;
+        ps.cursor   = expr;
+        flt->root   = sub_parseexpr(&ps);
+        if (flt->root < 0) {
+            goto filter_compile_ERR;
+        }
+        sub_skipspace(&ps);
+        if (*ps.cursor != 0) {
+            sub_error(&ps, "unexpected text");
+            goto filter_compile_ERR;
+        }
+    }
+
+    if (project != NULL) {
+        ps.expr     = project;
+        ps.cursor   = project;
+        do {
+            fpath_t* newproj = realloc(flt->proj, (flt->num_proj+1) * sizeof(fpath_t));
+            if (newproj == NULL) {
+                goto filter_compile_ERR;
+            }
+            flt->proj = newproj;
+            if (*ps.cursor == ',') {
+                ps.cursor++;
+            }
+            if (sub_parsepath(&ps, &flt->proj[flt->num_proj++]) != 0) {
+                goto filter_compile_ERR;
+            }
+            sub_skipspace(&ps);
+        } while (*ps.cursor == ',');
+        if (*ps.cursor != 0) {
+            sub_error(&ps, "unexpected text");
+            goto filter_compile_ERR;
+        }
+    }
+    return flt;
+
+    filter_compile_ERR:
+    filter_free(flt);
+    return NULL;
+}
+
+
+void filter_free(filter_t handle) {
+    filter_handle_t* flt = handle;
+
+    if (flt != NULL) {
+        for (size_t i=0; i<flt->num_nodes; i++) {
+            sub_freepath(&flt->node[i].path);
+            free(flt->node[i].lit);
+        }
+        for (size_t i=0; i<flt->num_proj; i++) {
+            sub_freepath(&flt->proj[i]);
+        }
+        free(flt->node);
+        free(flt->proj);
+        free(flt);
+    }
+}
+
+
+int filter_line(filter_t handle, const uint8_t* line, size_t len, uint8_t** buf, size_t* alloc, const uint8_t** out) {
+    filter_handle_t* flt = handle;
+    int rc;
+
+    if ((flt != NULL) && (flt->root >= 0) && !sub_eval(flt, flt->root, line, &line[len])) {
+        return -1;
+    }
+    if ((flt == NULL) || (flt->num_proj == 0)) {
+        *out = line;
+        return (int)len;
+    }
+    rc = sub_project(flt, line, &line[len], buf, alloc);
+    if (rc >= 0) {
+        *out = *buf;
+    }
+    return rc;
+}
@@ -0,0 +1,285 @@
+/* Copyright 2020, JP Norair
+  *
+  * Licensed under the OpenTag License, Version 1.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  * http://www.indigresso.com/wiki/doku.php?id=opentag:license_1_0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  *
+  */
+
+/// Frame bridge.  Each direction has an input buffer, which collects reads
+/// until a whole line or frame is there, and an output buffer, which is
+/// sent with one write per read.  The daemon's lines are scanned once here,
+/// to fill in the frame header, so that framed clients don't need to.
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#   define _GNU_SOURCE
+#endif
+
+// Application Headers
+#include "framebridge.h"
+#include "debug.h"
+#include "ottercat_cfg.h"
+#include "sockpush.h"
+#include "unixsrv.h"
+
+// Standard C & POSIX Libraries
+#include <errno.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+
+#define FB_CHUNK        (64*1024)
+#define FB_MAXPENDING   (OTTERCAT_PARAM_MAXLINE + SP_FRAME_HDRSIZE + FB_CHUNK)
+
+
+typedef struct {
+    uint8_t*    buf;
+    size_t      fill;
+    size_t      alloc;
+} fbbuf_t;
+
+typedef struct {
+    fbbuf_t     dmn_in;
+    fbbuf_t     cli_in;
+    fbbuf_t     out;
+} fbridge_t;
+
+
+/** Buffers and Sockets <BR>
+  * ========================================================================<BR>
+  */
+
+static int sub_reserve(fbbuf_t* b, size_t more) {
+    return unixsrv_grow(&b->buf, &b->alloc, b->fill + more, FB_CHUNK, FB_MAXPENDING);
+}
+
+
+/// Read what is available into b.  Returns -1 when the peer has gone.
+static int sub_fill(int fd, fbbuf_t* b) {
+    ssize_t rc;
+
+    if (sub_reserve(b, FB_CHUNK) != 0) {
+        ERR_PRINTF("framebridge: message longer than %zu bytes\n", (size_t)OTTERCAT_PARAM_MAXLINE);
+        return -1;
+    }
+    rc = recv(fd, &b->buf[b->fill], FB_CHUNK, 0);
+    if (rc <= 0) {
+        return ((rc < 0) && (errno == EINTR)) ? 0 : -1;
+    }
+    b->fill += (size_t)rc;
+    return 0;
+}
+
+
+static void sub_consume(fbbuf_t* b, size_t used) {
+    b->fill -= used;
+    memmove(b->buf, &b->buf[used], b->fill);
+}
+
+
+
+
+/** Translation <BR>
+  * ========================================================================<BR>
+  */
+
+/// Find the value of "key" in a line.  Returns a pointer past the ':' and
+/// any whitespace, or NULL.
+static const uint8_t* sub_findvalue(const uint8_t* line, const uint8_t* end, const char* qkey, size_t qkeylen) {
+    const uint8_t* cursor;
+
+    cursor = memmem(line, (size_t)(end - line), qkey, qkeylen);
+    if (cursor == NULL) {
+        return NULL;
+    }
+    for (cursor+=qkeylen; (cursor < end) && ((*cursor == ' ') || (*cursor == ':') || (*cursor == '\t')); cursor++);
+    return (cursor < end) ? cursor : NULL;
+}
+
+
+static void sub_classify(const uint8_t* line, const uint8_t* end, uint8_t* type, uint32_t* sid) {
+    const uint8_t* val;
+
+    *type   = SP_FRAME_MSG;
+    *sid    = 0;
+
+    val = sub_findvalue(line, end, "\"type\"", 6);
+    if (val != NULL) {
+        if (((end - val) >= 5) && (memcmp(val, "\"ack\"", 5) == 0)) {
+            *type = SP_FRAME_ACK;
+        }
+        else if (((end - val) >= 8) && (memcmp(val, "\"rxstat\"", 8) == 0)) {
+            *type = SP_FRAME_RXSTAT;
+        }
+    }
+    val = sub_findvalue(line, end, "\"sid\"", 5);
+    while ((val != NULL) && (val < end) && (*val >= '0') && (*val <= '9')) {
+        *sid = (*sid * 10) + (uint32_t)(*val++ - '0');
+    }
+}
+
+
+/// Daemon lines to client frames.  Returns -1 when the client has gone.
+static int sub_tofront(fbridge_t* fb, int fd_cli) {
+    fbbuf_t* in = &fb->dmn_in;
+    const uint8_t* line;
+    const uint8_t* end;
+    const uint8_t* term;
+    uint8_t type;
+    uint32_t sid;
+    size_t used = 0;
+
+    fb->out.fill = 0;
+    while (used < in->fill) {
+        line = &in->buf[used];
+        for (term=line; (term < &in->buf[in->fill]) && (*term != '\n') && (*term != 0); term++);
+        if (term == &in->buf[in->fill]) {
+            break;
+        }
+        used = (size_t)(term - in->buf) + 1;
+        for (end=term; (end > line) && (end[-1] == '\r'); end--);
+        if (end == line) {
+            continue;
+        }
+
+        if (sub_reserve(&fb->out, SP_FRAME_HDRSIZE + (size_t)(end - line)) != 0) {
+            return -1;
+        }
+        sub_classify(line, end, &type, &sid);
+        sp_frame_pack(&fb->out.buf[fb->out.fill], type, sid, (size_t)(end - line));
+        memcpy(&fb->out.buf[fb->out.fill + SP_FRAME_HDRSIZE], line, (size_t)(end - line));
+        fb->out.fill += SP_FRAME_HDRSIZE + (size_t)(end - line);
+    }
+    sub_consume(in, used);
+    return unixsrv_sendall(fd_cli, fb->out.buf, fb->out.fill);
+}
+
+
+/// Client frames to daemon lines.  Returns -1 when the daemon has gone.
+static int sub_toback(fbridge_t* fb, int fd_dmn) {
+    fbbuf_t* in = &fb->cli_in;
+    uint8_t type;
+    uint32_t sid;
+    size_t size;
+    size_t used = 0;
+
+    fb->out.fill = 0;
+    while ((in->fill - used) >= SP_FRAME_HDRSIZE) {
+        if (sp_frame_unpack(&in->buf[used], &type, &sid, &size) != 0) {
+            used++;
+            continue;
+        }
+        if ((in->fill - used) < (SP_FRAME_HDRSIZE + size)) {
+            break;
+        }
+        if (sub_reserve(&fb->out, size + 1) != 0) {
+            return -1;
+        }
+        memcpy(&fb->out.buf[fb->out.fill], &in->buf[used + SP_FRAME_HDRSIZE], size);
+        fb->out.fill += size;
+        fb->out.buf[fb->out.fill++] = '\n';
+        used += SP_FRAME_HDRSIZE + size;
+    }
+    sub_consume(in, used);
+    return unixsrv_sendall(fd_dmn, fb->out.buf, fb->out.fill);
+}
+
+
+static void sub_session(fbridge_t* fb, int fd_cli, const char* daemon_path) {
+    struct sockaddr_un addr;
+    struct pollfd pfd[2];
+    int fd_dmn;
+
+    fd_dmn = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd_dmn < 0) {
+        return;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", daemon_path);
+    if (connect(fd_dmn, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        fprintf(stderr, "framebridge: cannot connect to %s\n", daemon_path);
+        close(fd_dmn);
+        return;
+    }
+
+    fb->dmn_in.fill = 0;
+    fb->cli_in.fill = 0;
+    pfd[0].fd       = fd_dmn;
+    pfd[0].events   = POLLIN;
+    pfd[1].fd       = fd_cli;
+    pfd[1].events   = POLLIN;
+    while (unixsrv_stopped() == false) {
+        if (poll(pfd, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if (pfd[0].revents != 0) {
+            if ((sub_fill(fd_dmn, &fb->dmn_in) != 0) || (sub_tofront(fb, fd_cli) != 0)) {
+                break;
+            }
+        }
+        if (pfd[1].revents != 0) {
+            if ((sub_fill(fd_cli, &fb->cli_in) != 0) || (sub_toback(fb, fd_dmn) != 0)) {
+                break;
+            }
+        }
+    }
+    close(fd_dmn);
+}
+
+
+
+
+/** Public Functions <BR>
+  * ========================================================================<BR>
+  */
+
+int framebridge_run(const char* listen_path, const char* daemon_path) {
+    fbridge_t fb;
+    int fd_srv, fd_cli;
+
+    if ((listen_path == NULL) || (daemon_path == NULL)) {
+        return -1;
+    }
+    fd_srv = unixsrv_listen(listen_path, 4);
+    if (fd_srv < 0) {
+        fprintf(stderr, "framebridge: cannot listen on %s\n", listen_path);
+        return -2;
+    }
+    unixsrv_onstop();
+
+    memset(&fb, 0, sizeof(fb));
+    while (unixsrv_stopped() == false) {
+        fd_cli = unixsrv_accept(fd_srv);
+        if (fd_cli < 0) {
+            break;
+        }
+        sub_session(&fb, fd_cli, daemon_path);
+        close(fd_cli);
+    }
+
+    close(fd_srv);
+    unlink(listen_path);
+    free(fb.dmn_in.buf);
+    free(fb.cli_in.buf);
+    free(fb.out.buf);
+    return 0;
+}
@@ -0,0 +1,1457 @@
+/* Copyright 2020, JP Norair
+  *
+  * Licensed under the OpenTag License, Version 1.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  * http://www.indigresso.com/wiki/doku.php?id=opentag:license_1_0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  *
+  */
+
+/// libottercat engine.
+///
+/// Each handle has one engine thread.  The engine owns the in-flight state
+/// (ack queue, rxstat queue, sid table) and is the only thread that sends on
+/// the socket.  Other threads touch only the send queue, the completion
+/// queue and the request pool, which are guarded by otc->mutex.  Inbound
+/// lines are handed over by the sockpush subscriber through a separate inbox
+/// so that the sockpush I/O thread never waits on the engine.
+///
+/// otter acks commands in the order it receives them, so acks are matched
+/// to the oldest command awaiting an ack (checked against the "cmd" name in
+/// the ack).  rxstats are matched by sid.
+///
+/// With OTC_FLAG_AIMD, the number of commands in flight is limited by a
+/// congestion window rather than by cfg.window alone.  The window starts at
+/// one command and grows by one per clean completion up to a threshold (slow
+/// start), then by 1/cwnd per clean completion.  A streamed session counts
+/// once, when it ends, however many frames it had.  A timeout or a qual failure
+/// halves it.  Losses of commands sent before the last decrease belong to the
+/// same congestion event, so they don't decrease it again.
+///
+/// Queued commands wait in one send queue per priority class.  The urgent
+/// class always goes first.  The other classes share what's left by deficit
+/// round robin, in proportion to their weights, so that bulk traffic keeps
+/// moving while higher classes get ahead of it.
+///
+/// Commands named in cfg.coalesce are coalesced: one that is identical to a
+/// command already awaiting its ack or rxstat isn't sent.  It joins that
+/// command as a follower instead, and gets a copy of each of its results.
+
+// Application Headers
+#include "libottercat.h"
+#include "capture.h"
+#include "debug.h"
+#include "devmgr_json.h"
+#include "sockpush.h"
+
+// HB Libraries
+#include <cJSON.h>
+
+// Standard C & POSIX Libraries
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+
+#define OTC_SIDBUCKETS      64
+#define OTC_HOLDOFF_MS      10
+
+
+typedef enum {
+    OTC_RS_free     = 0,
+    OTC_RS_queued   = 1,
+    OTC_RS_ack      = 2,
+    OTC_RS_rx       = 3,
+    OTC_RS_done     = 4,
+    OTC_RS_tomb     = 5,
+    OTC_RS_joined   = 6
+} OTC_RS_Type;
+
+
+typedef struct otc_link {
+    struct otc_link* prev;
+    struct otc_link* next;
+} otc_link_t;
+
+
+// link must be the first element: requests are cast from their links
+typedef struct otc_req {
+    otc_link_t      link;
+    struct otc_req* hnext;
+    otc_result_t    res;
+    otc_link_t      followers;
+    otc_callback_t  callback;
+    OTC_RS_Type     state;
+    bool            streaming;
+    int             stalls;
+    int             cls;
+    uint64_t        sendseq;
+    struct timespec queued_at;
+    struct timespec deadline;
+
+    // Buffers are kept when a request returns to the pool
+    char*           cmdbuf;
+    size_t          cmdalloc;
+    size_t          cmdsize;
+    char*           ackbuf;
+    size_t          ackalloc;
+    char*           rxbuf;
+    size_t          rxalloc;
+    char*           framebuf;
+    size_t          framealloc;
+} otc_req_t;
+
+
+typedef struct otc_line {
+    struct otc_line* next;
+    size_t          size;
+    char            data[];
+} otc_line_t;
+
+
+typedef struct {
+    otc_link_t      q;
+    int             deficit;
+    otc_classstats_t stats;
+} otc_class_t;
+
+
+typedef struct {
+    sp_handle_t     sp;
+    sp_subscr_t     subscr;
+    otc_cfg_t       cfg;
+    pthread_t       engine;
+    int             wake[2];
+
+    // Shared: guarded by mutex
+    pthread_mutex_t mutex;
+    pthread_cond_t  done_cond;
+    bool            closing;
+    uint64_t        next_id;
+    int             pending;
+    otc_link_t      freeq;
+    otc_class_t     sendq[OTC_CLASSES];
+    int             drr;
+    otc_link_t      compq;
+
+    // Inbound lines from sockpush: guarded by inbox_mutex
+    pthread_mutex_t inbox_mutex;
+    otc_line_t*     inbox_head;
+    otc_line_t**    inbox_tail;
+
+    // Engine-private
+    otc_link_t      ackq;
+    otc_link_t      rxq;
+    int             inflight;
+    bool            holdoff;
+    struct timespec holdoff_until;
+    struct timespec pace_next;
+    long            pace_ns;
+    double          cwnd;
+    double          ssthresh;
+    uint64_t        sendseq;
+    uint64_t        recover_seq;
+    otc_req_t*      sidtab[OTC_SIDBUCKETS];
+} otc_t;
+
+
+
+
+/** Local Utilities <BR>
+  * ========================================================================<BR>
+  */
+
+static void sub_list_init(otc_link_t* list) {
+    list->prev = list;
+    list->next = list;
+}
+
+static bool sub_list_isempty(otc_link_t* list) {
+    return (list->next == list);
+}
+
+static void sub_list_remove(otc_link_t* link) {
+    link->prev->next = link->next;
+    link->next->prev = link->prev;
+    link->prev = link;
+    link->next = link;
+}
+
+static void sub_list_insert(otc_link_t* after, otc_link_t* link) {
+    link->prev          = after;
+    link->next          = after->next;
+    after->next->prev   = link;
+    after->next         = link;
+}
+
+static void sub_list_pushback(otc_link_t* list, otc_link_t* link) {
+    sub_list_insert(list->prev, link);
+}
+
+static void sub_list_pushfront(otc_link_t* list, otc_link_t* link) {
+    sub_list_insert(list, link);
+}
+
+static otc_req_t* sub_list_popfront(otc_link_t* list) {
+    otc_link_t* link;
+
+    if (sub_list_isempty(list)) {
+        return NULL;
+    }
+    link = list->next;
+    sub_list_remove(link);
+    return (otc_req_t*)link;
+}
+
+
+static int sub_buf_put(char** buf, size_t* alloc, const char* src, size_t size) {
+    if ((*buf == NULL) || (*alloc < (size+1))) {
+        char* newbuf = realloc(*buf, size+1);
+        if (newbuf == NULL) {
+            return -1;
+        }
+        *buf    = newbuf;
+        *alloc  = size+1;
+    }
+    memcpy(*buf, src, size);
+    (*buf)[size] = 0;
+    return 0;
+}
+
+
+static void sub_timespec_addms(struct timespec* ts, int ms) {
+    ts->tv_sec  += ms / 1000;
+    ts->tv_nsec += (long)(ms % 1000) * 1000000;
+    if (ts->tv_nsec >= 1000000000) {
+        ts->tv_nsec -= 1000000000;
+        ts->tv_sec  += 1;
+    }
+}
+
+static void sub_timespec_addns(struct timespec* ts, long ns) {
+    ts->tv_sec  += ns / 1000000000;
+    ts->tv_nsec += ns % 1000000000;
+    if (ts->tv_nsec >= 1000000000) {
+        ts->tv_nsec -= 1000000000;
+        ts->tv_sec  += 1;
+    }
+}
+
+static bool sub_timespec_passed(const struct timespec* now, const struct timespec* ts) {
+    return (now->tv_sec > ts->tv_sec) \
+        || ((now->tv_sec == ts->tv_sec) && (now->tv_nsec >= ts->tv_nsec));
+}
+
+static int sub_timespec_msuntil(const struct timespec* now, const struct timespec* ts) {
+    long long ms;
+
+    if (sub_timespec_passed(now, ts)) {
+        return 0;
+    }
+    ms  = (long long)(ts->tv_sec - now->tv_sec) * 1000;
+    ms += (ts->tv_nsec - now->tv_nsec + 999999) / 1000000;
+    return (ms > INT32_MAX) ? INT32_MAX : (int)ms;
+}
+
+
+static bool sub_cmdname_matches(const char* name, const char* cmd) {
+    size_t len = strcspn(cmd, " \t\r\n");
+    return (strncmp(name, cmd, len) == 0) && (name[len] == 0);
+}
+
+
+static void sub_wake(otc_t* otc) {
+    char token = 1;
+
+    // Pipe is non-blocking: if it's full the engine is already awake
+    if (write(otc->wake[1], &token, 1) < 0) {
+        return;
+    }
+}
+
+
+
+
+/** Request Pool <BR>
+  * ========================================================================<BR>
+  * Requests are recycled through freeq, along with their buffers, so that
+  * steady-state operation doesn't allocate per command.
+  */
+
+static otc_req_t* sub_req_new(otc_t* otc) {
+    otc_req_t* req;
+
+    pthread_mutex_lock(&otc->mutex);
+    req = sub_list_popfront(&otc->freeq);
+    pthread_mutex_unlock(&otc->mutex);
+
+    if (req == NULL) {
+        req = calloc(1, sizeof(otc_req_t));
+        if (req == NULL) {
+            return NULL;
+        }
+        sub_list_init(&req->link);
+    }
+    sub_list_init(&req->followers);
+
+    req->hnext      = NULL;
+    req->callback   = NULL;
+    req->state      = OTC_RS_free;
+    req->streaming  = false;
+    req->stalls     = 0;
+    req->cmdsize    = 0;
+    memset(&req->res, 0, sizeof(otc_result_t));
+
+    return req;
+}
+
+
+static void sub_req_free(otc_t* otc, otc_req_t* req) {
+    req->state = OTC_RS_free;
+    pthread_mutex_lock(&otc->mutex);
+    sub_list_pushfront(&otc->freeq, &req->link);
+    pthread_mutex_unlock(&otc->mutex);
+}
+
+
+static void sub_req_destroy(otc_req_t* req) {
+    free(req->cmdbuf);
+    free(req->ackbuf);
+    free(req->rxbuf);
+    free(req->framebuf);
+    free(req);
+}
+
+
+static void sub_list_destroy(otc_link_t* list) {
+    otc_req_t* req;
+    while ((req = sub_list_popfront(list)) != NULL) {
+        sub_req_destroy(req);
+    }
+}
+
+
+
+
+/** Send Scheduler <BR>
+  * ========================================================================<BR>
+  * All of these are called with otc->mutex held.
+  */
+
+static void sub_sendq_push(otc_t* otc, otc_req_t* req, bool front) {
+    otc_class_t* cls = &otc->sendq[req->cls];
+
+    if (front) {
+        sub_list_pushfront(&cls->q, &req->link);
+    }
+    else {
+        sub_list_pushback(&cls->q, &req->link);
+    }
+    cls->stats.depth++;
+    if (cls->stats.depth > cls->stats.depth_max) {
+        cls->stats.depth_max = cls->stats.depth;
+    }
+}
+
+
+static otc_req_t* sub_sendq_take(otc_t* otc, int i) {
+    otc_class_t* cls = &otc->sendq[i];
+    otc_req_t* req;
+
+    req = sub_list_popfront(&cls->q);
+    if (req != NULL) {
+        cls->stats.depth--;
+    }
+    return req;
+}
+
+
+/// Pick the next command to send: strict priority for OTC_CLASS_URGENT, then
+/// deficit round robin over the other classes.  Each visit to a class adds
+/// its weight to its deficit, and each command sent from it costs one.
+static otc_req_t* sub_sendq_pop(otc_t* otc) {
+    otc_class_t* cls;
+    otc_req_t* req;
+    int visits;
+
+    req = sub_sendq_take(otc, OTC_CLASS_URGENT);
+    if (req != NULL) {
+        return req;
+    }
+
+    for (visits=0; visits<=(2*OTC_CLASSES); visits++) {
+        cls = &otc->sendq[otc->drr];
+        if (sub_list_isempty(&cls->q)) {
+            // Idle classes don't bank credit
+            cls->deficit = 0;
+        }
+        else if (cls->deficit > 0) {
+            cls->deficit--;
+            return sub_sendq_take(otc, otc->drr);
+        }
+        otc->drr = (otc->drr < (OTC_CLASSES-1)) ? (otc->drr + 1) : (OTC_CLASS_URGENT + 1);
+        otc->sendq[otc->drr].deficit += otc->cfg.weight[otc->drr];
+    }
+
+    return NULL;
+}
+
+
+/// A command taken by sub_sendq_pop() couldn't be sent: put it back
+static void sub_sendq_unpop(otc_t* otc, otc_req_t* req) {
+    sub_sendq_push(otc, req, true);
+    if (req->cls != OTC_CLASS_URGENT) {
+        otc->sendq[req->cls].deficit++;
+    }
+}
+
+
+static void sub_sendq_sent(otc_t* otc, otc_req_t* req, const struct timespec* now) {
+    otc_classstats_t* stats = &otc->sendq[req->cls].stats;
+    long long wait_ms;
+
+    wait_ms  = (long long)(now->tv_sec - req->queued_at.tv_sec) * 1000;
+    wait_ms += (now->tv_nsec - req->queued_at.tv_nsec) / 1000000;
+    wait_ms  = (wait_ms < 0) ? 0 : wait_ms;
+
+    stats->sent++;
+    stats->wait_ms_total += (uint64_t)wait_ms;
+    if (wait_ms > stats->wait_ms_max) {
+        stats->wait_ms_max = (int)wait_ms;
+    }
+}
+
+
+
+
+/** Engine: Request State Transitions <BR>
+  * ========================================================================<BR>
+  */
+
+static void sub_sid_insert(otc_t* otc, otc_req_t* req) {
+    otc_req_t** slot = &otc->sidtab[req->res.sid % OTC_SIDBUCKETS];
+
+    // Append, so the oldest request with a given sid is found first
+    while (*slot != NULL) {
+        slot = &(*slot)->hnext;
+    }
+    req->hnext  = NULL;
+    *slot       = req;
+}
+
+
+static void sub_sid_remove(otc_t* otc, otc_req_t* req) {
+    otc_req_t** slot = &otc->sidtab[req->res.sid % OTC_SIDBUCKETS];
+
+    while (*slot != NULL) {
+        if (*slot == req) {
+            *slot = req->hnext;
+            break;
+        }
+        slot = &(*slot)->hnext;
+    }
+    req->hnext = NULL;
+}
+
+
+static otc_req_t* sub_sid_find(otc_t* otc, uint32_t sid) {
+    otc_req_t* req = otc->sidtab[sid % OTC_SIDBUCKETS];
+
+    while ((req != NULL) && (req->res.sid != sid)) {
+        req = req->hnext;
+    }
+    return req;
+}
+
+
+static void sub_unflight(otc_t* otc, otc_req_t* req) {
+    if (req->state == OTC_RS_rx) {
+        sub_sid_remove(otc, req);
+    }
+    sub_list_remove(&req->link);
+    otc->inflight -= (req->state != OTC_RS_tomb);
+}
+
+
+/// Number of commands that may be in flight right now
+static int sub_cc_limit(otc_t* otc) {
+    if (otc->cfg.flags & OTC_FLAG_AIMD) {
+        return (int)otc->cwnd;
+    }
+    return otc->cfg.window;
+}
+
+
+/// Additive increase: a command completed cleanly
+static void sub_cc_clean(otc_t* otc) {
+    if (otc->cfg.flags & OTC_FLAG_AIMD) {
+        otc->cwnd += (otc->cwnd < otc->ssthresh) ? 1.0 : (1.0 / otc->cwnd);
+        if (otc->cwnd > (double)otc->cfg.window) {
+            otc->cwnd = (double)otc->cfg.window;
+        }
+    }
+}
+
+
+/// Multiplicative decrease: req timed out or came back with bad qual
+static void sub_cc_loss(otc_t* otc, otc_req_t* req) {
+    if ((otc->cfg.flags & OTC_FLAG_AIMD) && (req->sendseq >= otc->recover_seq)) {
+        otc->ssthresh       = (otc->cwnd / 2.0 < 1.0) ? 1.0 : (otc->cwnd / 2.0);
+        otc->cwnd           = otc->ssthresh;
+        otc->recover_seq    = otc->sendseq;
+        VERBOSE_PRINTF("Congestion window backed off to %i\n", (int)otc->cwnd);
+    }
+}
+
+
+/// Copy the result of a coalesced command to one of its followers
+static void sub_share(otc_req_t* req, otc_req_t* follower) {
+    otc_result_t* res = &follower->res;
+
+    res->rc         = req->res.rc;
+    res->ack_err    = req->res.ack_err;
+    res->sid        = req->res.sid;
+    res->qual       = req->res.qual;
+    res->tries      = req->res.tries;
+    res->more       = req->res.more;
+    res->shared     = 1;
+    res->ack        = NULL;
+    res->rxstat     = NULL;
+    res->frame      = NULL;
+    res->frame_size = 0;
+
+    if ((req->res.ack != NULL)
+    && (sub_buf_put(&follower->ackbuf, &follower->ackalloc, req->res.ack, strlen(req->res.ack)) == 0)) {
+        res->ack = follower->ackbuf;
+    }
+    if ((req->res.rxstat != NULL)
+    && (sub_buf_put(&follower->rxbuf, &follower->rxalloc, req->res.rxstat, strlen(req->res.rxstat)) == 0)) {
+        res->rxstat = follower->rxbuf;
+    }
+    if ((req->res.frame != NULL)
+    && (sub_buf_put(&follower->framebuf, &follower->framealloc, req->res.frame, req->res.frame_size) == 0)) {
+        res->frame      = follower->framebuf;
+        res->frame_size = req->res.frame_size;
+    }
+}
+
+
+static void sub_complete(otc_t* otc, otc_req_t* req, int rc) {
+    otc_req_t* follower;
+
+    req->state  = OTC_RS_done;
+    req->res.rc = rc;
+
+    // A command that is done is never replayed, whatever its ack did
+    if (req->res.tries != 0) {
+        sp_forget(otc->sp, req->res.id);
+    }
+
+    // Followers are completed first: req's buffers go back to the pool, or
+    // to the user, once req is complete.
+    while ((follower = sub_list_popfront(&req->followers)) != NULL) {
+        sub_share(req, follower);
+        sub_complete(otc, follower, rc);
+    }
+
+    if (req->callback != NULL) {
+        req->callback(otc, &req->res, req->res.user);
+        pthread_mutex_lock(&otc->mutex);
+        otc->pending--;
+        pthread_mutex_unlock(&otc->mutex);
+        sub_req_free(otc, req);
+    }
+    else {
+        pthread_mutex_lock(&otc->mutex);
+        otc->pending--;
+        sub_list_pushback(&otc->compq, &req->link);
+        pthread_cond_broadcast(&otc->done_cond);
+        pthread_mutex_unlock(&otc->mutex);
+    }
+}
+
+
+static void sub_retry(otc_t* otc, otc_req_t* req, int rc) {
+    if (req->res.tries >= otc->cfg.tries) {
+        sub_complete(otc, req, rc);
+        return;
+    }
+
+    // The send that failed is not replayed after a reconnect.  The retry is
+    // kept in its place once it is sent.
+    sp_forget(otc->sp, req->res.id);
+
+    // Retries go to the front of the queue: they've been waiting longest
+    VERBOSE_PRINTF("Retrying command (try %i): %s\n", req->res.tries+1, req->cmdbuf);
+    req->state      = OTC_RS_queued;
+    req->res.ack    = NULL;
+    req->res.rxstat = NULL;
+    req->res.frame  = NULL;
+    req->res.sid    = 0;
+    clock_gettime(CLOCK_MONOTONIC, &req->queued_at);
+    pthread_mutex_lock(&otc->mutex);
+    sub_sendq_push(otc, req, true);
+    pthread_mutex_unlock(&otc->mutex);
+}
+
+
+/// A command whose ack times out leaves a tombstone behind it on the ack
+/// queue, so that a late ack doesn't get matched to the next command.  The
+/// tombstone lasts for one more timeout period.
+static void sub_entomb(otc_t* otc, otc_req_t* req) {
+    otc_req_t* tomb = sub_req_new(otc);
+
+    if (tomb != NULL) {
+        if (sub_buf_put(&tomb->cmdbuf, &tomb->cmdalloc, req->cmdbuf, req->cmdsize) == 0) {
+            tomb->cmdsize   = req->cmdsize;
+            tomb->state     = OTC_RS_tomb;
+            tomb->deadline  = req->deadline;
+            sub_timespec_addms(&tomb->deadline, otc->cfg.timeout_ms);
+            sub_list_insert(&req->link, &tomb->link);
+        }
+        else {
+            sub_req_free(otc, tomb);
+        }
+    }
+}
+
+
+
+
+/** Engine: Inbound Processing <BR>
+  * ========================================================================<BR>
+  */
+
+static otc_req_t* sub_match_ack(otc_t* otc, const char* name) {
+    otc_link_t* link;
+
+    if (sub_list_isempty(&otc->ackq)) {
+        return NULL;
+    }
+    if (name != NULL) {
+        for (link=otc->ackq.next; link!=&otc->ackq; link=link->next) {
+            if (sub_cmdname_matches(name, ((otc_req_t*)link)->cmdbuf)) {
+                return (otc_req_t*)link;
+            }
+        }
+    }
+    return (otc_req_t*)otc->ackq.next;
+}
+
+
+static void sub_proc_ack(otc_t* otc, cJSON* resp, otc_line_t* line) {
+    otc_req_t* req;
+    uint32_t sid = 0;
+    int err;
+
+    err = devmgr_json_getack(resp, &sid);
+    req = sub_match_ack(otc, devmgr_json_getcmd(resp));
+    if (req == NULL) {
+        return;
+    }
+
+    sub_unflight(otc, req);
+    if (req->state == OTC_RS_tomb) {
+        sub_req_free(otc, req);
+        return;
+    }
+
+    if (sub_buf_put(&req->ackbuf, &req->ackalloc, line->data, line->size) == 0) {
+        req->res.ack = req->ackbuf;
+    }
+    req->res.ack_err    = err;
+    req->res.sid        = sid;
+
+    if (err != 0) {
+        sub_complete(otc, req, OTC_ERR_ACK(err));
+    }
+    else if ((sid == 0) || (otc->cfg.flags & OTC_FLAG_ACKONLY)) {
+        sub_complete(otc, req, 0);
+    }
+    else {
+        // Success + wait for rxstat packet, which gets a full timeout of its
+        // own, as each frame of a session does.
+        req->state = OTC_RS_rx;
+        clock_gettime(CLOCK_MONOTONIC, &req->deadline);
+        sub_timespec_addms(&req->deadline, otc->cfg.timeout_ms);
+        sub_list_pushback(&otc->rxq, &req->link);
+        sub_sid_insert(otc, req);
+        otc->inflight++;
+    }
+}
+
+
+/// Deliver one frame of a multi-frame session.  The request stays on the rx
+/// queue, with its deadline renewed, until the last frame or an idle timeout.
+static void sub_partial(otc_t* otc, otc_req_t* req, int rc) {
+    otc_link_t* link;
+    otc_req_t* follower;
+
+    req->streaming  = true;
+    req->res.more   = 1;
+    req->res.rc     = rc;
+    if (req->callback != NULL) {
+        req->callback(otc, &req->res, req->res.user);
+    }
+    for (link=req->followers.next; link!=&req->followers; link=link->next) {
+        follower = (otc_req_t*)link;
+        if (follower->callback != NULL) {
+            sub_share(req, follower);
+            follower->callback(otc, &follower->res, follower->res.user);
+            follower->res.more = 0;
+        }
+    }
+    req->res.more   = 0;
+
+    // The ack is delivered with the first frame only
+    req->res.ack = NULL;
+    clock_gettime(CLOCK_MONOTONIC, &req->deadline);
+    sub_timespec_addms(&req->deadline, otc->cfg.timeout_ms);
+    sub_list_remove(&req->link);
+    sub_list_pushback(&otc->rxq, &req->link);
+}
+
+
+static void sub_proc_rxstat(otc_t* otc, cJSON* resp, otc_line_t* line) {
+    otc_req_t* req;
+    cJSON* frame = NULL;
+    int qualtest = 0;
+    int session_end;
+    int sid;
+    int rc;
+
+    sid = devmgr_json_getframe(resp, &frame, &qualtest);
+    if (sid < 0) {
+        return;
+    }
+    req = sub_sid_find(otc, (uint32_t)sid);
+    if (req == NULL) {
+        return;
+    }
+    session_end = devmgr_json_getend(resp);
+
+    if (sub_buf_put(&req->rxbuf, &req->rxalloc, line->data, line->size) == 0) {
+        req->res.rxstat = req->rxbuf;
+    }
+    req->res.qual       = qualtest;
+    req->res.frame      = NULL;
+    req->res.frame_size = 0;
+
+    // - If qualtest!=0, then data is corrupted: retry.
+    // - If the frame is somehow invalid: retry
+    // Once a session is streaming, a retry would repeat frames that have
+    // been delivered, so bad frames are passed on with an error instead.
+    if ((qualtest != 0) || !cJSON_IsString(frame) || (frame->valuestring == NULL)) {
+        rc = OTC_ERR_QUAL;
+        if (qualtest != 0) {
+            sub_cc_loss(otc, req);
+        }
+        if ((qualtest == 0) && (session_end >= 0)) {
+            rc = 0;     // session marker without a frame
+        }
+        else if ((req->streaming == false) && (session_end != 0)) {
+            sub_unflight(otc, req);
+            sub_retry(otc, req, OTC_ERR_QUAL);
+            return;
+        }
+    }
+    else {
+        // The frame is stored separately from the raw line because JSON
+        // escapes have been resolved by the parser.
+        rc = (int)strlen(frame->valuestring);
+        if (sub_buf_put(&req->framebuf, &req->framealloc, frame->valuestring, (size_t)rc) != 0) {
+            rc = OTC_ERR_NOMEM;
+        }
+        else {
+            req->res.frame      = req->framebuf;
+            req->res.frame_size = (size_t)rc;
+        }
+    }
+
+    // The window grows once per command, not per frame of a session
+    if (session_end == 0) {
+        sub_partial(otc, req, rc);
+    }
+    else {
+        if (rc >= 0) {
+            sub_cc_clean(otc);
+        }
+        sub_unflight(otc, req);
+        sub_complete(otc, req, rc);
+    }
+}
+
+
+static void sub_proc_line(otc_t* otc, otc_line_t* line) {
+    cJSON* resp;
+
+    resp = cJSON_Parse(line->data);
+    if (resp != NULL) {
+        if (devmgr_json_gettype(resp, "ack") != NULL) {
+            sub_proc_ack(otc, resp, line);
+        }
+        else if (devmgr_json_gettype(resp, "rxstat") != NULL) {
+            sub_proc_rxstat(otc, resp, line);
+        }
+        ///@todo msg types could be propagated to a console callback
+        cJSON_Delete(resp);
+    }
+}
+
+
+static void sub_proc_inbox(otc_t* otc) {
+    otc_line_t* line;
+    otc_line_t* next;
+
+    pthread_mutex_lock(&otc->inbox_mutex);
+    line            = otc->inbox_head;
+    otc->inbox_head = NULL;
+    otc->inbox_tail = &otc->inbox_head;
+    pthread_mutex_unlock(&otc->inbox_mutex);
+
+    while (line != NULL) {
+        next = line->next;
+        sub_proc_line(otc, line);
+        free(line);
+        line = next;
+    }
+}
+
+
+/// sockpush subscriber action: runs on the sockpush I/O thread
+static int sub_inbound(void* parent, const uint8_t* data, size_t size) {
+    otc_t* otc = parent;
+    otc_line_t* line;
+
+    while ((size > 0) && ((data[size-1] == 0) || (data[size-1] == '\r'))) {
+        size--;
+    }
+    if (size == 0) {
+        return 0;
+    }
+
+    line = malloc(sizeof(otc_line_t) + size + 1);
+    if (line == NULL) {
+        return -1;
+    }
+    line->next  = NULL;
+    line->size  = size;
+    memcpy(line->data, data, size);
+    line->data[size] = 0;
+
+    pthread_mutex_lock(&otc->inbox_mutex);
+    *otc->inbox_tail    = line;
+    otc->inbox_tail     = &line->next;
+    pthread_mutex_unlock(&otc->inbox_mutex);
+
+    sub_wake(otc);
+    return 0;
+}
+
+
+
+
+/** Engine: Timeouts and Sending <BR>
+  * ========================================================================<BR>
+  */
+
+static void sub_proc_timeouts(otc_t* otc, const struct timespec* now) {
+    otc_link_t* link;
+    otc_link_t* next;
+    otc_req_t* req;
+
+    // ackq: tombstones have later deadlines than the commands behind them,
+    // so skip over them rather than stopping at the first live deadline.
+    for (link=otc->ackq.next; link!=&otc->ackq; link=next) {
+        next    = link->next;
+        req     = (otc_req_t*)link;
+        if (sub_timespec_passed(now, &req->deadline) == false) {
+            if (req->state == OTC_RS_tomb) {
+                continue;
+            }
+            break;
+        }
+        if (req->state == OTC_RS_tomb) {
+            sub_unflight(otc, req);
+            sub_req_free(otc, req);
+        }
+        else {
+            ERR_PRINTF("ack timeout in libottercat: %i ms\n", otc->cfg.timeout_ms);
+            sub_cc_loss(otc, req);
+            sub_entomb(otc, req);
+            sub_unflight(otc, req);
+            sub_retry(otc, req, OTC_ERR_TIMEOUT);
+        }
+    }
+
+    // rxq: a request is pushed to the back whenever its deadline is renewed,
+    // so deadlines are in order
+    while (!sub_list_isempty(&otc->rxq)) {
+        req = (otc_req_t*)otc->rxq.next;
+        if (sub_timespec_passed(now, &req->deadline) == false) {
+            break;
+        }
+        sub_unflight(otc, req);
+        if (req->streaming) {
+            // Idle timeout ends a multi-frame session
+            req->res.rxstat     = NULL;
+            req->res.frame      = NULL;
+            req->res.frame_size = 0;
+            sub_complete(otc, req, 0);
+            continue;
+        }
+        ERR_PRINTF("rxstat timeout in libottercat: %i ms\n", otc->cfg.timeout_ms);
+        sub_cc_loss(otc, req);
+        sub_retry(otc, req, OTC_ERR_TIMEOUT);
+    }
+}
+
+
+static bool sub_coalescible(otc_t* otc, const char* cmd) {
+    const char** name;
+
+    if (otc->cfg.coalesce != NULL) {
+        for (name=otc->cfg.coalesce; *name!=NULL; name++) {
+            if (sub_cmdname_matches(*name, cmd)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+
+static otc_req_t* sub_find_twin(otc_link_t* list, otc_req_t* req) {
+    otc_link_t* link;
+    otc_req_t* test;
+
+    for (link=list->next; link!=list; link=link->next) {
+        test = (otc_req_t*)link;
+        if ((test->state != OTC_RS_tomb) && (test->streaming == false)
+        && (test->cmdsize == req->cmdsize)
+        && (memcmp(test->cmdbuf, req->cmdbuf, req->cmdsize) == 0)) {
+            return test;
+        }
+    }
+    return NULL;
+}
+
+
+/// If an identical command is already in flight, attach req to it rather
+/// than sending it.  A session that has started streaming can't be joined,
+/// because its earlier frames are gone.
+static bool sub_coalesce(otc_t* otc, otc_req_t* req) {
+    otc_req_t* twin;
+
+    if (sub_coalescible(otc, req->cmdbuf) == false) {
+        return false;
+    }
+    twin = sub_find_twin(&otc->ackq, req);
+    if (twin == NULL) {
+        twin = sub_find_twin(&otc->rxq, req);
+    }
+    if (twin == NULL) {
+        return false;
+    }
+
+    DEBUG_PRINTF("Coalescing with command in flight: %s\n", req->cmdbuf);
+    req->state = OTC_RS_joined;
+    sub_list_pushback(&twin->followers, &req->link);
+    return true;
+}
+
+
+static void sub_proc_sendq(otc_t* otc, const struct timespec* now) {
+    otc_req_t* req;
+    int rc;
+
+    if (otc->holdoff) {
+        if (sub_timespec_passed(now, &otc->holdoff_until) == false) {
+            return;
+        }
+        otc->holdoff = false;
+    }
+
+    while (otc->inflight < sub_cc_limit(otc)) {
+        // Rate ceiling: commands are spaced evenly, at most cfg.rate/s
+        if ((otc->pace_ns > 0) && (sub_timespec_passed(now, &otc->pace_next) == false)) {
+            otc->holdoff        = true;
+            otc->holdoff_until  = otc->pace_next;
+            break;
+        }
+        
+        pthread_mutex_lock(&otc->mutex);
+        req = sub_sendq_pop(otc);
+        pthread_mutex_unlock(&otc->mutex);
+        if (req == NULL) {
+            break;
+        }
+        if (sub_coalesce(otc, req)) {
+            continue;
+        }
+
+        DEBUG_PRINTF("Sending %zu bytes to sp_sendcmd():\n%.*s\n", req->cmdsize, (int)req->cmdsize, req->cmdbuf);
+        rc = sp_sendcmd_id(otc->sp, (uint8_t*)req->cmdbuf, req->cmdsize, req->res.id);
+        if (rc < 0) {
+            // Socket is not connected (yet).  Hold off and try again, up to
+            // the amount of time the command would have been allowed.
+            req->stalls++;
+            if ((req->stalls * OTC_HOLDOFF_MS) > (otc->cfg.timeout_ms * otc->cfg.tries)) {
+                sub_complete(otc, req, OTC_ERR_SEND);
+                continue;
+            }
+            pthread_mutex_lock(&otc->mutex);
+            sub_sendq_unpop(otc, req);
+            pthread_mutex_unlock(&otc->mutex);
+            otc->holdoff        = true;
+            otc->holdoff_until  = *now;
+            sub_timespec_addms(&otc->holdoff_until, OTC_HOLDOFF_MS);
+            break;
+        }
+
+        if (otc->pace_ns > 0) {
+            if (sub_timespec_passed(now, &otc->pace_next)) {
+                otc->pace_next = *now;
+            }
+            sub_timespec_addns(&otc->pace_next, otc->pace_ns);
+        }
+
+        pthread_mutex_lock(&otc->mutex);
+        sub_sendq_sent(otc, req, now);
+        pthread_mutex_unlock(&otc->mutex);
+
+        req->res.tries++;
+        req->sendseq    = otc->sendseq++;
+        req->state      = OTC_RS_ack;
+        req->deadline   = *now;
+        sub_timespec_addms(&req->deadline, otc->cfg.timeout_ms);
+        sub_list_pushback(&otc->ackq, &req->link);
+        otc->inflight++;
+    }
+}
+
+
+static int sub_next_wait(otc_t* otc, const struct timespec* now) {
+    otc_link_t* link;
+    int wait_ms = -1;
+    int test;
+
+    for (link=otc->ackq.next; link!=&otc->ackq; link=link->next) {
+        test    = sub_timespec_msuntil(now, &((otc_req_t*)link)->deadline);
+        wait_ms = ((wait_ms < 0) || (test < wait_ms)) ? test : wait_ms;
+        if (((otc_req_t*)link)->state != OTC_RS_tomb) {
+            break;
+        }
+    }
+    if (!sub_list_isempty(&otc->rxq)) {
+        test    = sub_timespec_msuntil(now, &((otc_req_t*)otc->rxq.next)->deadline);
+        wait_ms = ((wait_ms < 0) || (test < wait_ms)) ? test : wait_ms;
+    }
+    if (otc->holdoff) {
+        test    = sub_timespec_msuntil(now, &otc->holdoff_until);
+        wait_ms = ((wait_ms < 0) || (test < wait_ms)) ? test : wait_ms;
+    }
+
+    return wait_ms;
+}
+
+
+static void sub_abort_list(otc_t* otc, otc_link_t* list, bool lock) {
+    otc_req_t* req;
+
+    while (1) {
+        if (lock) pthread_mutex_lock(&otc->mutex);
+        req = sub_list_popfront(list);
+        if (lock) pthread_mutex_unlock(&otc->mutex);
+        if (req == NULL) {
+            break;
+        }
+        if (req->state == OTC_RS_rx) {
+            sub_sid_remove(otc, req);
+        }
+        if (req->state == OTC_RS_tomb) {
+            sub_req_free(otc, req);
+        }
+        else {
+            sub_complete(otc, req, OTC_ERR_CLOSED);
+        }
+    }
+}
+
+
+static void* sub_engine(void* args) {
+    otc_t* otc = args;
+    struct pollfd pfd;
+    struct timespec now;
+    char drain[64];
+    bool closing;
+    int i;
+
+    pfd.fd      = otc->wake[0];
+    pfd.events  = POLLIN;
+
+    while (1) {
+        sub_proc_inbox(otc);
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        sub_proc_timeouts(otc, &now);
+        sub_proc_sendq(otc, &now);
+
+        pthread_mutex_lock(&otc->mutex);
+        closing = otc->closing;
+        pthread_mutex_unlock(&otc->mutex);
+        if (closing) {
+            break;
+        }
+
+        if (poll(&pfd, 1, sub_next_wait(otc, &now)) > 0) {
+            while (read(otc->wake[0], drain, sizeof(drain)) > 0);
+        }
+    }
+
+    // Complete everything that's outstanding
+    sub_abort_list(otc, &otc->ackq, false);
+    sub_abort_list(otc, &otc->rxq, false);
+    for (i=0; i<OTC_CLASSES; i++) {
+        sub_abort_list(otc, &otc->sendq[i].q, true);
+        otc->sendq[i].stats.depth = 0;
+    }
+    otc->inflight = 0;
+
+    return NULL;
+}
+
+
+
+
+/** Public Functions <BR>
+  * ========================================================================<BR>
+  */
+
+void otc_cfg_init(otc_cfg_t* cfg) {
+    if (cfg != NULL) {
+        cfg->timeout_ms = 500;
+        cfg->tries      = 1;
+        cfg->window     = 8;
+        cfg->rate       = 0;
+        cfg->flags      = 0;
+        cfg->coalesce   = NULL;
+        cfg->capture    = NULL;
+        cfg->weight[OTC_CLASS_URGENT]   = 0;
+        cfg->weight[OTC_CLASS_HIGH]     = 4;
+        cfg->weight[OTC_CLASS_NORMAL]   = 2;
+        cfg->weight[OTC_CLASS_BULK]     = 1;
+    }
+}
+
+
+int otc_open(otc_handle_t* handle, const char* socket_path, const otc_cfg_t* cfg) {
+    otc_t* otc;
+    int rc;
+    int i;
+
+    if ((handle == NULL) || (socket_path == NULL)) {
+        return OTC_ERR_PARAM;
+    }
+
+    otc = calloc(1, sizeof(otc_t));
+    if (otc == NULL) {
+        return OTC_ERR_NOMEM;
+    }
+
+    if (cfg != NULL) {
+        otc->cfg = *cfg;
+    }
+    else {
+        otc_cfg_init(&otc->cfg);
+    }
+    otc->cfg.timeout_ms = (otc->cfg.timeout_ms > 0) ? otc->cfg.timeout_ms : 500;
+    otc->cfg.tries      = (otc->cfg.tries > 0) ? otc->cfg.tries : 1;
+    otc->cfg.window     = (otc->cfg.window > 0) ? otc->cfg.window : 1;
+    otc->cfg.rate       = (otc->cfg.rate > 0) ? otc->cfg.rate : 0;
+    otc->pace_ns        = (otc->cfg.rate > 0) ? (1000000000L / otc->cfg.rate) : 0;
+    otc->cwnd           = 1.0;
+    otc->ssthresh       = (double)otc->cfg.window;
+
+    otc->next_id    = 1;
+    otc->inbox_tail = &otc->inbox_head;
+    sub_list_init(&otc->freeq);
+    for (i=0; i<OTC_CLASSES; i++) {
+        sub_list_init(&otc->sendq[i].q);
+        if (i != OTC_CLASS_URGENT) {
+            otc->cfg.weight[i] = (otc->cfg.weight[i] > 0) ? otc->cfg.weight[i] : 1;
+        }
+    }
+    otc->drr = OTC_CLASS_URGENT + 1;
+    sub_list_init(&otc->compq);
+    sub_list_init(&otc->ackq);
+    sub_list_init(&otc->rxq);
+
+    // Wake-up pipe for the engine thread
+    if (pipe(otc->wake) != 0) {
+        rc = OTC_ERR_NOMEM;
+        goto otc_open_FREE;
+    }
+    fcntl(otc->wake[0], F_SETFL, fcntl(otc->wake[0], F_GETFL) | O_NONBLOCK);
+    fcntl(otc->wake[1], F_SETFL, fcntl(otc->wake[1], F_GETFL) | O_NONBLOCK);
+
+    if (pthread_mutex_init(&otc->mutex, NULL) != 0) {
+        rc = OTC_ERR_NOMEM;
+        goto otc_open_PIPE;
+    }
+    if (pthread_mutex_init(&otc->inbox_mutex, NULL) != 0) {
+        rc = OTC_ERR_NOMEM;
+        goto otc_open_MUTEX;
+    }
+    if (pthread_cond_init(&otc->done_cond, NULL) != 0) {
+        rc = OTC_ERR_NOMEM;
+        goto otc_open_INBOX;
+    }
+
+    if (sp_open(&otc->sp, socket_path, ((otc->cfg.flags & OTC_FLAG_EVLOOP) ? SP_FLAG_EVLOOP : 0)
+                                     | ((otc->cfg.flags & OTC_FLAG_FRAMED) ? SP_FLAG_FRAMED : 0)
+                                     | ((otc->cfg.flags & OTC_FLAG_SHMRING) ? SP_FLAG_SHMRING : 0)
+                                     | ((otc->cfg.flags & OTC_FLAG_REPLAY) ? SP_FLAG_REPLAY : 0)) != 0) {
+        rc = OTC_ERR_SOCKET;
+        goto otc_open_COND;
+    }
+    if (capture_attach(otc->cfg.capture, otc->sp, socket_path) < 0) {
+        rc = OTC_ERR_NOMEM;
+        goto otc_open_SOCKET;
+    }
+    otc->subscr = sp_subscribe(otc->sp, otc, &sub_inbound, SP_SUB_INBOUND, NULL, 0);
+    if (otc->subscr == NULL) {
+        rc = OTC_ERR_NOMEM;
+        goto otc_open_SOCKET;
+    }
+
+    if (pthread_create(&otc->engine, NULL, &sub_engine, otc) != 0) {
+        rc = OTC_ERR_NOMEM;
+        goto otc_open_SUBSCR;
+    }
+
+    *handle = otc;
+    return 0;
+
+    otc_open_SUBSCR:    sp_unsubscribe(otc->subscr);
+    otc_open_SOCKET:    sp_close(otc->sp);
+    otc_open_COND:      pthread_cond_destroy(&otc->done_cond);
+    otc_open_INBOX:     pthread_mutex_destroy(&otc->inbox_mutex);
+    otc_open_MUTEX:     pthread_mutex_destroy(&otc->mutex);
+    otc_open_PIPE:      close(otc->wake[0]);
+                        close(otc->wake[1]);
+    otc_open_FREE:      free(otc);
+    return rc;
+}
+
+
+int otc_close(otc_handle_t handle) {
+    otc_t* otc = handle;
+    otc_line_t* line;
+
+    if (otc == NULL) {
+        return OTC_ERR_PARAM;
+    }
+
+    pthread_mutex_lock(&otc->mutex);
+    otc->closing = true;
+    pthread_mutex_unlock(&otc->mutex);
+    sub_wake(otc);
+    pthread_join(otc->engine, NULL);
+
+    sp_unsubscribe(otc->subscr);
+    sp_close(otc->sp);
+
+    while (otc->inbox_head != NULL) {
+        line            = otc->inbox_head;
+        otc->inbox_head = line->next;
+        free(line);
+    }
+
+    sub_list_destroy(&otc->compq);
+    sub_list_destroy(&otc->freeq);
+
+    pthread_cond_destroy(&otc->done_cond);
+    pthread_mutex_destroy(&otc->inbox_mutex);
+    pthread_mutex_destroy(&otc->mutex);
+    close(otc->wake[0]);
+    close(otc->wake[1]);
+    free(otc);
+
+    return 0;
+}
+
+
+int otc_submit(otc_handle_t handle, const char* cmd, size_t cmdsize,
+               otc_callback_t callback, void* user, uint64_t* id) {
+    return otc_submit_class(handle, OTC_CLASS_NORMAL, cmd, cmdsize, callback, user, id);
+}
+
+
+int otc_submit_class(otc_handle_t handle, int cls, const char* cmd, size_t cmdsize,
+                     otc_callback_t callback, void* user, uint64_t* id) {
+    otc_t* otc = handle;
+    otc_req_t* req;
+
+    if ((otc == NULL) || (cmd == NULL) || (cls < 0) || (cls >= OTC_CLASSES)) {
+        return OTC_ERR_PARAM;
+    }
+
+    // Commands are single lines: trim the terminator, sockpush adds it back
+    while ((cmdsize > 0) && ((cmd[cmdsize-1] == '\n') || (cmd[cmdsize-1] == 0))) {
+        cmdsize--;
+    }
+    if (cmdsize == 0) {
+        return OTC_ERR_PARAM;
+    }
+
+    req = sub_req_new(otc);
+    if (req == NULL) {
+        return OTC_ERR_NOMEM;
+    }
+    if (sub_buf_put(&req->cmdbuf, &req->cmdalloc, cmd, cmdsize) != 0) {
+        sub_req_free(otc, req);
+        return OTC_ERR_NOMEM;
+    }
+    req->cmdsize    = cmdsize;
+    req->cls        = cls;
+    req->callback   = callback;
+    req->state      = OTC_RS_queued;
+    req->res.user   = user;
+    req->res.cmd    = req->cmdbuf;
+
+    pthread_mutex_lock(&otc->mutex);
+    if (otc->closing) {
+        pthread_mutex_unlock(&otc->mutex);
+        sub_req_free(otc, req);
+        return OTC_ERR_CLOSED;
+    }
+    req->res.id = otc->next_id++;
+    otc->pending++;
+    clock_gettime(CLOCK_MONOTONIC, &req->queued_at);
+    sub_sendq_push(otc, req, false);
+    pthread_mutex_unlock(&otc->mutex);
+
+    if (id != NULL) {
+        *id = req->res.id;
+    }
+
+    sub_wake(otc);
+    return 0;
+}
+
+
+static int sub_drain_compq(otc_t* otc, otc_result_t** out, int max) {
+    otc_req_t* req;
+    int count = 0;
+
+    while (count < max) {
+        req = sub_list_popfront(&otc->compq);
+        if (req == NULL) {
+            break;
+        }
+        out[count++] = &req->res;
+    }
+
+    return count;
+}
+
+
+int otc_poll(otc_handle_t handle, otc_result_t** out, int max) {
+    otc_t* otc = handle;
+    int count;
+
+    if ((otc == NULL) || (out == NULL)) {
+        return OTC_ERR_PARAM;
+    }
+
+    pthread_mutex_lock(&otc->mutex);
+    count = sub_drain_compq(otc, out, max);
+    pthread_mutex_unlock(&otc->mutex);
+
+    return count;
+}
+
+
+int otc_wait(otc_handle_t handle, otc_result_t** out, int max, int timeout_ms) {
+    otc_t* otc = handle;
+    struct timespec ts;
+    int count;
+    int wait_test = 0;
+
+    if ((otc == NULL) || (out == NULL)) {
+        return OTC_ERR_PARAM;
+    }
+
+    if (timeout_ms >= 0) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        sub_timespec_addms(&ts, timeout_ms);
+    }
+
+    pthread_mutex_lock(&otc->mutex);
+    while (sub_list_isempty(&otc->compq) && (wait_test == 0)) {
+        if (timeout_ms < 0) {
+            wait_test = pthread_cond_wait(&otc->done_cond, &otc->mutex);
+        }
+        else {
+            wait_test = pthread_cond_timedwait(&otc->done_cond, &otc->mutex, &ts);
+        }
+    }
+    count = sub_drain_compq(otc, out, max);
+    pthread_mutex_unlock(&otc->mutex);
+
+    return count;
+}
+
+
+void otc_release(otc_handle_t handle, otc_result_t* result) {
+    otc_req_t* req;
+
+    if ((handle != NULL) && (result != NULL)) {
+        req = (otc_req_t*)((uint8_t*)result - offsetof(otc_req_t, res));
+        sub_req_free(handle, req);
+    }
+}
+
+
+int otc_classstats(otc_handle_t handle, int cls, otc_classstats_t* stats) {
+    otc_t* otc = handle;
+
+    if ((otc == NULL) || (stats == NULL) || (cls < 0) || (cls >= OTC_CLASSES)) {
+        return OTC_ERR_PARAM;
+    }
+    pthread_mutex_lock(&otc->mutex);
+    *stats = otc->sendq[cls].stats;
+    pthread_mutex_unlock(&otc->mutex);
+
+    return 0;
+}
+
+
+int otc_pending(otc_handle_t handle) {
+    otc_t* otc = handle;
+    int pending;
+
+    if (otc == NULL) {
+        return OTC_ERR_PARAM;
+    }
+
+    pthread_mutex_lock(&otc->mutex);
+    pending = otc->pending;
+    pthread_mutex_unlock(&otc->mutex);
+
+    return pending;
+}
@@ -36,10 +36,23 @@
 #include "ottercat_cfg.h"
 
 // Application Headers
+#include "capture.h"
 #include "cmds.h"
 #include "cliopt.h"
+#include "cmdcheck.h"
+#include "cmdgraph.h"
+#include "cmdtmpl.h"
+#include "collect.h"
 #include "debug.h"
+#include "fanout.h"
+#include "filter.h"
+#include "framebridge.h"
+#include "poller.h"
+#include "shmring.h"
+#include "rcache.h"
 #include "sockpush.h"
+#include "watch.h"
+#include "xfer.h"
 
 // HBuilder Package Libraries
 #include <argtable3.h>
@@ -53,6 +66,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 
@@ -61,10 +75,18 @@ static cliopt_t cliopts;
 
 typedef struct {
     int exitcode;
+    rcache_t cache;
+    filter_t filter;
+    capture_t capture;
+    collect_t journal;
 } cli_struct;
 
 cli_struct cli;
 
+// Device ID options: these are also the devid options used by cmd_devmgr
+struct arg_str* devid_opt;
+struct arg_str* devidlist_opt;
+
 
 
 
@@ -136,30 +158,89 @@ static FORMAT_Type sub_fmt_cmp(const char* s1) {
 }
 
 
-static int sub_readline(size_t* bytesread, int fd, char* buf_a, int max) {
+/// Split a comma separated list of names, in place, into a NULL-terminated
+/// array (malloc'ed).  Returns the number of names, or -1 on error.
+static int sub_splitnames(char* list, const char*** names) {
+    const char** array;
+    char* cursor;
+    int count = 0;
+    
+    array = malloc((strlen(list) + 2) * sizeof(char*));
+    if (array == NULL) {
+        return -1;
+    }
+    for (cursor=strtok(list, ", \t"); cursor!=NULL; cursor=strtok(NULL, ", \t")) {
+        array[count++] = cursor;
+    }
+    array[count] = NULL;
+    
+    *names = array;
+    return count;
+}
+
+
+/// Append the contents of a file to a growing string buffer
+static int sub_appendfile(char** buf, size_t* size, const char* path) {
+    FILE* fp;
+    char* newbuf;
     size_t bytesin;
-    char* start = buf_a;
+    
+    fp = fopen(path, "r");
+    if (fp == NULL) {
+        return -1;
+    }
+    do {
+        newbuf = realloc(*buf, *size + 4096 + 1);
+        if (newbuf == NULL) {
+            fclose(fp);
+            return -2;
+        }
+        *buf        = newbuf;
+        bytesin     = fread(&(*buf)[*size], 1, 4096, fp);
+        *size      += bytesin;
+        (*buf)[*size] = 0;
+    } while (bytesin != 0);
+    
+    fclose(fp);
+    return 0;
+}
+
+
+/// Reads one line from fd into *buf, which is grown (realloc'ed) as needed up
+/// to OTTERCAT_PARAM_MAXLINE bytes.  The line is null-terminated.  Returns the
+/// number of bytes read, or a negative value on error.
+static int sub_readline(size_t* bytesread, int fd, char** buf, size_t* alloc) {
+    size_t bytesin = 0;
     int rc = 0;
     char test;
     
-    while (max > 0) {
-        rc = (int)read(fd, buf_a, 1);
+    while (bytesin < OTTERCAT_PARAM_MAXLINE) {
+        if ((bytesin + 1) >= *alloc) {
+            size_t newalloc = (*alloc == 0) ? 1024 : (*alloc * 2);
+            char* newbuf    = realloc(*buf, newalloc);
+            if (newbuf == NULL) {
+                rc = -2;
+                break;
+            }
+            *buf    = newbuf;
+            *alloc  = newalloc;
+        }
+        rc = (int)read(fd, &test, 1);
         if (rc != 1) {
             break;
         }
-        max--;
-        test = *buf_a++;
+        (*buf)[bytesin++] = test;
         if ((test == '\n') || (test == 0)) {
             break;
         }
     }
     
-    bytesin = (buf_a - start);
-    
+    if (*buf != NULL) {
+        (*buf)[bytesin] = 0;
+    }
     if (bytesread != NULL) {
         *bytesread = bytesin;
     }
-    
     if (rc >= 0) {
         rc = (int)bytesin;
     }
@@ -183,10 +264,13 @@ int ottercat_main(INTF_Type intf_val, const char* socket, char* cmdstr) {
     /// If it works, the devmgr command should be added using the name of the
     /// program used for devmgr.
     DEBUG_PRINTF("Opening client socket (%s) ...\n", socket);
-    if (sp_open(&sockpush_handle, socket, 0) == 0) {    
+    if (sp_open(&sockpush_handle, socket, (cliopt_isframed() ? SP_FLAG_FRAMED : 0) | (cliopt_isshmring() ? SP_FLAG_SHMRING : 0)
+                                        | (cliopt_isresend() ? SP_FLAG_REPLAY : 0)) == 0) {
         use_socket      = true;
         devmgr_handle   = sockpush_handle;
         
+        capture_attach(cli.capture, sockpush_handle, socket);
+        
         // This is a hack to let the socket thread finish connection
         usleep(5000);
     }
@@ -210,6 +294,10 @@ int ottercat_main(INTF_Type intf_val, const char* socket, char* cmdstr) {
         cli.exitcode = -2;
         goto ottercat_main_TERM;
     }
+    dterm_handle.cache  = cli.cache;
+    dterm_handle.target = socket;
+    dterm_handle.filter = cli.filter;
+    dterm_handle.journal= cli.journal;
     DEBUG_PRINTF("--> done\n");
     DEBUG_PRINTF("Finished startup\n");
     // ------------------------------------------------------------------------
@@ -268,11 +356,62 @@ int main(int argc, char* argv[]) {
     struct arg_int  *timeout = arg_int0("t","timeout","int",            "Integer number of milliseconds for response timeout: default 500ms");
     struct arg_int  *retries = arg_int0("r","retries","int",            "Integer number of request retries: default 0");
   //struct arg_str  *fmt     = arg_str0("f", "fmt", "format",           "\"default\", \"json\", \"jsonhex\", \"bintex\", \"hex\"");
-    struct arg_file *socket  = arg_file1(NULL,NULL,"path/addr",         "Socket path/address of daemon");
+    struct arg_int  *idle    = arg_int0(NULL,"idle","int",              "End a streamed session after this many ms without data");
+    struct arg_int  *rate    = arg_int0(NULL,"rate","int",              "Send at most this many commands per second, per daemon");
+    struct arg_file *cache   = arg_file0(NULL,"cache","file",           "Serve read commands from this response cache file, and keep it updated");
+    struct arg_int  *cachettl= arg_int0(NULL,"cache-ttl","int",         "Milliseconds a cached response stays valid: default 10000");
+    struct arg_str  *cachecmd= arg_str0(NULL,"cache-cmds","list",       "Comma separated names of cacheable (read) commands: default \"" OTTERCAT_PARAM_CACHECMDS "\"");
+    struct arg_str  *filter  = arg_str0(NULL,"filter","expr",           "Print only response lines that match, e.g. 'type==\"rxstat\" && data.qual==0'");
+    struct arg_str  *project = arg_str0(NULL,"project","paths",         "Print only these values of each response line, e.g. data.sid,data.frame");
+    struct arg_file *targets = arg_file0(NULL,"targets","file",          "File with socket paths of daemons, one per line");
+    struct arg_int  *tgttime = arg_int0(NULL,"target-timeout","int",    "Milliseconds allowed per target to run all commands (fan-out)");
+    struct arg_str  *devid   = arg_strn(NULL,"devid","id",0,OTTERCAT_PARAM_MAXTARGETS, "Device ID(s) for the command template, which uses " FANOUT_DEVID_VAR);
+    struct arg_str  *devlist = arg_str0(NULL,"devidlist","file",        "File of device IDs for the command template");
+    struct arg_int  *concur  = arg_int0(NULL,"concurrency","int",       "Devices in flight per daemon, or commands in flight in a graph script: default 8");
+    struct arg_int  *rounds  = arg_int0(NULL,"devid-retries","int",     "Extra rounds for devices that failed: default 0");
+    struct arg_file *failed  = arg_file0(NULL,"failed","file",          "Write IDs of devices that failed to this file");
+    struct arg_lit  *watch   = arg_lit0(NULL,"watch",                   "Stay connected and print every line from the daemon");
+    struct arg_str  *wtype   = arg_str0(NULL,"watch-type","list",       "With --watch: print only lines of these types (comma separated)");
+    struct arg_str  *wsid    = arg_strn(NULL,"watch-sid","ranges",0,16, "With --watch: print only lines with a sid in these ranges, e.g. 1-10,20");
+    struct arg_str  *wfield  = arg_strn(NULL,"watch-field","key=value",0,16, "With --watch: print only lines where the key has this value");
+    struct arg_int  *wstats  = arg_int0(NULL,"watch-stats","int",       "With --watch: print line counters to stderr every this many ms");
+    struct arg_file *capfile = arg_file0(NULL,"capture","file",         "Append all socket traffic, with timestamps, to this binary log");
+    struct arg_file *replay  = arg_file0(NULL,"replay","file",          "Act as a daemon on <path/addr> that replays the lines of a capture log");
+    struct arg_dbl  *rpspeed = arg_dbl0(NULL,"replay-speed","x",        "With --replay: pacing multiplier, 0 for as fast as possible: default 1");
+    struct arg_int  *rpchan  = arg_int0(NULL,"replay-chan","int",       "With --replay: replay only this channel (socket) of the capture");
+    struct arg_lit  *framed  = arg_lit0(NULL,"framed",                  "Use the length-prefixed framed transport on the daemon socket(s)");
+    struct arg_file *fbridge = arg_file0(NULL,"frame-bridge","path",    "Serve framed clients on this socket, translating to the text daemon at <path/addr>");
+    struct arg_lit  *shmring = arg_lit0(NULL,"shmring",                 "Offer the daemon(s) shared memory rings instead of socket I/O (same host)");
+    struct arg_lit  *shmloop = arg_lit0(NULL,"shm-loopback",            "Act as a loopback daemon on <path/addr> that accepts shared memory rings");
+    struct arg_int  *tcpka   = arg_int0(NULL,"tcp-keepalive","s",       "TCP: seconds idle before keepalive probes, 0 for none: default 5");
+    struct arg_int  *tcpsnd  = arg_int0(NULL,"tcp-sndbuf","bytes",      "TCP: socket send buffer size");
+    struct arg_int  *tcprcv  = arg_int0(NULL,"tcp-rcvbuf","bytes",      "TCP: socket receive buffer size");
+    struct arg_str  *resend  = arg_str0(NULL,"resend","policy",         "After a reconnect, resend commands without an ack: unacked (default) or none");
+    struct arg_lit  *ackonly = arg_lit0(NULL,"ack-only",                "Done with each command at its ack, without waiting for the rxstat");
+    struct arg_file *journal = arg_file0(NULL,"journal","file",         "With --ack-only: append the session ids left open to this file");
+    struct arg_file *collect = arg_file0(NULL,"collect","file",         "Collect and print the rxstats of the sessions in this journal");
+    struct arg_str  *tmpl    = arg_str0(NULL,"template","cmd",          "Command template with ${field} placeholders, run once per row of --data");
+    struct arg_file *data    = arg_file0(NULL,"data","file",            "With --template: CSV (with a header row) or NDJSON rows, - for stdin");
+    struct arg_file *xput    = arg_file0(NULL,"put","file",             "Send this local file to a device file, in pipelined chunks (see --file-id)");
+    struct arg_file *xget    = arg_file0(NULL,"get","file",             "Receive a device file into this local file, in pipelined chunks (see --file-id)");
+    struct arg_str  *xfileid = arg_str0(NULL,"file-id","id",            "With --put/--get: device file ID; the device is given with --devid");
+    struct arg_int  *xchunk  = arg_int0(NULL,"chunk","bytes",           "With --put/--get: bytes per chunk: default 128");
+    struct arg_int  *xsize   = arg_int0(NULL,"size","bytes",            "With --get: number of bytes to read");
+    struct arg_file *xresume = arg_file0(NULL,"resume","file",          "With --put/--get: journal of finished chunks, to resume an interrupted transfer");
+    struct arg_str  *xcmd    = arg_str0(NULL,"xfer-cmd","cmd",          "With --put/--get: chunk command template (${devid} ${fileid} ${offset} ${length} ${end} ${data})");
+    struct arg_file *cmdtab  = arg_file0(NULL,"cmdtab","file",          "Check command lines against this command table before sending any");
+    struct arg_lit  *dryrun  = arg_lit0(NULL,"dry-run",                 "With --cmdtab: check the command lines, and exit without sending");
+    struct arg_str  *every   = arg_str0(NULL,"every","interval",        "Stay connected and run the command lines once per interval, e.g. 500ms, 2s, 1m");
+    struct arg_lit  *changes = arg_lit0(NULL,"changes",                 "With --every: print only results that changed since the last poll");
+    struct arg_int  *polls   = arg_int0(NULL,"polls","int",             "With --every: stop after this many polls");
+    struct arg_file *socket  = arg_filen(NULL,NULL,"path/addr",0,OTTERCAT_PARAM_MAXTARGETS, "Socket path/address of daemon(s)");
   //struct arg_str  *cmdstr  = arg_strn(NULL,NULL,"cmd",0,240,          "Command string to send to otter daemon");
     struct arg_end  *end     = arg_end(20);
     
-    void* argtable[] = { help, version, verbose, debug, /*fmt,*/ socket, /*cmdstr,*/ end };
+    void* argtable[] = { help, version, verbose, debug, timeout, retries, idle, rate, cache, cachettl, cachecmd, filter, project, /*fmt,*/ targets, tgttime,
+                         devid, devlist, concur, rounds, failed, watch, wtype, wsid, wfield, wstats,
+                         capfile, replay, rpspeed, rpchan, framed, fbridge, shmring, shmloop,
+                         tcpka, tcpsnd, tcprcv, resend, ackonly, journal, collect, tmpl, data, xput, xget, xfileid, xchunk, xsize, xresume, xcmd, cmdtab, dryrun, every, changes, polls, socket, /*cmdstr,*/ end };
     const char* progname = OTTERCAT_PARAM_NAME;
     int nerrors;
     bool bailout        = true;
@@ -287,9 +426,60 @@ int main(int argc, char* argv[]) {
     //FORMAT_Type fmt_val = FORMAT_JsonHex;
     INTF_Type intf_val  = INTF_socket;
     char* socket_val    = NULL;
+    char** target_list  = NULL;
+    size_t target_count = 0;
+    int tgttime_val     = 0;
+    int idle_val        = 0;
+    int rate_val        = 0;
+    char* devid_store   = NULL;
+    size_t devid_size   = 0;
+    char** devid_list   = NULL;
+    size_t devid_count  = 0;
+    char* failed_val    = NULL;
+    char* cache_val     = NULL;
+    int cachettl_val    = OTTERCAT_PARAM_CACHETTL;
+    char* cachecmd_val  = NULL;
+    const char** cachecmd_list = NULL;
+    fanout_cfg_t fanout_cfg;
+    bool watch_val      = false;
+    char* wtype_val     = NULL;
+    char** wfield_val   = NULL;
+    int wfield_count    = 0;
+    watch_cfg_t watch_cfg;
+    char* capture_val   = NULL;
+    char* replay_val    = NULL;
+    double rpspeed_val  = 1.0;
+    int rpchan_val      = -1;
+    bool framed_val     = false;
+    char* fbridge_val   = NULL;
+    bool shmring_val    = false;
+    bool shmloop_val    = false;
+    sp_tcpopt_t tcpopt;
+    bool resend_val     = true;
+    bool ackonly_val    = false;
+    char* journal_val   = NULL;
+    char* collect_val   = NULL;
+    collect_cfg_t collect_cfg;
+    cmdgraph_cfg_t graph_cfg;
+    char* tmpl_val      = NULL;
+    char* data_val      = NULL;
+    cmdtmpl_cfg_t tmpl_cfg;
+    bool xfer_val       = false;
+    char* xpath_val     = NULL;
+    char* xfileid_val   = NULL;
+    char* xcmd_val      = NULL;
+    char* xresume_val   = NULL;
+    xfer_cfg_t xfer_cfg;
+    char* cmdtab_val    = NULL;
+    bool dryrun_val     = false;
+    long every_val      = 0;
+    poller_cfg_t poll_cfg;
     char* cmdstr_val    = NULL;
     size_t cmdstr_size  = 0;
 
+    watch_cfg_init(&watch_cfg);
+    xfer_cfg_init(&xfer_cfg);
+    poller_cfg_init(&poll_cfg);
     
     /// Agglomerate the command input arguments, which are at the end of the
     /// argv section after the un-paired "--"
@@ -380,24 +570,319 @@ int main(int argc, char* argv[]) {
         tries_val = 1 + retries->ival[0];
     }
 
-    // Socket field is required, and argtable will flag an error if not present
-    FILL_STRINGARG(socket, socket_val);
-    intf_val = INTF_socket;
+    if (idle->count != 0) {
+        idle_val = idle->ival[0];
+    }
+    if (rate->count != 0) {
+        rate_val = rate->ival[0];
+    }
+    if (tgttime->count != 0) {
+        tgttime_val = tgttime->ival[0];
+    }
     
-    /// Input command string may be taken from command line or fed by stdin.
-    /// If no command string is present, then use pipe stdin.
-    if (cmdstr_size == 0) {
-        ///@todo 1024 should be configurable
-        cmdstr_val = malloc(1024);
-        if (cmdstr_val == NULL) {
+    /// Device IDs are gathered into one buffer, which is split in place.
+    /// The list can be very long, so the IDs are not copied individually.
+    devid_opt       = devid;
+    devidlist_opt   = devlist;
+    for (int i=0; i<devid->count; i++) {
+        char* newbuf = realloc(devid_store, devid_size + strlen(devid->sval[i]) + 2);
+        if (newbuf == NULL) {
+            goto main_FINISH;
+        }
+        devid_store = newbuf;
+        devid_size += (size_t)sprintf(&devid_store[devid_size], "%s,", devid->sval[i]);
+    }
+    if (devlist->count != 0) {
+        if (sub_appendfile(&devid_store, &devid_size, devlist->sval[0]) != 0) {
+            fprintf(stderr, "%s: device ID file %s could not be read\n", progname, devlist->sval[0]);
+            exitcode = 1;
+            goto main_FINISH;
+        }
+    }
+    if (devid_store != NULL) {
+        if (fanout_splitdevids(devid_store, &devid_list, &devid_count) <= 0) {
+            fprintf(stderr, "%s: no device IDs given\n", progname);
+            exitcode = 1;
+            goto main_FINISH;
+        }
+    }
+    if (failed->count != 0) {
+        failed_val = strdup(failed->filename[0]);
+    }
+    
+    /// File transfer: one device, and one file each way
+    if ((xput->count != 0) || (xget->count != 0)) {
+        if (((xput->count != 0) && (xget->count != 0)) || (xfileid->count == 0)) {
+            fprintf(stderr, "%s: a transfer takes one of --put or --get, and --file-id\n", progname);
+            exitcode = 1;
+            goto main_FINISH;
+        }
+        xfer_val            = true;
+        xfer_cfg.is_get     = (xget->count != 0);
+        xpath_val           = strdup(xfer_cfg.is_get ? xget->filename[0] : xput->filename[0]);
+        xfileid_val         = strdup(xfileid->sval[0]);
+        xcmd_val            = (xcmd->count != 0) ? strdup(xcmd->sval[0]) : NULL;
+        xresume_val         = (xresume->count != 0) ? strdup(xresume->filename[0]) : NULL;
+        xfer_cfg.path       = xpath_val;
+        xfer_cfg.fileid     = xfileid_val;
+        xfer_cfg.devid      = (devid_count != 0) ? devid_list[0] : NULL;
+        xfer_cfg.cmd        = xcmd_val;
+        xfer_cfg.resume     = xresume_val;
+        xfer_cfg.size       = (xsize->count != 0) ? (size_t)xsize->ival[0] : 0;
+        if (xchunk->count != 0) {
+            xfer_cfg.chunk  = xchunk->ival[0];
+        }
+        if ((xfer_cfg.chunk <= 0) || ((xsize->count != 0) && (xsize->ival[0] < 0))) {
+            fprintf(stderr, "%s: --chunk and --size must be positive\n", progname);
+            exitcode = 1;
+            goto main_FINISH;
+        }
+    }
+    if (cache->count != 0) {
+        cache_val = strdup(cache->filename[0]);
+    }
+    if (cachettl->count != 0) {
+        cachettl_val = cachettl->ival[0];
+    }
+    cachecmd_val = strdup((cachecmd->count != 0) ? cachecmd->sval[0] : OTTERCAT_PARAM_CACHECMDS);
+    if ((cachecmd_val == NULL) || (sub_splitnames(cachecmd_val, &cachecmd_list) < 0)) {
+        goto main_FINISH;
+    }
+    
+    /// The output filter is compiled once, here, and applied to every line
+    cli.filter = NULL;
+    if ((filter->count != 0) || (project->count != 0)) {
+        char errbuf[256];
+        cli.filter = filter_compile((filter->count != 0) ? filter->sval[0] : NULL,
+                                    (project->count != 0) ? project->sval[0] : NULL, errbuf, sizeof(errbuf));
+        if (cli.filter == NULL) {
+            fprintf(stderr, "%s: %s\n", progname, errbuf);
+            exitcode = 1;
+            goto main_FINISH;
+        }
+    }
+    
+    /// Watch mode options.  The filter strings are copied, because the
+    /// argtable is freed before the watch runs.
+    watch_val = (watch->count != 0);
+    if (wtype->count != 0) {
+        wtype_val = strdup(wtype->sval[0]);
+        if ((wtype_val == NULL) || (sub_splitnames(wtype_val, &watch_cfg.types) < 0)) {
+            goto main_FINISH;
+        }
+    }
+    for (int i=0; i<wsid->count; i++) {
+        if (watch_addsids(&watch_cfg, wsid->sval[i]) < 0) {
+            fprintf(stderr, "%s: invalid sid ranges %s\n", progname, wsid->sval[i]);
+            exitcode = 1;
             goto main_FINISH;
         }
-        if (sub_readline(&cmdstr_size, STDIN_FILENO, cmdstr_val, 1024) <= 0) {
+    }
+    if (wfield->count != 0) {
+        wfield_val = calloc((size_t)wfield->count, sizeof(char*));
+        if (wfield_val == NULL) {
+            goto main_FINISH;
+        }
+        wfield_count = wfield->count;
+    }
+    for (int i=0; i<wfield->count; i++) {
+        wfield_val[i] = strdup(wfield->sval[i]);
+        if ((wfield_val[i] == NULL) || (watch_addfield(&watch_cfg, wfield_val[i]) != 0)) {
+            fprintf(stderr, "%s: invalid field filter %s\n", progname, wfield->sval[i]);
+            exitcode = 1;
+            goto main_FINISH;
+        }
+    }
+    if (wstats->count != 0) {
+        watch_cfg.stats_ms = wstats->ival[0];
+    }
+    watch_cfg.idle_ms = idle_val;
+    watch_cfg.filter  = cli.filter;
+    
+    /// Capture and replay.  A replay stands in for the daemon, so it needs
+    /// nothing but the capture file and the socket path.
+    if (capfile->count != 0) {
+        capture_val = strdup(capfile->filename[0]);
+    }
+    if (replay->count != 0) {
+        replay_val = strdup(replay->filename[0]);
+    }
+    if (rpspeed->count != 0) {
+        rpspeed_val = rpspeed->dval[0];
+    }
+    if (rpchan->count != 0) {
+        rpchan_val = rpchan->ival[0];
+    }
+    
+    /// Framed transport.  The bridge is a stand-alone adapter, like replay.
+    framed_val = (framed->count != 0);
+    if (fbridge->count != 0) {
+        fbridge_val = strdup(fbridge->filename[0]);
+    }
+    
+    /// Shared memory rings.  The loopback daemon is stand-alone, like replay.
+    shmring_val = (shmring->count != 0);
+    shmloop_val = (shmloop->count != 0);
+    
+    /// TCP options apply to every host:port connection
+    sp_tcp_getopt(&tcpopt);
+    if (tcpka->count != 0) {
+        tcpopt.keepidle_s = tcpka->ival[0];
+    }
+    if (tcpsnd->count != 0) {
+        tcpopt.sndbuf = tcpsnd->ival[0];
+    }
+    if (tcprcv->count != 0) {
+        tcpopt.rcvbuf = tcprcv->ival[0];
+    }
+    tcpopt.connect_ms = timeout_val;
+    
+    /// Fire-and-forget, and the collector for it.  The collector stands in
+    /// for the commands, so it needs no command string.
+    ackonly_val = (ackonly->count != 0);
+    if ((tmpl->count != 0) != (data->count != 0)) {
+        fprintf(stderr, "%s: --template and --data go together\n", progname);
+        exitcode = 1;
+        goto main_FINISH;
+    }
+    if (tmpl->count != 0) {
+        tmpl_val = strdup(tmpl->sval[0]);
+        data_val = strdup(data->filename[0]);
+    }
+    if (cmdtab->count != 0) {
+        cmdtab_val = strdup(cmdtab->filename[0]);
+    }
+    dryrun_val  = (dryrun->count != 0);
+    if (dryrun_val && (cmdtab_val == NULL)) {
+        fprintf(stderr, "%s: --dry-run needs --cmdtab\n", progname);
+        exitcode = 1;
+        goto main_FINISH;
+    }
+    
+    /// Periodic polling
+    if (every->count != 0) {
+        every_val = poller_parseperiod(every->sval[0]);
+        if (every_val <= 0) {
+            fprintf(stderr, "%s: --every needs an interval such as 500ms, 2s or 1m\n", progname);
+            exitcode = 1;
+            goto main_FINISH;
+        }
+        if (ackonly_val) {
+            fprintf(stderr, "%s: --every waits for results, so it can't be used with --ack-only\n", progname);
+            exitcode = 1;
+            goto main_FINISH;
+        }
+        poll_cfg.period_ms  = every_val;
+        poll_cfg.changes    = (changes->count != 0);
+        poll_cfg.polls      = ((polls->count != 0) && (polls->ival[0] > 0)) ? (unsigned long)polls->ival[0] : 0;
+    }
+    if (journal->count != 0) {
+        journal_val = strdup(journal->filename[0]);
+    }
+    if (collect->count != 0) {
+        collect_val = strdup(collect->filename[0]);
+    }
+    collect_cfg.fd_out      = STDOUT_FILENO;
+    collect_cfg.timeout_ms  = timeout_val * tries_val;
+    collect_cfg.idle_ms     = idle_val;
+    collect_cfg.filter      = cli.filter;
+    
+    /// Reconnect policy for commands sent but not yet acked
+    if (resend->count != 0) {
+        if (strcmp(resend->sval[0], "none") == 0) {
+            resend_val = false;
+        }
+        else if (strcmp(resend->sval[0], "unacked") != 0) {
+            fprintf(stderr, "%s: --resend must be unacked or none\n", progname);
+            exitcode = 1;
+            goto main_FINISH;
+        }
+    }
+    
+    fanout_cfg_init(&fanout_cfg);
+    fanout_cfg.fd_out           = STDOUT_FILENO;
+    fanout_cfg.target_timeout_ms= tgttime_val;
+    fanout_cfg.devid            = devid_list;
+    fanout_cfg.num_devids       = devid_count;
+    fanout_cfg.concurrency      = (concur->count != 0) ? concur->ival[0] : 8;
+    fanout_cfg.rounds           = (rounds->count != 0) ? rounds->ival[0] : 0;
+    fanout_cfg.failed_path      = failed_val;
+    fanout_cfg.filter           = cli.filter;
+    graph_cfg.fd_out            = STDOUT_FILENO;
+    graph_cfg.concurrency       = fanout_cfg.concurrency;
+    graph_cfg.filter            = cli.filter;
+    tmpl_cfg.fd_out             = STDOUT_FILENO;
+    tmpl_cfg.concurrency        = fanout_cfg.concurrency;
+    tmpl_cfg.filter             = cli.filter;
+    poll_cfg.fd_out             = STDOUT_FILENO;
+    poll_cfg.concurrency        = fanout_cfg.concurrency;
+    poll_cfg.filter             = cli.filter;
+
+    /// At least one socket is required, given directly or in a targets file.
+    /// More than one socket selects fan-out mode.
+    if (targets->count != 0) {
+        if (fanout_loadtargets(targets->filename[0], &target_list, &target_count) < 0) {
+            fprintf(stderr, "%s: targets file %s could not be read\n", progname, targets->filename[0]);
+            exitcode = 1;
+            goto main_FINISH;
+        }
+    }
+    for (int i=0; i<socket->count; i++) {
+        char** newlist = realloc(target_list, (target_count+1) * sizeof(char*));
+        if (newlist == NULL) {
+            goto main_FINISH;
+        }
+        target_list = newlist;
+        target_list[target_count] = strdup(socket->filename[i]);
+        if (target_list[target_count] == NULL) {
+            goto main_FINISH;
+        }
+        target_count++;
+    }
+    if ((every_val > 0) && ((target_count > 1) || (devid_count != 0))) {
+        fprintf(stderr, "%s: --every polls one daemon, and can't be used with more targets or --devid\n", progname);
+        exitcode = 1;
+        goto main_FINISH;
+    }
+    if ((target_count == 0) && (dryrun_val == false)) {
+        fprintf(stderr, "%s: missing option <path/addr>\n", progname);
+        printf("Try '%s --help' for more information.\n", progname);
+        exitcode = 1;
+        goto main_FINISH;
+    }
+    socket_val  = (target_count != 0) ? target_list[0] : NULL;
+    intf_val    = INTF_socket;
+    
+    /// Input command string may be taken from command line or fed by stdin.
+    /// If no command string is present, then use pipe stdin.  Watch mode
+    /// doesn't need a command, so it only uses one given on the command line.
+    if ((cmdstr_size == 0) && (watch_val == false) && (replay_val == NULL) && (fbridge_val == NULL) && (shmloop_val == false)
+     && (collect_val == NULL) && (tmpl_val == NULL) && (xfer_val == false)) {
+        size_t cmdstr_alloc = 0;
+        if (sub_readline(&cmdstr_size, STDIN_FILENO, &cmdstr_val, &cmdstr_alloc) <= 0) {
             goto main_FINISH;
         }
         if (cmdstr_size == 0) {
             goto main_FINISH;
         }
+        
+        /// A dry run checks all of stdin, not just its first line, and polls
+        /// run all of it too
+        if (dryrun_val || (every_val > 0)) {
+            char* more          = NULL;
+            size_t more_alloc   = 0;
+            size_t more_size;
+            while (sub_readline(&more_size, STDIN_FILENO, &more, &more_alloc) > 0) {
+                char* newbuf = realloc(cmdstr_val, cmdstr_size + more_size + 1);
+                if (newbuf == NULL) {
+                    break;
+                }
+                cmdstr_val = newbuf;
+                memcpy(&cmdstr_val[cmdstr_size], more, more_size + 1);
+                cmdstr_size += more_size;
+            }
+            free(more);
+        }
     }    
 
     /// Set cliopt struct with derived variables
@@ -406,6 +891,90 @@ int main(int argc, char* argv[]) {
     cliopt_setdebug(debug_val);
     cliopt_settimeout(timeout_val);
     cliopt_settries(tries_val);
+    cliopt_setidle(idle_val);
+    cliopt_setrate(rate_val);
+    cliopt_setframed(framed_val);
+    cliopt_setshmring(shmring_val);
+    cliopt_setresend(resend_val);
+    cliopt_setackonly(ackonly_val);
+    sp_tcp_setopt(&tcpopt);
+    
+    /// The response cache is optional: ottercat runs without it if the file
+    /// can't be used.
+    cli.cache = NULL;
+    if (cache_val != NULL) {
+        cli.cache = rcache_open(cache_val, OTTERCAT_PARAM_CACHESIZE, cachettl_val, cachecmd_list);
+        if (cli.cache == NULL) {
+            fprintf(stderr, "%s: cache file %s could not be used\n", progname, cache_val);
+        }
+    }
+    
+    /// A capture was asked for explicitly, so ottercat doesn't run without it
+    cli.capture = NULL;
+    if (capture_val != NULL) {
+        cli.capture = capture_open(capture_val);
+        if (cli.capture == NULL) {
+            fprintf(stderr, "%s: capture file %s could not be used\n", progname, capture_val);
+            exitcode = 1;
+            goto main_FINISH;
+        }
+    }
+    watch_cfg.capture   = cli.capture;
+    fanout_cfg.capture  = cli.capture;
+    collect_cfg.capture = cli.capture;
+    graph_cfg.capture   = cli.capture;
+    tmpl_cfg.capture    = cli.capture;
+    poll_cfg.capture    = cli.capture;
+    
+    /// Same as the capture: a journal that was asked for is required
+    cli.journal = NULL;
+    if (journal_val != NULL) {
+        cli.journal = collect_open(journal_val);
+        if (cli.journal == NULL) {
+            fprintf(stderr, "%s: journal file %s could not be used\n", progname, journal_val);
+            exitcode = 1;
+            goto main_FINISH;
+        }
+    }
+    fanout_cfg.journal  = cli.journal;
+    graph_cfg.journal   = cli.journal;
+    tmpl_cfg.journal    = cli.journal;
+    
+    /// Check the command lines against the command table before anything is
+    /// sent.  A dry run stops here.
+    if (cmdtab_val != NULL) {
+        cmdcheck_t table;
+        struct timespec start, stop;
+        int checked = 0;
+        int bad     = 0;
+        
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        table = cmdcheck_load(cmdtab_val);
+        if (table == NULL) {
+            exitcode = 1;
+            goto main_FINISH;
+        }
+        if (cmdstr_val != NULL) {
+            bad = cmdcheck_script(table, cmdstr_val, &checked);
+        }
+        else if (tmpl_val != NULL) {
+            bad = cmdcheck_script(table, tmpl_val, &checked);
+        }
+        cmdcheck_free(table);
+        clock_gettime(CLOCK_MONOTONIC, &stop);
+        
+        if (dryrun_val) {
+            fprintf(stderr, "%s: %d commands checked, %d bad.  %li ms\n", progname, checked, bad,
+                    (long)(stop.tv_sec - start.tv_sec)*1000 + (stop.tv_nsec - start.tv_nsec)/1000000);
+            exitcode = (bad != 0);
+            goto main_FINISH;
+        }
+        if (bad != 0) {
+            fprintf(stderr, "%s: %d bad command lines, nothing was sent\n", progname, bad);
+            exitcode = 1;
+            goto main_FINISH;
+        }
+    }
     
     /// All configuration is done.
     /// Send all configuration data to program main function.
@@ -413,13 +982,82 @@ int main(int argc, char* argv[]) {
     
     main_FINISH:
     arg_freetable(argtable, sizeof(argtable)/sizeof(argtable[0]));
+    devid_opt       = NULL;
+    devidlist_opt   = NULL;
     
     if (bailout == false) {
-        exitcode = ottercat_main(intf_val, (const char*)socket_val, cmdstr_val);
+        if (shmloop_val) {
+            exitcode = shmring_loopback_run((const char*)socket_val);
+        }
+        else if (fbridge_val != NULL) {
+            exitcode = framebridge_run(fbridge_val, (const char*)socket_val);
+        }
+        else if (replay_val != NULL) {
+            exitcode = capture_replay(replay_val, (const char*)socket_val, rpspeed_val, rpchan_val);
+        }
+        else if (collect_val != NULL) {
+            exitcode = collect_run((const char*)socket_val, collect_val, &collect_cfg);
+        }
+        else if (xfer_val) {
+            xfer_cfg.concurrency = fanout_cfg.concurrency;
+            xfer_cfg.capture     = cli.capture;
+            exitcode = xfer_run((const char*)socket_val, &xfer_cfg);
+        }
+        else if (tmpl_val != NULL) {
+            exitcode = cmdtmpl_run((const char*)socket_val, tmpl_val, data_val, &tmpl_cfg);
+        }
+        else if (every_val > 0) {
+            exitcode = poller_run((const char*)socket_val, cmdstr_val, &poll_cfg);
+        }
+        else if (watch_val) {
+            exitcode = watch_run((const char*)socket_val, cmdstr_val, &watch_cfg);
+        }
+        else if ((target_count > 1) || (devid_count != 0)) {
+            exitcode = fanout_run((const char**)target_list, target_count, cmdstr_val, &fanout_cfg);
+        }
+        else if ((cmdstr_val != NULL) && cmdgraph_detect(cmdstr_val)) {
+            exitcode = cmdgraph_run((const char*)socket_val, cmdstr_val, &graph_cfg);
+        }
+        else {
+            exitcode = ottercat_main(intf_val, (const char*)socket_val, cmdstr_val);
+        }
     }
     
-    free(socket_val);
+    for (size_t i=0; i<target_count; i++) {
+        free(target_list[i]);
+    }
+    free(target_list);
+    free(devid_list);
+    free(devid_store);
+    free(failed_val);
     free(cmdstr_val);
+    rcache_close(cli.cache);
+    filter_free(cli.filter);
+    capture_close(cli.capture);
+    collect_close(cli.journal);
+    free(capture_val);
+    free(journal_val);
+    free(cmdtab_val);
+    free(tmpl_val);
+    free(data_val);
+    free(xpath_val);
+    free(xfileid_val);
+    free(xcmd_val);
+    free(xresume_val);
+    free(collect_val);
+    free(replay_val);
+    free(fbridge_val);
+    free(cachecmd_list);
+    free(cachecmd_val);
+    free(cache_val);
+    free(watch_cfg.types);
+    free(watch_cfg.sids);
+    free(watch_cfg.fields);
+    free(wtype_val);
+    for (int i=0; (wfield_val != NULL) && (i<wfield_count); i++) {
+        free(wfield_val[i]);
+    }
+    free(wfield_val);
 
     return exitcode;
 }
@@ -19,6 +19,9 @@ endif
 
 BUILDDIR    := ../$(OTTERCAT_BLD)
 
+# Objects are shared by the ottercat app and libottercat.so
+PICFLAG     ?= -fPIC
+
 SUBAPPDIR   := .
 SRCEXT      := c
 DEPEXT      := d
@@ -63,7 +66,7 @@ $(SUBAPP): $(OBJECTS)
 #Compile Stages
 $(BUILDDIR)/%.$(OBJEXT): ./%.$(SRCEXT)
 	@mkdir -p $(dir $@)
-	$(CC) $(CFLAGS) $(OTTERCAT_DEF) $(INC) -c -o $@ $<
+	$(CC) $(CFLAGS) $(PICFLAG) $(OTTERCAT_DEF) $(INC) -c -o $@ $<
 	@$(CC) $(CFLAGS) $(OTTERCAT_DEF) $(INCDEP) -MM ./$*.$(SRCEXT) > $(BUILDDIR)/$*.$(DEPEXT)
 	@cp -f $(BUILDDIR)/$*.$(DEPEXT) $(BUILDDIR)/$*.$(DEPEXT).tmp
 	@sed -e 's|.*:|$(BUILDDIR)/$*.$(OBJEXT):|' < $(BUILDDIR)/$*.$(DEPEXT).tmp > $(BUILDDIR)/$*.$(DEPEXT)
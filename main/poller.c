@@ -0,0 +1,480 @@
+/* Copyright 2020, JP Norair
+  *
+  * Licensed under the OpenTag License, Version 1.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  * http://www.indigresso.com/wiki/doku.php?id=opentag:license_1_0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  *
+  */
+
+/// The main thread sleeps on the timerfd and starts each poll by submitting
+/// every command to one libottercat handle, which stays open for the whole
+/// run.  Completions come back on the engine thread: each command gathers its
+/// tagged lines in its own buffer, and hashes its frames as they come, so
+/// that the whole result is written (or not) in one piece when the command is
+/// complete.  The buffer is taken off the command and written after the mutex
+/// is released, so a slow reader of the output doesn't hold up the other
+/// commands' completions.  The main thread only looks at the count of commands
+/// still running, to decide whether a poll that is due has to be skipped.
+
+// Application Headers
+#include "poller.h"
+#include "cmdgraph.h"
+#include "debug.h"
+#include "libottercat.h"
+#include "ottercat_cfg.h"
+#include "runner.h"
+#include "unixsrv.h"
+
+// Standard C & POSIX Libraries
+#include <ctype.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+
+#define POLLER_HASH_INIT    14695981039346656037ull
+#define POLLER_HASH_PRIME   1099511628211ull
+
+struct poller;
+
+typedef struct {
+    struct poller*  pl;
+    const char*     line;
+    size_t          size;
+    int             num;            ///< place in the script, from 1
+    uint64_t        hash;           ///< hash of this poll's result, so far
+    uint64_t        last;           ///< hash of the last poll's result
+    bool            seen;           ///< last is valid
+    char*           out;            ///< this poll's tagged lines
+    size_t          outsize;
+    size_t          outalloc;
+} pcmd_t;
+
+typedef struct poller {
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+    pthread_mutex_t outmutex;       ///< held while a result is written
+    const poller_cfg_t* cfg;
+    otc_handle_t    otc;
+    char*           stream;
+    pcmd_t*         cmd;
+    size_t          cmds;
+
+    // Guarded by mutex
+    unsigned long   polls;          ///< polls started
+    size_t          running;        ///< commands of this poll not complete
+    runout_t        out;
+    unsigned long   ok;
+    unsigned long   failed;
+    unsigned long   unchanged;
+
+    // Main thread only
+    unsigned long   skipped;
+    unsigned long   late_n;
+    uint64_t        late_us_total;
+    uint64_t        late_us_max;
+} poller_t;
+
+
+
+
+/** Commands <BR>
+  * ========================================================================<BR>
+  */
+
+/// Split the stream into command lines, in place.  JSON lines are reduced
+/// to their "data" string, as in a plain run.
+static int sub_splitcmds(poller_t* pl, char* stream) {
+    char* cursor;
+    char* line;
+    size_t max = 1;
+
+    for (cursor=stream; *cursor!=0; cursor++) {
+        max += (*cursor == '\n');
+    }
+    pl->cmd = calloc(max, sizeof(pcmd_t));
+    if (pl->cmd == NULL) {
+        return -1;
+    }
+
+    for (line=strtok_r(stream, "\n", &cursor); line!=NULL; line=strtok_r(NULL, "\n", &cursor)) {
+        while (isspace(*line)) line++;
+        if ((*line == 0) || (*line == '#') || cmdgraph_isdirective(line)) {
+            continue;
+        }
+        pl->cmd[pl->cmds].pl    = pl;
+        pl->cmd[pl->cmds].line  = runner_cmdline(line);
+        pl->cmd[pl->cmds].size  = strlen(line);
+        pl->cmd[pl->cmds].num   = (int)pl->cmds + 1;
+        pl->cmds++;
+    }
+
+    return (int)pl->cmds;
+}
+
+
+static uint64_t sub_hash(uint64_t hash, const void* data, size_t size) {
+    const uint8_t* cursor = data;
+    while (size-- != 0) {
+        hash = (hash ^ *cursor++) * POLLER_HASH_PRIME;
+    }
+    return hash;
+}
+
+
+
+
+/** Output <BR>
+  * ========================================================================<BR>
+  */
+
+/// Add one response line, tagged, to the command's buffer.  Call with
+/// pl->mutex held.
+static void sub_append(poller_t* pl, pcmd_t* cmd, const char* line) {
+    const uint8_t* text;
+    size_t need;
+    int size;
+    int tag;
+
+    if (line == NULL) {
+        return;
+    }
+    size = runner_filter(&pl->out, line, &text);
+    if (size < 0) {
+        return;
+    }
+
+    need = cmd->outsize + (size_t)size + 48;
+    if (need > cmd->outalloc) {
+        char* newbuf = realloc(cmd->out, need * 2);
+        if (newbuf == NULL) {
+            return;
+        }
+        cmd->out        = newbuf;
+        cmd->outalloc   = need * 2;
+    }
+    tag = snprintf(&cmd->out[cmd->outsize], 48, "[%lu.%d] ", pl->polls, cmd->num);
+    cmd->outsize += (size_t)tag;
+    memcpy(&cmd->out[cmd->outsize], text, (size_t)size);
+    cmd->outsize += (size_t)size;
+    cmd->out[cmd->outsize++] = '\n';
+}
+
+
+static void sub_appenderr(poller_t* pl, pcmd_t* cmd, int rc, const char* desc) {
+    char line[256];
+    runner_errline(line, sizeof(line), rc, desc, NULL);
+    sub_append(pl, cmd, line);
+}
+
+
+/// Mark the command complete.  Its lines are taken off it, to be written
+/// with sub_write() once pl->mutex is released, unless they are unchanged
+/// and only changes are wanted.  Call with pl->mutex held.
+static char* sub_finish(poller_t* pl, pcmd_t* cmd, int rc, size_t* outsize) {
+    char* out = NULL;
+    bool changed;
+
+    cmd->hash = sub_hash(cmd->hash, &rc, sizeof(rc));
+    changed   = !cmd->seen || (cmd->hash != cmd->last);
+    if ((rc < 0) || changed || !pl->cfg->changes) {
+        out             = cmd->out;
+        *outsize        = cmd->outsize;
+        cmd->out        = NULL;
+        cmd->outsize    = 0;
+        cmd->outalloc   = 0;
+    }
+    else {
+        pl->unchanged++;
+    }
+    if (rc < 0) {
+        pl->failed++;
+    }
+    else {
+        pl->ok++;
+    }
+
+    cmd->last   = cmd->hash;
+    cmd->seen   = true;
+    if (--pl->running == 0) {
+        pthread_cond_broadcast(&pl->cond);
+    }
+    return out;
+}
+
+
+/// Write a finished command's lines, and free them.  Call without
+/// pl->mutex held.
+static void sub_write(poller_t* pl, char* out, size_t size) {
+    const char* cursor = out;
+
+    if (out == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&pl->outmutex);
+    while (size != 0) {
+        ssize_t wrote = write(pl->cfg->fd_out, cursor, size);
+        if (wrote <= 0) {
+            if ((wrote < 0) && (errno == EINTR)) {
+                continue;
+            }
+            break;
+        }
+        cursor += wrote;
+        size   -= (size_t)wrote;
+    }
+    pthread_mutex_unlock(&pl->outmutex);
+    free(out);
+}
+
+
+
+
+/** Runner <BR>
+  * ========================================================================<BR>
+  */
+
+static void sub_oncomplete(otc_handle_t otc, const otc_result_t* res, void* user) {
+    pcmd_t* cmd     = user;
+    poller_t* pl    = cmd->pl;
+    int rc          = res->rc;
+    char* out       = NULL;
+    size_t outsize  = 0;
+
+    pthread_mutex_lock(&pl->mutex);
+
+    sub_append(pl, cmd, res->ack);
+    sub_append(pl, cmd, res->rxstat);
+
+    // The ack carries a new sid every time, so only the rxstats are hashed
+    if (res->rxstat != NULL) {
+        cmd->hash = sub_hash(cmd->hash, &res->qual, sizeof(res->qual));
+        if (res->frame != NULL) {
+            cmd->hash = sub_hash(cmd->hash, res->frame, res->frame_size);
+        }
+    }
+    if (res->more == 0) {
+        if ((rc < 0) && ((res->ack == NULL) || (rc > OTC_ERR_ACK(0)))) {
+            sub_appenderr(pl, cmd, rc, "execution error");
+        }
+        out = sub_finish(pl, cmd, (rc < 0) ? rc : 0, &outsize);
+    }
+
+    pthread_mutex_unlock(&pl->mutex);
+    sub_write(pl, out, outsize);
+}
+
+
+static void sub_startpoll(poller_t* pl) {
+    char* out;
+    size_t outsize = 0;
+    int rc;
+
+    pthread_mutex_lock(&pl->mutex);
+    pl->polls++;
+    pl->running = pl->cmds;
+    for (size_t i=0; i<pl->cmds; i++) {
+        pl->cmd[i].hash     = POLLER_HASH_INIT;
+        pl->cmd[i].outsize  = 0;
+    }
+    pthread_mutex_unlock(&pl->mutex);
+
+    for (size_t i=0; i<pl->cmds; i++) {
+        rc = otc_submit(pl->otc, pl->cmd[i].line, pl->cmd[i].size, &sub_oncomplete, &pl->cmd[i], NULL);
+        if (rc < 0) {
+            pthread_mutex_lock(&pl->mutex);
+            sub_appenderr(pl, &pl->cmd[i], rc, "submit error");
+            out = sub_finish(pl, &pl->cmd[i], rc, &outsize);
+            pthread_mutex_unlock(&pl->mutex);
+            sub_write(pl, out, outsize);
+        }
+    }
+}
+
+
+static void sub_timespec_addms(struct timespec* ts, long ms) {
+    ts->tv_sec  += ms / 1000;
+    ts->tv_nsec += (ms % 1000) * 1000000;
+    if (ts->tv_nsec >= 1000000000) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000;
+    }
+}
+
+
+
+
+/** Public API <BR>
+  * ========================================================================<BR>
+  */
+
+void poller_cfg_init(poller_cfg_t* cfg) {
+    memset(cfg, 0, sizeof(poller_cfg_t));
+    cfg->fd_out         = -1;
+    cfg->concurrency    = 8;
+}
+
+
+long poller_parseperiod(const char* arg) {
+    char* end;
+    long period;
+
+    if ((arg == NULL) || !isdigit((unsigned char)*arg)) {
+        return -1;
+    }
+    period = strtol(arg, &end, 10);
+    if ((*end == 0) || (strcmp(end, "ms") == 0)) {
+        ;
+    }
+    else if (strcmp(end, "s") == 0) {
+        period *= 1000;
+    }
+    else if (strcmp(end, "m") == 0) {
+        period *= 60000;
+    }
+    else {
+        return -1;
+    }
+    return (period > 0) ? period : -1;
+}
+
+
+int poller_run(const char* socket, const char* cmdstream, const poller_cfg_t* cfg) {
+    poller_t pl;
+    otc_cfg_t otccfg;
+    struct itimerspec its;
+    struct timespec start;
+    struct timespec now;
+    struct timespec due;
+    struct pollfd pfd;
+    uint64_t ticks = 0;
+    uint64_t expired;
+    uint64_t late_us;
+    bool busy;
+    int tfd = -1;
+    int rc;
+
+    if ((socket == NULL) || (cmdstream == NULL) || (cfg == NULL) || (cfg->period_ms <= 0)) {
+        return -1;
+    }
+
+    memset(&pl, 0, sizeof(pl));
+    pl.cfg      = cfg;
+    pl.stream   = strdup(cmdstream);
+    if (pl.stream == NULL) {
+        return -1;
+    }
+    if (sub_splitcmds(&pl, pl.stream) <= 0) {
+        fprintf(stderr, OTTERCAT_PARAM_NAME ": no commands to poll\n");
+        rc = -2;
+        goto poller_run_FREE;
+    }
+
+    tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (tfd < 0) {
+        rc = -1;
+        goto poller_run_FREE;
+    }
+    pthread_mutex_init(&pl.mutex, NULL);
+    pthread_mutex_init(&pl.outmutex, NULL);
+    pthread_cond_init(&pl.cond, NULL);
+    runner_outinit(&pl.out, cfg->fd_out, cfg->filter);
+
+    // Polls wait for rxstats, so that there is a result to compare
+    runner_otccfg(&otccfg, cfg->concurrency, OTC_FLAG_ACKONLY, cfg->capture);
+
+    rc = otc_open(&pl.otc, socket, &otccfg);
+    if (rc < 0) {
+        fprintf(stderr, "Err: socket could not be opened.\n");
+        goto poller_run_DESTROY;
+    }
+
+    // SIGINT/SIGTERM end the run after the poll in progress, so the stats
+    // are printed.  The timerfd is waited on with a short poll() timeout,
+    // since the signal may be taken by another thread.
+    unixsrv_onstop();
+
+    // The first poll is due now, and the rest on the grid from there
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    memset(&its, 0, sizeof(its));
+    its.it_value                = start;
+    its.it_interval.tv_sec      = cfg->period_ms / 1000;
+    its.it_interval.tv_nsec     = (cfg->period_ms % 1000) * 1000000;
+    timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, NULL);
+
+    pfd.fd      = tfd;
+    pfd.events  = POLLIN;
+    while ((unixsrv_stopped() == false) && ((cfg->polls == 0) || (pl.polls < cfg->polls))) {
+        if ((poll(&pfd, 1, 100) <= 0) || (read(tfd, &expired, sizeof(expired)) != sizeof(expired))) {
+            continue;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        // Periods that passed without a wakeup at all are skipped
+        ticks          += expired;
+        pl.skipped     += expired - 1;
+        due             = start;
+        sub_timespec_addms(&due, (long)(ticks - 1) * cfg->period_ms);
+        late_us         = (uint64_t)(((int64_t)(now.tv_sec - due.tv_sec) * 1000000)
+                        + ((now.tv_nsec - due.tv_nsec) / 1000));
+
+        pthread_mutex_lock(&pl.mutex);
+        busy = (pl.running != 0);
+        pthread_mutex_unlock(&pl.mutex);
+        if (busy) {
+            pl.skipped++;
+            continue;
+        }
+
+        pl.late_n++;
+        pl.late_us_total += late_us;
+        if (late_us > pl.late_us_max) {
+            pl.late_us_max = late_us;
+        }
+        sub_startpoll(&pl);
+    }
+
+    pthread_mutex_lock(&pl.mutex);
+    while (pl.running != 0) {
+        pthread_cond_wait(&pl.cond, &pl.mutex);
+    }
+    pthread_mutex_unlock(&pl.mutex);
+
+    otc_close(pl.otc);
+
+    fprintf(stderr, OTTERCAT_PARAM_NAME ": every %li ms: %lu polls, %lu skipped; %lu results: %lu ok, %lu failed, %lu unchanged.  jitter mean %.0f us, max %llu us\n",
+            cfg->period_ms, pl.polls, pl.skipped, pl.ok + pl.failed, pl.ok, pl.failed, pl.unchanged,
+            (pl.late_n != 0) ? ((double)pl.late_us_total / (double)pl.late_n) : 0.0,
+            (unsigned long long)pl.late_us_max);
+    rc = (pl.failed == 0) ? 0 : -4;
+
+    poller_run_DESTROY:
+    pthread_cond_destroy(&pl.cond);
+    pthread_mutex_destroy(&pl.outmutex);
+    pthread_mutex_destroy(&pl.mutex);
+    close(tfd);
+
+    poller_run_FREE:
+    for (size_t i=0; i<pl.cmds; i++) {
+        free(pl.cmd[i].out);
+    }
+    free(pl.cmd);
+    free(pl.stream);
+    runner_outfree(&pl.out);
+    return rc;
+}
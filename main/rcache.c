@@ -0,0 +1,386 @@
+/* Copyright 2020, JP Norair
+  *
+  * Licensed under the OpenTag License, Version 1.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  * http://www.indigresso.com/wiki/doku.php?id=opentag:license_1_0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  *
+  */
+
+/// Response cache file layout:
+///
+/// [header][index][data ring]
+///
+/// The index is a set-associative table: a key hashes to one bucket of
+/// RCACHE_WAYS entries, and a new key replaces the oldest entry in its
+/// bucket.  Records are appended to the data ring at an absolute write
+/// position (wpos) that only grows.  A record at absolute position pos is
+/// still intact while (wpos - pos) <= data_size, so an index entry whose
+/// record has been overwritten by the ring is detected without any search.
+/// Records that would straddle the end of the ring start over at its
+/// beginning instead.
+
+// Application Headers
+#include "rcache.h"
+#include "cliopt.h"
+#include "debug.h"
+
+// Standard C & POSIX Libraries
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+
+#define RCACHE_MAGIC        0x3143525443544fULL     // "OTCTRC1"
+#define RCACHE_WAYS         4
+#define RCACHE_MINSIZE      (64*1024)
+#define RCACHE_ALIGN(N)     (((N) + 7) & ~(uint64_t)7)
+
+// A record may use at most this fraction of the ring, so that one large
+// value can't evict most of the others
+#define RCACHE_MAXFRAC      16
+
+
+typedef struct {
+    uint64_t    magic;
+    uint64_t    size;
+    uint64_t    nbuckets;
+    uint64_t    data_off;
+    uint64_t    data_size;
+    uint64_t    wpos;
+    uint64_t    seq;
+} rchdr_t;
+
+
+typedef struct {
+    uint64_t    hash;
+    uint64_t    pos;
+    uint64_t    seq;            ///< 0: empty
+    int64_t     stored_ms;
+    uint32_t    keylen;
+    uint32_t    vallen;
+} rcentry_t;
+
+
+typedef struct {
+    uint64_t    seq;
+    uint64_t    hash;
+} rcrec_t;
+
+
+typedef struct {
+    int         fd;
+    uint8_t*    base;
+    size_t      size;
+    int         ttl_ms;
+    const char** cmds;
+} rcache_handle_t;
+
+
+
+
+static uint64_t sub_hash(const void* key, size_t keylen) {
+    const uint8_t* p = key;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    while (keylen-- != 0) {
+        hash ^= *p++;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+
+static int64_t sub_now_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return ((int64_t)now.tv_sec * 1000) + (now.tv_nsec / 1000000);
+}
+
+
+static rchdr_t* sub_hdr(rcache_handle_t* rc) {
+    return (rchdr_t*)rc->base;
+}
+
+
+static rcentry_t* sub_bucket(rcache_handle_t* rc, uint64_t hash) {
+    rchdr_t* hdr = sub_hdr(rc);
+    rcentry_t* index = (rcentry_t*)(rc->base + sizeof(rchdr_t));
+
+    return &index[(hash % hdr->nbuckets) * RCACHE_WAYS];
+}
+
+
+static rcrec_t* sub_record(rcache_handle_t* rc, uint64_t pos) {
+    rchdr_t* hdr = sub_hdr(rc);
+    return (rcrec_t*)(rc->base + hdr->data_off + (pos % hdr->data_size));
+}
+
+
+/// The entry's record hasn't been overwritten, and it holds the key
+static bool sub_entry_matches(rcache_handle_t* rc, rcentry_t* entry, uint64_t hash,
+                              const void* key, size_t keylen) {
+    rchdr_t* hdr = sub_hdr(rc);
+    rcrec_t* rec;
+
+    if ((entry->seq == 0) || (entry->hash != hash) || (entry->keylen != keylen)) {
+        return false;
+    }
+    if ((hdr->wpos - entry->pos) > hdr->data_size) {
+        return false;
+    }
+    rec = sub_record(rc, entry->pos);
+    if ((rec->seq != entry->seq) || (rec->hash != hash)) {
+        return false;
+    }
+    return (memcmp((uint8_t*)rec + sizeof(rcrec_t), key, keylen) == 0);
+}
+
+
+static void sub_format(rcache_handle_t* rc) {
+    rchdr_t* hdr = sub_hdr(rc);
+    uint64_t index_size;
+
+    memset(rc->base, 0, rc->size);
+
+    // The index takes about 1/8 of the file
+    hdr->nbuckets   = (rc->size / 8) / (sizeof(rcentry_t) * RCACHE_WAYS);
+    hdr->nbuckets   = (hdr->nbuckets > 0) ? hdr->nbuckets : 1;
+    index_size      = hdr->nbuckets * RCACHE_WAYS * sizeof(rcentry_t);
+    hdr->data_off   = RCACHE_ALIGN(sizeof(rchdr_t) + index_size);
+    hdr->data_size  = (rc->size - hdr->data_off) & ~(uint64_t)7;
+    hdr->wpos       = 0;
+    hdr->seq        = 0;
+    hdr->size       = rc->size;
+    hdr->magic      = RCACHE_MAGIC;
+}
+
+
+
+
+rcache_t rcache_open(const char* path, size_t size, int ttl_ms, const char** cmds) {
+    rcache_handle_t* rc;
+    struct stat st;
+
+    if ((path == NULL) || (cmds == NULL)) {
+        return NULL;
+    }
+    rc = calloc(1, sizeof(rcache_handle_t));
+    if (rc == NULL) {
+        return NULL;
+    }
+    rc->ttl_ms  = ttl_ms;
+    rc->cmds    = cmds;
+
+    rc->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (rc->fd < 0) {
+        ERR_PRINTF("cannot open cache file %s\n", path);
+        goto rcache_open_FREE;
+    }
+
+    // Creation is done under the lock, so two processes starting at once
+    // agree on the file size and format.
+    if (flock(rc->fd, LOCK_EX) != 0) {
+        goto rcache_open_CLOSE;
+    }
+    if (fstat(rc->fd, &st) != 0) {
+        goto rcache_open_UNLOCK;
+    }
+    rc->size = (size_t)st.st_size;
+    if (rc->size < RCACHE_MINSIZE) {
+        rc->size = (size < RCACHE_MINSIZE) ? RCACHE_MINSIZE : size;
+        if (ftruncate(rc->fd, (off_t)rc->size) != 0) {
+            goto rcache_open_UNLOCK;
+        }
+    }
+
+    rc->base = mmap(NULL, rc->size, PROT_READ | PROT_WRITE, MAP_SHARED, rc->fd, 0);
+    if (rc->base == MAP_FAILED) {
+        goto rcache_open_UNLOCK;
+    }
+    if ((sub_hdr(rc)->magic != RCACHE_MAGIC) || (sub_hdr(rc)->size != rc->size)) {
+        sub_format(rc);
+    }
+    flock(rc->fd, LOCK_UN);
+    return rc;
+
+    rcache_open_UNLOCK: flock(rc->fd, LOCK_UN);
+    rcache_open_CLOSE:  close(rc->fd);
+    rcache_open_FREE:   free(rc);
+    return NULL;
+}
+
+
+void rcache_close(rcache_t handle) {
+    rcache_handle_t* rc = handle;
+
+    if (rc != NULL) {
+        munmap(rc->base, rc->size);
+        close(rc->fd);
+        free(rc);
+    }
+}
+
+
+size_t rcache_maxval(rcache_t handle) {
+    rcache_handle_t* rc = handle;
+    if (rc == NULL) {
+        return 0;
+    }
+    return (size_t)(sub_hdr(rc)->data_size / RCACHE_MAXFRAC);
+}
+
+
+bool rcache_iscacheable(rcache_t handle, const char* cmd) {
+    rcache_handle_t* rc = handle;
+    const char** name;
+    size_t len;
+
+    if ((rc == NULL) || (cmd == NULL)) {
+        return false;
+    }
+    while ((*cmd == ' ') || (*cmd == '\t')) {
+        cmd++;
+    }
+    len = strcspn(cmd, " \t\r\n");
+    for (name=rc->cmds; *name!=NULL; name++) {
+        if ((strncmp(*name, cmd, len) == 0) && ((*name)[len] == 0)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+int rcache_get(rcache_t handle, const void* key, size_t keylen, uint8_t** buf, size_t* alloc) {
+    rcache_handle_t* rc = handle;
+    rcentry_t* entry;
+    uint64_t hash;
+    int64_t now;
+    int rv = -1;
+    int i;
+
+    if ((rc == NULL) || (key == NULL) || (buf == NULL) || (alloc == NULL)) {
+        return -1;
+    }
+    hash    = sub_hash(key, keylen);
+    now     = sub_now_ms();
+    entry   = sub_bucket(rc, hash);
+
+    if (flock(rc->fd, LOCK_SH) != 0) {
+        return -1;
+    }
+    for (i=0; i<RCACHE_WAYS; i++, entry++) {
+        if (sub_entry_matches(rc, entry, hash, key, keylen)) {
+            if ((now - entry->stored_ms) > rc->ttl_ms) {
+                break;
+            }
+            if ((entry->vallen + 1) > *alloc) {
+                uint8_t* newbuf = realloc(*buf, entry->vallen + 1);
+                if (newbuf == NULL) {
+                    break;
+                }
+                *buf    = newbuf;
+                *alloc  = entry->vallen + 1;
+            }
+            memcpy(*buf, (uint8_t*)sub_record(rc, entry->pos) + sizeof(rcrec_t) + keylen, entry->vallen);
+            (*buf)[entry->vallen] = 0;
+            rv = (int)entry->vallen;
+            break;
+        }
+    }
+    flock(rc->fd, LOCK_UN);
+
+    return rv;
+}
+
+
+int rcache_put(rcache_t handle, const void* key, size_t keylen, const void* val, size_t vallen) {
+    rcache_handle_t* rc = handle;
+    rchdr_t* hdr;
+    rcentry_t* bucket;
+    rcentry_t* entry;
+    rcrec_t* rec;
+    uint64_t hash;
+    uint64_t reclen;
+    uint64_t phys;
+    int i;
+
+    if ((rc == NULL) || (key == NULL) || (val == NULL)) {
+        return -1;
+    }
+    hdr     = sub_hdr(rc);
+    hash    = sub_hash(key, keylen);
+    reclen  = RCACHE_ALIGN(sizeof(rcrec_t) + keylen + vallen);
+
+    // A value that is too large is rejected, rather than evicting the rest
+    if ((reclen > (hdr->data_size / RCACHE_MAXFRAC)) || (vallen > INT32_MAX)) {
+        DEBUG_PRINTF("rcache: %zu byte value rejected\n", vallen);
+        return -1;
+    }
+
+    if (flock(rc->fd, LOCK_EX) != 0) {
+        return -1;
+    }
+
+    // Use the entry that has this key, else an empty or stale one, else the
+    // oldest one in the bucket.
+    bucket  = sub_bucket(rc, hash);
+    entry   = NULL;
+    for (i=0; i<RCACHE_WAYS; i++) {
+        if (sub_entry_matches(rc, &bucket[i], hash, key, keylen)) {
+            entry = &bucket[i];
+            break;
+        }
+    }
+    for (i=0; (entry == NULL) && (i<RCACHE_WAYS); i++) {
+        if ((bucket[i].seq == 0) || ((hdr->wpos - bucket[i].pos) > hdr->data_size)) {
+            entry = &bucket[i];
+        }
+    }
+    if (entry == NULL) {
+        entry = &bucket[0];
+        for (i=1; i<RCACHE_WAYS; i++) {
+            if (bucket[i].stored_ms < entry->stored_ms) {
+                entry = &bucket[i];
+            }
+        }
+    }
+
+    // Append the record to the ring
+    phys = hdr->wpos % hdr->data_size;
+    if ((phys + reclen) > hdr->data_size) {
+        hdr->wpos += hdr->data_size - phys;
+    }
+    hdr->seq++;
+    rec         = sub_record(rc, hdr->wpos);
+    rec->seq    = hdr->seq;
+    rec->hash   = hash;
+    memcpy((uint8_t*)rec + sizeof(rcrec_t), key, keylen);
+    memcpy((uint8_t*)rec + sizeof(rcrec_t) + keylen, val, vallen);
+
+    // The entry is invalid (seq = 0) until it is complete
+    entry->seq          = 0;
+    entry->hash         = hash;
+    entry->pos          = hdr->wpos;
+    entry->stored_ms    = sub_now_ms();
+    entry->keylen       = (uint32_t)keylen;
+    entry->vallen       = (uint32_t)vallen;
+    entry->seq          = hdr->seq;
+    hdr->wpos          += reclen;
+
+    flock(rc->fd, LOCK_UN);
+    return 0;
+}
@@ -0,0 +1,153 @@
+/* Copyright 2020, JP Norair
+  *
+  * Licensed under the OpenTag License, Version 1.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  * http://www.indigresso.com/wiki/doku.php?id=opentag:license_1_0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  *
+  */
+
+// Application Headers
+#include "runner.h"
+#include "cliopt.h"
+#include "collect.h"
+#include "filter.h"
+#include "ottercat_cfg.h"
+
+// HB Libraries
+#include <cJSON.h>
+
+// Standard C & POSIX Libraries
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+
+
+/** Handle Setup <BR>
+  * ========================================================================<BR>
+  */
+
+void runner_otccfg(otc_cfg_t* otccfg, int window, unsigned int noflags, void* capture) {
+    otc_cfg_init(otccfg);
+    otccfg->timeout_ms  = cliopt_gettimeout();
+    otccfg->tries       = cliopt_gettries();
+    otccfg->window      = (window < 1) ? 1 : window;
+    otccfg->rate        = cliopt_getrate();
+    otccfg->flags       = OTC_FLAG_EVLOOP | OTC_FLAG_AIMD | (cliopt_isframed() ? OTC_FLAG_FRAMED : 0)
+                        | (cliopt_isshmring() ? OTC_FLAG_SHMRING : 0) | (cliopt_isresend() ? OTC_FLAG_REPLAY : 0)
+                        | (cliopt_isackonly() ? OTC_FLAG_ACKONLY : 0);
+    otccfg->flags      &= ~noflags;
+    otccfg->capture     = capture;
+}
+
+
+char* runner_cmdline(char* line) {
+    if (*line == '{') {
+        cJSON* obj  = cJSON_Parse(line);
+        cJSON* data = cJSON_GetObjectItemCaseSensitive(obj, "data");
+        if (cJSON_IsString(data)) {
+            size_t size = strlen(data->valuestring);
+            if (size <= strlen(line)) {
+                memcpy(line, data->valuestring, size+1);
+            }
+        }
+        cJSON_Delete(obj);
+    }
+    return line;
+}
+
+
+long runner_elapsed_ms(const struct timespec* start, const struct timespec* end) {
+    struct timespec now;
+
+    if (end == NULL) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        end = &now;
+    }
+    return ((long)(end->tv_sec - start->tv_sec) * 1000)
+         + ((end->tv_nsec - start->tv_nsec) / 1000000);
+}
+
+
+
+
+/** Output <BR>
+  * ========================================================================<BR>
+  */
+
+void runner_outinit(runout_t* out, int fd_out, void* filter) {
+    memset(out, 0, sizeof(runout_t));
+    out->fd_out = fd_out;
+    out->filter = filter;
+}
+
+
+void runner_outfree(runout_t* out) {
+    free(out->projbuf);
+    out->projbuf    = NULL;
+    out->projalloc  = 0;
+}
+
+
+int runner_filter(runout_t* out, const char* line, const uint8_t** text) {
+    size_t size = strlen(line);
+
+    while ((size > 0) && (line[size-1] == '\n')) {
+        size--;
+    }
+    return filter_line(out->filter, (const uint8_t*)line, size, &out->projbuf, &out->projalloc, text);
+}
+
+
+int runner_errline(char* line, size_t max, int rc, const char* desc, const char* name) {
+    return snprintf(line, max, "{\"cmd\":\"" OTTERCAT_PARAM_NAME "\", \"err\":%d, \"desc\":\"%s%s\"}",
+                    rc, desc, (name == NULL) ? "" : name);
+}
+
+
+void runner_emit(runout_t* out, const char* tag, const char* line) {
+    const uint8_t* text;
+    int size;
+
+    if (line != NULL) {
+        size = runner_filter(out, line, &text);
+        if (size >= 0) {
+            dprintf(out->fd_out, "[%s] %.*s\n", tag, size, (const char*)text);
+        }
+    }
+}
+
+
+void runner_emiterr(runout_t* out, const char* tag, int rc, const char* desc) {
+    char line[256];
+    runner_errline(line, sizeof(line), rc, desc, NULL);
+    runner_emit(out, tag, line);
+}
+
+
+bool runner_result(runout_t* out, const char* tag, const otc_result_t* res, void* journal, const char* socket) {
+    runner_emit(out, tag, res->ack);
+    runner_emit(out, tag, res->rxstat);
+    if (res->more) {
+        return false;
+    }
+
+    // An error ack speaks for itself.  A timeout after the ack doesn't.
+    if ((res->rc < 0) && ((res->ack == NULL) || (res->rc > OTC_ERR_ACK(0)))) {
+        runner_emiterr(out, tag, res->rc, "execution error");
+    }
+    if ((res->rc >= 0) && (res->sid != 0) && (res->rxstat == NULL) && (res->shared == 0)) {
+        collect_note(journal, socket, res->sid, res->cmd, strlen(res->cmd));
+    }
+    return true;
+}
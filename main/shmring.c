@@ -0,0 +1,653 @@
+/* Copyright 2020, JP Norair
+  *
+  * Licensed under the OpenTag License, Version 1.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  * http://www.indigresso.com/wiki/doku.php?id=opentag:license_1_0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  *
+  */
+
+/// Ring positions (head, tail) count bytes since the rings were created, and
+/// only grow.  The producer owns head and the consumer owns tail, and each
+/// is on its own cache line.  Positions are published with release stores
+/// and read with acquire loads, so the bytes a position covers are visible
+/// before the position is.
+///
+/// Sleeping uses the usual flag-and-recheck: the consumer sets waiting,
+/// fences, and checks the ring once more before it sleeps.  The producer
+/// fences after publishing head and rings the doorbell if waiting is set.
+/// One of the two always sees the other's store, so no wakeup is lost.
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#   define _GNU_SOURCE
+#endif
+
+// Application Headers
+#include "shmring.h"
+#include "debug.h"
+#include "ottercat_cfg.h"
+#include "unixsrv.h"
+
+// Standard C & POSIX Libraries
+#include <errno.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#if defined(__linux__)
+#   define SHMRING_SUPPORTED
+#   include <sys/eventfd.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#   define SHMRING_PAUSE()  __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#   define SHMRING_PAUSE()  __asm__ __volatile__("yield")
+#else
+#   define SHMRING_PAUSE()  do { } while (0)
+#endif
+
+
+#define SHMRING_MAGIC       0x31474e49524d4853ULL   // "SHMRING1"
+#define SHMRING_DATAOFF     4096
+#define SHMRING_MINSIZE     4096
+#define SHMRING_SPIN        500
+#define SHMRING_NAP_NS      50000
+#define SHMRING_CHUNK       (64*1024)
+
+
+typedef struct {
+    uint64_t    head;
+    uint8_t     pad0[56];
+    uint64_t    tail;
+    uint8_t     pad1[56];
+    uint32_t    waiting;
+    uint32_t    size;
+    uint64_t    offset;
+    uint8_t     pad2[48];
+} shmring_ctl_t;
+
+struct shmring_map {
+    uint64_t        magic;
+    uint64_t        mapsize;
+    uint8_t         pad[48];
+    shmring_ctl_t   ring[2];
+};
+
+
+
+
+/** Ring Operations <BR>
+  * ========================================================================<BR>
+  */
+
+static uint8_t* sub_data(shmring_t* shm, shmring_ctl_t* r) {
+    return (uint8_t*)shm->map + r->offset;
+}
+
+
+static bool sub_ready(shmring_ctl_t* r) {
+    return __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) != __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+}
+
+
+static void sub_doorbell(shmring_t* shm, int ring) {
+    shmring_ctl_t* r = &shm->map->ring[ring];
+    uint64_t one = 1;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&r->waiting, __ATOMIC_RELAXED)
+    &&  __atomic_exchange_n(&r->waiting, 0, __ATOMIC_SEQ_CST)) {
+        if (write(shm->fd_bell[ring], &one, sizeof(one)) < 0) {
+            ERR_PRINTF("shmring: doorbell failed (%s)\n", strerror(errno));
+        }
+    }
+}
+
+
+static void sub_nap(void) {
+    struct timespec nap = { 0, SHMRING_NAP_NS };
+    nanosleep(&nap, NULL);
+}
+
+
+static int64_t sub_ms_since(const struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((int64_t)(now.tv_sec - start->tv_sec) * 1000) + ((now.tv_nsec - start->tv_nsec) / 1000000);
+}
+
+
+int shmring_write(shmring_t* shm, const uint8_t* data, size_t size, int timeout_ms) {
+    shmring_ctl_t* r = &shm->map->ring[shm->tx];
+    uint8_t* base = sub_data(shm, r);
+    uint64_t head = r->head;
+    uint64_t tail;
+    size_t space, pos, first;
+    struct timespec start;
+    bool waited = false;
+
+    while (size != 0) {
+        tail    = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+        space   = r->size - (size_t)(head - tail);
+
+        // A full ring only drains as fast as the peer reads it
+        if (space == 0) {
+            if (waited == false) {
+                clock_gettime(CLOCK_MONOTONIC, &start);
+                waited = true;
+            }
+            else if (sub_ms_since(&start) > timeout_ms) {
+                return -1;
+            }
+            sub_doorbell(shm, shm->tx);
+            sub_nap();
+            continue;
+        }
+
+        space   = (space > size) ? size : space;
+        pos     = (size_t)(head & (r->size - 1));
+        first   = ((r->size - pos) < space) ? (r->size - pos) : space;
+        memcpy(&base[pos], data, first);
+        memcpy(base, &data[first], space - first);
+        head   += space;
+        data   += space;
+        size   -= space;
+        __atomic_store_n(&r->head, head, __ATOMIC_RELEASE);
+        sub_doorbell(shm, shm->tx);
+    }
+    return 0;
+}
+
+
+size_t shmring_peek(shmring_t* shm, const uint8_t** span) {
+    shmring_ctl_t* r = &shm->map->ring[shm->tx ^ 1];
+    uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    uint64_t tail = r->tail;
+    size_t pos, avail;
+
+    pos     = (size_t)(tail & (r->size - 1));
+    avail   = (size_t)(head - tail);
+    *span   = &sub_data(shm, r)[pos];
+    return ((r->size - pos) < avail) ? (r->size - pos) : avail;
+}
+
+
+void shmring_consume(shmring_t* shm, size_t size) {
+    shmring_ctl_t* r = &shm->map->ring[shm->tx ^ 1];
+    __atomic_store_n(&r->tail, r->tail + size, __ATOMIC_RELEASE);
+}
+
+
+int shmring_wait(shmring_t* shm, int fd_sock, int timeout_ms) {
+    int rx = shm->tx ^ 1;
+    shmring_ctl_t* r = &shm->map->ring[rx];
+    struct pollfd pfd[2];
+    uint64_t count;
+    int rc;
+
+    for (int i=0; i<SHMRING_SPIN; i++) {
+        if (sub_ready(r)) {
+            return 1;
+        }
+        SHMRING_PAUSE();
+    }
+
+    __atomic_store_n(&r->waiting, 1, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (sub_ready(r)) {
+        __atomic_store_n(&r->waiting, 0, __ATOMIC_RELAXED);
+        return 1;
+    }
+
+    pfd[0].fd       = shm->fd_bell[rx];
+    pfd[0].events   = POLLIN;
+    pfd[1].fd       = fd_sock;
+    pfd[1].events   = POLLIN;
+    rc = poll(pfd, 2, timeout_ms);
+    __atomic_store_n(&r->waiting, 0, __ATOMIC_RELAXED);
+    if (rc < 0) {
+        return (errno == EINTR) ? 0 : -1;
+    }
+    if (pfd[0].revents & POLLIN) {
+        if (read(shm->fd_bell[rx], &count, sizeof(count)) < 0) {
+            // Nonblocking: another wakeup already cleared it
+        }
+    }
+    if (sub_ready(r)) {
+        return 1;
+    }
+    return (pfd[1].revents != 0) ? 2 : 0;
+}
+
+
+
+
+/** Setup and Handshake <BR>
+  * ========================================================================<BR>
+  */
+
+static void sub_init(shmring_t* shm) {
+    memset(shm, 0, sizeof(shmring_t));
+    shm->fd_mem     = -1;
+    shm->fd_bell[0] = -1;
+    shm->fd_bell[1] = -1;
+}
+
+
+void shmring_close(shmring_t* shm) {
+    if (shm->map != NULL) {
+        munmap(shm->map, shm->mapsize);
+    }
+    if (shm->fd_mem >= 0) {
+        close(shm->fd_mem);
+    }
+    if (shm->fd_bell[0] >= 0) {
+        close(shm->fd_bell[0]);
+    }
+    if (shm->fd_bell[1] >= 0) {
+        close(shm->fd_bell[1]);
+    }
+    sub_init(shm);
+}
+
+
+/// Read one line from the socket, a byte at a time so that nothing after it
+/// is taken, within timeout_ms.  Returns its length, or -1.
+static int sub_readreply(int fd, char* line, size_t max, int timeout_ms) {
+    struct pollfd pfd;
+    struct timespec start;
+    size_t len = 0;
+    int64_t left;
+    char c;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pfd.fd      = fd;
+    pfd.events  = POLLIN;
+    for (;;) {
+        left = timeout_ms - sub_ms_since(&start);
+        if ((left <= 0) || (poll(&pfd, 1, (int)left) <= 0)) {
+            return -1;
+        }
+        if (recv(fd, &c, 1, 0) != 1) {
+            return -1;
+        }
+        if ((c == '\n') || (c == 0)) {
+            break;
+        }
+        // The rest of a long line is read and dropped, so none of it is
+        // taken later for a response.
+        if ((c != '\r') && (len < (max - 1))) {
+            line[len++] = c;
+        }
+    }
+    line[len] = 0;
+    return (int)len;
+}
+
+
+int shmring_connect(shmring_t* shm, int fd_sock, size_t ringsize, int timeout_ms) {
+#if defined(SHMRING_SUPPORTED)
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr* cmsg;
+    union {
+        char            buf[CMSG_SPACE(3 * sizeof(int))];
+        struct cmsghdr  align;
+    } ctl;
+    int fds[3];
+    char reply[256];
+    size_t size;
+
+    sub_init(shm);
+    for (size=SHMRING_MINSIZE; size<ringsize; size<<=1);
+    shm->mapsize = SHMRING_DATAOFF + (2 * size);
+
+    shm->fd_mem = memfd_create("ottercat-shmring", MFD_CLOEXEC);
+    if ((shm->fd_mem < 0) || (ftruncate(shm->fd_mem, (off_t)shm->mapsize) != 0)) {
+        goto shmring_connect_ERR;
+    }
+    shm->map = mmap(NULL, shm->mapsize, PROT_READ | PROT_WRITE, MAP_SHARED, shm->fd_mem, 0);
+    if (shm->map == MAP_FAILED) {
+        shm->map = NULL;
+        goto shmring_connect_ERR;
+    }
+    shm->fd_bell[0] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    shm->fd_bell[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if ((shm->fd_bell[0] < 0) || (shm->fd_bell[1] < 0)) {
+        goto shmring_connect_ERR;
+    }
+    shm->map->mapsize = shm->mapsize;
+    for (int i=0; i<2; i++) {
+        shm->map->ring[i].size      = (uint32_t)size;
+        shm->map->ring[i].offset    = SHMRING_DATAOFF + (i * size);
+    }
+    shm->map->magic = SHMRING_MAGIC;
+    shm->tx         = 0;
+
+    // The offer: one line, with the descriptors riding on it
+    fds[0]          = shm->fd_mem;
+    fds[1]          = shm->fd_bell[0];
+    fds[2]          = shm->fd_bell[1];
+    iov.iov_base    = SHMRING_OFFER "\n";
+    iov.iov_len     = sizeof(SHMRING_OFFER);
+    memset(&msg, 0, sizeof(msg));
+    memset(&ctl, 0, sizeof(ctl));
+    msg.msg_iov         = &iov;
+    msg.msg_iovlen      = 1;
+    msg.msg_control     = ctl.buf;
+    msg.msg_controllen  = sizeof(ctl.buf);
+    cmsg                = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level    = SOL_SOCKET;
+    cmsg->cmsg_type     = SCM_RIGHTS;
+    cmsg->cmsg_len      = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+    if (sendmsg(fd_sock, &msg, MSG_NOSIGNAL) != (ssize_t)iov.iov_len) {
+        goto shmring_connect_ERR;
+    }
+
+    if (sub_readreply(fd_sock, reply, sizeof(reply), timeout_ms) < 0) {
+        DEBUG_PRINTF("shmring: no reply to the offer, staying on the socket\n");
+        shmring_close(shm);
+        return -2;
+    }
+    if (strcmp(reply, SHMRING_ACCEPT) != 0) {
+        DEBUG_PRINTF("shmring: offer not taken, staying on the socket\n");
+        goto shmring_connect_ERR;
+    }
+    return 0;
+
+    shmring_connect_ERR:
+    shmring_close(shm);
+#endif
+    return -1;
+}
+
+
+bool shmring_isreply(const uint8_t* line, size_t size) {
+    return (memmem(line, size, "\"" SHMRING_OFFER "\"", sizeof(SHMRING_OFFER) + 1) != NULL);
+}
+
+
+/// Daemon side: map the rings from an offer's descriptors, which are then
+/// owned by shm.
+static int sub_attach(shmring_t* shm, const int* fds) {
+    struct stat st;
+
+    sub_init(shm);
+    shm->fd_mem     = fds[0];
+    shm->fd_bell[0] = fds[1];
+    shm->fd_bell[1] = fds[2];
+    shm->tx         = 1;
+    if ((fstat(shm->fd_mem, &st) != 0) || (st.st_size < (off_t)sizeof(shmring_map_t))) {
+        goto sub_attach_ERR;
+    }
+    shm->mapsize    = (size_t)st.st_size;
+    shm->map        = mmap(NULL, shm->mapsize, PROT_READ | PROT_WRITE, MAP_SHARED, shm->fd_mem, 0);
+    if (shm->map == MAP_FAILED) {
+        shm->map = NULL;
+        goto sub_attach_ERR;
+    }
+    if ((shm->map->magic != SHMRING_MAGIC) || (shm->map->mapsize != shm->mapsize)) {
+        goto sub_attach_ERR;
+    }
+    for (int i=0; i<2; i++) {
+        shmring_ctl_t* r = &shm->map->ring[i];
+        if ((r->size == 0) || ((r->size & (r->size - 1)) != 0) || ((r->offset + r->size) > shm->mapsize)) {
+            goto sub_attach_ERR;
+        }
+    }
+    return 0;
+
+    sub_attach_ERR:
+    shmring_close(shm);
+    return -1;
+}
+
+
+
+
+/** Loopback Stand-in <BR>
+  * ========================================================================<BR>
+  */
+
+typedef struct {
+    int         fd;
+    shmring_t   shm;
+    bool        shm_on;
+    int         fds[3];
+    int         num_fds;
+    uint32_t    sid;
+    uint8_t*    in;
+    size_t      in_fill;
+    size_t      in_alloc;
+    uint8_t*    out;
+    size_t      out_fill;
+    size_t      out_alloc;
+} slconn_t;
+
+
+static int sub_grow(uint8_t** buf, size_t* alloc, size_t need) {
+    return unixsrv_grow(buf, alloc, need, SHMRING_CHUNK, OTTERCAT_PARAM_MAXLINE + SHMRING_CHUNK);
+}
+
+
+/// Read from the client's socket into the input buffer, keeping any
+/// descriptors that come along.  Returns -1 when the client has gone.
+static int sub_recv(slconn_t* c) {
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr* cmsg;
+    union {
+        char            buf[CMSG_SPACE(3 * sizeof(int))];
+        struct cmsghdr  align;
+    } ctl;
+    ssize_t rc;
+
+    if (sub_grow(&c->in, &c->in_alloc, c->in_fill + SHMRING_CHUNK) != 0) {
+        return -1;
+    }
+    iov.iov_base        = &c->in[c->in_fill];
+    iov.iov_len         = SHMRING_CHUNK;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov         = &iov;
+    msg.msg_iovlen      = 1;
+    msg.msg_control     = ctl.buf;
+    msg.msg_controllen  = sizeof(ctl.buf);
+    rc = recvmsg(c->fd, &msg, MSG_CMSG_CLOEXEC);
+    if (rc <= 0) {
+        return ((rc < 0) && (errno == EINTR)) ? 0 : -1;
+    }
+    for (cmsg=CMSG_FIRSTHDR(&msg); cmsg!=NULL; cmsg=CMSG_NXTHDR(&msg, cmsg)) {
+        if ((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_RIGHTS)
+        &&  (cmsg->cmsg_len == CMSG_LEN(3 * sizeof(int))) && (c->num_fds == 0)) {
+            memcpy(c->fds, CMSG_DATA(cmsg), 3 * sizeof(int));
+            c->num_fds = 3;
+        }
+    }
+    c->in_fill += (size_t)rc;
+    return 0;
+}
+
+
+/// Append otter's response to one command line
+static int sub_respond(slconn_t* c, const uint8_t* line, size_t len) {
+    size_t cmdlen;
+    int n;
+
+    if (sub_grow(&c->out, &c->out_alloc, c->out_fill + len + 256) != 0) {
+        return -1;
+    }
+    for (cmdlen=0; (cmdlen < len) && (line[cmdlen] != ' ') && (line[cmdlen] != '"') && (line[cmdlen] != '\\'); cmdlen++);
+    c->sid++;
+    n = sprintf((char*)&c->out[c->out_fill],
+                "{\"type\": \"ack\", \"data\": {\"cmd\": \"%.*s\", \"err\": 0, \"sid\": %u}}\n"
+                "{\"type\": \"rxstat\", \"data\": {\"sid\": %u, \"qual\": 0, \"frame\": \"",
+                (int)cmdlen, (const char*)line, c->sid, c->sid);
+    c->out_fill += (size_t)n;
+
+    // The command is echoed as the frame, less what would need escaping
+    for (size_t i=0; i<len; i++) {
+        if ((line[i] >= ' ') && (line[i] != '"') && (line[i] != '\\')) {
+            c->out[c->out_fill++] = line[i];
+        }
+    }
+    memcpy(&c->out[c->out_fill], "\"}}\n", 4);
+    c->out_fill += 4;
+    return 0;
+}
+
+
+/// Handle the complete lines in the input buffer.  A ring offer is taken
+/// if its descriptors came with it.
+static int sub_lines(slconn_t* c) {
+    const uint8_t* line;
+    const uint8_t* end;
+    size_t used = 0;
+    uint8_t* term;
+
+    while (used < c->in_fill) {
+        line = &c->in[used];
+        term = memchr(line, '\n', c->in_fill - used);
+        if (term == NULL) {
+            break;
+        }
+        used = (size_t)(term - c->in) + 1;
+        for (end=term; (end > line) && ((end[-1] == '\r') || (end[-1] == 0)); end--);
+        if (end == line) {
+            continue;
+        }
+
+        if (((size_t)(end - line) == (sizeof(SHMRING_OFFER) - 1)) && (memcmp(line, SHMRING_OFFER, sizeof(SHMRING_OFFER) - 1) == 0)) {
+            const char* reply = SHMRING_ACCEPT "\n";
+            if ((c->num_fds == 3) && (sub_attach(&c->shm, c->fds) == 0)) {
+                c->shm_on = true;
+            }
+            else {
+                reply = "{\"type\":\"shmring\",\"err\":-1}\n";
+                for (int i=0; i<c->num_fds; i++) {
+                    close(c->fds[i]);
+                }
+            }
+            c->num_fds = 0;
+            if (unixsrv_sendall(c->fd, reply, strlen(reply)) != 0) {
+                return -1;
+            }
+            continue;
+        }
+        if (sub_respond(c, line, (size_t)(end - line)) != 0) {
+            return -1;
+        }
+    }
+    c->in_fill -= used;
+    memmove(c->in, &c->in[used], c->in_fill);
+    return 0;
+}
+
+
+/// Send the responses, on the ring if it is up
+static int sub_flush(slconn_t* c) {
+    int rc = 0;
+
+    if (c->out_fill != 0) {
+        if (c->shm_on) {
+            rc = shmring_write(&c->shm, c->out, c->out_fill, 1000);
+        }
+        else {
+            rc = unixsrv_sendall(c->fd, c->out, c->out_fill);
+        }
+        c->out_fill = 0;
+    }
+    return rc;
+}
+
+
+static void sub_serve(slconn_t* c) {
+    struct pollfd pfd;
+    const uint8_t* span;
+    size_t n;
+    int rc;
+
+    while (unixsrv_stopped() == false) {
+        if (c->shm_on) {
+            n = shmring_peek(&c->shm, &span);
+            if (n != 0) {
+                if (sub_grow(&c->in, &c->in_alloc, c->in_fill + n) != 0) {
+                    break;
+                }
+                memcpy(&c->in[c->in_fill], span, n);
+                c->in_fill += n;
+                shmring_consume(&c->shm, n);
+                rc = 0;
+            }
+            else {
+                rc = shmring_wait(&c->shm, c->fd, -1);
+                if (rc == 1) {
+                    continue;
+                }
+                rc = ((rc == 2) && (sub_recv(c) == 0)) ? 0 : -1;
+            }
+        }
+        else {
+            pfd.fd      = c->fd;
+            pfd.events  = POLLIN;
+            rc = poll(&pfd, 1, -1);
+            rc = ((rc < 0) && (errno == EINTR)) ? 0 : ((rc > 0) ? sub_recv(c) : -1);
+        }
+        if ((rc != 0) || (sub_lines(c) != 0) || (sub_flush(c) != 0)) {
+            break;
+        }
+    }
+}
+
+
+int shmring_loopback_run(const char* socket_path) {
+    slconn_t c;
+    int fd_srv;
+
+    fd_srv = unixsrv_listen(socket_path, 4);
+    if (fd_srv < 0) {
+        fprintf(stderr, "shmring: cannot listen on %s\n", socket_path);
+        return -2;
+    }
+    unixsrv_onstop();
+
+    memset(&c, 0, sizeof(c));
+    sub_init(&c.shm);
+    while (unixsrv_stopped() == false) {
+        c.fd = unixsrv_accept(fd_srv);
+        if (c.fd < 0) {
+            break;
+        }
+        c.in_fill   = 0;
+        c.out_fill  = 0;
+        c.num_fds   = 0;
+        c.shm_on    = false;
+        sub_serve(&c);
+        for (int i=0; i<c.num_fds; i++) {
+            close(c.fds[i]);
+        }
+        shmring_close(&c.shm);
+        close(c.fd);
+    }
+
+    close(fd_srv);
+    unlink(socket_path);
+    free(c.in);
+    free(c.out);
+    return 0;
+}
@@ -14,13 +14,22 @@
   *
   */
 
+// pthread_setaffinity_np() for event loop CPU pinning
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#   define _GNU_SOURCE
+#endif
+
 #include "sockpush.h"
 #include "debug.h"
+#include "ottercat_cfg.h"
+#include "shmring.h"
+#include "sploop.h"
 
 #include <talloc.h>
 
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
 #include <poll.h>
 #include <pthread.h>
@@ -35,6 +44,22 @@
 #include <sys/types.h>
 #include <sys/un.h>
 #include <sys/wait.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#if OTTERCAT_FEATURE(IOURING)
+#   include <liburing.h>
+#   include <sys/eventfd.h>
+#endif
+
+// The event loop backend is built on epoll.  Elsewhere, SP_FLAG_EVLOOP is
+// accepted but connections get a dedicated I/O thread.
+#if defined(__linux__)
+#   define SP_EVLOOP
+#   include <sys/epoll.h>
+#   include <sys/eventfd.h>
+#endif
 
 
 
@@ -44,21 +69,98 @@
 
 
 #define SP_MAX_READERS      1
-#define SP_MAX_SUBSCRIBERS  1
+#define SP_MAX_SUBSCRIBERS  8
+
+// Size of each read from the socket.  Lines are split out of the chunk, so
+// a large chunk costs one syscall for many lines when the daemon is busy.
+#define SP_RXCHUNK          16384
+
+// Time allowed for the daemon to answer a shared memory ring offer, and for
+// it to make room in a full ring
+#define SP_SHM_TIMEOUT      1000
+
+// Most bytes of unread lines kept for a synchronous reader
+#define SP_BACKLOG_MAX      (1024*1024)
+
+// Most bytes of commands kept for replay (SP_FLAG_REPLAY).  Past this, the
+// oldest are forgotten.
+#define SP_PENDING_MAX      (1024*1024)
+
+// Reconnect backoff: the first retry after a drop is immediate, and failed
+// connects wait from SP_BACKOFF_MIN up to SP_BACKOFF_MAX, doubling (ms).
+#define SP_BACKOFF_MIN      50
+#define SP_BACKOFF_MAX      60000
+
+// Line buffers start at SP_LINE_INIT and grow as needed, up to SP_LINE_MAX
+#define SP_LINE_INIT        1024
+#define SP_LINE_MAX         OTTERCAT_PARAM_MAXLINE
+
+#ifndef MSG_NOSIGNAL
+#   define MSG_NOSIGNAL     0
+#endif
+
+// io_uring backend parameters: provided-buffer ring for multishot receive
+#define SP_URING_ENTRIES    16
+#define SP_URING_BUFS       16
+#define SP_URING_BUFSIZE    4096
+#define SP_URING_BGID       1
+#define SP_URING_RECV       1
+#define SP_URING_WAKE       2
+#define SP_URING_SEND       3
 
 
 // Internal data types.  May change at any time.
 // In .h file for hacking purposes only
 // ---------------------------------------------------------------------------
+
+// Line assembler for chunked reads.  The buffer grows to fit the line, up
+// to SP_LINE_MAX.  A longer line is discarded up to its terminator.  In
+// framed mode, the frame header is gathered in hdr first, and it gives the
+// payload size (need), type and sid.
+typedef struct {
+    uint8_t*    buf;
+    size_t      alloc;
+    size_t      fill;
+    bool        discard;
+    uint8_t     hdr[SP_FRAME_HDRSIZE];
+    size_t      hdrfill;
+    size_t      need;
+    uint8_t     type;
+    uint32_t    sid;
+} sprxasm_t;
+
+// Header of a command kept for replay
+typedef struct {
+    size_t      size;           ///< bytes as sent, which follow
+    uint64_t    id;             ///< sender's id for the command, or 0
+} sppend_t;
+
+// Connection states used by the event loop backend
+typedef enum {
+    SPSTATE_backoff     = 0,
+    SPSTATE_connecting  = 1,
+    SPSTATE_online      = 2
+} SPSTATE_Type;
+
+// A line published while the reader isn't waiting for one is kept in its
+// backlog, up to SP_BACKLOG_MAX bytes, so that a burst (an ack and rxstat
+// in one read) isn't lost between two sp_read() calls.  Each entry is a
+// size_t length and the line.  Guarded by user_mutex.
 typedef struct {
     void*           parent;
     unsigned int    last_read;
+    unsigned int    drop_seen;
+    uint8_t*        backlog;
+    size_t          backalloc;
+    size_t          backfill;
+    size_t          backread;
 } sprdr_t;
 
 
 typedef struct {
     int             flags;
     void*           parent;
+    void*           sp;
     sp_action_t     action;
     uint8_t*        buf;
     size_t          max;
@@ -72,10 +174,19 @@ typedef struct {
     unsigned int    flags;
     int             fd_sock;
     
-    // Data counter for bytes loaded from socket
+    // Transport (see sptransport_t), and its state if it keeps any
+    const struct sptransport* tp;
+    void*           tp_ctx;
+    
+    // Data counter for bytes loaded from socket.  read_buf is the last line
+    // published, and it trades places with the assembly buffer on each line.
     uint8_t*        read_buf;
+    size_t          read_alloc;
     size_t          read_size;
     unsigned int    read_id;
+    unsigned long   read_oversize;
+    uint8_t         read_type;
+    uint32_t        read_sid;
     
     ///@todo id_mutex deprecated
     //pthread_mutex_t id_mutex;
@@ -84,9 +195,11 @@ typedef struct {
     pthread_mutex_t user_mutex;
     
     // reader cond: for broadcasting "new line arrived" to all readers
-    ///@note readline_inactive is needed for Linux, which can have unreliable
-    ///      implementation of pthread_cond_wait & pthread_cond_timedwait
-    bool            readline_inactive;
+    ///@note readline_gen is needed for Linux, which can have unreliable
+    ///      implementation of pthread_cond_wait & pthread_cond_timedwait.
+    ///      Readers wait for it to change, so a reader that arrives late
+    ///      can't hold back readers that were already woken.
+    unsigned int    readline_gen;
     pthread_cond_t  readline_cond;
     pthread_mutex_t readline_mutex;
     
@@ -107,9 +220,99 @@ typedef struct {
     size_t      max_subs;
     spsubscr_t* sub[SP_MAX_SUBSCRIBERS];
     
+    // Line assembly
+    sprxasm_t   rxasm;
+    
+    // Connection state, for writers (user_mutex).  drop_gen counts drops,
+    // so that readers can be told of one (user_mutex and readline_mutex).
+    bool        online;
+    unsigned int drop_gen;
+    pthread_cond_t online_cond;
+    
+    // Commands sent without an ack yet, with SP_FLAG_REPLAY (user_mutex).
+    // Each entry is an sppend_t header and the bytes as they were sent.
+    uint8_t*    pend;
+    size_t      pend_fill;
+    size_t      pend_read;
+    size_t      pend_alloc;
+    size_t      pend_count;
+    
+    // Pending outbound data, guarded by user_mutex.  Used by the backends
+    // that don't write synchronously from the caller (io_uring, evloop).
+    uint8_t*    tx_pend;
+    size_t      tx_pendsize;
+    size_t      tx_pendalloc;
+    
+    // Outbound frame, built by sub_write() in framed mode (user_mutex)
+    uint8_t*    tx_frame;
+    size_t      tx_framealloc;
+    
+    // Shared memory rings (SP_FLAG_SHMRING), when the daemon took the offer.
+    // shm_active is changed by the I/O thread with user_mutex held.  After
+    // the daemon declines, the offer isn't made again on reconnects, and
+    // shm_late is set while a reply that missed the timeout may yet come.
+    shmring_t   shm;
+    bool        shm_active;
+    bool        shm_declined;
+    bool        shm_late;
+    
+#   if OTTERCAT_FEATURE(IOURING)
+    // io_uring backend.  While uring_active, writers append to tx_pend
+    // and the I/O thread sends it in one submission.  fd_wake is an eventfd
+    // that kicks the I/O thread when tx is idle.
+    bool        uring_active;
+    bool        uring_broken;
+    bool        tx_busy;
+    int         fd_wake;
+#   endif
+    
+#   if defined(SP_EVLOOP)
+    // Event loop backend (SP_FLAG_EVLOOP).  The connection is driven by one
+    // of the shared loop threads instead of a dedicated iothread.
+    struct spevloop* evloop;
+    void*       evnext;
+    SPSTATE_Type state;
+    bool        closing;
+    int         backoff;
+    struct timespec retry_at;
+#   endif
+    
 } sp_item_t;
 
 
+/// Transport: how a connection reaches its daemon.  sp_open() picks one by
+/// the form of the address.  The I/O thread and sub_write() go through it.
+/// The event loop, io_uring and shared memory backends drive the socket
+/// descriptor directly, so they are only used with socket transports.
+typedef struct sptransport {
+    const char* name;
+    bool        is_socket;
+    bool        is_local;       ///< same host: shared memory rings may be offered
+    
+    /// Check and store the address.  Called once, by sp_open().
+    int     (*init)(sp_item_t* sp, const char* address);
+    void    (*term)(sp_item_t* sp);
+    
+    /// Create the endpoint, to be connected.  close() and open() again to
+    /// reconnect.
+    int     (*open)(sp_item_t* sp, bool nonblock);
+    void    (*close)(sp_item_t* sp);
+    
+    /// 0, or -1 with errno set (EINPROGRESS on a nonblocking endpoint)
+    int     (*connect)(sp_item_t* sp);
+    
+    /// Send all of data.  Returns the size, or -1.
+    int     (*send)(sp_item_t* sp, const uint8_t* data, size_t size);
+    
+    /// Receive what is available, waiting if there is nothing.  Returns the
+    /// number of bytes, or 0 or less when the daemon has gone.
+    ssize_t (*recv)(sp_item_t* sp, uint8_t* buf, size_t max);
+    
+    /// Descriptor that polls readable when recv() has data
+    int     (*fd)(sp_item_t* sp);
+} sptransport_t;
+
+
 
 
 
@@ -164,29 +367,1648 @@ static int sub_mutex_timedlock(pthread_mutex_t *restrict mutex, const struct tim
 
 
 
-static void* sp_iothread(void*);
+static void* sp_iothread(void*);
+
+
+
+
+static void sub_sendtosub(spsubscr_t* sub, uint8_t* data, size_t datasize) {
+    datasize = (datasize > sub->max) ? sub->max : datasize;
+    
+    if (sub->buf != NULL) {
+        memcpy(sub->buf, data, datasize);
+        data = sub->buf;
+    }
+    if (sub->action != NULL) {
+        sub->action(sub->parent, data, datasize);
+    }
+}
+
+
+
+/** I/O Thread Internals <BR>
+  * ========================================================================<BR>
+  */
+
+static int sub_readinit(sp_item_t* sp) {
+    sp->readline_gen        = 0;
+    sp->read_buf            = calloc(1, SP_LINE_INIT);
+    sp->read_alloc          = SP_LINE_INIT;
+    sp->read_size           = 0;
+    sp->read_id             = 1;
+    sp->rxasm.buf           = malloc(SP_LINE_INIT);
+    sp->rxasm.alloc         = SP_LINE_INIT;
+    sp->rxasm.fill          = 0;
+    sp->rxasm.discard       = false;
+    
+    if ((sp->read_buf == NULL) || (sp->rxasm.buf == NULL)) {
+        free(sp->read_buf);
+        free(sp->rxasm.buf);
+        return -1;
+    }
+    return 0;
+}
+
+/// Drop any partial line or frame, for a new connection
+static void sub_rxreset(sprxasm_t* rxasm) {
+    rxasm->fill     = 0;
+    rxasm->discard  = false;
+    rxasm->hdrfill  = 0;
+}
+
+/// Remove the entry at pos.  Call with user_mutex held.
+static void sub_pend_cut(sp_item_t* sp, size_t pos) {
+    sppend_t hdr;
+    size_t entry;
+    
+    memcpy(&hdr, &sp->pend[pos], sizeof(sppend_t));
+    entry = sizeof(sppend_t) + hdr.size;
+    if (pos == sp->pend_read) {
+        sp->pend_read += entry;
+    }
+    else {
+        memmove(&sp->pend[pos], &sp->pend[pos + entry], sp->pend_fill - pos - entry);
+        sp->pend_fill -= entry;
+    }
+    sp->pend_count--;
+    if (sp->pend_count == 0) {
+        sp->pend_read = 0;
+        sp->pend_fill = 0;
+    }
+}
+
+
+/// Forget the command with this id, if it is kept.  Call with user_mutex held.
+static void sub_pend_remove(sp_item_t* sp, uint64_t id) {
+    sppend_t hdr;
+    size_t pos;
+    
+    for (pos=sp->pend_read; pos<sp->pend_fill; pos+=sizeof(sppend_t)+hdr.size) {
+        memcpy(&hdr, &sp->pend[pos], sizeof(sppend_t));
+        if (hdr.id == id) {
+            sub_pend_cut(sp, pos);
+            return;
+        }
+    }
+}
+
+
+/// Keep a command for replay: data as sent, and a terminator if one was sent
+/// after it.  A command with the id of one already kept is a retry of it,
+/// and replaces it.  Call with user_mutex held.
+static void sub_pend_push(sp_item_t* sp, uint64_t id, const uint8_t* data, size_t size, bool do_terminate) {
+    sppend_t hdr;
+    size_t need;
+    
+    hdr.size    = size + (do_terminate ? 1 : 0);
+    hdr.id      = id;
+    if ((sizeof(sppend_t) + hdr.size) > SP_PENDING_MAX) {
+        return;
+    }
+    if (id != 0) {
+        sub_pend_remove(sp, id);
+    }
+    
+    // Compact, forgetting the oldest commands if there isn't room
+    while ((sp->pend_fill - sp->pend_read + sizeof(sppend_t) + hdr.size) > SP_PENDING_MAX) {
+        sppend_t oldest;
+        memcpy(&oldest, &sp->pend[sp->pend_read], sizeof(sppend_t));
+        sp->pend_read += sizeof(sppend_t) + oldest.size;
+        sp->pend_count--;
+    }
+    if (sp->pend_read != 0) {
+        sp->pend_fill -= sp->pend_read;
+        memmove(sp->pend, &sp->pend[sp->pend_read], sp->pend_fill);
+        sp->pend_read = 0;
+    }
+    
+    need = sp->pend_fill + sizeof(sppend_t) + hdr.size;
+    if (need > sp->pend_alloc) {
+        size_t newalloc = (sp->pend_alloc == 0) ? 4096 : sp->pend_alloc;
+        uint8_t* newbuf;
+        while (newalloc < need) {
+            newalloc *= 2;
+        }
+        newbuf = realloc(sp->pend, newalloc);
+        if (newbuf == NULL) {
+            return;
+        }
+        sp->pend        = newbuf;
+        sp->pend_alloc  = newalloc;
+    }
+    memcpy(&sp->pend[sp->pend_fill], &hdr, sizeof(sppend_t));
+    memcpy(&sp->pend[sp->pend_fill + sizeof(sppend_t)], data, size);
+    if (do_terminate) {
+        sp->pend[sp->pend_fill + sizeof(sppend_t) + size] = '\n';
+    }
+    sp->pend_fill = need;
+    sp->pend_count++;
+}
+
+
+/// The command name at the start of a kept command
+static size_t sub_pend_name(sp_item_t* sp, size_t pos, const uint8_t** name) {
+    sppend_t hdr;
+    const uint8_t* data;
+    size_t size;
+    size_t len;
+    
+    memcpy(&hdr, &sp->pend[pos], sizeof(sppend_t));
+    data = &sp->pend[pos + sizeof(sppend_t)];
+    size = hdr.size;
+    if ((sp->flags & SP_FLAG_FRAMED) && (size >= SP_FRAME_HDRSIZE)) {
+        data += SP_FRAME_HDRSIZE;
+        size -= SP_FRAME_HDRSIZE;
+    }
+    while ((size != 0) && ((*data == ' ') || (*data == '\t'))) {
+        data++;
+        size--;
+    }
+    for (len=0; (len<size) && (data[len] > ' '); len++);
+    *name = data;
+    return len;
+}
+
+
+/// An ack has come back.  otter acks in command order, so it belongs to the
+/// oldest kept command of the same name: older ones that don't match were
+/// lost, and stay for the replay (or until their sender forgets them).  An
+/// ack without a name goes to the oldest command.  Call with user_mutex held.
+static void sub_pend_ack(sp_item_t* sp, const sprxasm_t* rxasm) {
+    const uint8_t* end = &rxasm->buf[rxasm->fill];
+    const uint8_t* val;
+    const uint8_t* name;
+    const uint8_t* cmdname;
+    size_t namelen;
+    sppend_t hdr;
+    size_t pos;
+    
+    val = memmem(rxasm->buf, rxasm->fill, "\"cmd\"", 5);
+    if (val == NULL) {
+        sub_pend_cut(sp, sp->pend_read);
+        return;
+    }
+    for (val+=5; (val < end) && ((*val == ' ') || (*val == ':') || (*val == '\t')); val++);
+    if ((val == end) || (*val != '"')) {
+        sub_pend_cut(sp, sp->pend_read);
+        return;
+    }
+    name = ++val;
+    for (; (val < end) && (*val != '"'); val++);
+    namelen = (size_t)(val - name);
+    
+    for (pos=sp->pend_read; pos<sp->pend_fill; pos+=sizeof(sppend_t)+hdr.size) {
+        memcpy(&hdr, &sp->pend[pos], sizeof(sppend_t));
+        if ((sub_pend_name(sp, pos, &cmdname) == namelen) && (memcmp(cmdname, name, namelen) == 0)) {
+            sub_pend_cut(sp, pos);
+            return;
+        }
+    }
+}
+
+
+/// True if the line being published is an ack
+static bool sub_isack(sp_item_t* sp, const sprxasm_t* rxasm) {
+    const uint8_t* end = &rxasm->buf[rxasm->fill];
+    const uint8_t* val;
+    
+    if (sp->flags & SP_FLAG_FRAMED) {
+        return (rxasm->type == SP_FRAME_ACK);
+    }
+    val = memmem(rxasm->buf, rxasm->fill, "\"type\"", 6);
+    if (val == NULL) {
+        return false;
+    }
+    for (val+=6; (val < end) && ((*val == ' ') || (*val == ':') || (*val == '\t')); val++);
+    return ((end - val) >= 5) && (memcmp(val, "\"ack\"", 5) == 0);
+}
+
+
+/// The connection has dropped.  Readers are told at once, and commands
+/// without an ack are kept for the reconnect only with SP_FLAG_REPLAY.
+/// Call with user_mutex held.
+static void sub_dropped(sp_item_t* sp) {
+    if (sp->online == false) {
+        return;
+    }
+    sp->online = false;
+    pthread_mutex_lock(&sp->readline_mutex);
+    sp->drop_gen++;
+    pthread_cond_broadcast(&sp->readline_cond);
+    pthread_mutex_unlock(&sp->readline_mutex);
+    
+    if ((sp->flags & SP_FLAG_REPLAY) == 0) {
+        sp->pend_read   = 0;
+        sp->pend_fill   = 0;
+        sp->pend_count  = 0;
+    }
+}
+
+
+/// Keep a line for a reader that isn't waiting.  Call with user_mutex held.
+static void sub_backlog_push(sprdr_t* rdr, const uint8_t* line, size_t size) {
+    size_t need;
+
+    if (rdr->backread == rdr->backfill) {
+        rdr->backread = 0;
+        rdr->backfill = 0;
+    }
+    need = rdr->backfill + sizeof(size_t) + size;
+    if (need > SP_BACKLOG_MAX) {
+        DEBUG_PRINTF("Reader backlog full: %zu byte line dropped\n", size);
+        return;
+    }
+    if (need > rdr->backalloc) {
+        size_t newalloc = (rdr->backalloc == 0) ? 4096 : rdr->backalloc;
+        uint8_t* newbuf;
+        while (newalloc < need) {
+            newalloc *= 2;
+        }
+        newbuf = realloc(rdr->backlog, newalloc);
+        if (newbuf == NULL) {
+            return;
+        }
+        rdr->backlog    = newbuf;
+        rdr->backalloc  = newalloc;
+    }
+    memcpy(&rdr->backlog[rdr->backfill], &size, sizeof(size_t));
+    memcpy(&rdr->backlog[rdr->backfill + sizeof(size_t)], line, size);
+    rdr->backfill = need;
+}
+
+
+/// Publish the assembled line to subscribers and synchronous readers.  The
+/// line is not copied: the assembly buffer becomes read_buf, and the old
+/// read_buf is used to assemble the next line.
+static void sub_publish_line(sp_item_t* sp, sprxasm_t* rxasm) {
+    uint8_t* swap_buf;
+    size_t swap_alloc;
+    
+    pthread_mutex_lock(&sp->user_mutex);
+    
+    // A late reply to the ring offer is not a response, and not an ack
+    if (sp->shm_late && shmring_isreply(rxasm->buf, rxasm->fill)) {
+        sp->shm_late    = false;
+        rxasm->fill     = 0;
+        pthread_mutex_unlock(&sp->user_mutex);
+        return;
+    }
+    
+    sp->read_id++;
+    sp->read_size   = rxasm->fill;
+    sp->read_type   = rxasm->type;
+    sp->read_sid    = rxasm->sid;
+    swap_buf        = sp->read_buf;
+    swap_alloc      = sp->read_alloc;
+    sp->read_buf    = rxasm->buf;
+    sp->read_alloc  = rxasm->alloc;
+    
+    if ((sp->pend_count != 0) && sub_isack(sp, rxasm)) {
+        sub_pend_ack(sp, rxasm);
+    }
+    
+    rxasm->buf      = swap_buf;
+    rxasm->alloc    = swap_alloc;
+    rxasm->fill     = 0;
+
+    // publish it to subscribers, which are callbacks that need
+    // to deal with data replication themselves.
+    // lock the data mutex to prevent new subscribers getting added
+    if (sp->subs > 0) {
+        for (int i=0; i<sp->subs; i++) {
+            ///@todo Change Array to linked list
+            if (sp->sub[i]->flags & SP_SUB_INBOUND) {
+                sub_sendtosub(sp->sub[i], sp->read_buf, sp->read_size);
+            }
+        }
+    }
+
+    ///@todo there seems to be a problem where a line gets read multiple times via sp_read()
+    if (sp->readers > 0) {
+        pthread_mutex_lock(&sp->readline_mutex);
+        if (sp->waiting_readers <= 0) {
+            pthread_mutex_unlock(&sp->readline_mutex);
+            for (int i=0; i<sp->readers; i++) {
+                sub_backlog_push(sp->reader[i], sp->read_buf, sp->read_size);
+                sp->reader[i]->last_read = sp->read_id;
+            }
+        }
+        else {
+            // readdone must be armed before the readers are woken: the last
+            // reader can otherwise signal it before this thread waits on it,
+            // and this thread would then wait forever.
+            pthread_mutex_lock(&sp->readdone_mutex);
+            sp->readdone_inactive = true;
+            pthread_mutex_unlock(&sp->readdone_mutex);
+            
+            sp->readline_gen++;
+            pthread_cond_broadcast(&sp->readline_cond);
+            pthread_mutex_unlock(&sp->readline_mutex);
+        
+            pthread_mutex_lock(&sp->readdone_mutex);
+            while (sp->readdone_inactive) {
+                pthread_cond_wait(&sp->readdone_cond, &sp->readdone_mutex);
+            }
+            pthread_mutex_unlock(&sp->readdone_mutex);
+        }
+        
+    }
+    
+    pthread_mutex_unlock(&sp->user_mutex);
+}
+
+
+/// Make room for need bytes in the assembly buffer
+static int sub_rxgrow(sprxasm_t* rxasm, size_t need) {
+    size_t newalloc;
+    uint8_t* newbuf;
+    
+    if (need <= rxasm->alloc) {
+        return 0;
+    }
+    if (need > SP_LINE_MAX) {
+        return -1;
+    }
+    for (newalloc=rxasm->alloc; newalloc<need; newalloc*=2);
+    if (newalloc > SP_LINE_MAX) {
+        newalloc = SP_LINE_MAX;
+    }
+    newbuf = realloc(rxasm->buf, newalloc);
+    if (newbuf == NULL) {
+        return -1;
+    }
+    rxasm->buf      = newbuf;
+    rxasm->alloc    = newalloc;
+    return 0;
+}
+
+
+/// Feed a chunk of received bytes through the frame assembler, publishing
+/// each frame's payload as a line once it is complete.  The header gives
+/// the payload size, so payloads are copied in whole spans without looking
+/// at their bytes.  A payload that can't fit in SP_LINE_MAX is skipped, and
+/// counted in read_oversize.  If a header doesn't start with the sync bytes,
+/// the assembler slides along one byte at a time until it finds them.
+static void sub_rxframe(sp_item_t* sp, sprxasm_t* rxasm, const uint8_t* data, size_t size) {
+    size_t seg;
+    
+    while (size != 0) {
+        if (rxasm->hdrfill < SP_FRAME_HDRSIZE) {
+            seg = SP_FRAME_HDRSIZE - rxasm->hdrfill;
+            seg = (seg > size) ? size : seg;
+            memcpy(&rxasm->hdr[rxasm->hdrfill], data, seg);
+            rxasm->hdrfill += seg;
+            data += seg;
+            size -= seg;
+            if (rxasm->hdrfill < SP_FRAME_HDRSIZE) {
+                break;
+            }
+            if (sp_frame_unpack(rxasm->hdr, &rxasm->type, &rxasm->sid, &rxasm->need) != 0) {
+                memmove(rxasm->hdr, &rxasm->hdr[1], SP_FRAME_HDRSIZE-1);
+                rxasm->hdrfill--;
+                continue;
+            }
+            rxasm->fill     = 0;
+            rxasm->discard  = (sub_rxgrow(rxasm, rxasm->need + 1) != 0);
+            if (rxasm->discard) {
+                ERR_PRINTF("sockpush: dropping frame longer than %zu bytes\n", (size_t)SP_LINE_MAX);
+                sp->read_oversize++;
+            }
+        }
+        
+        // While discarding, fill counts the bytes skipped
+        seg = rxasm->need - rxasm->fill;
+        seg = (seg > size) ? size : seg;
+        if (rxasm->discard == false) {
+            memcpy(&rxasm->buf[rxasm->fill], data, seg);
+        }
+        rxasm->fill += seg;
+        data += seg;
+        size -= seg;
+        
+        if (rxasm->fill == rxasm->need) {
+            rxasm->hdrfill = 0;
+            if (rxasm->discard) {
+                rxasm->discard  = false;
+                rxasm->fill     = 0;
+            }
+            else {
+                rxasm->buf[rxasm->fill++] = 0;
+                sub_publish_line(sp, rxasm);
+            }
+        }
+    }
+}
+
+
+/// Feed a chunk of received bytes through the line assembler, publishing
+/// each line as its terminator ('\n' or 0) arrives.  A line that can't fit
+/// in SP_LINE_MAX is dropped, and counted in read_oversize.
+static void sub_rxfeed(sp_item_t* sp, sprxasm_t* rxasm, const uint8_t* data, size_t size) {
+    const uint8_t* term;
+    size_t seg;
+    
+    if (sp->flags & SP_FLAG_FRAMED) {
+        sub_rxframe(sp, rxasm, data, size);
+        return;
+    }
+    
+    while (size != 0) {
+        for (term=data; (term < &data[size]) && (*term != '\n') && (*term != 0); term++);
+        seg = (size_t)(term - data);
+        
+        if (rxasm->discard == false) {
+            if (sub_rxgrow(rxasm, rxasm->fill + seg + 1) == 0) {
+                memcpy(&rxasm->buf[rxasm->fill], data, seg);
+                rxasm->fill += seg;
+            }
+            else {
+                ERR_PRINTF("sockpush: dropping line longer than %zu bytes\n", (size_t)SP_LINE_MAX);
+                rxasm->discard = true;
+                sp->read_oversize++;
+            }
+        }
+        if (term == &data[size]) {
+            break;
+        }
+        
+        data += seg + 1;
+        size -= seg + 1;
+        if (rxasm->discard) {
+            rxasm->discard  = false;
+            rxasm->fill     = 0;
+            continue;
+        }
+        rxasm->buf[rxasm->fill++] = 0;
+        sub_publish_line(sp, rxasm);
+    }
+}
+
+
+
+/// Append outbound data to tx_pend.  Call with user_mutex held.
+static int sub_txappend(sp_item_t* sp, const uint8_t* data, size_t size, bool do_terminate) {
+    size_t need = sp->tx_pendsize + size + 1;
+
+    if (need > sp->tx_pendalloc) {
+        size_t newalloc = (sp->tx_pendalloc == 0) ? 4096 : sp->tx_pendalloc;
+        uint8_t* newbuf;
+        while (newalloc < need) {
+            newalloc *= 2;
+        }
+        newbuf = realloc(sp->tx_pend, newalloc);
+        if (newbuf == NULL) {
+            return -1;
+        }
+        sp->tx_pend     = newbuf;
+        sp->tx_pendalloc= newalloc;
+    }
+
+    memcpy(&sp->tx_pend[sp->tx_pendsize], data, size);
+    sp->tx_pendsize += size;
+    if (do_terminate) {
+        sp->tx_pend[sp->tx_pendsize++] = '\n';
+    }
+    return 0;
+}
+
+
+/// Send the commands kept for replay, oldest first, on a new connection.
+/// They go ahead of anything written after it.  Call with user_mutex held.
+static void sub_pend_resend(sp_item_t* sp) {
+    size_t pos = sp->pend_read;
+    size_t size;
+    int rc = 0;
+    
+    while ((pos < sp->pend_fill) && (rc >= 0)) {
+        const uint8_t* data;
+        sppend_t hdr;
+        memcpy(&hdr, &sp->pend[pos], sizeof(sppend_t));
+        size = hdr.size;
+        data = &sp->pend[pos + sizeof(sppend_t)];
+        pos += sizeof(sppend_t) + size;
+        
+#       if defined(SP_EVLOOP)
+        if (sp->evloop != NULL) {
+            rc = sub_txappend(sp, data, size, false);
+            continue;
+        }
+#       endif
+        if (sp->shm_active) {
+            rc = shmring_write(&sp->shm, data, size, SP_SHM_TIMEOUT);
+        }
+        else {
+            rc = (int)sp->tp->send(sp, data, size);
+        }
+    }
+}
+
+
+
+
+/** Shared Memory Ring Backend <BR>
+  * ========================================================================<BR>
+  * With SP_FLAG_SHMRING, the I/O thread offers rings right after connecting.
+  * If they are taken, writers copy into the outbound ring and the I/O thread
+  * assembles lines straight out of the inbound ring.  The socket is only
+  * watched for a hang-up, or for anything the daemon still sends on it.
+  */
+
+/// Connect the socket and, if asked to, set up the rings.  Writers are held
+/// off until this is done, so nothing is sent on the socket ahead of the
+/// offer, and commands kept for replay go out ahead of new ones.  Returns 0
+/// when connected.
+static int sub_connect(sp_item_t* sp) {
+    int cancel_state;
+    int rc;
+
+    // The connect itself is made without user_mutex, and can be cancelled
+    // by sp_close(): a TCP connect can take up to the connect timeout.
+    // Writers see the connection offline until it's done.
+    rc = sp->tp->connect(sp);
+    
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &cancel_state);
+    pthread_mutex_lock(&sp->user_mutex);
+    sp->shm_late = false;
+    if ((rc == 0) && (sp->flags & SP_FLAG_SHMRING) && (sp->shm_declined == false)) {
+        int shm_rc          = shmring_connect(&sp->shm, sp->fd_sock, OTTERCAT_PARAM_SHMRING, SP_SHM_TIMEOUT);
+        sp->shm_active      = (shm_rc == 0);
+        sp->shm_declined    = (shm_rc != 0);
+        sp->shm_late        = (shm_rc == -2);
+    }
+    if (rc == 0) {
+        sp->online = true;
+        pthread_cond_broadcast(&sp->online_cond);
+        sub_pend_resend(sp);
+    }
+    pthread_mutex_unlock(&sp->user_mutex);
+    pthread_setcancelstate(cancel_state, NULL);
+
+    return rc;
+}
+
+
+/// Run the connection on the rings until the daemon hangs up
+static void sub_shm_run(sp_item_t* sp, uint8_t* chunk, size_t chunksize) {
+    const uint8_t* span;
+    size_t avail;
+    ssize_t bytesin;
+    int rc;
+
+    sub_rxreset(&sp->rxasm);
+    while (1) {
+        avail = shmring_peek(&sp->shm, &span);
+        if (avail != 0) {
+            sub_rxfeed(sp, &sp->rxasm, span, avail);
+            shmring_consume(&sp->shm, avail);
+            continue;
+        }
+        rc = shmring_wait(&sp->shm, sp->fd_sock, -1);
+        if (rc == 2) {
+            bytesin = read(sp->fd_sock, chunk, chunksize);
+            if (bytesin < 1) {
+                break;
+            }
+            sub_rxfeed(sp, &sp->rxasm, chunk, (size_t)bytesin);
+        }
+        else if (rc < 0) {
+            break;
+        }
+    }
+
+    pthread_mutex_lock(&sp->user_mutex);
+    sp->shm_active = false;
+    shmring_close(&sp->shm);
+    pthread_mutex_unlock(&sp->user_mutex);
+}
+
+
+
+
+#if OTTERCAT_FEATURE(IOURING)
+/** io_uring Backend <BR>
+  * ========================================================================<BR>
+  * Build with IOURING=1.  The I/O thread keeps one multishot receive posted
+  * on the socket, with a ring of provided buffers, and one read posted on the
+  * wake eventfd.  Writers append to tx_pend and only kick the eventfd when
+  * no send is in progress, so a burst of writes goes out in one send.
+  *
+  * If the kernel lacks io_uring, provided buffer rings or multishot receive,
+  * sub_uring_run() returns -1 before any data is consumed, uring_broken is
+  * set, and the I/O thread uses the blocking reader from then on.
+  */
+
+typedef struct {
+    sp_item_t*          sp;
+    struct io_uring     ring;
+    struct io_uring_buf_ring* br;
+    uint8_t*            bufs;
+    uint8_t*            tx_buf;
+    size_t              tx_alloc;
+    size_t              tx_size;
+    size_t              tx_sent;
+    eventfd_t           wakeval;
+} spuring_t;
+
+
+/// Called by sub_write() with user_mutex held
+static int sub_uring_queuetx(sp_item_t* sp, uint8_t* writebuf, size_t writesize, bool do_terminate) {
+    bool kick = (sp->tx_busy == false) && (sp->tx_pendsize == 0);
+
+    if (sub_txappend(sp, writebuf, writesize, do_terminate) != 0) {
+        return -2;
+    }
+    if (kick) {
+        eventfd_write(sp->fd_wake, 1);
+    }
+
+    return (int)writesize;
+}
+
+
+static bool sub_uring_post(spuring_t* ur, int op) {
+    struct io_uring_sqe* sqe = io_uring_get_sqe(&ur->ring);
+
+    if (sqe == NULL) {
+        return false;
+    }
+
+    switch (op) {
+        case SP_URING_RECV:
+            io_uring_prep_recv_multishot(sqe, ur->sp->fd_sock, NULL, 0, 0);
+            sqe->flags     |= IOSQE_BUFFER_SELECT;
+            sqe->buf_group  = SP_URING_BGID;
+            break;
+
+        case SP_URING_WAKE:
+            io_uring_prep_read(sqe, ur->sp->fd_wake, &ur->wakeval, sizeof(eventfd_t), 0);
+            break;
+
+        case SP_URING_SEND:
+            io_uring_prep_send(sqe, ur->sp->fd_sock, &ur->tx_buf[ur->tx_sent],
+                                ur->tx_size - ur->tx_sent, MSG_NOSIGNAL);
+            break;
+
+        default: return false;
+    }
+
+    io_uring_sqe_set_data64(sqe, (uint64_t)op);
+    return true;
+}
+
+
+/// Swap pending tx data into the I/O thread's buffer and post a send.
+/// Returns false if there was nothing to send.
+static bool sub_uring_starttx(spuring_t* ur) {
+    sp_item_t* sp = ur->sp;
+    uint8_t* swapbuf;
+    size_t swapalloc;
+
+    pthread_mutex_lock(&sp->user_mutex);
+    sp->tx_busy = (sp->tx_pendsize != 0);
+    if (sp->tx_busy) {
+        swapbuf         = ur->tx_buf;
+        swapalloc       = ur->tx_alloc;
+        ur->tx_buf      = sp->tx_pend;
+        ur->tx_alloc    = sp->tx_pendalloc;
+        ur->tx_size     = sp->tx_pendsize;
+        ur->tx_sent     = 0;
+        sp->tx_pend     = swapbuf;
+        sp->tx_pendalloc= swapalloc;
+        sp->tx_pendsize = 0;
+    }
+    pthread_mutex_unlock(&sp->user_mutex);
+
+    return sp->tx_busy && sub_uring_post(ur, SP_URING_SEND);
+}
+
+
+static void sub_uring_cleanup(void* args) {
+    spuring_t* ur = args;
+
+    pthread_mutex_lock(&ur->sp->user_mutex);
+    ur->sp->uring_active= false;
+    ur->sp->tx_busy     = false;
+    ur->sp->tx_pendsize = 0;
+    pthread_mutex_unlock(&ur->sp->user_mutex);
+
+    if (ur->br != NULL) {
+        io_uring_free_buf_ring(&ur->ring, ur->br, SP_URING_BUFS, SP_URING_BGID);
+    }
+    io_uring_queue_exit(&ur->ring);
+    free(ur->bufs);
+    free(ur->tx_buf);
+}
+
+
+/// Runs a connected socket until it drops.  Returns 0 on disconnect, or -1
+/// if io_uring can't be used (nothing has been read from the socket).
+static int sub_uring_run(sp_item_t* sp, sprxasm_t* rxasm) {
+    spuring_t ur;
+    struct io_uring_cqe* cqe;
+    unsigned int head;
+    unsigned int count;
+    bool received = false;
+    int rc = 0;
+    int err;
+
+    memset(&ur, 0, sizeof(spuring_t));
+    ur.sp = sp;
+
+    if (io_uring_queue_init(SP_URING_ENTRIES, &ur.ring, 0) < 0) {
+        return -1;
+    }
+    ur.br   = io_uring_setup_buf_ring(&ur.ring, SP_URING_BUFS, SP_URING_BGID, 0, &err);
+    ur.bufs = malloc(SP_URING_BUFS * SP_URING_BUFSIZE);
+    if ((ur.br == NULL) || (ur.bufs == NULL)) {
+        sub_uring_cleanup(&ur);
+        return -1;
+    }
+    for (int i=0; i<SP_URING_BUFS; i++) {
+        io_uring_buf_ring_add(ur.br, &ur.bufs[i*SP_URING_BUFSIZE], SP_URING_BUFSIZE, i,
+                                io_uring_buf_ring_mask(SP_URING_BUFS), i);
+    }
+    io_uring_buf_ring_advance(ur.br, SP_URING_BUFS);
+
+    pthread_cleanup_push(&sub_uring_cleanup, &ur);
+
+    sub_uring_post(&ur, SP_URING_RECV);
+    sub_uring_post(&ur, SP_URING_WAKE);
+    pthread_mutex_lock(&sp->user_mutex);
+    sp->uring_active = true;
+    pthread_mutex_unlock(&sp->user_mutex);
+
+    while (rc == 0) {
+        io_uring_submit_and_wait(&ur.ring, 1);
+        pthread_testcancel();
+
+        count = 0;
+        io_uring_for_each_cqe(&ur.ring, head, cqe) {
+            count++;
+            switch (cqe->user_data) {
+            case SP_URING_RECV:
+                if (cqe->res > 0) {
+                    int bid = (int)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+                    received = true;
+                    sub_rxfeed(sp, rxasm, &ur.bufs[bid*SP_URING_BUFSIZE], (size_t)cqe->res);
+                    io_uring_buf_ring_add(ur.br, &ur.bufs[bid*SP_URING_BUFSIZE], SP_URING_BUFSIZE, bid,
+                                            io_uring_buf_ring_mask(SP_URING_BUFS), 0);
+                    io_uring_buf_ring_advance(ur.br, 1);
+                }
+                else if (cqe->res == -ENOBUFS) {
+                    // All buffers in use: they've been returned by now
+                }
+                else if ((cqe->res == -EINVAL) && (received == false)) {
+                    // Multishot receive not supported by this kernel
+                    rc = -1;
+                    break;
+                }
+                else {
+                    // Disconnected
+                    rc = 1;
+                    break;
+                }
+                if ((cqe->flags & IORING_CQE_F_MORE) == 0) {
+                    sub_uring_post(&ur, SP_URING_RECV);
+                }
+                break;
+
+            case SP_URING_WAKE:
+                if (sp->tx_busy == false) {
+                    sub_uring_starttx(&ur);
+                }
+                sub_uring_post(&ur, SP_URING_WAKE);
+                break;
+
+            case SP_URING_SEND:
+                if (cqe->res < 0) {
+                    rc = 1;
+                    break;
+                }
+                ur.tx_sent += (size_t)cqe->res;
+                if (ur.tx_sent < ur.tx_size) {
+                    sub_uring_post(&ur, SP_URING_SEND);
+                }
+                else {
+                    sub_uring_starttx(&ur);
+                }
+                break;
+
+            default: break;
+            }
+        }
+        io_uring_cq_advance(&ur.ring, count);
+    }
+
+    pthread_cleanup_pop(1);
+
+    return (rc < 0) ? -1 : 0;
+}
+#endif
+
+
+
+#if defined(SP_EVLOOP)
+/** Event Loop Backend <BR>
+  * ========================================================================<BR>
+  * sp_open() with SP_FLAG_EVLOOP attaches the connection to one of a pool of
+  * epoll loop threads, instead of creating a thread per connection.  Each
+  * connection is a small state machine:
+  *
+  * backoff     --(retry time)-->   connecting or online
+  * connecting  --(EPOLLOUT ok)-->  online
+  * online      --(EOF/error)-->    backoff, with immediate retry
+  *
+  * Failed connects double the backoff from SP_BACKOFF_MIN up to
+  * SP_BACKOFF_MAX, same as the iothread.
+  * Writes are sent directly from the caller when the socket has room, and
+  * otherwise queued on tx_pend and flushed by the loop on EPOLLOUT.
+  *
+  * The loop mutex is held while events are dispatched, so sp_close() can
+  * detach a connection once the loop has finished any batch that refers to
+  * it.  Subscriber actions and readers on loop connections run on the loop
+  * thread, so they delay every connection on that loop while they run.
+  */
+
+#define SP_EVLOOP_MAX       16
+#define SP_EVLOOP_EVENTS    64
+
+typedef struct spevloop {
+    pthread_t       thread;
+    int             fd_epoll;
+    int             fd_wake;
+    pthread_mutex_t mutex;
+    pthread_cond_t  iter_cond;
+    unsigned long   iter;
+    bool            stopping;
+    size_t          conns;
+    sp_item_t*      head;
+} spevloop_t;
+
+static pthread_mutex_t  evloop_mutex = PTHREAD_MUTEX_INITIALIZER;
+static spevloop_t*      evloop[SP_EVLOOP_MAX];
+static unsigned int     evloops = 0;
+
+
+static void sub_ev_setretry(sp_item_t* sp, int delay_ms) {
+    clock_gettime(CLOCK_MONOTONIC, &sp->retry_at);
+    sp->retry_at.tv_sec    += delay_ms / 1000;
+    sp->retry_at.tv_nsec   += (long)(delay_ms % 1000) * 1000000;
+    if (sp->retry_at.tv_nsec >= 1000000000) {
+        sp->retry_at.tv_nsec   -= 1000000000;
+        sp->retry_at.tv_sec    += 1;
+    }
+}
+
+
+static void sub_ev_epoll(spevloop_t* loop, sp_item_t* sp, int op, uint32_t events) {
+    struct epoll_event ev;
+    ev.events   = events;
+    ev.data.ptr = sp;
+    epoll_ctl(loop->fd_epoll, op, sp->tp->fd(sp), &ev);
+}
+
+
+static void sub_ev_online(spevloop_t* loop, sp_item_t* sp) {
+    pthread_mutex_lock(&sp->user_mutex);
+    sp->state       = SPSTATE_online;
+    sp->online      = true;
+    sp->backoff     = SP_BACKOFF_MIN;
+    pthread_cond_broadcast(&sp->online_cond);
+    sub_rxreset(&sp->rxasm);
+    sub_pend_resend(sp);
+    sub_ev_epoll(loop, sp, EPOLL_CTL_MOD, EPOLLIN | EPOLLRDHUP | ((sp->tx_pendsize != 0) ? EPOLLOUT : 0));
+    pthread_mutex_unlock(&sp->user_mutex);
+}
+
+
+/// Drop the socket and go to backoff.  delay_ms is 0 after a disconnect, so
+/// the reconnect is immediate, and the current backoff after a failed connect.
+static void sub_ev_drop(spevloop_t* loop, sp_item_t* sp, int delay_ms) {
+    pthread_mutex_lock(&sp->user_mutex);
+    sub_dropped(sp);
+    if (sp->fd_sock >= 0) {
+        epoll_ctl(loop->fd_epoll, EPOLL_CTL_DEL, sp->fd_sock, NULL);
+        sp->tp->close(sp);
+    }
+    sp->state       = SPSTATE_backoff;
+    sp->tx_pendsize = 0;
+    pthread_mutex_unlock(&sp->user_mutex);
+
+    sub_ev_setretry(sp, delay_ms);
+    if (delay_ms != 0) {
+        sp->backoff = (sp->backoff < (SP_BACKOFF_MAX/2)) ? (sp->backoff * 2) : SP_BACKOFF_MAX;
+    }
+}
+
+
+static void sub_ev_connect(spevloop_t* loop, sp_item_t* sp) {
+    int rc;
+
+    pthread_mutex_lock(&sp->user_mutex);
+    rc = sp->tp->open(sp, true);
+    if (rc == 0) {
+        sp->state = SPSTATE_connecting;
+    }
+    pthread_mutex_unlock(&sp->user_mutex);
+    if (rc != 0) {
+        sub_ev_drop(loop, sp, sp->backoff);
+        return;
+    }
+    sub_ev_epoll(loop, sp, EPOLL_CTL_ADD, EPOLLOUT);
+
+    if (sp->tp->connect(sp) == 0) {
+        sub_ev_online(loop, sp);
+    }
+    else if (errno != EINPROGRESS) {
+        sub_ev_drop(loop, sp, sp->backoff);
+    }
+}
+
+
+static void sub_ev_flushtx(spevloop_t* loop, sp_item_t* sp) {
+    ssize_t sent;
+
+    pthread_mutex_lock(&sp->user_mutex);
+    if (sp->tx_pendsize != 0) {
+        sent = send(sp->fd_sock, sp->tx_pend, sp->tx_pendsize, MSG_NOSIGNAL);
+        if (sent > 0) {
+            sp->tx_pendsize -= (size_t)sent;
+            memmove(sp->tx_pend, &sp->tx_pend[sent], sp->tx_pendsize);
+        }
+    }
+    if (sp->tx_pendsize == 0) {
+        sub_ev_epoll(loop, sp, EPOLL_CTL_MOD, EPOLLIN | EPOLLRDHUP);
+    }
+    pthread_mutex_unlock(&sp->user_mutex);
+}
+
+
+static void sub_ev_handle(spevloop_t* loop, sp_item_t* sp, uint32_t events) {
+    uint8_t chunk[SP_RXCHUNK];
+    ssize_t bytesin;
+    int err;
+    socklen_t errlen;
+
+    switch (sp->state) {
+    case SPSTATE_connecting:
+        err     = 0;
+        errlen  = sizeof(err);
+        getsockopt(sp->fd_sock, SOL_SOCKET, SO_ERROR, &err, &errlen);
+        if ((err != 0) || (events & (EPOLLERR | EPOLLHUP))) {
+            sub_ev_drop(loop, sp, sp->backoff);
+        }
+        else {
+            sub_ev_online(loop, sp);
+        }
+        break;
+
+    case SPSTATE_online:
+        if (events & EPOLLOUT) {
+            sub_ev_flushtx(loop, sp);
+        }
+        if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+            while (1) {
+                bytesin = read(sp->fd_sock, chunk, sizeof(chunk));
+                if (bytesin > 0) {
+                    sub_rxfeed(sp, &sp->rxasm, chunk, (size_t)bytesin);
+                    continue;
+                }
+                if ((bytesin < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) {
+                    break;
+                }
+                if ((bytesin < 0) && (errno == EINTR)) {
+                    continue;
+                }
+                sub_ev_drop(loop, sp, 0);
+                break;
+            }
+        }
+        break;
+
+    default: break;
+    }
+}
+
+
+static int sub_ev_timers(spevloop_t* loop) {
+    struct timespec now;
+    sp_item_t* sp;
+    long long wait_ms = -1;
+    long long test;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    for (sp=loop->head; sp!=NULL; sp=sp->evnext) {
+        if ((sp->state != SPSTATE_backoff) || sp->closing) {
+            continue;
+        }
+        test = ((long long)(sp->retry_at.tv_sec - now.tv_sec) * 1000)
+             + ((sp->retry_at.tv_nsec - now.tv_nsec) / 1000000);
+        if (test <= 0) {
+            sub_ev_connect(loop, sp);
+            if (sp->state != SPSTATE_backoff) {
+                continue;
+            }
+            test = (long long)sp->backoff;
+        }
+        wait_ms = ((wait_ms < 0) || (test < wait_ms)) ? test : wait_ms;
+    }
+
+    return (int)wait_ms;
+}
+
+
+static void* sp_evthread(void* args) {
+    spevloop_t* loop = args;
+    struct epoll_event events[SP_EVLOOP_EVENTS];
+    eventfd_t drain;
+    int wait_ms = 0;
+    int n;
+
+    while (1) {
+        n = epoll_wait(loop->fd_epoll, events, SP_EVLOOP_EVENTS, wait_ms);
+
+        pthread_mutex_lock(&loop->mutex);
+        if (loop->stopping) {
+            pthread_mutex_unlock(&loop->mutex);
+            break;
+        }
+        for (int i=0; i<n; i++) {
+            if (events[i].data.ptr == loop) {
+                eventfd_read(loop->fd_wake, &drain);
+            }
+            else if (((sp_item_t*)events[i].data.ptr)->closing == false) {
+                sub_ev_handle(loop, events[i].data.ptr, events[i].events);
+            }
+        }
+        wait_ms = sub_ev_timers(loop);
+        loop->iter++;
+        pthread_cond_broadcast(&loop->iter_cond);
+        pthread_mutex_unlock(&loop->mutex);
+    }
+
+    return NULL;
+}
+
+
+static void sub_evloop_destroy(spevloop_t* loop) {
+    if (loop->fd_wake >= 0) close(loop->fd_wake);
+    if (loop->fd_epoll >= 0) close(loop->fd_epoll);
+    pthread_cond_destroy(&loop->iter_cond);
+    pthread_mutex_destroy(&loop->mutex);
+    free(loop);
+}
+
+
+static spevloop_t* sub_evloop_create(int cpu) {
+    spevloop_t* loop;
+    struct epoll_event ev;
+
+    loop = calloc(1, sizeof(spevloop_t));
+    if (loop == NULL) {
+        return NULL;
+    }
+    pthread_mutex_init(&loop->mutex, NULL);
+    pthread_cond_init(&loop->iter_cond, NULL);
+    loop->fd_epoll  = epoll_create1(EPOLL_CLOEXEC);
+    loop->fd_wake   = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if ((loop->fd_epoll < 0) || (loop->fd_wake < 0)) {
+        goto sub_evloop_create_ERR;
+    }
+
+    ev.events   = EPOLLIN;
+    ev.data.ptr = loop;
+    if (epoll_ctl(loop->fd_epoll, EPOLL_CTL_ADD, loop->fd_wake, &ev) != 0) {
+        goto sub_evloop_create_ERR;
+    }
+    if (pthread_create(&loop->thread, NULL, &sp_evthread, loop) != 0) {
+        goto sub_evloop_create_ERR;
+    }
+
+    if (cpu >= 0) {
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        CPU_SET(cpu, &cpuset);
+        if (pthread_setaffinity_np(loop->thread, sizeof(cpu_set_t), &cpuset) != 0) {
+            DEBUG_PRINTF("Could not pin sockpush event loop to CPU %i\n", cpu);
+        }
+    }
+
+    return loop;
+
+    sub_evloop_create_ERR:
+    sub_evloop_destroy(loop);
+    return NULL;
+}
+
+
+static int sub_evloop_attach(sp_item_t* sp) {
+    spevloop_t* loop = NULL;
+
+    pthread_mutex_lock(&evloop_mutex);
+    if (evloops == 0) {
+        evloop[0] = sub_evloop_create(-1);
+        evloops   = (evloop[0] != NULL);
+    }
+    for (unsigned int i=0; i<evloops; i++) {
+        if ((loop == NULL) || (evloop[i]->conns < loop->conns)) {
+            loop = evloop[i];
+        }
+    }
+    if (loop != NULL) {
+        pthread_mutex_lock(&loop->mutex);
+        sp->evloop  = loop;
+        sp->evnext  = loop->head;
+        sp->state   = SPSTATE_backoff;
+        sp->backoff = SP_BACKOFF_MIN;
+        sub_ev_setretry(sp, 0);
+        loop->head  = sp;
+        loop->conns++;
+        pthread_mutex_unlock(&loop->mutex);
+        eventfd_write(loop->fd_wake, 1);
+    }
+    pthread_mutex_unlock(&evloop_mutex);
+
+    return (loop != NULL) ? 0 : -1;
+}
+
+
+static void sub_evloop_detach(sp_item_t* sp) {
+    spevloop_t* loop = sp->evloop;
+    sp_item_t** link;
+    unsigned long target;
+
+    pthread_mutex_lock(&loop->mutex);
+    sp->closing = true;
+    for (link=&loop->head; *link!=NULL; link=(sp_item_t**)&(*link)->evnext) {
+        if (*link == sp) {
+            *link = sp->evnext;
+            break;
+        }
+    }
+    loop->conns--;
+    if (sp->fd_sock >= 0) {
+        epoll_ctl(loop->fd_epoll, EPOLL_CTL_DEL, sp->fd_sock, NULL);
+    }
+
+    // An event batch already returned by epoll_wait() may still point to sp:
+    // wait until the loop has completed that batch.
+    target = loop->iter + 1;
+    eventfd_write(loop->fd_wake, 1);
+    while (loop->iter < target) {
+        pthread_cond_wait(&loop->iter_cond, &loop->mutex);
+    }
+    pthread_mutex_unlock(&loop->mutex);
+}
+
+
+/// Called by sub_write() with user_mutex held
+static int sub_evloop_write(sp_item_t* sp, uint8_t* writebuf, size_t writesize, bool do_terminate) {
+    ssize_t sent = 0;
+
+    if (sp->state != SPSTATE_online) {
+        return -2;
+    }
+
+    // Keep ordering: if data is already waiting, queue behind it
+    if (sp->tx_pendsize == 0) {
+        sent = send(sp->fd_sock, writebuf, writesize, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+                return -2;
+            }
+            sent = 0;
+        }
+        if (((size_t)sent == writesize) && do_terminate) {
+            if (send(sp->fd_sock, "\n", 1, MSG_NOSIGNAL) == 1) {
+                return (int)writesize;
+            }
+        }
+        else if ((size_t)sent == writesize) {
+            return (int)writesize;
+        }
+    }
+
+    if ((size_t)sent == writesize) {
+        // Only the terminator is left
+        writebuf    = (uint8_t*)"\n";
+        writesize   = 1;
+        sent        = 0;
+        do_terminate= false;
+    }
+    if (sub_txappend(sp, &writebuf[sent], writesize - (size_t)sent, do_terminate) != 0) {
+        return -2;
+    }
+    sub_ev_epoll(sp->evloop, sp, EPOLL_CTL_MOD, EPOLLIN | EPOLLRDHUP | EPOLLOUT);
+
+    return (int)writesize;
+}
+
+
+int sp_evloop_start(unsigned int nthreads, const int* cpus) {
+    int rc = 0;
+
+    if ((nthreads == 0) || (nthreads > SP_EVLOOP_MAX)) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&evloop_mutex);
+    while (evloops < nthreads) {
+        evloop[evloops] = sub_evloop_create((cpus != NULL) ? cpus[evloops] : -1);
+        if (evloop[evloops] == NULL) {
+            rc = -2;
+            break;
+        }
+        evloops++;
+    }
+    pthread_mutex_unlock(&evloop_mutex);
+
+    return rc;
+}
+
+
+void sp_evloop_stop(void) {
+    pthread_mutex_lock(&evloop_mutex);
+    while (evloops > 0) {
+        spevloop_t* loop = evloop[--evloops];
+        pthread_mutex_lock(&loop->mutex);
+        loop->stopping = true;
+        pthread_mutex_unlock(&loop->mutex);
+        eventfd_write(loop->fd_wake, 1);
+        pthread_join(loop->thread, NULL);
+        sub_evloop_destroy(loop);
+    }
+    pthread_mutex_unlock(&evloop_mutex);
+}
+
+#else
+int sp_evloop_start(unsigned int nthreads, const int* cpus) {
+    return 0;
+}
+
+void sp_evloop_stop(void) {
+}
+#endif
+
+
+
+
+/** Transports <BR>
+  * ========================================================================<BR>
+  * "loop:" addresses use the in-process loopback (sploop.h).  An existing
+  * file is a Unix socket, and so is anything that isn't host:port.
+  */
+
+static int sub_sendall(int fd, const uint8_t* data, size_t size);
+
+static int sub_unix_init(sp_item_t* sp, const char* address) {
+    struct stat statdata;
+    
+    // Test if the address is indeed a path to a socket
+    if ((stat(address, &statdata) != 0) || (S_ISSOCK(statdata.st_mode) == 0)) {
+        return -1;
+    }
+    sp->addr.sun_family = AF_UNIX;
+    snprintf(sp->addr.sun_path, UNIX_PATH_MAX, "%s", address);
+    return 0;
+}
+
+static void sub_unix_term(sp_item_t* sp) {
+}
+
+static int sub_unix_open(sp_item_t* sp, bool nonblock) {
+    sp->fd_sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sp->fd_sock < 0) {
+        return -1;
+    }
+    if (nonblock) {
+        fcntl(sp->fd_sock, F_SETFL, fcntl(sp->fd_sock, F_GETFL) | O_NONBLOCK);
+        fcntl(sp->fd_sock, F_SETFD, FD_CLOEXEC);
+    }
+    return 0;
+}
+
+static void sub_unix_close(sp_item_t* sp) {
+    if (sp->fd_sock >= 0) {
+        close(sp->fd_sock);
+        sp->fd_sock = -1;
+    }
+}
+
+static int sub_unix_connect(sp_item_t* sp) {
+    return connect(sp->fd_sock, (struct sockaddr *)&sp->addr, sizeof(struct sockaddr_un));
+}
+
+static int sub_unix_send(sp_item_t* sp, const uint8_t* data, size_t size) {
+    return sub_sendall(sp->fd_sock, data, size);
+}
+
+static ssize_t sub_unix_recv(sp_item_t* sp, uint8_t* buf, size_t max) {
+    return read(sp->fd_sock, buf, max);
+}
+
+static int sub_unix_fd(sp_item_t* sp) {
+    return sp->fd_sock;
+}
+
+static const sptransport_t sp_unix = {
+    .name       = "unix",
+    .is_socket  = true,
+    .is_local   = true,
+    .init       = &sub_unix_init,
+    .term       = &sub_unix_term,
+    .open       = &sub_unix_open,
+    .close      = &sub_unix_close,
+    .connect    = &sub_unix_connect,
+    .send       = &sub_unix_send,
+    .recv       = &sub_unix_recv,
+    .fd         = &sub_unix_fd
+};
+
+
+static int sub_loop_init(sp_item_t* sp, const char* address) {
+    sp->tp_ctx = sploop_open(&address[5], (sp->flags & SP_FLAG_FRAMED) != 0);
+    return (sp->tp_ctx != NULL) ? 0 : -1;
+}
+
+static void sub_loop_term(sp_item_t* sp) {
+    sploop_close(sp->tp_ctx);
+    sp->tp_ctx = NULL;
+}
+
+static int sub_loop_open(sp_item_t* sp, bool nonblock) {
+    sploop_reset(sp->tp_ctx);
+    return 0;
+}
+
+static void sub_loop_close(sp_item_t* sp) {
+}
+
+static int sub_loop_connect(sp_item_t* sp) {
+    return 0;
+}
+
+static int sub_loop_send(sp_item_t* sp, const uint8_t* data, size_t size) {
+    return (sploop_send(sp->tp_ctx, data, size) == 0) ? (int)size : -1;
+}
+
+static ssize_t sub_loop_recv(sp_item_t* sp, uint8_t* buf, size_t max) {
+    return sploop_recv(sp->tp_ctx, buf, max);
+}
+
+static int sub_loop_fd(sp_item_t* sp) {
+    return sploop_fd(sp->tp_ctx);
+}
+
+static const sptransport_t sp_loop = {
+    .name       = "loop",
+    .is_socket  = false,
+    .is_local   = false,
+    .init       = &sub_loop_init,
+    .term       = &sub_loop_term,
+    .open       = &sub_loop_open,
+    .close      = &sub_loop_close,
+    .connect    = &sub_loop_connect,
+    .send       = &sub_loop_send,
+    .recv       = &sub_loop_recv,
+    .fd         = &sub_loop_fd
+};
+
+
+static sp_tcpopt_t sp_tcpopt = {
+    .nodelay    = true,
+    .keepidle_s = 5,
+    .keepintvl_s= 2,
+    .keepcnt    = 3,
+    .sndbuf     = 0,
+    .rcvbuf     = 0,
+    .connect_ms = 0
+};
+
+typedef struct {
+    struct sockaddr_storage addr;
+    socklen_t   addrlen;
+} sptcp_t;
+
+
+/// Split "host:port" or "[host]:port" into host and port.  Returns -1 if
+/// address isn't in that form.
+static int sub_tcp_split(const char* address, char* host, size_t hostmax, char* port, size_t portmax) {
+    const char* colon;
+    const char* hostend;
+    size_t hostlen;
+
+    colon = strrchr(address, ':');
+    if ((colon == NULL) || (colon[1] == 0) || (strchr(address, '/') != NULL)) {
+        return -1;
+    }
+    for (const char* p=&colon[1]; *p!=0; p++) {
+        if ((*p < '0') || (*p > '9')) {
+            return -1;
+        }
+    }
+    hostend = colon;
+    if (address[0] == '[') {
+        address++;
+        if (hostend[-1] != ']') {
+            return -1;
+        }
+        hostend--;
+    }
+    else if (memchr(address, ':', (size_t)(colon - address)) != NULL) {
+        return -1;
+    }
+    hostlen = (size_t)(hostend - address);
+    if ((hostlen == 0) || (hostlen >= hostmax) || (strlen(&colon[1]) >= portmax)) {
+        return -1;
+    }
+    memcpy(host, address, hostlen);
+    host[hostlen] = 0;
+    strcpy(port, &colon[1]);
+    return 0;
+}
+
+
+static int sub_tcp_init(sp_item_t* sp, const char* address) {
+    char host[256];
+    char port[8];
+    struct addrinfo hints;
+    struct addrinfo* res;
+    sptcp_t* tcp;
+    int rc;
+
+    if (sub_tcp_split(address, host, sizeof(host), port, sizeof(port)) != 0) {
+        return -1;
+    }
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family     = AF_UNSPEC;
+    hints.ai_socktype   = SOCK_STREAM;
+    rc = getaddrinfo(host, port, &hints, &res);
+    if (rc != 0) {
+        ERR_PRINTF("%s: %s\n", address, gai_strerror(rc));
+        return -1;
+    }
+    tcp = calloc(1, sizeof(sptcp_t));
+    if (tcp != NULL) {
+        memcpy(&tcp->addr, res->ai_addr, res->ai_addrlen);
+        tcp->addrlen = res->ai_addrlen;
+    }
+    freeaddrinfo(res);
+    sp->tp_ctx = tcp;
+    return (tcp != NULL) ? 0 : -1;
+}
+
+static void sub_tcp_term(sp_item_t* sp) {
+    free(sp->tp_ctx);
+    sp->tp_ctx = NULL;
+}
+
+static void sub_tcp_setopt(int fd, int level, int opt, int val) {
+    if (setsockopt(fd, level, opt, &val, sizeof(val)) != 0) {
+        DEBUG_PRINTF("setsockopt(%i, %i) failed: %s\n", level, opt, strerror(errno));
+    }
+}
+
+static int sub_tcp_open(sp_item_t* sp, bool nonblock) {
+    sptcp_t* tcp = sp->tp_ctx;
+    int fd;
+
+    fd = socket(tcp->addr.ss_family, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    
+    // Buffer sizes have to be set before connecting, for the TCP window
+    if (sp_tcpopt.sndbuf > 0) {
+        sub_tcp_setopt(fd, SOL_SOCKET, SO_SNDBUF, sp_tcpopt.sndbuf);
+    }
+    if (sp_tcpopt.rcvbuf > 0) {
+        sub_tcp_setopt(fd, SOL_SOCKET, SO_RCVBUF, sp_tcpopt.rcvbuf);
+    }
+    if (sp_tcpopt.nodelay) {
+        sub_tcp_setopt(fd, IPPROTO_TCP, TCP_NODELAY, 1);
+    }
+    if (sp_tcpopt.keepidle_s > 0) {
+        sub_tcp_setopt(fd, SOL_SOCKET, SO_KEEPALIVE, 1);
+#       if defined(TCP_KEEPIDLE)
+        sub_tcp_setopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, sp_tcpopt.keepidle_s);
+#       elif defined(TCP_KEEPALIVE)
+        sub_tcp_setopt(fd, IPPROTO_TCP, TCP_KEEPALIVE, sp_tcpopt.keepidle_s);
+#       endif
+#       if defined(TCP_KEEPINTVL)
+        if (sp_tcpopt.keepintvl_s > 0) {
+            sub_tcp_setopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, sp_tcpopt.keepintvl_s);
+        }
+#       endif
+#       if defined(TCP_KEEPCNT)
+        if (sp_tcpopt.keepcnt > 0) {
+            sub_tcp_setopt(fd, IPPROTO_TCP, TCP_KEEPCNT, sp_tcpopt.keepcnt);
+        }
+#       endif
+#       if defined(TCP_USER_TIMEOUT)
+        // Keepalive only probes an idle link: this covers a peer that
+        // vanishes while data is waiting to be acknowledged.
+        sub_tcp_setopt(fd, IPPROTO_TCP, TCP_USER_TIMEOUT,
+                       1000 * (sp_tcpopt.keepidle_s + (sp_tcpopt.keepintvl_s * sp_tcpopt.keepcnt)));
+#       endif
+    }
+    if (nonblock) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+    sp->fd_sock = fd;
+    return 0;
+}
+
+/// A blocking connect waits out the system's SYN retries, which can be
+/// minutes.  So unless the socket is already nonblocking (the event loop
+/// waits for it itself), it's made nonblocking for the connect, and the wait
+/// for it is bounded by connect_ms.
+static int sub_tcp_connect(sp_item_t* sp) {
+    sptcp_t* tcp = sp->tp_ctx;
+    struct pollfd pfd;
+    socklen_t errlen;
+    int flags;
+    int err;
+    int rc;
+
+    flags = fcntl(sp->fd_sock, F_GETFL);
+    if ((sp_tcpopt.connect_ms <= 0) || (flags < 0) || (flags & O_NONBLOCK)) {
+        return connect(sp->fd_sock, (struct sockaddr*)&tcp->addr, tcp->addrlen);
+    }
+    
+    fcntl(sp->fd_sock, F_SETFL, flags | O_NONBLOCK);
+    rc  = connect(sp->fd_sock, (struct sockaddr*)&tcp->addr, tcp->addrlen);
+    err = (rc == 0) ? 0 : errno;
+    if (err == EINPROGRESS) {
+        pfd.fd      = sp->fd_sock;
+        pfd.events  = POLLOUT;
+        do {
+            rc = poll(&pfd, 1, sp_tcpopt.connect_ms);
+        } while ((rc < 0) && (errno == EINTR));
+        
+        err     = ETIMEDOUT;
+        errlen  = sizeof(err);
+        if ((rc > 0) && (getsockopt(sp->fd_sock, SOL_SOCKET, SO_ERROR, &err, &errlen) != 0)) {
+            err = errno;
+        }
+    }
+    fcntl(sp->fd_sock, F_SETFL, flags);
+    
+    errno = err;
+    return (err == 0) ? 0 : -1;
+}
 
+static const sptransport_t sp_tcp = {
+    .name       = "tcp",
+    .is_socket  = true,
+    .is_local   = false,
+    .init       = &sub_tcp_init,
+    .term       = &sub_tcp_term,
+    .open       = &sub_tcp_open,
+    .close      = &sub_unix_close,
+    .connect    = &sub_tcp_connect,
+    .send       = &sub_unix_send,
+    .recv       = &sub_unix_recv,
+    .fd         = &sub_unix_fd
+};
+
+
+void sp_tcp_setopt(const sp_tcpopt_t* opt) {
+    if (opt != NULL) {
+        sp_tcpopt = *opt;
+    }
+}
 
+void sp_tcp_getopt(sp_tcpopt_t* opt) {
+    if (opt != NULL) {
+        *opt = sp_tcpopt;
+    }
+}
 
 
-static void sub_sendtosub(spsubscr_t* sub, uint8_t* data, size_t datasize) {
-    datasize = (datasize > sub->max) ? sub->max : datasize;
+static const sptransport_t* sub_transport(const char* address) {
+    struct stat statdata;
+    char host[256];
+    char port[8];
     
-    if (sub->buf != NULL) {
-        memcpy(sub->buf, data, datasize);
-        data = sub->buf;
+    if (strncmp(address, "loop:", 5) == 0) {
+        return &sp_loop;
     }
-    if (sub->action != NULL) {
-        sub->action(sub->parent, data, datasize);
+    if ((stat(address, &statdata) != 0)
+    &&  (sub_tcp_split(address, host, sizeof(host), port, sizeof(port)) == 0)) {
+        return &sp_tcp;
     }
+    return &sp_unix;
 }
 
 
 
+
 int sp_open(sp_handle_t* handle, const char* socket_path, unsigned int flags) {
     int rc;
     sp_item_t* new_sp;
-    struct stat statdata;
 
     if ((handle == NULL) || (socket_path == NULL)) {
         return -1;
@@ -198,31 +2020,55 @@ int sp_open(sp_handle_t* handle, const char* socket_path, unsigned int flags) {
         return -2;
     }
     
+    // Setup line buffers and reference variables needed by sp_read()
+    if (sub_readinit(new_sp) != 0) {
+        free(new_sp);
+        return -2;
+    }
+    
     // Default socket is -1, which is an unsupported/unused value
     new_sp->fd_sock     = -1;
+#   if OTTERCAT_FEATURE(IOURING)
+    new_sp->fd_wake     = eventfd(0, EFD_CLOEXEC);
+    new_sp->uring_broken= (new_sp->fd_wake < 0);
+#   endif
     
     ///@todo allocate reader array to initial size
     new_sp->max_readers = SP_MAX_READERS;
     new_sp->max_subs    = SP_MAX_SUBSCRIBERS;
 
-    // Test if the socket_path argument is indeed a path to a socket
-    if (stat(socket_path, &statdata) != 0) {
-        rc = -3;
-        goto sp_open_ERR;
+    // The backends that drive a socket directly are only for socket
+    // transports.  Rings need the dedicated I/O thread.
+    new_sp->tp = sub_transport(socket_path);
+    if (new_sp->tp->is_socket == false) {
+        flags &= ~SP_FLAG_EVLOOP;
+#       if OTTERCAT_FEATURE(IOURING)
+        new_sp->uring_broken = true;
+#       endif
     }
-    if (S_ISSOCK(statdata.st_mode) == 0) {
+    if (new_sp->tp->is_local == false) {
+        flags &= ~SP_FLAG_SHMRING;
+    }
+    if (flags & SP_FLAG_SHMRING) {
+        flags &= ~SP_FLAG_EVLOOP;
+    }
+    new_sp->flags = flags;
+    if (new_sp->tp->init(new_sp, socket_path) != 0) {
         rc = -3;
         goto sp_open_ERR;
     }
 
-    // Open the socket
-    new_sp->fd_sock = socket(AF_UNIX, SOCK_STREAM, 0);
-    if (new_sp < 0) {
-        rc = -4;
-        goto sp_open_ERR;
+    // Open the socket.  Event loop connections open their own nonblocking
+    // socket from the loop thread.
+#   if defined(SP_EVLOOP)
+    if ((flags & SP_FLAG_EVLOOP) == 0)
+#   endif
+    {
+        if (new_sp->tp->open(new_sp, false) != 0) {
+            rc = -4;
+            goto sp_open_ERR;
+        }
     }
-    new_sp->addr.sun_family = AF_UNIX;
-    snprintf(new_sp->addr.sun_path, UNIX_PATH_MAX, "%s", socket_path);
 
     // Initialize Data Mutexes
     if (pthread_mutex_init(&new_sp->user_mutex, NULL) != 0) {
@@ -254,9 +2100,26 @@ int sp_open(sp_handle_t* handle, const char* socket_path, unsigned int flags) {
         goto sp_open_ERR;
     }
     
+    // Initialize Online Cond (waits on user_mutex)
+    if (pthread_cond_init(&new_sp->online_cond, NULL) != 0) {
+        rc = -11;
+        goto sp_open_ERR;
+    }
+    
+#   if defined(SP_EVLOOP)
+    if (flags & SP_FLAG_EVLOOP) {
+        if (sub_evloop_attach(new_sp) != 0) {
+            rc = -12;
+            goto sp_open_ERR;
+        }
+        *handle = new_sp;
+        return 0;
+    }
+#   endif
+    
     // Create the socket management thread
     if (pthread_create(&new_sp->iothread, NULL, &sp_iothread, new_sp) != 0) {
-        rc = -11;
+        rc = -12;
         goto sp_open_ERR;
     }
     
@@ -265,6 +2128,7 @@ int sp_open(sp_handle_t* handle, const char* socket_path, unsigned int flags) {
     
     sp_open_ERR:
     switch (rc) {
+        case -12: pthread_cond_destroy(&new_sp->online_cond);
         case -11: pthread_cond_destroy(&new_sp->readdone_cond);
         case -10: pthread_mutex_unlock(&new_sp->readdone_mutex);
                  pthread_mutex_destroy(&new_sp->readdone_mutex);
@@ -275,9 +2139,15 @@ int sp_open(sp_handle_t* handle, const char* socket_path, unsigned int flags) {
                  //pthread_mutex_destroy(&new_sp->id_mutex);
         case -6: pthread_mutex_unlock(&new_sp->user_mutex);
                  pthread_mutex_destroy(&new_sp->user_mutex);
-        case -5: close(new_sp->fd_sock);
-        case -4:
-        case -3: free(new_sp);
+        case -5: new_sp->tp->close(new_sp);
+        case -4: new_sp->tp->term(new_sp);
+        case -3:
+#                if OTTERCAT_FEATURE(IOURING)
+                 if (new_sp->fd_wake >= 0) close(new_sp->fd_wake);
+#                endif
+                 free(new_sp->read_buf);
+                 free(new_sp->rxasm.buf);
+                 free(new_sp);
         default: break;
     }
     
@@ -293,12 +2163,37 @@ int sp_close(sp_handle_t handle) {
         return -1;
     }
     
+#   if defined(SP_EVLOOP)
+    if (sp->evloop != NULL) {
+        sub_evloop_detach(sp);
+        goto sp_close_FREE;
+    }
+#   endif
+    
     if (pthread_cancel(sp->iothread) != 0) {
         return -2;
     }
     
+#   if OTTERCAT_FEATURE(IOURING)
+    // The io_uring wait is not a cancellation point: kick it so the I/O
+    // thread reaches pthread_testcancel()
+    if (sp->fd_wake >= 0) {
+        eventfd_write(sp->fd_wake, 1);
+    }
+#   endif
+    
     pthread_join(sp->iothread, NULL);
     
+    if (sp->shm_active) {
+        shmring_close(&sp->shm);
+    }
+    
+#   if defined(SP_EVLOOP)
+    sp_close_FREE:
+#   endif
+    
+    pthread_cond_destroy(&sp->online_cond);
+    
     pthread_cond_destroy(&sp->readdone_cond);
     pthread_mutex_unlock(&sp->readdone_mutex);
     pthread_mutex_destroy(&sp->readdone_mutex);
@@ -312,8 +2207,24 @@ int sp_close(sp_handle_t handle) {
     
     pthread_mutex_unlock(&sp->user_mutex);
     pthread_mutex_destroy(&sp->user_mutex);
-
-    close(sp->fd_sock);
+    
+    for (int i=0; i<sp->subs; i++) {
+        free(sp->sub[i]);
+    }
+    
+#   if OTTERCAT_FEATURE(IOURING)
+    if (sp->fd_wake >= 0) {
+        close(sp->fd_wake);
+    }
+#   endif
+    free(sp->tx_pend);
+    free(sp->pend);
+    free(sp->tx_frame);
+    free(sp->read_buf);
+    free(sp->rxasm.buf);
+
+    sp->tp->close(sp);
+    sp->tp->term(sp);
     free(sp);
     
     return 0;
@@ -343,6 +2254,11 @@ sp_reader_t sp_reader_create(void* ctx, sp_handle_t handle) {
             if (reader != NULL) {
                 reader->parent      = sp;
                 reader->last_read   = sp->read_id;
+                reader->drop_seen   = sp->drop_gen;
+                reader->backlog     = NULL;
+                reader->backalloc   = 0;
+                reader->backfill    = 0;
+                reader->backread    = 0;
                 
                 ///@todo Change Array to linked list
                 sp->reader[sp->readers] = reader;
@@ -365,6 +2281,7 @@ void sp_reader_destroy(sp_reader_t reader) {
         pthread_mutex_lock(&sp->user_mutex);
         sp->readers--;
         pthread_mutex_unlock(&sp->user_mutex);
+        free(((sprdr_t*)reader)->backlog);
         talloc_free(reader);
     }
 }
@@ -377,6 +2294,8 @@ void sp_reader_purge(sp_reader_t reader) {
         sp = ((sprdr_t*)reader)->parent;
         pthread_mutex_lock(&sp->user_mutex);
         ((sprdr_t*)reader)->last_read = sp->read_id;
+        ((sprdr_t*)reader)->backfill  = 0;
+        ((sprdr_t*)reader)->backread  = 0;
         pthread_mutex_unlock(&sp->user_mutex);
     }
 }
@@ -385,33 +2304,55 @@ void sp_reader_purge(sp_reader_t reader) {
 
 
 
-static int sub_loadread(sprdr_t* rdr, sp_item_t* sp, uint8_t* readbuf, size_t readmax) {
-    rdr->last_read = sp->read_id;
+/// Copy the published line to the reader.  If growbuf is not NULL, the
+/// reader's buffer is grown to fit the whole line.
+static int sub_copyline(const uint8_t* line, size_t size, uint8_t** growbuf, size_t* growalloc, uint8_t* readbuf, size_t readmax) {
+    if ((growbuf != NULL) && (*growalloc < size)) {
+        uint8_t* newbuf = realloc(*growbuf, size);
+        if (newbuf != NULL) {
+            *growbuf    = newbuf;
+            *growalloc  = size;
+        }
+        readbuf = *growbuf;
+        readmax = *growalloc;
+    }
 
-    if (readmax > sp->read_size) {
-        readmax = sp->read_size;
+    if (readmax > size) {
+        readmax = size;
     }
-    memcpy(readbuf, sp->read_buf, readmax);
+    memcpy(readbuf, line, readmax);
     
     return (int)readmax;
 }
 
 
-int sp_read(sp_reader_t reader, uint8_t* readbuf, size_t readmax, size_t timeout_ms) {
+static int sub_loadread(sprdr_t* rdr, sp_item_t* sp, uint8_t** growbuf, size_t* growalloc, uint8_t* readbuf, size_t readmax) {
+    rdr->last_read = sp->read_id;
+    return sub_copyline(sp->read_buf, sp->read_size, growbuf, growalloc, readbuf, readmax);
+}
+
+
+/// Take the oldest line from the reader's backlog.  Call with user_mutex
+/// held.  Returns 0 if the backlog is empty.
+static int sub_backlog_pop(sprdr_t* rdr, uint8_t** growbuf, size_t* growalloc, uint8_t* readbuf, size_t readmax) {
+    size_t size;
+
+    if (rdr->backread == rdr->backfill) {
+        return 0;
+    }
+    memcpy(&size, &rdr->backlog[rdr->backread], sizeof(size_t));
+    rdr->backread += sizeof(size_t);
+    readmax = (size_t)sub_copyline(&rdr->backlog[rdr->backread], size, growbuf, growalloc, readbuf, readmax);
+    rdr->backread += size;
+    return (int)readmax;
+}
+
+
+static int sub_read(sprdr_t* rdr, uint8_t** growbuf, size_t* growalloc, uint8_t* readbuf, size_t readmax, size_t timeout_ms) {
     sp_item_t* sp;
-    sprdr_t* rdr;
     struct timespec ts, cur;
     int rc = 0;
     int wait_test;
-    
-    rdr = reader;
-    if (rdr == NULL) {
-        return -1;
-    }
-
-    if ((readbuf == NULL) || (readmax == 0)) {
-        return 0;
-    }
 
     // Create timespec based on milliseconds from input
     ts.tv_sec   = timeout_ms / 1000;
@@ -429,37 +2370,49 @@ int sp_read(sp_reader_t reader, uint8_t* readbuf, size_t readmax, size_t timeout
     sp = rdr->parent;
 
 
-    // 1st step is just to look if there's data sitting on the buffer already
-    // This timed-lock allows sp_read() to catch a line that is being read at
-    // time of calling.
-    if (pthread_mutex_trylock(&sp->user_mutex) == 0) {
-        if (rdr->last_read != sp->read_id) {
-            rc = sub_loadread(rdr, sp, readbuf, readmax);
-        }
-        pthread_mutex_unlock(&sp->user_mutex);
+    // 1st step is just to look if there's data sitting on the buffer already:
+    // lines that arrived since the last call are in the backlog.
+    pthread_mutex_lock(&sp->user_mutex);
+    rc = sub_backlog_pop(rdr, growbuf, growalloc, readbuf, readmax);
+    if ((rc == 0) && (rdr->last_read != sp->read_id)) {
+        rc = sub_loadread(rdr, sp, growbuf, growalloc, readbuf, readmax);
+    }
+    if ((rc == 0) && (rdr->drop_seen != sp->drop_gen)) {
+        rdr->drop_seen = sp->drop_gen;
+        rc = SP_DROPPED;
     }
     
     // If 1st step yields no data, it means that sp_iothread() is in its poll()
     // state, waiting on the file.  So until the timeout expires, we can wait
-    // for a readline cond signal to be broadcasted by sp_iothread().
-    if (rc == 0) {
+    // for a readline cond signal to be broadcasted by sp_iothread().  The
+    // reader is marked as waiting before user_mutex is released, so a line
+    // published in between is handed over rather than backlogged.
+    if (rc != 0) {
+        pthread_mutex_unlock(&sp->user_mutex);
+    }
+    else {
         int waiting_readers;
-    
-        // Set "waiting state"
-        //pthread_mutex_lock(&sp->id_mutex);
-        //sp->waiting_readers++;
-        //pthread_mutex_unlock(&sp->id_mutex);
+        unsigned int gen;
+        unsigned int drop;
         
         ///@todo there seems to be a multiple read problem at times, here (or maybe above)
         pthread_mutex_lock(&sp->readline_mutex);
         sp->waiting_readers++;
+        pthread_mutex_unlock(&sp->user_mutex);
         wait_test = 0;
-        sp->readline_inactive = true;
-        while (sp->readline_inactive && (wait_test == 0)) {
+        gen = sp->readline_gen;
+        drop = sp->drop_gen;
+        while ((gen == sp->readline_gen) && (drop == sp->drop_gen) && (wait_test == 0)) {
             wait_test = pthread_cond_timedwait(&sp->readline_cond, &sp->readline_mutex, &ts);
         }
-        if (wait_test == 0) {
-            rc = sub_loadread(rdr, sp, readbuf, readmax);
+        // A line published as the wait timed out is still taken.  A drop is
+        // reported on its own call, after any line that came ahead of it.
+        if (gen != sp->readline_gen) {
+            rc = sub_loadread(rdr, sp, growbuf, growalloc, readbuf, readmax);
+        }
+        else if (drop != sp->drop_gen) {
+            rdr->drop_seen = sp->drop_gen;
+            rc = SP_DROPPED;
         }
         sp->waiting_readers -= (sp->waiting_readers != 0);
         waiting_readers = (int)sp->waiting_readers;
@@ -478,33 +2431,215 @@ int sp_read(sp_reader_t reader, uint8_t* readbuf, size_t readmax, size_t timeout
         //pthread_mutex_unlock(&sp->id_mutex);
     }
     
-    sp_read_END:
     return rc;
 }
 
 
+int sp_read(sp_reader_t reader, uint8_t* readbuf, size_t readmax, size_t timeout_ms) {
+    if (reader == NULL) {
+        return -1;
+    }
+    if ((readbuf == NULL) || (readmax == 0)) {
+        return 0;
+    }
+    return sub_read(reader, NULL, NULL, readbuf, readmax, timeout_ms);
+}
+
+
+int sp_readline(sp_reader_t reader, uint8_t** readbuf, size_t* readalloc, size_t timeout_ms) {
+    if ((reader == NULL) || (readbuf == NULL) || (readalloc == NULL)) {
+        return -1;
+    }
+    if (*readbuf == NULL) {
+        *readalloc = 0;
+    }
+    return sub_read(reader, readbuf, readalloc, *readbuf, *readalloc, timeout_ms);
+}
+
+
+unsigned long sp_oversize(sp_handle_t handle) {
+    sp_item_t* sp = handle;
+    return (sp != NULL) ? sp->read_oversize : 0;
+}
+
+
+int sp_frameinfo(sp_handle_t handle, uint8_t* type, uint32_t* sid) {
+    sp_item_t* sp = handle;
+    
+    if ((sp == NULL) || ((sp->flags & SP_FLAG_FRAMED) == 0)) {
+        return -1;
+    }
+    if (type != NULL) {
+        *type = sp->read_type;
+    }
+    if (sid != NULL) {
+        *sid = sp->read_sid;
+    }
+    return 0;
+}
+
+
+void sp_frame_pack(uint8_t* hdr, uint8_t type, uint32_t sid, size_t size) {
+    hdr[0]  = SP_FRAME_SYNC0;
+    hdr[1]  = SP_FRAME_SYNC1;
+    hdr[2]  = type;
+    hdr[3]  = 0;
+    hdr[4]  = (uint8_t)(size >> 24);
+    hdr[5]  = (uint8_t)(size >> 16);
+    hdr[6]  = (uint8_t)(size >> 8);
+    hdr[7]  = (uint8_t)size;
+    hdr[8]  = (uint8_t)(sid >> 24);
+    hdr[9]  = (uint8_t)(sid >> 16);
+    hdr[10] = (uint8_t)(sid >> 8);
+    hdr[11] = (uint8_t)sid;
+}
+
+
+int sp_frame_unpack(const uint8_t* hdr, uint8_t* type, uint32_t* sid, size_t* size) {
+    if ((hdr[0] != SP_FRAME_SYNC0) || (hdr[1] != SP_FRAME_SYNC1)) {
+        return -1;
+    }
+    *type   = hdr[2];
+    *size   = ((size_t)hdr[4] << 24) | ((size_t)hdr[5] << 16) | ((size_t)hdr[6] << 8) | (size_t)hdr[7];
+    *sid    = ((uint32_t)hdr[8] << 24) | ((uint32_t)hdr[9] << 16) | ((uint32_t)hdr[10] << 8) | (uint32_t)hdr[11];
+    return 0;
+}
+
+
+
+/// Blocking send of the whole buffer.  Returns the size, or -1.
+static int sub_sendall(int fd, const uint8_t* data, size_t size) {
+    size_t sent = 0;
+    ssize_t rc;
+    
+    while (sent < size) {
+        rc = send(fd, &data[sent], size - sent, MSG_NOSIGNAL);
+        if (rc < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        sent += (size_t)rc;
+    }
+    return (int)sent;
+}
+
+
+/// Build the frame for one write in tx_frame.  The line terminator isn't
+/// part of the payload.  Call with user_mutex held.  Returns the frame size.
+static int sub_txframe(sp_item_t* sp, const uint8_t* data, size_t size) {
+    while ((size != 0) && ((data[size-1] == '\n') || (data[size-1] == '\r') || (data[size-1] == 0))) {
+        size--;
+    }
+    if ((SP_FRAME_HDRSIZE + size) > sp->tx_framealloc) {
+        uint8_t* newbuf = realloc(sp->tx_frame, SP_FRAME_HDRSIZE + size);
+        if (newbuf == NULL) {
+            return -1;
+        }
+        sp->tx_frame        = newbuf;
+        sp->tx_framealloc   = SP_FRAME_HDRSIZE + size;
+    }
+    sp_frame_pack(sp->tx_frame, SP_FRAME_CMD, 0, size);
+    memcpy(&sp->tx_frame[SP_FRAME_HDRSIZE], data, size);
+    return (int)(SP_FRAME_HDRSIZE + size);
+}
+
 
-static int sub_write(sp_handle_t handle, uint8_t* writebuf, size_t writesize, bool do_terminate) {
+static int sub_write(sp_handle_t handle, uint8_t* writebuf, size_t writesize, bool do_terminate, bool is_cmd, uint64_t id) {
     sp_item_t* sp = handle;
+    uint8_t* txbuf = writebuf;
+    size_t txsize = writesize;
     int rc;
 
-    /// Send to socket
+    /// Send to socket.
+    /// MSG_NOSIGNAL keeps a dropped daemon from raising SIGPIPE in the host
+    /// process: the I/O thread deals with reconnection on its own.
     pthread_mutex_lock(&sp->user_mutex);
-    rc = (int)write(sp->fd_sock, writebuf, writesize);
+    
+    /// In framed mode, each write goes out as one frame, which carries its
+    /// own length instead of a terminator.
+    if (sp->flags & SP_FLAG_FRAMED) {
+        rc = sub_txframe(sp, writebuf, writesize);
+        if (rc < 0) {
+            goto sub_write_END;
+        }
+        txbuf       = sp->tx_frame;
+        txsize      = (size_t)rc;
+        do_terminate= false;
+    }
+    
+    /// With SP_FLAG_REPLAY, a command written while disconnected is held
+    /// for the reconnect.  Otherwise it fails straight away.
+    is_cmd = is_cmd && (sp->flags & SP_FLAG_REPLAY);
+    if (sp->online == false) {
+        if (is_cmd == false) {
+            rc = -2;
+            goto sub_write_END;
+        }
+        sub_pend_push(sp, id, txbuf, txsize, do_terminate);
+        rc = (int)txsize;
+        goto sub_write_DISPATCH;
+    }
+    
+#   if defined(SP_EVLOOP)
+    if (sp->evloop != NULL) {
+        rc = sub_evloop_write(sp, txbuf, txsize, do_terminate);
+        if (rc < 0) {
+            goto sub_write_END;
+        }
+        goto sub_write_SENT;
+    }
+#   endif
+    if (sp->shm_active) {
+        rc = shmring_write(&sp->shm, txbuf, txsize, SP_SHM_TIMEOUT);
+        if ((rc == 0) && do_terminate) {
+            rc = shmring_write(&sp->shm, (const uint8_t*)"\n", 1, SP_SHM_TIMEOUT);
+        }
+        if (rc < 0) {
+            rc = -2;
+            goto sub_write_END;
+        }
+        rc = (int)txsize;
+        goto sub_write_SENT;
+    }
+#   if OTTERCAT_FEATURE(IOURING)
+    if (sp->uring_active) {
+        rc = sub_uring_queuetx(sp, txbuf, txsize, do_terminate);
+        if (rc < 0) {
+            goto sub_write_END;
+        }
+        goto sub_write_SENT;
+    }
+#   endif
+    rc = sp->tp->send(sp, txbuf, txsize);
     if (rc < 0) {
         rc = -2;
         goto sub_write_END;
     }
     if (do_terminate) {
-        rc = (int)write(sp->fd_sock, "\n", 1);
+        if (sp->tp->send(sp, (const uint8_t*)"\n", 1) < 0) {
+            rc = -2;
+            goto sub_write_END;
+        }
+    }
+    
+    /// Sent: keep commands until their ack
+    sub_write_SENT:
+    if (is_cmd) {
+        sub_pend_push(sp, id, txbuf, txsize, do_terminate);
     }
     
     /// Dispatch to subscriber(s)
+    sub_write_DISPATCH:
+    if (txbuf != writebuf) {
+        rc = (int)writesize;
+    }
     if (sp->subs > 0) {
         for (int i=0; i<sp->subs; i++) {
             ///@todo Change Array to linked list
             if (sp->sub[i]->flags & SP_SUB_OUTBOUND) {
-                sub_sendtosub(sp->sub[i], writebuf, rc);
+                sub_sendtosub(sp->sub[i], writebuf, (size_t)rc);
             }
         }
     }
@@ -522,132 +2657,203 @@ int sp_write(sp_handle_t handle, uint8_t* writebuf, size_t writesize) {
     if ((writebuf == NULL) || (writesize == 0)) {
         return 0;
     }
-    return sub_write(handle, writebuf, writesize, false);
+    return sub_write(handle, writebuf, writesize, false, false, 0);
 }
 
 
 int sp_sendcmd(sp_handle_t handle, uint8_t* writebuf, size_t writesize) {
+    return sp_sendcmd_id(handle, writebuf, writesize, 0);
+}
+
+
+int sp_sendcmd_id(sp_handle_t handle, uint8_t* writebuf, size_t writesize, uint64_t id) {
     if (handle == NULL) {
         return -1;
     }
     if ((writebuf == NULL) || (writesize == 0)) {
         return 0;
     }
-    return sub_write(handle, writebuf, writesize, (bool)(writebuf[writesize-1] != '\n'));
+    return sub_write(handle, writebuf, writesize, (bool)(writebuf[writesize-1] != '\n'), true, id);
+}
+
+
+int sp_waitonline(sp_handle_t handle, size_t timeout_ms) {
+    sp_item_t* sp = handle;
+    struct timespec ts;
+    int rc = 0;
+    
+    if (sp == NULL) {
+        return -1;
+    }
+    
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec  += timeout_ms / 1000;
+    ts.tv_nsec += (timeout_ms % 1000) * 1000000;
+    if (ts.tv_nsec >= 1000000000) {
+        ts.tv_nsec -= 1000000000;
+        ts.tv_sec  += 1;
+    }
+    
+    pthread_mutex_lock(&sp->user_mutex);
+    while ((sp->online == false) && (rc == 0)) {
+        rc = pthread_cond_timedwait(&sp->online_cond, &sp->user_mutex, &ts);
+    }
+    rc = sp->online ? 0 : -2;
+    pthread_mutex_unlock(&sp->user_mutex);
+    
+    return rc;
+}
+
+
+void sp_forget(sp_handle_t handle, uint64_t id) {
+    sp_item_t* sp = handle;
+    
+    if ((sp == NULL) || (id == 0)) {
+        return;
+    }
+    pthread_mutex_lock(&sp->user_mutex);
+    sub_pend_remove(sp, id);
+    pthread_mutex_unlock(&sp->user_mutex);
 }
 
 
 
-///@todo Not yet implemented
-//-----------------------------------------------------------------------------
-int sp_subscribe(sp_handle_t handle, sp_action_t action, int flags, uint8_t* buf, size_t max) {
-    return -1;
+sp_subscr_t sp_subscribe(sp_handle_t handle, void* parent, sp_action_t action, int flags, uint8_t* buf, size_t max) {
+    sp_item_t* sp = handle;
+    spsubscr_t* sub = NULL;
+    
+    if ((sp == NULL) || (action == NULL)) {
+        return NULL;
+    }
+    
+    pthread_mutex_lock(&sp->user_mutex);
+    if (sp->subs < sp->max_subs) {
+        sub = calloc(1, sizeof(spsubscr_t));
+        if (sub != NULL) {
+            sub->flags  = flags;
+            sub->parent = parent;
+            sub->sp     = sp;
+            sub->action = action;
+            sub->buf    = buf;
+            sub->max    = (buf == NULL) ? SIZE_MAX : max;
+            
+            ///@todo Change Array to linked list
+            sp->sub[sp->subs] = sub;
+            sp->subs++;
+        }
+    }
+    pthread_mutex_unlock(&sp->user_mutex);
+    
+    return sub;
+}
+
+
+void sp_unsubscribe(sp_subscr_t subscr) {
+    spsubscr_t* sub = subscr;
+    sp_item_t* sp;
+    
+    if (sub != NULL) {
+        sp = sub->sp;
+        
+        // The I/O thread only calls subscribers while holding user_mutex, so
+        // once this returns the action will not be called again.
+        pthread_mutex_lock(&sp->user_mutex);
+        for (int i=0; i<sp->subs; i++) {
+            if (sp->sub[i] == sub) {
+                sp->subs--;
+                sp->sub[i] = sp->sub[sp->subs];
+                sp->sub[sp->subs] = NULL;
+                break;
+            }
+        }
+        pthread_mutex_unlock(&sp->user_mutex);
+        free(sub);
+    }
 }
 
 //int sp_dispatch(sp_handle_t handle, sp_status_t action, uint8_t* writebuf, size_t writesize) {
 //    return -1;
 //}
-//-----------------------------------------------------------------------------
 
 
 
+/// Backoff sleep.  nanosleep() is a cancellation point, as sleep() was.
+static void sub_sleep_ms(int ms) {
+    struct timespec ts;
+    ts.tv_sec   = ms / 1000;
+    ts.tv_nsec  = (long)(ms % 1000) * 1000000;
+    while ((nanosleep(&ts, &ts) != 0) && (errno == EINTR));
+}
+
+
 void* sp_iothread(void* args) {
     sp_item_t* sp = args;
     
-    uint8_t linebuf[1024];
-    uint8_t readbuf[1024];
-    char* cursor;
-    char* end;
-    int backoff = 1;
-    int max_backoff = 60;
+    uint8_t chunk[SP_RXCHUNK];
+    int backoff = SP_BACKOFF_MIN;
+    int rc;
     
     // This thread uses mutexes, so it's important to have deferred cancelling
     // to prevent deadlock in odd cases where thread is cancelled
     pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, NULL);
     
-    // Setup reference variables needed by sp_read()
-    sp->readline_inactive   = true;
-    sp->read_buf            = linebuf;
-    sp->read_size           = 0;
-    sp->read_id             = 1;
-
     while (1) {
         /// Connect to the socket
-        if (connect(sp->fd_sock, (struct sockaddr *)&sp->addr, sizeof(struct sockaddr_un)) < 0) {
-            sleep(backoff);
-            if (backoff < max_backoff) {
-                backoff *= 2;
-            }
+        if (sub_connect(sp) < 0) {
+            sub_sleep_ms(backoff);
+            backoff = (backoff < (SP_BACKOFF_MAX/2)) ? (backoff * 2) : SP_BACKOFF_MAX;
+            
+            // A failed connect can leave the socket unusable (TCP)
+            pthread_mutex_lock(&sp->user_mutex);
+            sp->tp->close(sp);
+            rc = sp->tp->open(sp, false);
+            pthread_mutex_unlock(&sp->user_mutex);
             continue;
         }
-        
-        ///@todo have a wait function that can be released here
 
-        backoff = 1;
+        backoff = SP_BACKOFF_MIN;
 
-        while (1) {
-            // ----------------------------------------------------------------
-            /// Double-Buffer stream
-            /// Solves for problem of reading two lines at the same time.
-            cursor = (char*)readbuf;
-            end    = (char*)readbuf + sizeof(readbuf);
-            while(1) {
-                if (read(sp->fd_sock, cursor, 1) < 1) {
-                    goto sp_iothread_RECONNECT;
-                }
-                if ((*cursor == '\n') || (*cursor == 0)) {
-                    *cursor++ = 0;
-                    break;
-                }
-                if (++cursor >= end) {
-                    cursor = (char*)readbuf;
-                }
-            }
-            // ----------------------------------------------------------------
+        if (sp->shm_active) {
+            sub_shm_run(sp, chunk, sizeof(chunk));
+            goto sp_iothread_RECONNECT;
+        }
 
-            pthread_mutex_lock(&sp->user_mutex);
-            sp->read_id++;
-            sp->read_size = (cursor - (char*)readbuf);
-            memcpy(sp->read_buf, readbuf, sp->read_size);
-
-            // publish it to subscribers, which are callbacks that need
-            // to deal with data replication themselves.
-            // lock the data mutex to prevent new subscribers getting added
-            if (sp->subs > 0) {
-                for (int i=0; i<sp->subs; i++) {
-                    ///@todo Change Array to linked list
-                    if (sp->sub[i]->flags & SP_SUB_INBOUND) {
-                        sub_sendtosub(sp->sub[i], sp->read_buf, sp->read_size);
-                    }
-                }
+#       if OTTERCAT_FEATURE(IOURING)
+        if (sp->uring_broken == false) {
+            sub_rxreset(&sp->rxasm);
+            if (sub_uring_run(sp, &sp->rxasm) == 0) {
+                goto sp_iothread_RECONNECT;
             }
+            DEBUG_PRINTF("io_uring unavailable: using blocking socket I/O\n");
+            sp->uring_broken = true;
+        }
+#       endif
 
-            ///@todo there seems to be a problem where a line gets read multiple times via sp_read()
-            if (sp->readers > 0) {
-                pthread_mutex_lock(&sp->readline_mutex);
-                if (sp->waiting_readers <= 0) {
-                    pthread_mutex_unlock(&sp->readline_mutex);
-                }
-                else {
-                    sp->readline_inactive = false;
-                    pthread_cond_broadcast(&sp->readline_cond);
-                    pthread_mutex_unlock(&sp->readline_mutex);
-                
-                    pthread_mutex_lock(&sp->readdone_mutex);
-                    sp->readdone_inactive = true;
-                    while (sp->readdone_inactive) {
-                        pthread_cond_wait(&sp->readdone_cond, &sp->readdone_mutex);
-                    }
-                    pthread_mutex_unlock(&sp->readdone_mutex);
-                }
-                
+        // ----------------------------------------------------------------
+        /// Double-Buffer stream
+        /// Solves for problem of reading two lines at the same time.
+        /// Reads are chunked, and the assembler splits them into lines.
+        sub_rxreset(&sp->rxasm);
+        while (1) {
+            ssize_t bytesin = sp->tp->recv(sp, chunk, sizeof(chunk));
+            if (bytesin < 1) {
+                goto sp_iothread_RECONNECT;
             }
-            
-            pthread_mutex_unlock(&sp->user_mutex);
+            sub_rxfeed(sp, &sp->rxasm, chunk, (size_t)bytesin);
         }
+        // ----------------------------------------------------------------
         
         sp_iothread_RECONNECT:
-        close(sp->fd_sock);
+        // Waiting readers hear about the drop now, not at their timeout.
+        // A stream socket can't be connected twice: replace it.
+        pthread_mutex_lock(&sp->user_mutex);
+        sub_dropped(sp);
+        sp->tp->close(sp);
+        rc = sp->tp->open(sp, false);
+        pthread_mutex_unlock(&sp->user_mutex);
+        if (rc < 0) {
+            sub_sleep_ms(backoff);
+        }
     }
     
     
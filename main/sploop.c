@@ -0,0 +1,410 @@
+/* Copyright 2020, JP Norair
+  *
+  * Licensed under the OpenTag License, Version 1.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  * http://www.indigresso.com/wiki/doku.php?id=opentag:license_1_0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  *
+  */
+
+/// The response queue is a byte buffer under a mutex.  A pipe carries the
+/// wakeups: one byte is written when the queue goes from empty to not
+/// empty, so a busy receiver finds data waiting and makes no system calls.
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#   define _GNU_SOURCE
+#endif
+
+// Application Headers
+#include "sploop.h"
+#include "debug.h"
+#include "ottercat_cfg.h"
+#include "sockpush.h"
+
+// Standard C & POSIX Libraries
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+#define SPLOOP_CHUNK        4096
+#define SPLOOP_MAXQUEUE     (64*1024*1024)
+
+static const char sploop_default[] =
+    "{\"type\": \"ack\", \"data\": {\"cmd\": \"${cmd}\", \"err\": 0, \"sid\": ${sid}}}\n"
+    "{\"type\": \"rxstat\", \"data\": {\"sid\": ${sid}, \"qual\": 0, \"frame\": \"${line}\"}}\n";
+
+
+typedef struct {
+    const char* text;
+    uint8_t     type;
+} sltmpl_t;
+
+typedef struct {
+    uint8_t*    buf;
+    size_t      fill;
+    size_t      alloc;
+} slbuf_t;
+
+struct sploop {
+    pthread_mutex_t mutex;
+    int         fd_pipe[2];
+    bool        framed;
+    char*       script;
+    sltmpl_t*   tmpl;
+    size_t      num_tmpl;
+    uint32_t    sid;
+    slbuf_t     in;
+    slbuf_t     out;
+    size_t      out_read;
+};
+
+
+
+
+/** Buffers <BR>
+  * ========================================================================<BR>
+  */
+
+static int sub_reserve(slbuf_t* b, size_t more) {
+    size_t newalloc;
+    uint8_t* newbuf;
+
+    if ((b->fill + more) <= b->alloc) {
+        return 0;
+    }
+    if ((b->fill + more) > SPLOOP_MAXQUEUE) {
+        return -1;
+    }
+    for (newalloc=(b->alloc == 0) ? SPLOOP_CHUNK : b->alloc; newalloc<(b->fill + more); newalloc*=2);
+    newbuf = realloc(b->buf, newalloc);
+    if (newbuf == NULL) {
+        return -1;
+    }
+    b->buf      = newbuf;
+    b->alloc    = newalloc;
+    return 0;
+}
+
+
+static int sub_append(slbuf_t* b, const void* data, size_t size) {
+    if (sub_reserve(b, size) != 0) {
+        return -1;
+    }
+    memcpy(&b->buf[b->fill], data, size);
+    b->fill += size;
+    return 0;
+}
+
+
+
+
+/** Script <BR>
+  * ========================================================================<BR>
+  */
+
+static char* sub_readscript(const char* path) {
+    FILE* fp;
+    char* text;
+    long size;
+
+    fp = fopen(path, "rb");
+    if (fp == NULL) {
+        return NULL;
+    }
+    text = NULL;
+    if ((fseek(fp, 0, SEEK_END) == 0) && ((size = ftell(fp)) >= 0) && (fseek(fp, 0, SEEK_SET) == 0)) {
+        text = malloc((size_t)size + 1);
+        if ((text != NULL) && (fread(text, 1, (size_t)size, fp) != (size_t)size)) {
+            free(text);
+            text = NULL;
+        }
+        if (text != NULL) {
+            text[size] = 0;
+        }
+    }
+    fclose(fp);
+    return text;
+}
+
+
+/// Split the script into templates, in place
+static int sub_parsescript(sploop_t* lb) {
+    char* line;
+    char* next;
+    size_t count = 0;
+
+    for (line=lb->script; *line!=0; line++) {
+        count += (*line == '\n');
+    }
+    lb->tmpl = calloc(count + 1, sizeof(sltmpl_t));
+    if (lb->tmpl == NULL) {
+        return -1;
+    }
+
+    for (line=lb->script; line!=NULL; line=next) {
+        char* end;
+        next = strchr(line, '\n');
+        if (next != NULL) {
+            *next++ = 0;
+        }
+        for (end=line+strlen(line); (end > line) && ((end[-1] == '\r') || (end[-1] == ' ') || (end[-1] == '\t')); end--);
+        *end = 0;
+        if ((*line == 0) || (*line == '#')) {
+            continue;
+        }
+        lb->tmpl[lb->num_tmpl].text = line;
+        lb->tmpl[lb->num_tmpl].type = SP_FRAME_MSG;
+        if ((strstr(line, "\"type\": \"ack\"") != NULL) || (strstr(line, "\"type\":\"ack\"") != NULL)) {
+            lb->tmpl[lb->num_tmpl].type = SP_FRAME_ACK;
+        }
+        else if ((strstr(line, "\"type\": \"rxstat\"") != NULL) || (strstr(line, "\"type\":\"rxstat\"") != NULL)) {
+            lb->tmpl[lb->num_tmpl].type = SP_FRAME_RXSTAT;
+        }
+        lb->num_tmpl++;
+    }
+
+    return (lb->num_tmpl != 0) ? 0 : -1;
+}
+
+
+
+
+/** Responder <BR>
+  * ========================================================================<BR>
+  */
+
+/// Expand one template for a command into the response queue
+static int sub_expand(sploop_t* lb, const sltmpl_t* tmpl, const uint8_t* cmd, size_t cmdlen) {
+    const char* cursor;
+    size_t start = lb->out.fill;
+    size_t wordlen;
+    char num[16];
+    int rc = 0;
+
+    if (lb->framed) {
+        rc |= sub_append(&lb->out, "\0\0\0\0\0\0\0\0\0\0\0\0", SP_FRAME_HDRSIZE);
+    }
+    for (cursor=tmpl->text; (*cursor != 0) && (rc == 0); ) {
+        if (strncmp(cursor, "${sid}", 6) == 0) {
+            rc = sub_append(&lb->out, num, (size_t)snprintf(num, sizeof(num), "%u", lb->sid));
+            cursor += 6;
+        }
+        else if (strncmp(cursor, "${cmd}", 6) == 0) {
+            for (wordlen=0; (wordlen < cmdlen) && (cmd[wordlen] > ' ') && (cmd[wordlen] != '"') && (cmd[wordlen] != '\\'); wordlen++);
+            rc = sub_append(&lb->out, cmd, wordlen);
+            cursor += 6;
+        }
+        else if (strncmp(cursor, "${line}", 7) == 0) {
+            rc = sub_reserve(&lb->out, cmdlen);
+            for (size_t i=0; (rc == 0) && (i < cmdlen); i++) {
+                if ((cmd[i] >= ' ') && (cmd[i] != '"') && (cmd[i] != '\\')) {
+                    lb->out.buf[lb->out.fill++] = cmd[i];
+                }
+            }
+            cursor += 7;
+        }
+        else {
+            rc = sub_append(&lb->out, cursor++, 1);
+        }
+    }
+    if (rc != 0) {
+        lb->out.fill = start;
+        return -1;
+    }
+
+    if (lb->framed) {
+        size_t size = lb->out.fill - start - SP_FRAME_HDRSIZE;
+        sp_frame_pack(&lb->out.buf[start], tmpl->type, (strstr(tmpl->text, "${sid}") != NULL) ? lb->sid : 0, size);
+        return 0;
+    }
+    return sub_append(&lb->out, "\n", 1);
+}
+
+
+static int sub_respond(sploop_t* lb, const uint8_t* cmd, size_t cmdlen) {
+    lb->sid++;
+    for (size_t i=0; i<lb->num_tmpl; i++) {
+        if (sub_expand(lb, &lb->tmpl[i], cmd, cmdlen) != 0) {
+            ERR_PRINTF("sploop: response queue full\n");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+/// Answer the complete commands in the input buffer
+static int sub_commands(sploop_t* lb) {
+    slbuf_t* in = &lb->in;
+    const uint8_t* line;
+    const uint8_t* end;
+    uint8_t type;
+    uint32_t sid;
+    size_t size;
+    size_t used = 0;
+    int rc = 0;
+
+    while ((rc == 0) && (used < in->fill)) {
+        line = &in->buf[used];
+        if (lb->framed) {
+            if ((in->fill - used) < SP_FRAME_HDRSIZE) {
+                break;
+            }
+            if (sp_frame_unpack(line, &type, &sid, &size) != 0) {
+                used++;
+                continue;
+            }
+            if ((in->fill - used) < (SP_FRAME_HDRSIZE + size)) {
+                break;
+            }
+            used   += SP_FRAME_HDRSIZE + size;
+            line   += SP_FRAME_HDRSIZE;
+            end     = line + size;
+        }
+        else {
+            end = memchr(line, '\n', in->fill - used);
+            if (end == NULL) {
+                break;
+            }
+            used = (size_t)(end - in->buf) + 1;
+            while ((end > line) && ((end[-1] == '\r') || (end[-1] == 0))) {
+                end--;
+            }
+        }
+        if (end != line) {
+            rc = sub_respond(lb, line, (size_t)(end - line));
+        }
+    }
+    in->fill -= used;
+    memmove(in->buf, &in->buf[used], in->fill);
+    return rc;
+}
+
+
+
+
+/** Public Functions <BR>
+  * ========================================================================<BR>
+  */
+
+sploop_t* sploop_open(const char* script_path, bool framed) {
+    sploop_t* lb;
+
+    lb = calloc(1, sizeof(sploop_t));
+    if (lb == NULL) {
+        return NULL;
+    }
+    lb->framed = framed;
+    lb->script = ((script_path == NULL) || (*script_path == 0)) ? strdup(sploop_default) : sub_readscript(script_path);
+    if ((lb->script == NULL) || (sub_parsescript(lb) != 0)) {
+        goto sploop_open_ERR;
+    }
+    if (pipe(lb->fd_pipe) != 0) {
+        goto sploop_open_ERR;
+    }
+    fcntl(lb->fd_pipe[0], F_SETFD, FD_CLOEXEC);
+    fcntl(lb->fd_pipe[1], F_SETFD, FD_CLOEXEC);
+    fcntl(lb->fd_pipe[1], F_SETFL, O_NONBLOCK);
+    if (pthread_mutex_init(&lb->mutex, NULL) != 0) {
+        close(lb->fd_pipe[0]);
+        close(lb->fd_pipe[1]);
+        goto sploop_open_ERR;
+    }
+    return lb;
+
+    sploop_open_ERR:
+    free(lb->tmpl);
+    free(lb->script);
+    free(lb);
+    return NULL;
+}
+
+
+void sploop_close(sploop_t* lb) {
+    if (lb != NULL) {
+        pthread_mutex_destroy(&lb->mutex);
+        close(lb->fd_pipe[0]);
+        close(lb->fd_pipe[1]);
+        free(lb->in.buf);
+        free(lb->out.buf);
+        free(lb->tmpl);
+        free(lb->script);
+        free(lb);
+    }
+}
+
+
+void sploop_reset(sploop_t* lb) {
+    pthread_mutex_lock(&lb->mutex);
+    lb->in.fill     = 0;
+    lb->out.fill    = 0;
+    lb->out_read    = 0;
+    pthread_mutex_unlock(&lb->mutex);
+}
+
+
+int sploop_send(sploop_t* lb, const uint8_t* data, size_t size) {
+    bool was_empty;
+    int rc;
+
+    pthread_mutex_lock(&lb->mutex);
+    was_empty = (lb->out_read == lb->out.fill);
+    rc = sub_append(&lb->in, data, size);
+    if (rc == 0) {
+        rc = sub_commands(lb);
+    }
+    if (was_empty && (lb->out_read != lb->out.fill)) {
+        if (write(lb->fd_pipe[1], "", 1) < 0) {
+            // Pipe full: the receiver has wakeups pending already
+        }
+    }
+    pthread_mutex_unlock(&lb->mutex);
+
+    return rc;
+}
+
+
+ssize_t sploop_recv(sploop_t* lb, uint8_t* buf, size_t max) {
+    uint8_t drain[64];
+    size_t avail;
+    ssize_t rc;
+
+    while (1) {
+        pthread_mutex_lock(&lb->mutex);
+        avail = lb->out.fill - lb->out_read;
+        if (avail != 0) {
+            avail = (avail < max) ? avail : max;
+            memcpy(buf, &lb->out.buf[lb->out_read], avail);
+            lb->out_read += avail;
+            if (lb->out_read == lb->out.fill) {
+                lb->out_read = 0;
+                lb->out.fill = 0;
+            }
+            pthread_mutex_unlock(&lb->mutex);
+            return (ssize_t)avail;
+        }
+        pthread_mutex_unlock(&lb->mutex);
+
+        rc = read(lb->fd_pipe[0], drain, sizeof(drain));
+        if ((rc == 0) || ((rc < 0) && (errno != EINTR))) {
+            return -1;
+        }
+    }
+}
+
+
+int sploop_fd(sploop_t* lb) {
+    return lb->fd_pipe[0];
+}
@@ -0,0 +1,136 @@
+/* Copyright 2020, JP Norair
+  *
+  * Licensed under the OpenTag License, Version 1.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  * http://www.indigresso.com/wiki/doku.php?id=opentag:license_1_0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  *
+  */
+
+// Application Headers
+#include "unixsrv.h"
+
+// Standard C & POSIX Libraries
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+
+static volatile sig_atomic_t unixsrv_stop = 0;
+
+static void sub_sigstop(int sig) {
+    unixsrv_stop = 1;
+}
+
+
+
+
+/** Public Functions <BR>
+  * ========================================================================<BR>
+  */
+
+int unixsrv_listen(const char* path, int backlog) {
+    struct sockaddr_un addr;
+    struct stat st;
+    int fd_srv;
+
+    // Only a stale socket is removed, never some other file
+    if ((stat(path, &st) == 0) && S_ISSOCK(st.st_mode)) {
+        unlink(path);
+    }
+    fd_srv = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd_srv < 0) {
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    if ((bind(fd_srv, (struct sockaddr*)&addr, sizeof(addr)) != 0) || (listen(fd_srv, backlog) != 0)) {
+        close(fd_srv);
+        return -1;
+    }
+    return fd_srv;
+}
+
+
+int unixsrv_accept(int fd_srv) {
+    int fd_cli;
+
+    do {
+        fd_cli = accept(fd_srv, NULL, NULL);
+    } while ((fd_cli < 0) && (errno == EINTR) && (unixsrv_stop == 0));
+
+    return fd_cli;
+}
+
+
+int unixsrv_sendall(int fd, const void* data, size_t size) {
+    const uint8_t* cursor = data;
+    ssize_t rc;
+
+    while (size != 0) {
+        rc = send(fd, cursor, size, MSG_NOSIGNAL);
+        if (rc < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        cursor += rc;
+        size   -= (size_t)rc;
+    }
+    return 0;
+}
+
+
+int unixsrv_grow(uint8_t** buf, size_t* alloc, size_t need, size_t chunk, size_t limit) {
+    size_t newalloc;
+    uint8_t* newbuf;
+
+    if (need <= *alloc) {
+        return 0;
+    }
+    if (need > limit) {
+        return -1;
+    }
+    for (newalloc=(*alloc == 0) ? chunk : *alloc; newalloc<need; newalloc*=2);
+    newbuf = realloc(*buf, newalloc);
+    if (newbuf == NULL) {
+        return -1;
+    }
+    *buf    = newbuf;
+    *alloc  = newalloc;
+    return 0;
+}
+
+
+void unixsrv_onstop(void) {
+    struct sigaction sa;
+
+    // No SA_RESTART: a signal has to break accept() and poll()
+    unixsrv_stop = 0;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = &sub_sigstop;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sa.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &sa, NULL);
+}
+
+
+bool unixsrv_stopped(void) {
+    return (unixsrv_stop != 0);
+}
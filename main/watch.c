@@ -0,0 +1,500 @@
+/* Copyright 2020, JP Norair
+  *
+  * Licensed under the OpenTag License, Version 1.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  * http://www.indigresso.com/wiki/doku.php?id=opentag:license_1_0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  *
+  */
+
+/// Watch mode.  Lines are filtered by a sockpush subscriber, which runs on
+/// the sockpush I/O thread and sees each line in place.  Lines that pass are
+/// appended to the fill buffer.  The main thread swaps the fill buffer with
+/// the flush buffer and writes it out, so the I/O thread never waits for the
+/// output, and it only holds the buffer lock for a memcpy.
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#   define _GNU_SOURCE
+#endif
+
+// Application Headers
+#include "watch.h"
+#include "capture.h"
+#include "cliopt.h"
+#include "debug.h"
+#include "filter.h"
+#include "ottercat_cfg.h"
+#include "runner.h"
+#include "sockpush.h"
+#include "unixsrv.h"
+
+// Standard C & POSIX Libraries
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+
+/// Filter key, compiled to the quoted form that is searched for
+typedef struct {
+    char*       needle;
+    size_t      needlelen;
+    const char* value;
+    size_t      valuelen;
+} wkey_t;
+
+
+typedef struct {
+    const watch_cfg_t* cfg;
+    sp_handle_t     sp;
+
+    wkey_t          type;
+    wkey_t          sid;
+    wkey_t*         fields;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+    uint8_t*        fill;
+    size_t          fill_size;
+    uint8_t*        flush;
+    uint8_t*        proj;
+    size_t          proj_alloc;
+
+    unsigned long   lines;
+    unsigned long   matched;
+    unsigned long   dropped;
+    struct timespec last_rx;
+} watch_t;
+
+
+
+
+/** Raw Line Filters <BR>
+  * ========================================================================<BR>
+  */
+
+static int sub_compilekey(wkey_t* wkey, const char* key, const char* value) {
+    wkey->needlelen = strlen(key) + 2;
+    wkey->needle    = malloc(wkey->needlelen + 1);
+    if (wkey->needle == NULL) {
+        return -1;
+    }
+    sprintf(wkey->needle, "\"%s\"", key);
+    wkey->value     = value;
+    wkey->valuelen  = (value != NULL) ? strlen(value) : 0;
+    return 0;
+}
+
+
+static bool sub_isdelim(uint8_t c) {
+    return (c == ',') || (c == '}') || (c == ']') || (c == ' ') || (c == '\t') || (c == '\r');
+}
+
+
+/// Returns the start of the key's value, or NULL if the key isn't in the
+/// line.  The needle is also found where it is a string value, so it only
+/// counts as the key when a ':' follows it.
+static const uint8_t* sub_findvalue(const uint8_t* line, const uint8_t* end, const wkey_t* wkey) {
+    const uint8_t* cursor = line;
+
+    while ((cursor = memmem(cursor, (size_t)(end - cursor), wkey->needle, wkey->needlelen)) != NULL) {
+        cursor += wkey->needlelen;
+        while ((cursor < end) && ((*cursor == ' ') || (*cursor == '\t'))) {
+            cursor++;
+        }
+        if ((cursor < end) && (*cursor == ':')) {
+            for (cursor++; (cursor < end) && ((*cursor == ' ') || (*cursor == '\t')); cursor++);
+            return cursor;
+        }
+    }
+    return NULL;
+}
+
+
+/// Compare a value in the line to a literal.  A quoted value is compared
+/// without its quotes.
+static bool sub_valueis(const uint8_t* val, const uint8_t* end, const char* want, size_t wantlen) {
+    if ((val < end) && (*val == '"')) {
+        val++;
+        return ((size_t)(end - val) > wantlen) && (memcmp(val, want, wantlen) == 0) && (val[wantlen] == '"');
+    }
+    if ((size_t)(end - val) < wantlen) {
+        return false;
+    }
+    if (memcmp(val, want, wantlen) != 0) {
+        return false;
+    }
+    return (&val[wantlen] == end) || sub_isdelim(val[wantlen]);
+}
+
+
+static bool sub_match_type(watch_t* watch, const uint8_t* line, const uint8_t* end, uint8_t ftype) {
+    const uint8_t* val;
+    const char** name;
+    const char* fname;
+
+    fname = (ftype == SP_FRAME_ACK) ? "ack" : ((ftype == SP_FRAME_RXSTAT) ? "rxstat" : NULL);
+    if (fname != NULL) {
+        for (name=watch->cfg->types; *name!=NULL; name++) {
+            if (strcmp(*name, fname) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    val = sub_findvalue(line, end, &watch->type);
+    if (val == NULL) {
+        return false;
+    }
+    for (name=watch->cfg->types; *name!=NULL; name++) {
+        if (sub_valueis(val, end, *name, strlen(*name))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+static bool sub_match_sid(watch_t* watch, const uint8_t* line, const uint8_t* end, uint8_t ftype, uint32_t fsid) {
+    const uint8_t* val;
+    uint32_t sid = 0;
+
+    if ((ftype == SP_FRAME_ACK) || (ftype == SP_FRAME_RXSTAT)) {
+        sid = fsid;
+    }
+    else {
+        val = sub_findvalue(line, end, &watch->sid);
+        if ((val == NULL) || (val == end) || (*val < '0') || (*val > '9')) {
+            return false;
+        }
+        for (; (val < end) && (*val >= '0') && (*val <= '9'); val++) {
+            sid = (sid * 10) + (*val - '0');
+        }
+    }
+    for (size_t i=0; i<watch->cfg->num_sids; i++) {
+        if ((sid >= watch->cfg->sids[i].lo) && (sid <= watch->cfg->sids[i].hi)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+static bool sub_match(watch_t* watch, const uint8_t* line, const uint8_t* end) {
+    const uint8_t* val;
+    uint8_t ftype = SP_FRAME_MSG;
+    uint32_t fsid = 0;
+
+    // On a framed connection, acks and rxstats carry their type and sid in
+    // the frame header, so they aren't searched for in the line.
+    sp_frameinfo(watch->sp, &ftype, &fsid);
+
+    if ((watch->cfg->types != NULL) && !sub_match_type(watch, line, end, ftype)) {
+        return false;
+    }
+    if ((watch->cfg->num_sids != 0) && !sub_match_sid(watch, line, end, ftype, fsid)) {
+        return false;
+    }
+    for (size_t i=0; i<watch->cfg->num_fields; i++) {
+        val = sub_findvalue(line, end, &watch->fields[i]);
+        if ((val == NULL) || !sub_valueis(val, end, watch->fields[i].value, watch->fields[i].valuelen)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+
+
+/** Output <BR>
+  * ========================================================================<BR>
+  */
+
+/// sockpush subscriber: called on the I/O thread for every inbound line
+static int sub_online(void* parent, const uint8_t* data, size_t size) {
+    watch_t* watch = parent;
+    const uint8_t* end = &data[size];
+    const uint8_t* text = data;
+    int textlen = -1;
+
+    // Lines arrive null-terminated
+    while ((end > data) && ((end[-1] == 0) || (end[-1] == '\r') || (end[-1] == '\n'))) {
+        end--;
+    }
+
+    if ((end != data) && sub_match(watch, data, end)) {
+        textlen = filter_line(watch->cfg->filter, data, (size_t)(end - data), &watch->proj, &watch->proj_alloc, &text);
+    }
+    size = (size_t)textlen;
+
+    pthread_mutex_lock(&watch->mutex);
+    clock_gettime(CLOCK_MONOTONIC, &watch->last_rx);
+    watch->lines++;
+    if (textlen >= 0) {
+        watch->matched++;
+        if ((watch->fill_size + size + 1) > watch->cfg->bufsize) {
+            watch->dropped++;
+        }
+        else {
+            // The writer only needs a wakeup when the buffer was empty
+            if (watch->fill_size == 0) {
+                pthread_cond_signal(&watch->cond);
+            }
+            memcpy(&watch->fill[watch->fill_size], text, size);
+            watch->fill_size += size;
+            watch->fill[watch->fill_size++] = '\n';
+        }
+    }
+    pthread_mutex_unlock(&watch->mutex);
+
+    return 0;
+}
+
+
+static int sub_writeall(int fd, const uint8_t* buf, size_t size) {
+    ssize_t rc;
+
+    while (size != 0) {
+        rc = write(fd, buf, size);
+        if (rc < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf  += rc;
+        size -= (size_t)rc;
+    }
+    return 0;
+}
+
+
+static void sub_printstats(watch_t* watch, sp_handle_t handle) {
+    unsigned long lines, matched, dropped;
+
+    pthread_mutex_lock(&watch->mutex);
+    lines   = watch->lines;
+    matched = watch->matched;
+    dropped = watch->dropped;
+    pthread_mutex_unlock(&watch->mutex);
+
+    fprintf(stderr, "watch: %lu lines, %lu matched, %lu dropped, %lu oversize\n",
+            lines, matched, dropped, sp_oversize(handle));
+}
+
+
+
+
+
+/** Public Functions <BR>
+  * ========================================================================<BR>
+  */
+
+void watch_cfg_init(watch_cfg_t* cfg) {
+    memset(cfg, 0, sizeof(watch_cfg_t));
+    cfg->fd_out     = STDOUT_FILENO;
+    cfg->bufsize    = OTTERCAT_PARAM_WATCHBUF;
+}
+
+
+int watch_addsids(watch_cfg_t* cfg, const char* list) {
+    watch_range_t* newsids;
+    unsigned long lo, hi;
+    char* endp;
+    int count = 0;
+
+    while (*list != 0) {
+        if ((*list == ',') || (*list == ' ')) {
+            list++;
+            continue;
+        }
+        lo = strtoul(list, &endp, 10);
+        if (endp == list) {
+            return -1;
+        }
+        hi = lo;
+        if (*endp == '-') {
+            list    = endp + 1;
+            hi      = strtoul(list, &endp, 10);
+            if ((endp == list) || (hi < lo)) {
+                return -1;
+            }
+        }
+        list = endp;
+
+        newsids = realloc(cfg->sids, (cfg->num_sids+1) * sizeof(watch_range_t));
+        if (newsids == NULL) {
+            return -2;
+        }
+        cfg->sids = newsids;
+        cfg->sids[cfg->num_sids].lo = (uint32_t)lo;
+        cfg->sids[cfg->num_sids].hi = (uint32_t)hi;
+        cfg->num_sids++;
+        count++;
+    }
+    return count;
+}
+
+
+int watch_addfield(watch_cfg_t* cfg, char* arg) {
+    watch_field_t* newfields;
+    char* eq;
+
+    eq = strchr(arg, '=');
+    if ((eq == NULL) || (eq == arg)) {
+        return -1;
+    }
+    newfields = realloc(cfg->fields, (cfg->num_fields+1) * sizeof(watch_field_t));
+    if (newfields == NULL) {
+        return -2;
+    }
+    *eq = 0;
+    cfg->fields = newfields;
+    cfg->fields[cfg->num_fields].key    = arg;
+    cfg->fields[cfg->num_fields].value  = eq + 1;
+    cfg->num_fields++;
+    return 0;
+}
+
+
+int watch_run(const char* socket, const char* cmdstr, const watch_cfg_t* cfg) {
+    watch_t watch;
+    sp_handle_t handle;
+    sp_subscr_t subscr;
+    struct timespec stats_at;
+    struct timespec wake;
+    uint8_t* swap;
+    size_t size;
+    int rc = 0;
+
+    memset(&watch, 0, sizeof(watch_t));
+    watch.cfg = cfg;
+    pthread_mutex_init(&watch.mutex, NULL);
+    pthread_cond_init(&watch.cond, NULL);
+
+    watch.fill  = malloc(cfg->bufsize);
+    watch.flush = malloc(cfg->bufsize);
+    watch.fields= calloc(cfg->num_fields + 1, sizeof(wkey_t));
+    if ((watch.fill == NULL) || (watch.flush == NULL) || (watch.fields == NULL)) {
+        rc = -1;
+        goto watch_run_FREE;
+    }
+    if ((sub_compilekey(&watch.type, "type", NULL) != 0) || (sub_compilekey(&watch.sid, "sid", NULL) != 0)) {
+        rc = -1;
+        goto watch_run_FREE;
+    }
+    for (size_t i=0; i<cfg->num_fields; i++) {
+        if (sub_compilekey(&watch.fields[i], cfg->fields[i].key, cfg->fields[i].value) != 0) {
+            rc = -1;
+            goto watch_run_FREE;
+        }
+    }
+
+    if (sp_open(&handle, socket, (cliopt_isframed() ? SP_FLAG_FRAMED : 0) | (cliopt_isshmring() ? SP_FLAG_SHMRING : 0)
+                               | (cliopt_isresend() ? SP_FLAG_REPLAY : 0)) != 0) {
+        fprintf(stderr, "Err: socket could not be opened.\n");
+        rc = -2;
+        goto watch_run_FREE;
+    }
+    if (capture_attach(cfg->capture, handle, socket) < 0) {
+        rc = -1;
+        goto watch_run_CLOSE;
+    }
+    watch.sp = handle;
+    clock_gettime(CLOCK_MONOTONIC, &watch.last_rx);
+    subscr = sp_subscribe(handle, &watch, &sub_online, SP_SUB_INBOUND, NULL, 0);
+    if (subscr == NULL) {
+        rc = -1;
+        goto watch_run_CLOSE;
+    }
+
+    // SIGINT/SIGTERM end the watch cleanly, so the buffer is flushed and the
+    // stats are printed.  A closed output pipe ends it the same way.
+    unixsrv_onstop();
+
+    // The command goes out once the I/O thread has connected.  With
+    // SP_FLAG_REPLAY it can be sent before that, and is held for the connect.
+    if (cmdstr != NULL) {
+        if ((sp_waitonline(handle, (size_t)cliopt_gettimeout()) != 0) && (cliopt_isresend() == false)) {
+            fprintf(stderr, "Err: not connected within the timeout, command not sent.\n");
+            rc = -2;
+            goto watch_run_UNSUB;
+        }
+        sp_sendcmd(handle, (uint8_t*)cmdstr, strlen(cmdstr));
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &stats_at);
+    while (unixsrv_stopped() == false) {
+        pthread_mutex_lock(&watch.mutex);
+        if (watch.fill_size == 0) {
+            clock_gettime(CLOCK_REALTIME, &wake);
+            wake.tv_nsec += 100000000;
+            if (wake.tv_nsec >= 1000000000) {
+                wake.tv_sec++;
+                wake.tv_nsec -= 1000000000;
+            }
+            pthread_cond_timedwait(&watch.cond, &watch.mutex, &wake);
+        }
+        swap            = watch.fill;
+        size            = watch.fill_size;
+        watch.fill      = watch.flush;
+        watch.fill_size = 0;
+        watch.flush     = swap;
+        pthread_mutex_unlock(&watch.mutex);
+
+        if ((size != 0) && (sub_writeall(cfg->fd_out, watch.flush, size) != 0)) {
+            break;
+        }
+        if ((cfg->stats_ms > 0) && (runner_elapsed_ms(&stats_at, NULL) >= cfg->stats_ms)) {
+            sub_printstats(&watch, handle);
+            clock_gettime(CLOCK_MONOTONIC, &stats_at);
+        }
+        if (cfg->idle_ms > 0) {
+            long idle;
+            pthread_mutex_lock(&watch.mutex);
+            idle = runner_elapsed_ms(&watch.last_rx, NULL);
+            pthread_mutex_unlock(&watch.mutex);
+            if (idle >= cfg->idle_ms) {
+                break;
+            }
+        }
+    }
+
+    // No more lines are added once the subscriber is gone
+    watch_run_UNSUB:
+    sp_unsubscribe(subscr);
+    if (watch.fill_size != 0) {
+        sub_writeall(cfg->fd_out, watch.fill, watch.fill_size);
+    }
+    sub_printstats(&watch, handle);
+
+    watch_run_CLOSE:
+    sp_close(handle);
+
+    watch_run_FREE:
+    free(watch.type.needle);
+    free(watch.sid.needle);
+    for (size_t i=0; (watch.fields != NULL) && (i<cfg->num_fields); i++) {
+        free(watch.fields[i].needle);
+    }
+    free(watch.fields);
+    free(watch.fill);
+    free(watch.flush);
+    free(watch.proj);
+    pthread_cond_destroy(&watch.cond);
+    pthread_mutex_destroy(&watch.mutex);
+    return rc;
+}
@@ -0,0 +1,598 @@
+/* Copyright 2020, JP Norair
+  *
+  * Licensed under the OpenTag License, Version 1.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  * http://www.indigresso.com/wiki/doku.php?id=opentag:license_1_0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  *
+  */
+
+/// The main thread builds and submits the chunk commands, and callbacks on
+/// the libottercat engine thread check the results.  A get chunk's frames are
+/// written straight to the file at the chunk's offset, so chunks can finish
+/// in any order.  Chunk states and counters are guarded by the mutex; the
+/// command buffer belongs to the main thread.
+
+// Application Headers
+#include "xfer.h"
+#include "debug.h"
+#include "libottercat.h"
+#include "ottercat_cfg.h"
+#include "runner.h"
+
+// Standard C & POSIX Libraries
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+
+typedef enum {
+    XCHUNK_todo     = 0,
+    XCHUNK_run      = 1,
+    XCHUNK_done     = 2,
+    XCHUNK_failed   = 3
+} XCHUNK_Type;
+
+struct xfer;
+
+typedef struct {
+    struct xfer*    xf;
+    size_t          chunk;
+    size_t          got;            ///< get: bytes written so far
+    bool            bad;            ///< get: a frame didn't fit
+    int             tries;          ///< get: the try that got and bad are for
+} xslot_t;
+
+typedef struct xfer {
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+    const xfer_cfg_t* cfg;
+    const char*     tmpl;
+    otc_handle_t    otc;
+    int             fd;
+    int             jfd;
+    size_t          size;
+    size_t          chunks;
+    uint8_t*        state;
+    int*            rc;
+
+    // Main thread only
+    uint8_t*        data;
+    char*           cmd;
+    size_t          cmdalloc;
+    size_t          cmdsize;
+
+    // Guarded by mutex
+    xslot_t*        slot;
+    int*            freeslot;
+    int             frees;
+    int             slots;
+    size_t          done;
+    size_t          bytes;          ///< sent or received in this run
+    size_t          resumed;
+    size_t          resent;
+    int             failrun;        ///< chunks failed in a row
+} xfer_t;
+
+
+void xfer_cfg_init(xfer_cfg_t* cfg) {
+    memset(cfg, 0, sizeof(xfer_cfg_t));
+    cfg->chunk          = OTTERCAT_PARAM_XFER_CHUNK;
+    cfg->concurrency    = 8;
+    cfg->rounds         = OTTERCAT_PARAM_XFER_ROUNDS;
+}
+
+
+
+
+/** Chunk Commands <BR>
+  * ========================================================================<BR>
+  */
+
+static char* sub_reserve(xfer_t* xf, size_t extra) {
+    if ((xf->cmdsize + extra + 1) > xf->cmdalloc) {
+        size_t newalloc = (xf->cmdalloc == 0) ? 256 : xf->cmdalloc;
+        char* newbuf;
+        while (newalloc < (xf->cmdsize + extra + 1)) {
+            newalloc *= 2;
+        }
+        newbuf = realloc(xf->cmd, newalloc);
+        if (newbuf == NULL) {
+            return NULL;
+        }
+        xf->cmd         = newbuf;
+        xf->cmdalloc    = newalloc;
+    }
+    return &xf->cmd[xf->cmdsize];
+}
+
+
+static int sub_append(xfer_t* xf, const char* s, size_t len) {
+    char* dst = sub_reserve(xf, len);
+    if (dst == NULL) {
+        return -1;
+    }
+    memcpy(dst, s, len);
+    xf->cmdsize += len;
+    return 0;
+}
+
+
+/// Put: read the chunk from the file, as a hex block
+static int sub_append_data(xfer_t* xf, size_t offset, size_t length) {
+    static const char convert[] = "0123456789abcdef";
+    char* dst = sub_reserve(xf, (2 * length) + 2);
+
+    if (dst == NULL) {
+        return -1;
+    }
+    if (pread(xf->fd, xf->data, length, (off_t)offset) != (ssize_t)length) {
+        return -2;
+    }
+    *dst++ = '[';
+    for (size_t i=0; i<length; i++) {
+        *dst++ = convert[xf->data[i] >> 4];
+        *dst++ = convert[xf->data[i] & 15];
+    }
+    *dst++ = ']';
+    xf->cmdsize += (2 * length) + 2;
+    return 0;
+}
+
+
+/// Build the command for a chunk in xf->cmd.  Returns 0, -1 on memory or
+/// read errors, or -2 for an unknown placeholder.
+static int sub_expand(xfer_t* xf, size_t chunk) {
+    const char* cursor  = xf->tmpl;
+    size_t offset       = chunk * (size_t)xf->cfg->chunk;
+    size_t length       = xf->size - offset;
+    const char* mark;
+    const char* close;
+    char num[32];
+    int rc = 0;
+
+    if (length > (size_t)xf->cfg->chunk) {
+        length = (size_t)xf->cfg->chunk;
+    }
+    xf->cmdsize = 0;
+
+    while ((rc == 0) && ((mark = strstr(cursor, "${")) != NULL)) {
+        const char* name = mark + 2;
+        size_t len;
+
+        close = strchr(name, '}');
+        if (close == NULL) {
+            return -2;
+        }
+        len = (size_t)(close - name);
+        rc  = sub_append(xf, cursor, (size_t)(mark - cursor));
+        if (rc != 0) {
+            break;
+        }
+
+        if ((len == 5) && (memcmp(name, "devid", 5) == 0) && (xf->cfg->devid != NULL)) {
+            rc = sub_append(xf, xf->cfg->devid, strlen(xf->cfg->devid));
+        }
+        else if ((len == 6) && (memcmp(name, "fileid", 6) == 0)) {
+            rc = sub_append(xf, xf->cfg->fileid, strlen(xf->cfg->fileid));
+        }
+        else if ((len == 6) && (memcmp(name, "offset", 6) == 0)) {
+            rc = sub_append(xf, num, (size_t)snprintf(num, sizeof(num), "%zu", offset));
+        }
+        else if ((len == 6) && (memcmp(name, "length", 6) == 0)) {
+            rc = sub_append(xf, num, (size_t)snprintf(num, sizeof(num), "%zu", length));
+        }
+        else if ((len == 3) && (memcmp(name, "end", 3) == 0)) {
+            rc = sub_append(xf, num, (size_t)snprintf(num, sizeof(num), "%zu", offset + length));
+        }
+        else if ((len == 4) && (memcmp(name, "data", 4) == 0) && !xf->cfg->is_get) {
+            rc = sub_append_data(xf, offset, length);
+            rc = (rc == -2) ? -1 : rc;
+        }
+        else {
+            return -2;
+        }
+        cursor = close + 1;
+    }
+    if (rc == 0) {
+        rc = sub_append(xf, cursor, strlen(cursor));
+    }
+    if (rc == 0) {
+        xf->cmd[xf->cmdsize] = 0;
+    }
+    return rc;
+}
+
+
+
+
+/** Resume Journal <BR>
+  * ========================================================================<BR>
+  */
+
+static int sub_journal_open(xfer_t* xf, long mtime) {
+    const xfer_cfg_t* cfg = xf->cfg;
+    char header[1024];
+    struct stat st;
+    char* text;
+    char* line;
+    char* next;
+    int len;
+
+    len = snprintf(header, sizeof(header),
+                "{\"xfer\":\"%s\",\"path\":\"%s\",\"size\":%zu,\"mtime\":%li,\"chunk\":%d,\"fileid\":\"%s\",\"devid\":\"%s\"}\n",
+                cfg->is_get ? "get" : "put", cfg->path, xf->size, mtime, cfg->chunk, cfg->fileid,
+                (cfg->devid == NULL) ? "" : cfg->devid);
+    if ((len < 0) || (len >= (int)sizeof(header))) {
+        return -1;
+    }
+
+    xf->jfd = open(cfg->resume, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if ((xf->jfd < 0) || (fstat(xf->jfd, &st) != 0)) {
+        fprintf(stderr, OTTERCAT_PARAM_NAME ": resume journal %s could not be used\n", cfg->resume);
+        return -2;
+    }
+    if (st.st_size == 0) {
+        return (write(xf->jfd, header, (size_t)len) == len) ? 0 : -2;
+    }
+
+    text = malloc((size_t)st.st_size + 1);
+    if (text == NULL) {
+        return -1;
+    }
+    if (pread(xf->jfd, text, (size_t)st.st_size, 0) != (ssize_t)st.st_size) {
+        free(text);
+        return -2;
+    }
+    text[st.st_size] = 0;
+
+    if (strncmp(text, header, (size_t)len) != 0) {
+        fprintf(stderr, OTTERCAT_PARAM_NAME ": resume journal %s is for a different transfer\n", cfg->resume);
+        free(text);
+        return -2;
+    }
+    for (line=&text[len]; *line!=0; line=next) {
+        char* end;
+        unsigned long chunk = strtoul(line, &end, 10);
+        next = strchr(line, '\n');
+        next = (next == NULL) ? &line[strlen(line)] : next+1;
+        if ((end != line) && (chunk < xf->chunks) && (xf->state[chunk] != XCHUNK_done)) {
+            xf->state[chunk] = XCHUNK_done;
+            xf->resumed++;
+        }
+    }
+    xf->done = xf->resumed;
+    free(text);
+    return 0;
+}
+
+
+static void sub_journal_note(xfer_t* xf, size_t chunk) {
+    char line[32];
+    int len;
+
+    if (xf->jfd >= 0) {
+        len = snprintf(line, sizeof(line), "%zu\n", chunk);
+        if (write(xf->jfd, line, (size_t)len) != len) {
+            ///@note a lost line only means the chunk is sent again on resume
+        }
+    }
+}
+
+
+
+
+/** Engine <BR>
+  * ========================================================================<BR>
+  */
+
+static int sub_hexval(char c) {
+    if ((c >= '0') && (c <= '9'))   return c - '0';
+    if ((c >= 'a') && (c <= 'f'))   return c - 'a' + 10;
+    if ((c >= 'A') && (c <= 'F'))   return c - 'A' + 10;
+    return -1;
+}
+
+
+/// Get: decode a hex frame and write it at the slot's position.  Spaces and
+/// brackets are skipped.  Returns false if the frame isn't hex or runs past
+/// the end of the chunk.
+static bool sub_writeframe(xfer_t* xf, xslot_t* slot, const char* frame, size_t size) {
+    size_t offset   = slot->chunk * (size_t)xf->cfg->chunk;
+    size_t length   = xf->size - offset;
+    uint8_t buf[256];
+    size_t fill     = 0;
+    int hi          = -1;
+
+    if (length > (size_t)xf->cfg->chunk) {
+        length = (size_t)xf->cfg->chunk;
+    }
+    for (size_t i=0; i<=size; i++) {
+        if ((i == size) || (fill == sizeof(buf))) {
+            if ((slot->got + fill) > length) {
+                return false;
+            }
+            if (pwrite(xf->fd, buf, fill, (off_t)(offset + slot->got)) != (ssize_t)fill) {
+                return false;
+            }
+            slot->got  += fill;
+            fill        = 0;
+            if (i == size) {
+                break;
+            }
+        }
+        if ((frame[i] == ' ') || (frame[i] == '[') || (frame[i] == ']')) {
+            continue;
+        }
+        int nibble = sub_hexval(frame[i]);
+        if (nibble < 0) {
+            return false;
+        }
+        if (hi < 0) {
+            hi = nibble;
+        }
+        else {
+            buf[fill++] = (uint8_t)((hi << 4) | nibble);
+            hi = -1;
+        }
+    }
+    return (hi < 0);
+}
+
+
+static void sub_oncomplete(otc_handle_t otc, const otc_result_t* res, void* user) {
+    xslot_t* slot   = user;
+    xfer_t* xf      = slot->xf;
+    size_t offset   = slot->chunk * (size_t)xf->cfg->chunk;
+    size_t length   = xf->size - offset;
+    bool ok;
+
+    if (length > (size_t)xf->cfg->chunk) {
+        length = (size_t)xf->cfg->chunk;
+    }
+
+    // A command that libottercat sent again starts the chunk over
+    if (res->tries != slot->tries) {
+        slot->tries = res->tries;
+        slot->got   = 0;
+        slot->bad   = false;
+    }
+
+    // Frames are only expected from gets.  They arrive in order.
+    if (xf->cfg->is_get && (res->rc >= 0) && (res->frame != NULL) && !slot->bad) {
+        slot->bad = !sub_writeframe(xf, slot, res->frame, res->frame_size);
+    }
+    if (res->more) {
+        return;
+    }
+
+    ok = (res->rc >= 0) && (!xf->cfg->is_get || (!slot->bad && (slot->got == length)));
+
+    pthread_mutex_lock(&xf->mutex);
+    if (ok) {
+        xf->state[slot->chunk] = XCHUNK_done;
+        xf->done++;
+        xf->bytes += length;
+        sub_journal_note(xf, slot->chunk);
+        xf->failrun = 0;
+    }
+    else {
+        xf->state[slot->chunk]  = XCHUNK_failed;
+        xf->rc[slot->chunk]     = (res->rc < 0) ? res->rc : OTC_ERR_QUAL;
+        xf->failrun++;
+    }
+    xf->freeslot[xf->frees++] = (int)(slot - xf->slot);
+    pthread_cond_signal(&xf->cond);
+    pthread_mutex_unlock(&xf->mutex);
+}
+
+
+/// Send every chunk that isn't done, and wait for them.  When a whole window
+/// of chunks fails in a row, the link is taken to be down, and the rest of
+/// the round is not sent: each of those chunks would only fail after its own
+/// timeout.  Returns the number that were sent, or a
+/// negative value on a local error.
+static long sub_round(xfer_t* xf) {
+    xslot_t* slot;
+    long sent = 0;
+    int rc;
+
+    xf->failrun = 0;
+    for (size_t chunk=0; chunk<xf->chunks; chunk++) {
+        if (xf->state[chunk] == XCHUNK_done) {
+            continue;
+        }
+        rc = sub_expand(xf, chunk);
+        if (rc != 0) {
+            fprintf(stderr, OTTERCAT_PARAM_NAME ": chunk %zu could not be read\n", chunk);
+            return -1;
+        }
+
+        pthread_mutex_lock(&xf->mutex);
+        while ((xf->frees == 0) && (xf->failrun < xf->slots)) {
+            pthread_cond_wait(&xf->cond, &xf->mutex);
+        }
+        if (xf->failrun >= xf->slots) {
+            pthread_mutex_unlock(&xf->mutex);
+            break;
+        }
+        slot        = &xf->slot[xf->freeslot[--xf->frees]];
+        slot->chunk = chunk;
+        slot->got   = 0;
+        slot->bad   = false;
+        slot->tries = 0;
+        xf->resent += (xf->state[chunk] == XCHUNK_failed);
+        xf->state[chunk] = XCHUNK_run;
+        pthread_mutex_unlock(&xf->mutex);
+
+        rc = otc_submit(xf->otc, xf->cmd, xf->cmdsize, &sub_oncomplete, slot, NULL);
+        if (rc < 0) {
+            pthread_mutex_lock(&xf->mutex);
+            xf->state[chunk]    = XCHUNK_failed;
+            xf->rc[chunk]       = rc;
+            xf->freeslot[xf->frees++] = (int)(slot - xf->slot);
+            pthread_mutex_unlock(&xf->mutex);
+        }
+        sent++;
+    }
+
+    pthread_mutex_lock(&xf->mutex);
+    while (xf->frees < xf->slots) {
+        pthread_cond_wait(&xf->cond, &xf->mutex);
+    }
+    pthread_mutex_unlock(&xf->mutex);
+    return sent;
+}
+
+
+
+
+/** Public API <BR>
+  * ========================================================================<BR>
+  */
+
+int xfer_run(const char* socket, const xfer_cfg_t* cfg) {
+    xfer_t xf;
+    otc_cfg_t otccfg;
+    struct stat st;
+    struct timespec start, stop;
+    long elapsed;
+    long mtime = 0;
+    int rc;
+
+    if ((socket == NULL) || (cfg == NULL) || (cfg->path == NULL) || (cfg->fileid == NULL) || (cfg->chunk <= 0)) {
+        return -1;
+    }
+
+    memset(&xf, 0, sizeof(xf));
+    xf.cfg  = cfg;
+    xf.jfd  = -1;
+    xf.tmpl = (cfg->cmd != NULL) ? cfg->cmd : (cfg->is_get ? OTTERCAT_PARAM_XFER_GETCMD : OTTERCAT_PARAM_XFER_PUTCMD);
+
+    // A get is written in place, so that a resumed get keeps what it has
+    xf.fd = cfg->is_get ? open(cfg->path, O_RDWR | O_CREAT, 0644) : open(cfg->path, O_RDONLY);
+    if ((xf.fd < 0) || (fstat(xf.fd, &st) != 0)) {
+        fprintf(stderr, OTTERCAT_PARAM_NAME ": file %s could not be opened\n", cfg->path);
+        rc = -2;
+        goto xfer_run_CLOSE;
+    }
+    if (cfg->is_get) {
+        xf.size = cfg->size;
+        if (xf.size == 0) {
+            fprintf(stderr, OTTERCAT_PARAM_NAME ": a get needs the size to read\n");
+            rc = -2;
+            goto xfer_run_CLOSE;
+        }
+    }
+    else {
+        xf.size = (size_t)st.st_size;
+        mtime   = (long)st.st_mtime;
+    }
+    xf.chunks   = (xf.size + (size_t)cfg->chunk - 1) / (size_t)cfg->chunk;
+    xf.slots    = (cfg->concurrency < 1) ? 1 : cfg->concurrency;
+    xf.state    = calloc(xf.chunks + 1, sizeof(uint8_t));
+    xf.rc       = calloc(xf.chunks + 1, sizeof(int));
+    xf.data     = malloc((size_t)cfg->chunk);
+    xf.slot     = calloc((size_t)xf.slots, sizeof(xslot_t));
+    xf.freeslot = calloc((size_t)xf.slots, sizeof(int));
+    if ((xf.state == NULL) || (xf.rc == NULL) || (xf.data == NULL) || (xf.slot == NULL) || (xf.freeslot == NULL)) {
+        rc = -1;
+        goto xfer_run_CLOSE;
+    }
+    for (int i=0; i<xf.slots; i++) {
+        xf.slot[i].xf   = &xf;
+        xf.freeslot[i]  = i;
+    }
+    xf.frees = xf.slots;
+
+    // Check the template once, on the first chunk
+    if ((xf.chunks != 0) && (sub_expand(&xf, 0) == -2)) {
+        fprintf(stderr, OTTERCAT_PARAM_NAME ": transfer command \"%s\" has an unknown placeholder%s\n",
+                xf.tmpl, (cfg->devid == NULL) ? ", or needs --devid" : "");
+        rc = -2;
+        goto xfer_run_CLOSE;
+    }
+
+    if (cfg->resume != NULL) {
+        rc = sub_journal_open(&xf, mtime);
+        if (rc < 0) {
+            goto xfer_run_CLOSE;
+        }
+    }
+
+    pthread_mutex_init(&xf.mutex, NULL);
+    pthread_cond_init(&xf.cond, NULL);
+
+    // Chunks are never run ack-only: a chunk is only done when it is verified
+    runner_otccfg(&otccfg, xf.slots, OTC_FLAG_ACKONLY, cfg->capture);
+
+    rc = otc_open(&xf.otc, socket, &otccfg);
+    if (rc < 0) {
+        fprintf(stderr, "Err: socket could not be opened.\n");
+        goto xfer_run_DESTROY;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    rc = 0;
+    for (int round=0; (rc == 0) && (round <= cfg->rounds) && (xf.done < xf.chunks); round++) {
+        rc = (sub_round(&xf) < 0) ? -1 : 0;
+    }
+    otc_close(xf.otc);
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    elapsed = runner_elapsed_ms(&start, &stop);
+
+    for (size_t chunk=0; chunk<xf.chunks; chunk++) {
+        if (xf.state[chunk] != XCHUNK_done) {
+            fprintf(stderr, OTTERCAT_PARAM_NAME ": chunk %zu at %zu failed (%d)\n",
+                    chunk, chunk * (size_t)cfg->chunk, xf.rc[chunk]);
+        }
+    }
+    fprintf(stderr, OTTERCAT_PARAM_NAME ": %s %s, %zu bytes in %zu chunks (%zu resumed): %zu ok, %zu failed, %zu resent.  %li ms, %.1f KB/s\n",
+            cfg->is_get ? "get" : "put", cfg->path, xf.size, xf.chunks, xf.resumed,
+            xf.done - xf.resumed, xf.chunks - xf.done, xf.resent, elapsed,
+            (elapsed > 0) ? ((double)xf.bytes / (double)elapsed) : 0.0);
+
+    if ((rc == 0) && (xf.done == xf.chunks)) {
+        if (cfg->is_get && (ftruncate(xf.fd, (off_t)xf.size) != 0)) {
+            rc = -2;
+        }
+        if (cfg->resume != NULL) {
+            unlink(cfg->resume);
+        }
+    }
+    else if (rc == 0) {
+        rc = -4;
+    }
+
+    xfer_run_DESTROY:
+    pthread_cond_destroy(&xf.cond);
+    pthread_mutex_destroy(&xf.mutex);
+
+    xfer_run_CLOSE:
+    if (xf.fd >= 0) {
+        close(xf.fd);
+    }
+    if (xf.jfd >= 0) {
+        close(xf.jfd);
+    }
+    free(xf.state);
+    free(xf.rc);
+    free(xf.data);
+    free(xf.cmd);
+    free(xf.slot);
+    free(xf.freeslot);
+    return rc;
+}